@@ -31,6 +31,8 @@ void leibniz_undefined_opcode(newton_t *newton, uint32_t opcode);
 void docker_connected(void *ctx);
 void docker_disconnected(void *ctx);
 void docker_install_progress(void *ctx, double progress);
+void leibniz_display_open(void *ext, int width, int height);
+void leibniz_display_update(void *ext, const uint8_t *framebuffer, int width, int height);
 
 static NSString * kLastROMFile = @"lastROMFile";
 
@@ -48,7 +50,6 @@ static NSString * kLastROMFile = @"lastROMFile";
 
 - (void)applicationDidFinishLaunching:(NSNotification *)aNotification {
   self.files = @[];
-  gScreenView = self.screenView;
   
   [self setupTitlebarAccessory];
   [self createConsoleWindowAndFileStream];
@@ -119,6 +120,7 @@ static NSString * kLastROMFile = @"lastROMFile";
   
   
   docker_set_callbacks(newton_get_docker(_newton), (__bridge void *)self, docker_connected, docker_disconnected, docker_install_progress);
+  newton_set_display_functions(_newton, (__bridge void *)self, leibniz_display_open, leibniz_display_update);
 
   _emulatorQueue = dispatch_queue_create("org.swhite.leibniz.emulator", NULL);
   return YES;
@@ -225,7 +227,7 @@ static NSString * kLastROMFile = @"lastROMFile";
 #pragma mark - Actions
 - (IBAction) togglePowerSwitch:(id)sender {
   if (_newton != NULL) {
-    runt_switch_toggle(_newton->runt, RuntSwitchPower);
+    newton_switch_toggle(_newton, RuntSwitchPower);
   }
 }
 
@@ -293,15 +295,16 @@ static NSString * kLastROMFile = @"lastROMFile";
   [self.window makeKeyAndOrderFront:self];
 }
 
-void newton_display_open(int width, int height) {
+void leibniz_display_open(void *ext, int width, int height) {
+  AppDelegate *self = (__bridge AppDelegate *)ext;
   dispatch_async(dispatch_get_main_queue(), ^{
-    [(AppDelegate *)[NSApp delegate] createDisplayWithWidth:width height:height];
+    [self createDisplayWithWidth:width height:height];
   });
 }
 
-static EmulatorView *gScreenView = nil;
-void newton_display_set_framebuffer(const uint8_t *display, int width, int height) {
-  [gScreenView updateWithFramebuffer:display width:width height:height];
+void leibniz_display_update(void *ext, const uint8_t *framebuffer, int width, int height) {
+  AppDelegate *self = (__bridge AppDelegate *)ext;
+  [self.screenView updateWithFramebuffer:framebuffer width:width height:height];
 }
 
 #pragma mark - Errors
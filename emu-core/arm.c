@@ -32,6 +32,7 @@
 
 #include "arm.h"
 #include "internal.h"
+#include "state.h"
 
 void arm_init (arm_t *c)
 {
@@ -49,7 +50,6 @@ void arm_init (arm_t *c)
 	c->set_uint16 = NULL;
 	c->set_uint32 = NULL;
 
-	c->ram = NULL;
 	c->ram_cnt = 0;
 
 	c->log_ext = NULL;
@@ -59,7 +59,26 @@ void arm_init (arm_t *c)
 
 	arm_set_opcodes (c);
 
+	c->jit = NULL;
+
+	c->dirty = NULL;
+
+	c->brk = NULL;
+	c->brk_ext = NULL;
+	c->brk_check = NULL;
+	c->brk_oprcnt = 0;
+	c->brk_pc = 0;
+
+	c->slow = NULL;
+
+#if DISABLE_THREADED
+	c->threaded = 0;
+#else
+	c->threaded = 1;
+#endif
+
 	c->cpsr = 0;
+	c->cc_op = ARM_CC_NONE;
 
 	c->exception_base = 0;
 
@@ -74,6 +93,8 @@ void arm_init (arm_t *c)
 	c->oprcnt = 0;
 	c->clkcnt = 0;
 
+	c->run_cnt = 0;
+
 	for (i = 0; i < 16; i++) {
 		c->copr[i] = NULL;
 	}
@@ -83,6 +104,8 @@ void arm_init (arm_t *c)
 
 	cp15_init (&c->copr15);
 	c->copr[15] = &c->copr15.copr;
+
+	arm_tlb_flush (c);
 }
 
 arm_t *arm_new (void)
@@ -101,6 +124,11 @@ arm_t *arm_new (void)
 
 void arm_free (arm_t *c)
 {
+	arm_set_jit (c, 0);
+	arm_set_dirty_tracking (c, 0);
+	arm_clear_brk (c);
+	arm_clear_slow (c);
+
 	cp14_free (&c->copr14);
 	cp15_free (&c->copr15);
 }
@@ -131,8 +159,148 @@ void arm_set_mem_fct (arm_t *c, void *ext,
 
 void arm_set_ram (arm_t *c, unsigned char *ram, unsigned long cnt)
 {
-	c->ram = ram;
-	c->ram_cnt = cnt;
+	arm_clear_ram (c);
+
+	if ((ram != NULL) && (cnt > 0)) {
+		arm_add_ram (c, 0, cnt, ram, 1);
+	}
+}
+
+int arm_add_ram (arm_t *c, uint32_t base, uint32_t size, unsigned char *data, int writable)
+{
+	arm_ram_t *ram;
+
+	if (c->ram_cnt >= ARM_RAM_CNT) {
+		return (1);
+	}
+
+	ram = &c->ram[c->ram_cnt++];
+
+	ram->base = base;
+	ram->size = size;
+	ram->data = data;
+	ram->writable = (writable != 0);
+
+	arm_tlb_flush (c);
+
+	return (0);
+}
+
+void arm_clear_ram (arm_t *c)
+{
+	c->ram_cnt = 0;
+
+	arm_tlb_flush (c);
+}
+
+int arm_set_dirty_tracking (arm_t *c, int enable)
+{
+	if (enable == 0) {
+		free (c->dirty);
+		c->dirty = NULL;
+		return (0);
+	}
+
+	if (c->dirty == NULL) {
+		c->dirty = calloc (1UL << (32 - ARM_DIRTY_PAGE_SHIFT - 3), 1);
+
+		if (c->dirty == NULL) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+int arm_get_dirty (arm_t *c, uint32_t addr)
+{
+	uint32_t      page;
+	unsigned char msk;
+
+	if (c->dirty == NULL) {
+		return (0);
+	}
+
+	page = addr >> ARM_DIRTY_PAGE_SHIFT;
+	msk = 1U << (page & 7);
+
+	if ((c->dirty[page >> 3] & msk) == 0) {
+		return (0);
+	}
+
+	c->dirty[page >> 3] &= ~msk;
+
+	return (1);
+}
+
+void arm_set_brk_fct (arm_t *c, void *ext, arm_brk_f check)
+{
+	c->brk_ext = ext;
+	c->brk_check = check;
+}
+
+static
+int arm_set_page_bit (unsigned char **map, uint32_t addr)
+{
+	uint32_t page;
+
+	if (*map == NULL) {
+		*map = calloc (1UL << (32 - ARM_BRK_PAGE_SHIFT - 3), 1);
+
+		if (*map == NULL) {
+			return (1);
+		}
+	}
+
+	page = addr >> ARM_BRK_PAGE_SHIFT;
+	(*map)[page >> 3] |= 1U << (page & 7);
+
+	return (0);
+}
+
+void arm_brk_skip (arm_t *c)
+{
+	c->brk_oprcnt = c->oprcnt;
+	c->brk_pc = arm_get_pc (c);
+}
+
+int arm_set_brk_page (arm_t *c, uint32_t addr)
+{
+	if (c->brk_check == NULL) {
+		return (1);
+	}
+
+	return (arm_set_page_bit (&c->brk, addr));
+}
+
+void arm_clear_brk (arm_t *c)
+{
+	free (c->brk);
+	c->brk = NULL;
+}
+
+int arm_set_slow_page (arm_t *c, uint32_t addr)
+{
+	if (arm_set_page_bit (&c->slow, addr)) {
+		return (1);
+	}
+
+	/* the TLB caches the host address of the page */
+	arm_tlb_flush (c);
+
+	return (0);
+}
+
+void arm_clear_slow (arm_t *c)
+{
+	if (c->slow == NULL) {
+		return;
+	}
+
+	free (c->slow);
+	c->slow = NULL;
+
+	arm_tlb_flush (c);
 }
 
 unsigned arm_get_flags (const arm_t *c, unsigned flags)
@@ -281,6 +449,103 @@ unsigned long arm_get_delay (arm_t *c)
 }
 
 
+static
+void arm_save_regs (state_t *st, const uint32_t *reg, unsigned cnt)
+{
+	unsigned i;
+
+	for (i = 0; i < cnt; i++) {
+		state_put_u32 (st, reg[i]);
+	}
+}
+
+static
+void arm_load_regs (state_t *st, uint32_t *reg, unsigned cnt)
+{
+	unsigned i;
+
+	for (i = 0; i < cnt; i++) {
+		reg[i] = state_get_u32 (st);
+	}
+}
+
+void arm_save_state (arm_t *c, state_t *st)
+{
+	arm_cc_sync (c);
+
+	state_put_u32 (st, c->cpsr);
+	state_put_u32 (st, c->spsr);
+
+	arm_save_regs (st, c->reg, 16);
+	arm_save_regs (st, c->lastpc, 2);
+
+	state_put_u32 (st, c->old_mode);
+	arm_save_regs (st, c->usr_regs_low, 5);
+	arm_save_regs (st, c->usr_regs, 2);
+	arm_save_regs (st, c->irq_regs, 3);
+	arm_save_regs (st, c->svc_regs, 3);
+	arm_save_regs (st, c->abt_regs, 3);
+	arm_save_regs (st, c->und_regs, 3);
+	arm_save_regs (st, c->fiq_regs, 8);
+
+	state_put_u32 (st, c->copr14.cclkcfg);
+	state_put_u32 (st, c->copr14.pwrmode);
+
+	state_put_u32 (st, c->ir);
+	state_put_u32 (st, c->exception_base);
+	state_put_u8 (st, c->bigendian);
+	state_put_u8 (st, c->privileged);
+
+	state_put_u8 (st, c->irq);
+	state_put_u8 (st, c->fiq);
+	state_put_u8 (st, c->irq_or_fiq);
+
+	state_put_u32 (st, c->delay);
+	state_put_u64 (st, c->oprcnt);
+	state_put_u64 (st, c->clkcnt);
+}
+
+int arm_load_state (arm_t *c, state_t *st)
+{
+	c->cpsr = state_get_u32 (st);
+	c->cc_op = ARM_CC_NONE;
+	c->spsr = state_get_u32 (st);
+
+	arm_load_regs (st, c->reg, 16);
+	arm_load_regs (st, c->lastpc, 2);
+
+	c->old_mode = state_get_u32 (st);
+	arm_load_regs (st, c->usr_regs_low, 5);
+	arm_load_regs (st, c->usr_regs, 2);
+	arm_load_regs (st, c->irq_regs, 3);
+	arm_load_regs (st, c->svc_regs, 3);
+	arm_load_regs (st, c->abt_regs, 3);
+	arm_load_regs (st, c->und_regs, 3);
+	arm_load_regs (st, c->fiq_regs, 8);
+
+	c->copr14.cclkcfg = state_get_u32 (st);
+	c->copr14.pwrmode = state_get_u32 (st);
+
+	c->ir = state_get_u32 (st);
+	c->exception_base = state_get_u32 (st);
+	c->bigendian = state_get_u8 (st);
+	c->privileged = state_get_u8 (st);
+
+	c->irq = state_get_u8 (st);
+	c->fiq = state_get_u8 (st);
+	c->irq_or_fiq = state_get_u8 (st);
+
+	c->delay = state_get_u32 (st);
+	c->oprcnt = state_get_u64 (st);
+	c->clkcnt = state_get_u64 (st);
+
+	arm_tlb_flush (c);
+	arm_jit_reset (c);
+
+	return (st->error ? 1 : 0);
+}
+
+
 void arm_copr_init (arm_copr_t *p)
 {
 	p->copr_idx = 0;
@@ -411,6 +676,7 @@ void arm_reset (arm_t *c)
 	unsigned i;
 
 	c->cpsr = ARM_MODE_SVC;
+	c->cc_op = ARM_CC_NONE;
 
 	arm_set_reg_map (c, ARM_MODE_SVC);
 
@@ -465,7 +731,9 @@ void arm_reset (arm_t *c)
 	c->oprcnt = 0;
 	c->clkcnt = 0;
 
-	arm_tbuf_flush (c);
+	arm_tlb_flush (c);
+
+	arm_jit_reset (c);
 
 	for (i = 0; i < 16; i++) {
 		if (c->copr[i] != NULL) {
@@ -547,6 +815,69 @@ void arm_set_fiq (arm_t *c, unsigned char val)
 	c->irq_or_fiq = c->irq || c->fiq;
 }
 
+void arm_cc_eval (arm_t *c)
+{
+	uint32_t cc, d, s1, s2;
+
+	d = c->cc_d;
+	s1 = c->cc_s1;
+	s2 = c->cc_s2;
+
+	switch (c->cc_op) {
+	case ARM_CC_NZ:
+		cc = c->cpsr & (ARM_PSR_C | ARM_PSR_V);
+		break;
+
+	case ARM_CC_LOG:
+		cc = c->cpsr & ARM_PSR_V;
+
+		if (s1) {
+			cc |= ARM_PSR_C;
+		}
+		break;
+
+	case ARM_CC_ADD:
+		cc = 0;
+
+		if ((d < s1) || ((d == s1) && (s2 != 0))) {
+			cc |= ARM_PSR_C;
+		}
+
+		if ((d ^ s1) & (d ^ s2) & 0x80000000) {
+			cc |= ARM_PSR_V;
+		}
+		break;
+
+	case ARM_CC_SUB:
+		cc = 0;
+
+		if (!((d > s1) || ((d == s1) && (s2 != 0)))) {
+			cc |= ARM_PSR_C;
+		}
+
+		if ((d ^ s1) & (s1 ^ s2) & 0x80000000) {
+			cc |= ARM_PSR_V;
+		}
+		break;
+
+	default:
+		c->cc_op = ARM_CC_NONE;
+		return;
+	}
+
+	if (d == 0) {
+		cc |= ARM_PSR_Z;
+	}
+	else if (d & 0x80000000) {
+		cc |= ARM_PSR_N;
+	}
+
+	c->cpsr &= ~(ARM_PSR_Z | ARM_PSR_N | ARM_PSR_C | ARM_PSR_V);
+	c->cpsr |= cc;
+
+	c->cc_op = ARM_CC_NONE;
+}
+
 void arm_execute (arm_t *c)
 {
 	c->oprcnt += 1;
@@ -554,40 +885,49 @@ void arm_execute (arm_t *c)
 	c->lastpc[1] = c->lastpc[0];
 	c->lastpc[0] = arm_get_pc (c);
 
-	if (arm_ifetch (c, c->lastpc[0], &c->ir)) {
-		return;
+	if (c->jit != NULL) {
+		const arm_jit_op_t *op;
+
+		op = arm_jit_fetch (c, c->lastpc[0]);
+		if (op == NULL) {
+			return;
+		}
+
+		c->ir = op->ir;
+
+		if ((op->cond == 0x0e) || arm_check_cond (c, op->cond)) {
+			op->exec (c, op);
+		}
+		else {
+			arm_set_clk (c, 4, 1);
+		}
 	}
+	else {
+		if (arm_ifetch (c, c->lastpc[0], &c->ir)) {
+			return;
+		}
 
 #if 0
-	if (c->log_opcode != NULL) {
-		if (c->log_opcode (c->log_ext, c->ir)) {
-			/* nop */
-			c->ir = 0xe1a00000UL;
+		if (c->log_opcode != NULL) {
+			if (c->log_opcode (c->log_ext, c->ir)) {
+				/* nop */
+				c->ir = 0xe1a00000UL;
+			}
 		}
-	}
 #endif
 
-  if (arm_check_cond_al (c->ir) || arm_check_cond (c, arm_ir_cond (c->ir))) {
-    if ((c->ir & 0xfffff0ff) == 0xe6000010) {
-      uint32_t pc = arm_get_pc(c);
-      if (c->log_undef) {
-        c->log_undef(c->log_ext, c->ir);
-      }
-      if (pc == arm_get_pc(c)) {
-#if 1
-        arm_exception_undefined(c);
-#else
-        arm_set_clk (c, 4, 1);
-#endif
-      }
-    }
-    else {
-      c->opcodes[(c->ir >> 20) & 0xff] (c);
-    }
-  }
-  else {
-    arm_set_clk (c, 4, 1);
-  }
+		if (arm_check_cond_al (c->ir) || arm_check_cond (c, arm_ir_cond (c->ir))) {
+			if (arm_is_trap (c->ir)) {
+				op_trap (c);
+			}
+			else {
+				c->opcodes[(c->ir >> 20) & 0xff] (c);
+			}
+		}
+		else {
+			arm_set_clk (c, 4, 1);
+		}
+	}
 
 	if (c->irq_or_fiq) {
 		if (c->fiq && (arm_get_cpsr_f (c) == 0)) {
@@ -599,6 +939,46 @@ void arm_execute (arm_t *c)
 	}
 }
 
+void arm_run (arm_t *c, unsigned long n)
+{
+	if ((c->jit != NULL) && c->threaded) {
+		arm_jit_run (c, n);
+		return;
+	}
+
+	c->run_cnt = n;
+
+	while (c->run_cnt > 0) {
+		if ((c->brk != NULL) && arm_brk_hit (c, arm_get_pc (c))) {
+			c->run_cnt = 0;
+			break;
+		}
+
+		c->run_cnt -= 1;
+		arm_execute (c);
+	}
+}
+
+void arm_run_limit (arm_t *c, unsigned long n)
+{
+	if (c->run_cnt > n) {
+		c->run_cnt = n;
+	}
+}
+
+int arm_set_threaded (arm_t *c, int enable)
+{
+#if DISABLE_THREADED
+	c->threaded = 0;
+
+	return (enable != 0);
+#else
+	c->threaded = (enable != 0);
+
+	return (0);
+#endif
+}
+
 void arm_clock (arm_t *c, unsigned long n)
 {
 	while (n >= c->delay) {
@@ -30,6 +30,7 @@
 #define ARM_H 1
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 
@@ -50,6 +51,28 @@
 #define ARM_PSR_M 0x1fUL
 
 
+/* host byte order, used for direct RAM access */
+#if !defined(ARM_HOST_BE) && !defined(ARM_HOST_LE) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ARM_HOST_BE 1
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ARM_HOST_LE 1
+#endif
+#endif
+
+
+/*
+ * Lazy condition code evaluation. Instructions that set the
+ * condition codes only record the operation and its operands,
+ * cpsr is updated when the condition codes are read.
+ */
+#define ARM_CC_NONE 0 /* cpsr is up to date */
+#define ARM_CC_NZ   1 /* N and Z from cc_d */
+#define ARM_CC_LOG  2 /* N and Z from cc_d, C from cc_s1 */
+#define ARM_CC_ADD  3 /* NZCV from cc_d = cc_s1 + cc_s2 */
+#define ARM_CC_SUB  4 /* NZCV from cc_d = cc_s1 - cc_s2 */
+
+
 #define ARM_MODE_USR 0x10
 #define ARM_MODE_FIQ 0x11
 #define ARM_MODE_IRQ 0x12
@@ -109,20 +132,24 @@
 #define arm_get_gpr(c, n) ((c)->reg[(n)])
 #define arm_get_pc(c) ((c)->reg[15])
 #define arm_get_lr(c) ((c)->reg[14])
-#define arm_get_cpsr(c) ((c)->cpsr)
+#define arm_get_cpsr(c) (arm_cc_sync (c), (c)->cpsr)
 #define arm_get_spsr(c) ((c)->spsr)
 #define arm_get_last_pc(c) ((c)->lastpc[1])
 
 #define arm_set_gpr(c, n, v) do { (c)->reg[(n)] = (v); } while (0)
 #define arm_set_pc(c, v) do { (c)->reg[15] = (v); } while (0)
 #define arm_set_lr(c, v) do { (c)->reg[14] = (v); } while (0)
-#define arm_set_cpsr(c, v) do { (c)->cpsr = (v); } while (0)
+#define arm_set_cpsr(c, v) do { \
+	uint32_t arm_cpsr_ = (v); \
+	(c)->cc_op = ARM_CC_NONE; \
+	(c)->cpsr = arm_cpsr_; \
+	} while (0)
 #define arm_set_spsr(c, v) do { (c)->spsr = (v); } while (0)
 
-#define arm_get_cc_n(c) (((c)->cpsr & ARM_PSR_N) != 0)
-#define arm_get_cc_z(c) (((c)->cpsr & ARM_PSR_Z) != 0)
-#define arm_get_cc_c(c) (((c)->cpsr & ARM_PSR_C) != 0)
-#define arm_get_cc_v(c) (((c)->cpsr & ARM_PSR_V) != 0)
+#define arm_get_cc_n(c) (arm_cc_sync (c), ((c)->cpsr & ARM_PSR_N) != 0)
+#define arm_get_cc_z(c) (arm_cc_sync (c), ((c)->cpsr & ARM_PSR_Z) != 0)
+#define arm_get_cc_c(c) (arm_cc_sync (c), ((c)->cpsr & ARM_PSR_C) != 0)
+#define arm_get_cc_v(c) (arm_cc_sync (c), ((c)->cpsr & ARM_PSR_V) != 0)
 #define arm_get_cc_q(c) (((c)->cpsr & ARM_PSR_Q) != 0)
 
 #define arm_get_cpsr_i(c) (((c)->cpsr & ARM_PSR_I) != 0)
@@ -130,10 +157,18 @@
 #define arm_get_cpsr_t(c) (((c)->cpsr & ARM_PSR_T) != 0)
 #define arm_get_cpsr_m(c) ((c)->cpsr & ARM_PSR_M)
 
-#define arm_set_cc_n(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_N, (v))
-#define arm_set_cc_z(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_Z, (v))
-#define arm_set_cc_c(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_C, (v))
-#define arm_set_cc_v(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_V, (v))
+#define arm_set_cc_n(c, v) do { \
+	arm_cc_sync (c); arm_set_bits ((c)->cpsr, ARM_PSR_N, (v)); \
+	} while (0)
+#define arm_set_cc_z(c, v) do { \
+	arm_cc_sync (c); arm_set_bits ((c)->cpsr, ARM_PSR_Z, (v)); \
+	} while (0)
+#define arm_set_cc_c(c, v) do { \
+	arm_cc_sync (c); arm_set_bits ((c)->cpsr, ARM_PSR_C, (v)); \
+	} while (0)
+#define arm_set_cc_v(c, v) do { \
+	arm_cc_sync (c); arm_set_bits ((c)->cpsr, ARM_PSR_V, (v)); \
+	} while (0)
 #define arm_set_cc_q(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_Q, (v))
 
 #define arm_set_cpsr_i(c, v) arm_set_bits ((c)->cpsr, ARM_PSR_I, (v))
@@ -149,6 +184,7 @@
 
 struct arm_s;
 struct arm_copr_s;
+struct state_s;
 
 
 typedef uint8_t (*arm_get_uint8_f) (void *ext, uint32_t addr);
@@ -161,6 +197,8 @@ typedef void (*arm_set_uint32_f) (void *ext, uint32_t addr, uint32_t val);
 
 typedef void (*arm_opcode_f) (struct arm_s *c);
 
+typedef int (*arm_brk_f) (void *ext, uint32_t addr);
+
 
 /*****************************************************************************
  * @short The ARM coprocessor context
@@ -175,23 +213,76 @@ typedef struct arm_copr_s {
 } arm_copr_t;
 
 
+/* number of entries in a software TLB, must be a power of 2 */
+#define ARM_TLB_CNT 256
+
+/* arm_tlb_entry_t.perm */
+#define ARM_TLB_USER 0x01 /* access permitted in user mode */
+#define ARM_TLB_PRIV 0x02 /* access permitted in privileged modes */
+
+/* an address that never matches a page address */
+#define ARM_TLB_INVALID 0x00000001UL
+
+
+/*!***************************************************************************
+ * @short A software TLB entry
+ *
+ * Each entry maps one 4K page. Sections and large pages are cached
+ * one 4K page at a time, tiny pages are not cached.
+ *****************************************************************************/
+typedef struct {
+	/* the virtual page address or ARM_TLB_INVALID */
+	uint32_t      vaddr;
+
+	/* the physical page address */
+	uint32_t      raddr;
+
+	/* the page in host memory or NULL */
+	unsigned char *host;
+
+	/* the result of the domain and permission checks */
+	unsigned char perm;
+} arm_tlb_entry_t;
+
+
+/*!***************************************************************************
+ * @short A direct mapped software TLB
+ *****************************************************************************/
 typedef struct {
-	int      valid;
+	arm_tlb_entry_t entry[ARM_TLB_CNT];
+} arm_tlb_t;
+
+
+/* maximum number of direct RAM windows */
+#define ARM_RAM_CNT 8
+
+/* granularity of the dirty page tracking */
+#define ARM_DIRTY_PAGE_SHIFT 12
 
-	uint32_t vaddr;
-	uint32_t vmask;
+/* granularity of the breakpoint and slow page maps */
+#define ARM_BRK_PAGE_SHIFT 12
 
-	uint32_t raddr;
-	uint32_t rmask;
-} arm_tbuf_t;
+
+/*!***************************************************************************
+ * @short A window of physical memory the CPU accesses directly
+ *
+ * The data is in guest byte order. Accesses outside of all windows,
+ * and stores to read only windows, go through the memory functions.
+ *****************************************************************************/
+typedef struct {
+	uint32_t      base;
+	uint32_t      size;
+	unsigned char *data;
+	int           writable;
+} arm_ram_t;
 
 
 typedef struct {
 	arm_copr_t copr;
 
-	arm_tbuf_t tbuf_exec;
-	arm_tbuf_t tbuf_read;
-	arm_tbuf_t tbuf_write;
+	arm_tlb_t  tlb_exec;
+	arm_tlb_t  tlb_read;
+	arm_tlb_t  tlb_write;
 
 	uint32_t   reg[16];
 
@@ -208,6 +299,118 @@ typedef struct {
 } arm_copr14_t;
 
 
+/*****************************************************************************
+ * JIT
+ *****************************************************************************/
+
+/* the threaded interpreter needs computed goto */
+#if !defined(DISABLE_THREADED) && !defined(__GNUC__)
+#define DISABLE_THREADED 1
+#endif
+
+/* maximum number of instructions in a translated block */
+#define ARM_JIT_BLOCK_MAX  64
+
+/* blocks never cross this (physical and virtual) boundary */
+#define ARM_JIT_BLOCK_SIZE 1024
+
+/* granularity of code write detection */
+#define ARM_JIT_PAGE_SHIFT 12
+
+#define ARM_JIT_HASH_CNT   4096
+#define ARM_JIT_BLOCK_CNT  32768
+#define ARM_JIT_OP_CNT     (256UL * 1024)
+
+
+/* arm_jit_op_t.flags */
+#define ARM_JIT_OP_CRY 0x01 /* the immediate sets the shifter carry */
+#define ARM_JIT_OP_SUB 0x02 /* the register offset is subtracted */
+
+
+/*!***************************************************************************
+ * @short A pre-decoded instruction
+ *
+ * The operand fields are only meaningful to the specialized
+ * handler in exec. For all other instructions exec calls fct.
+ *****************************************************************************/
+typedef struct arm_jit_op_s {
+	uint32_t      ir;
+
+	/* rotated immediate, signed offset or branch displacement */
+	uint32_t      imm;
+
+	unsigned char cond;
+	unsigned char rd;
+	unsigned char rn;
+	unsigned char rm;
+	unsigned char shift;
+	unsigned char amount;
+	unsigned char flags;
+
+	/* the specialized handler, an index into the handler tables */
+	unsigned char kind;
+
+	arm_opcode_f  fct;
+	void          (*exec) (struct arm_s *c, const struct arm_jit_op_s *op);
+} arm_jit_op_t;
+
+typedef void (*arm_jit_exec_f) (struct arm_s *c, const arm_jit_op_t *op);
+
+
+/*!***************************************************************************
+ * @short A translated basic block
+ *
+ * Blocks are keyed by physical address. The instructions are
+ * translated lazily, the first time execution reaches them, so
+ * translation never reads memory the interpreter would not have
+ * read. Only the most recently allocated block can grow.
+ *****************************************************************************/
+typedef struct arm_jit_block_s {
+	uint32_t               paddr;
+
+	unsigned               cnt;
+	arm_jit_op_t           *op;
+
+	/* zero if invalidated by a code write */
+	unsigned char          valid;
+
+	/* the block ended with a branch or a boundary */
+	unsigned char          closed;
+
+	struct arm_jit_block_s *hnext;
+	struct arm_jit_block_s *pnext;
+
+	/* the successor of the last execution */
+	struct arm_jit_block_s *link;
+	uint32_t               link_vaddr;
+	unsigned               link_gen;
+	int                    link_priv;
+} arm_jit_block_t;
+
+
+typedef struct arm_jit_s {
+	/* incremented whenever virtual to physical mappings change */
+	unsigned        gen;
+
+	/* the current block and the virtual address of op[idx] */
+	arm_jit_block_t *cur;
+	unsigned        idx;
+	uint32_t        pc;
+
+	arm_jit_block_t *hash[ARM_JIT_HASH_CNT];
+	arm_jit_block_t *page[ARM_JIT_HASH_CNT];
+
+	unsigned        block_cnt;
+	arm_jit_block_t *block;
+
+	unsigned long   op_cnt;
+	arm_jit_op_t    *op;
+
+	/* one bit per physical page that contains translated code */
+	unsigned char   code[1UL << (32 - ARM_JIT_PAGE_SHIFT - 3)];
+} arm_jit_t;
+
+
 /*****************************************************************************
  * @short The ARM CPU context
  *****************************************************************************/
@@ -224,8 +427,8 @@ typedef struct arm_s {
 	arm_set_uint16_f   set_uint16;
 	arm_set_uint32_f   set_uint32;
 
-	unsigned char      *ram;
-	unsigned long      ram_cnt;
+	arm_ram_t          ram[ARM_RAM_CNT];
+	unsigned           ram_cnt;
 
 	void               *log_ext;
 	int                (*log_opcode) (void *ext, uint32_t ir);
@@ -234,6 +437,12 @@ typedef struct arm_s {
 
 	uint32_t           cpsr;
 
+	/* the pending condition code update, see ARM_CC_NONE */
+	unsigned           cc_op;
+	uint32_t           cc_d;
+	uint32_t           cc_s1;
+	uint32_t           cc_s2;
+
 	uint32_t           spsr;
 
 	uint32_t           reg[16];
@@ -277,6 +486,30 @@ typedef struct arm_s {
 	unsigned long long clkcnt;
 
 	arm_opcode_f       opcodes[256];
+
+	/* the translation cache, NULL if disabled */
+	arm_jit_t          *jit;
+
+	/* one bit per physical page stored to directly, NULL if disabled */
+	unsigned char      *dirty;
+
+	/* one bit per virtual page with a breakpoint, NULL if none */
+	unsigned char      *brk;
+	void               *brk_ext;
+	arm_brk_f          brk_check;
+
+	/* the instruction arm_brk_skip() was called at */
+	unsigned long long brk_oprcnt;
+	uint32_t           brk_pc;
+
+	/* one bit per physical page that is never accessed directly, NULL if none */
+	unsigned char      *slow;
+
+	/* use the threaded interpreter in arm_run() */
+	int                threaded;
+
+	/* instructions left in the current arm_run() */
+	unsigned long      run_cnt;
 } arm_t;
 
 
@@ -298,6 +531,23 @@ int arm_set_mem16 (arm_t *c, uint32_t addr, unsigned xlat, uint16_t val);
 int arm_set_mem32 (arm_t *c, uint32_t addr, unsigned xlat, uint32_t val);
 
 
+/*!***************************************************************************
+ * @short Update the condition codes in cpsr from a pending update
+ *****************************************************************************/
+void arm_cc_eval (arm_t *c);
+
+/*!***************************************************************************
+ * @short Make sure the condition codes in cpsr are up to date
+ *****************************************************************************/
+static inline
+void arm_cc_sync (arm_t *c)
+{
+	if (c->cc_op != ARM_CC_NONE) {
+		arm_cc_eval (c);
+	}
+}
+
+
 /*!***************************************************************************
  * @short Initialize an ARM context
  *****************************************************************************/
@@ -327,8 +577,103 @@ void arm_set_mem_fct (arm_t *c, void *ext,
 	void *set8, void *set16, void *set32
 );
 
+/*!***************************************************************************
+ * @short Map a single read/write RAM window at physical address 0
+ *
+ * Any other windows are removed.
+ *****************************************************************************/
 void arm_set_ram (arm_t *c, unsigned char *ram, unsigned long cnt);
 
+/*!***************************************************************************
+ * @short  Map host memory into the physical address space
+ * @param  c        The cpu context
+ * @param  base     The physical base address
+ * @param  size     The size of the window in bytes
+ * @param  data     The window contents in guest byte order
+ * @param  writable If zero, stores go through the memory functions
+ * @return Zero if successful, non-zero if all windows are in use
+ *
+ * Earlier windows take precedence over later ones where they overlap.
+ *****************************************************************************/
+int arm_add_ram (arm_t *c, uint32_t base, uint32_t size, unsigned char *data, int writable);
+
+/*!***************************************************************************
+ * @short Remove all direct RAM windows
+ *****************************************************************************/
+void arm_clear_ram (arm_t *c);
+
+/*!***************************************************************************
+ * @short  Enable or disable the dirty page tracking
+ * @return Zero if successful, non-zero otherwise
+ *
+ * Stores to the direct RAM windows bypass the memory functions.
+ * While tracking is enabled, they mark the physical page they
+ * hit as dirty.
+ *****************************************************************************/
+int arm_set_dirty_tracking (arm_t *c, int enable);
+
+/*!***************************************************************************
+ * @short  Check and clear the dirty bit of a physical page
+ * @return Non-zero if the page was stored to since the last call
+ *****************************************************************************/
+int arm_get_dirty (arm_t *c, uint32_t addr);
+
+/*!***************************************************************************
+ * @short Set the breakpoint function
+ *
+ * Before an instruction in a page marked with arm_set_brk_page()
+ * is executed, check is called with its address. If it returns
+ * non-zero, arm_run() returns without executing it.
+ *****************************************************************************/
+void arm_set_brk_fct (arm_t *c, void *ext, arm_brk_f check);
+
+/*!***************************************************************************
+ * @short Don't check the next instruction for a breakpoint
+ *
+ * Call this before running on from a breakpoint.
+ *****************************************************************************/
+void arm_brk_skip (arm_t *c);
+
+/*!***************************************************************************
+ * @short  Mark the virtual page of addr as holding a breakpoint
+ * @return Zero if successful, non-zero otherwise
+ *****************************************************************************/
+int arm_set_brk_page (arm_t *c, uint32_t addr);
+
+/*!***************************************************************************
+ * @short Unmark all breakpoint pages
+ *****************************************************************************/
+void arm_clear_brk (arm_t *c);
+
+/*!***************************************************************************
+ * @short  Send all accesses to the physical page of addr to the
+ *         memory functions, even inside a direct RAM window
+ * @return Zero if successful, non-zero otherwise
+ *****************************************************************************/
+int arm_set_slow_page (arm_t *c, uint32_t addr);
+
+/*!***************************************************************************
+ * @short Make all pages direct again
+ *****************************************************************************/
+void arm_clear_slow (arm_t *c);
+
+/*!***************************************************************************
+ * @short Check if the physical page of addr is marked slow
+ *****************************************************************************/
+static inline
+int arm_is_slow_page (const arm_t *c, uint32_t addr)
+{
+	uint32_t page;
+
+	if (c->slow == NULL) {
+		return (0);
+	}
+
+	page = addr >> ARM_BRK_PAGE_SHIFT;
+
+	return ((c->slow[page >> 3] >> (page & 7)) & 1);
+}
+
 
 /*!***************************************************************************
  * @short  Get CPU flags
@@ -372,6 +717,22 @@ unsigned long long arm_get_clkcnt (arm_t *c);
 unsigned long arm_get_delay (arm_t *c);
 
 
+/*!***************************************************************************
+ * @short Save the registers and cp14
+ *
+ * The coprocessors, including cp15, save their own state.
+ *****************************************************************************/
+void arm_save_state (arm_t *c, struct state_s *st);
+
+/*!***************************************************************************
+ * @short  Restore the state saved by arm_save_state()
+ * @return Zero if successful, non-zero if the state is truncated
+ *
+ * The TLB and the translation cache are flushed.
+ *****************************************************************************/
+int arm_load_state (arm_t *c, struct state_s *st);
+
+
 /*!***************************************************************************
  * @short Initialize a coprocessor context
  *****************************************************************************/
@@ -414,6 +775,19 @@ void cp15_free (arm_copr15_t *p);
 arm_copr_t *cp15_new (void);
 void cp15_del (arm_copr15_t *p);
 
+/*!***************************************************************************
+ * @short Save the cp15 registers of a cpu
+ *****************************************************************************/
+void cp15_save_state (arm_t *c, struct state_s *st);
+
+/*!***************************************************************************
+ * @short  Restore the state saved by cp15_save_state()
+ * @return Zero if successful, non-zero if the state is truncated
+ *
+ * The TLB and the translation cache are flushed.
+ *****************************************************************************/
+int cp15_load_state (arm_t *c, struct state_s *st);
+
 
 void arm_set_reg_map (arm_t *arm, unsigned mode);
 
@@ -462,6 +836,103 @@ void arm_execute (arm_t *c);
  *****************************************************************************/
 void arm_clock (arm_t *c, unsigned long n);
 
+/*!***************************************************************************
+ * @short Execute n instructions
+ *
+ * This has the same effect as n calls to arm_execute(). If the
+ * translation cache is enabled and the threaded interpreter is
+ * selected, the instructions are executed by the threaded
+ * interpreter.
+ *****************************************************************************/
+void arm_run (arm_t *c, unsigned long n);
+
+/*!***************************************************************************
+ * @short End the current arm_run() after at most n more instructions
+ *
+ * This can be called from a memory or coprocessor callback, for
+ * example when a device schedules an event that is due before the
+ * end of the run. It has no effect outside of arm_run().
+ *****************************************************************************/
+void arm_run_limit (arm_t *c, unsigned long n);
+
+/*!***************************************************************************
+ * @short  Select the threaded interpreter or the function table
+ * @return Zero if successful, non-zero if the threaded interpreter
+ *         is not available
+ *****************************************************************************/
+int arm_set_threaded (arm_t *c, int enable);
+
+
+/*!***************************************************************************
+ * @short Invalidate all software TLB entries
+ *
+ * This must be called when the translation table base, the domain
+ * access control or the control register change, when the TLB is
+ * flushed and when the RAM changes.
+ *****************************************************************************/
+void arm_tlb_flush (arm_t *c);
+
+
+/*!***************************************************************************
+ * @short  Enable or disable the translation cache
+ * @return Zero if successful, non-zero otherwise
+ *****************************************************************************/
+int arm_set_jit (arm_t *c, int enable);
+
+/*!***************************************************************************
+ * @short Discard all translated blocks
+ *****************************************************************************/
+void arm_jit_reset (arm_t *c);
+
+/*!***************************************************************************
+ * @short Forget all virtual to physical mappings
+ *
+ * This must be called when the translation table base, the domain
+ * access control or the control register change, or when the TLB
+ * is flushed.
+ *****************************************************************************/
+void arm_jit_flush (arm_t *c);
+
+/*!***************************************************************************
+ * @short Discard the translated blocks in a physical page
+ *****************************************************************************/
+void arm_jit_invalidate_page (arm_t *c, uint32_t addr);
+
+/*!***************************************************************************
+ * @short Notify the translation cache of a write to physical memory
+ *****************************************************************************/
+static inline
+void arm_jit_write (arm_t *c, uint32_t addr)
+{
+	arm_jit_t *jit = c->jit;
+
+	if (jit != NULL) {
+		uint32_t page = addr >> ARM_JIT_PAGE_SHIFT;
+
+		if (jit->code[page >> 3] & (1U << (page & 7))) {
+			arm_jit_invalidate_page (c, addr);
+		}
+	}
+}
+
+/*!***************************************************************************
+ * @short Notify the translation cache and the dirty page tracking of
+ *        a direct store to physical memory
+ *****************************************************************************/
+static inline
+void arm_mem_write (arm_t *c, uint32_t addr)
+{
+	unsigned char *dirty = c->dirty;
+
+	if (dirty != NULL) {
+		uint32_t page = addr >> ARM_DIRTY_PAGE_SHIFT;
+
+		dirty[page >> 3] |= 1U << (page & 7);
+	}
+
+	arm_jit_write (c, addr);
+}
+
 
 /*****************************************************************************
  * disasm
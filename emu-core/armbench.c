@@ -0,0 +1,205 @@
+/*****************************************************************************
+ * File name:   armbench.c                                                   *
+ *****************************************************************************/
+
+/*****************************************************************************
+ * This program is free software. You can redistribute it and / or modify it *
+ * under the terms of the GNU General Public License version 2 as  published *
+ * by the Free Software Foundation.                                          *
+ *                                                                           *
+ * This program is distributed in the hope  that  it  will  be  useful,  but *
+ * WITHOUT  ANY   WARRANTY,   without   even   the   implied   warranty   of *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  General *
+ * Public License for more details.                                          *
+ *****************************************************************************/
+
+/*
+ * Interpreter micro benchmark
+ *
+ * Runs a small loop of typical compiled code (loads, stores,
+ * conditional data processing, calls and branches) from RAM on
+ * each interpreter and prints the number of instructions per
+ * second.
+ *
+ * usage: armbench [instructions]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arm.h"
+
+
+#define BENCH_RAM_SIZE 0x10000
+#define BENCH_CODE     0x1000
+
+
+static const uint32_t bench_code[] = {
+	0xe3a00902, /*         mov   r0, #0x8000       */
+	0xe3a01003, /*         mov   r1, #3            */
+	0xe3a02801, /* outer:  mov   r2, #0x10000      */
+	0xe5903004, /* loop:   ldr   r3, [r0, #4]      */
+	0xe0833001, /*         add   r3, r3, r1        */
+	0xe5803004, /*         str   r3, [r0, #4]      */
+	0xe20340ff, /*         and   r4, r3, #0xff     */
+	0xe3540080, /*         cmp   r4, #0x80         */
+	0xc1a05104, /*         movgt r5, r4, lsl #2    */
+	0xd2855001, /*         addle r5, r5, #1        */
+	0xe7d06004, /*         ldrb  r6, [r0, r4]      */
+	0xe0277006, /*         eor   r7, r7, r6        */
+	0xeb000002, /*         bl    func              */
+	0xe2522001, /*         subs  r2, r2, #1        */
+	0x1afffff3, /*         bne   loop              */
+	0xeafffff1, /*         b     outer             */
+	0xe1878005, /* func:   orr   r8, r7, r5        */
+	0xe1a0f00e  /*         mov   pc, lr            */
+};
+
+
+static
+uint8_t bench_get_uint8 (void *ext, uint32_t addr)
+{
+	return (0);
+}
+
+static
+uint16_t bench_get_uint16 (void *ext, uint32_t addr)
+{
+	return (0);
+}
+
+static
+uint32_t bench_get_uint32 (void *ext, uint32_t addr)
+{
+	return (0);
+}
+
+static
+void bench_set_uint8 (void *ext, uint32_t addr, uint8_t val)
+{
+}
+
+static
+void bench_set_uint16 (void *ext, uint32_t addr, uint16_t val)
+{
+}
+
+static
+void bench_set_uint32 (void *ext, uint32_t addr, uint32_t val)
+{
+}
+
+static
+arm_t *bench_new (unsigned char *ram, int jit, int threaded)
+{
+	unsigned i;
+	arm_t    *c;
+
+	for (i = 0; i < BENCH_RAM_SIZE; i++) {
+		ram[i] = 0;
+	}
+
+	for (i = 0; i < sizeof (bench_code) / sizeof (bench_code[0]); i++) {
+		uint32_t      v = bench_code[i];
+		unsigned char *p = &ram[BENCH_CODE + 4 * i];
+
+		p[0] = (v >> 24) & 0xff;
+		p[1] = (v >> 16) & 0xff;
+		p[2] = (v >> 8) & 0xff;
+		p[3] = v & 0xff;
+	}
+
+	c = arm_new();
+	if (c == NULL) {
+		return (NULL);
+	}
+
+	arm_set_flags (c, ARM_FLAG_BIGENDIAN, 1);
+	arm_set_mem_fct (c, NULL,
+		bench_get_uint8, bench_get_uint16, bench_get_uint32,
+		bench_set_uint8, bench_set_uint16, bench_set_uint32
+	);
+	arm_set_ram (c, ram, BENCH_RAM_SIZE);
+
+	arm_reset (c);
+
+	if (jit) {
+		arm_set_jit (c, 1);
+	}
+
+	arm_set_threaded (c, threaded);
+
+	arm_set_pc (c, BENCH_CODE);
+
+	return (c);
+}
+
+static
+void bench_run (const char *name, int jit, int threaded, unsigned long cnt)
+{
+	unsigned char *ram;
+	arm_t         *c;
+	clock_t       t0, t1;
+	double        sec;
+
+	ram = malloc (BENCH_RAM_SIZE);
+	if (ram == NULL) {
+		return;
+	}
+
+	c = bench_new (ram, jit, threaded);
+	if (c == NULL) {
+		free (ram);
+		return;
+	}
+
+	t0 = clock();
+
+	if (jit) {
+		arm_run (c, cnt);
+	}
+	else {
+		unsigned long i;
+
+		for (i = 0; i < cnt; i++) {
+			arm_execute (c);
+		}
+	}
+
+	t1 = clock();
+
+	sec = (double) (t1 - t0) / CLOCKS_PER_SEC;
+
+	if (sec <= 0.0) {
+		sec = 1.0 / CLOCKS_PER_SEC;
+	}
+
+	printf ("%-24s %10lu instructions %8.3f s %8.2f MIPS\n",
+		name, cnt, sec, (double) cnt / sec / 1000000.0
+	);
+
+	arm_del (c);
+	free (ram);
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned long cnt;
+
+	cnt = 50000000UL;
+
+	if (argc > 1) {
+		cnt = strtoul (argv[1], NULL, 0);
+	}
+
+	bench_run ("interpreter", 0, 0, cnt);
+	bench_run ("jit, function table", 1, 0, cnt);
+
+#if !DISABLE_THREADED
+	bench_run ("jit, threaded", 1, 1, cnt);
+#endif
+
+	return (0);
+}
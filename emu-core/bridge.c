@@ -0,0 +1,406 @@
+//
+//  bridge.c
+//  Leibniz
+//
+
+// posix_openpt() and friends are left out under -std=c99, and
+// cfmakeraw() is a BSD extension
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include "bridge.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+#define BRIDGE_RING_SIZE  16384
+#define BRIDGE_CHUNK_SIZE 4096
+// How long to wait before offering the Newton again what it didn't
+// take, in ms
+#define BRIDGE_RETRY_MS   5
+
+struct bridge_s {
+  BridgeType type;
+  uint8_t channel;
+  char name[128];
+
+  // The PTY's master and slave; the slave is kept open so that the
+  // master doesn't hang up between clients
+  int ptyFD;
+  int slaveFD;
+  // The listening socket and the connected client
+  int listenFD;
+  int clientFD;
+
+  // From the Newton, written out by the bridge thread
+  ring_t tx;
+  uint8_t txBuffer[BRIDGE_CHUNK_SIZE];
+  uint32_t txOffset;
+  uint32_t txLength;
+  uint32_t dropped;
+
+  // Read from the host, not yet taken by the Newton
+  uint8_t rxBuffer[BRIDGE_CHUNK_SIZE];
+  uint32_t rxOffset;
+  uint32_t rxLength;
+  // The host hung up before the Newton took all of rxBuffer. The fd
+  // isn't polled until it has, or poll() would only say so again.
+  bool hungUp;
+
+  bridge_send_f send;
+  void *ext;
+
+  pthread_t thread;
+  bool running;
+  int wakePipe[2];
+  int quit;
+};
+
+static bool bridge_set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return (flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+// The fd the host's data comes and goes on, or -1 if nobody's
+// connected
+static int bridge_get_fd(bridge_t *b) {
+  return (b->type == BridgePTY) ? b->ptyFD : b->clientFD;
+}
+
+static void bridge_wake(bridge_t *b) {
+  uint8_t val = 0;
+  if (write(b->wakePipe[1], &val, 1) != 1) {
+    // A full pipe already has a wakeup pending
+  }
+}
+
+#pragma mark - Bridge thread
+static void bridge_disconnect(bridge_t *b) {
+  if (b->clientFD != -1) {
+    close(b->clientFD);
+    b->clientFD = -1;
+  }
+  // What was meant for this client isn't for the next one
+  b->rxLength = 0;
+  b->txLength = 0;
+  b->hungUp = false;
+}
+
+static void bridge_accept(bridge_t *b) {
+  int fd = accept(b->listenFD, NULL, NULL);
+  if (fd == -1) {
+    return;
+  }
+
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  if (bridge_set_nonblocking(fd) == false) {
+    close(fd);
+    return;
+  }
+  b->clientFD = fd;
+}
+
+static ssize_t bridge_write_fd(bridge_t *b, int fd, const uint8_t *data, size_t length) {
+#if defined(MSG_NOSIGNAL)
+  if (b->type == BridgeTCP) {
+    return send(fd, data, length, MSG_NOSIGNAL);
+  }
+#endif
+  return write(fd, data, length);
+}
+
+// Returns false if the connection has gone
+static bool bridge_flush_tx(bridge_t *b, int fd) {
+  while (true) {
+    if (b->txLength == 0) {
+      b->txOffset = 0;
+      b->txLength = ring_read(&b->tx, b->txBuffer, sizeof(b->txBuffer));
+      if (b->txLength == 0) {
+        return true;
+      }
+    }
+
+    ssize_t written = bridge_write_fd(b, fd, b->txBuffer + b->txOffset, b->txLength);
+    if (written < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    b->txOffset += (uint32_t)written;
+    b->txLength -= (uint32_t)written;
+  }
+}
+
+// Returns false if the connection has gone
+static bool bridge_fill_rx(bridge_t *b, int fd) {
+  ssize_t length = read(fd, b->rxBuffer, sizeof(b->rxBuffer));
+  if (length > 0) {
+    b->rxOffset = 0;
+    b->rxLength = (uint32_t)length;
+    return true;
+  }
+  if (length == 0) {
+    return false;
+  }
+  return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+static void bridge_offer_rx(bridge_t *b) {
+  if (b->rxLength == 0) {
+    return;
+  }
+  uint32_t sent = b->send(b->ext, b->channel, b->rxBuffer + b->rxOffset, b->rxLength);
+  b->rxOffset += sent;
+  b->rxLength -= sent;
+}
+
+static void *bridge_thread(void *arg) {
+  bridge_t *b = arg;
+
+  while (__atomic_load_n(&b->quit, __ATOMIC_ACQUIRE) == 0) {
+    struct pollfd fds[2];
+    fds[0].fd = b->wakePipe[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+
+    int fd = bridge_get_fd(b);
+    if (b->hungUp == true && b->rxLength == 0) {
+      // All taken, so see what else is left and then how it ended
+      b->hungUp = false;
+    }
+
+    fds[1].revents = 0;
+    if (fd != -1 && b->hungUp == true) {
+      // Ignored by poll()
+      fds[1].fd = -1;
+      fds[1].events = 0;
+    }
+    else if (fd != -1) {
+      fds[1].fd = fd;
+      fds[1].events = 0;
+      if (b->rxLength == 0) {
+        fds[1].events |= POLLIN;
+      }
+      if (b->txLength > 0 || ring_count(&b->tx) > 0) {
+        fds[1].events |= POLLOUT;
+      }
+    }
+    else {
+      fds[1].fd = b->listenFD;
+      fds[1].events = POLLIN;
+    }
+
+    int timeout = (b->rxLength > 0) ? BRIDGE_RETRY_MS : -1;
+    if (poll(fds, 2, timeout) == -1 && errno != EINTR) {
+      break;
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      uint8_t drain[64];
+      while (read(b->wakePipe[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+
+    if (fd == -1) {
+      if ((fds[1].revents & POLLIN) != 0) {
+        bridge_accept(b);
+      }
+      else {
+        // Nobody to write it to
+        ring_clear(&b->tx);
+      }
+      continue;
+    }
+
+    bool connected = true;
+    if ((fds[1].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0 && b->rxLength > 0) {
+      b->hungUp = true;
+    }
+    else if ((fds[1].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) != 0 && b->rxLength == 0) {
+      connected = bridge_fill_rx(b, fd);
+    }
+    if (connected == true && b->hungUp == false) {
+      connected = bridge_flush_tx(b, fd);
+    }
+    if (connected == false) {
+      if (b->type == BridgeTCP) {
+        bridge_disconnect(b);
+        continue;
+      }
+      // The slave is held open, so this is the terminal itself gone
+      // wrong, and polling it again would only say so again
+      break;
+    }
+
+    bridge_offer_rx(b);
+  }
+  return NULL;
+}
+
+#pragma mark -
+static bridge_t *bridge_new(BridgeType type, uint8_t channel, void *ext, bridge_send_f send) {
+  bridge_t *b = calloc(1, sizeof(bridge_t));
+  if (b == NULL) {
+    return NULL;
+  }
+  b->type = type;
+  b->channel = channel;
+  b->ext = ext;
+  b->send = send;
+  b->ptyFD = -1;
+  b->slaveFD = -1;
+  b->listenFD = -1;
+  b->clientFD = -1;
+  b->wakePipe[0] = -1;
+  b->wakePipe[1] = -1;
+
+  if (ring_init(&b->tx, BRIDGE_RING_SIZE) == false ||
+      pipe(b->wakePipe) != 0 ||
+      bridge_set_nonblocking(b->wakePipe[0]) == false ||
+      bridge_set_nonblocking(b->wakePipe[1]) == false)
+  {
+    bridge_del(b);
+    return NULL;
+  }
+  return b;
+}
+
+static bridge_t *bridge_start(bridge_t *b) {
+  if (pthread_create(&b->thread, NULL, bridge_thread, b) != 0) {
+    bridge_del(b);
+    return NULL;
+  }
+  b->running = true;
+  return b;
+}
+
+bridge_t *bridge_new_pty(uint8_t channel, void *ext, bridge_send_f send) {
+  bridge_t *b = bridge_new(BridgePTY, channel, ext, send);
+  if (b == NULL) {
+    return NULL;
+  }
+
+  b->ptyFD = posix_openpt(O_RDWR | O_NOCTTY);
+  if (b->ptyFD == -1 || grantpt(b->ptyFD) != 0 || unlockpt(b->ptyFD) != 0) {
+    bridge_del(b);
+    return NULL;
+  }
+
+  const char *path = ptsname(b->ptyFD);
+  if (path == NULL) {
+    bridge_del(b);
+    return NULL;
+  }
+  snprintf(b->name, sizeof(b->name), "%s", path);
+
+  // Raw, so that the bytes go through as they are
+  b->slaveFD = open(b->name, O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (b->slaveFD == -1 || tcgetattr(b->slaveFD, &tio) != 0) {
+    bridge_del(b);
+    return NULL;
+  }
+  cfmakeraw(&tio);
+  if (tcsetattr(b->slaveFD, TCSANOW, &tio) != 0 || bridge_set_nonblocking(b->ptyFD) == false) {
+    bridge_del(b);
+    return NULL;
+  }
+
+  return bridge_start(b);
+}
+
+bridge_t *bridge_new_tcp(uint8_t channel, uint16_t port, void *ext, bridge_send_f send) {
+  bridge_t *b = bridge_new(BridgeTCP, channel, ext, send);
+  if (b == NULL) {
+    return NULL;
+  }
+
+  b->listenFD = socket(AF_INET, SOCK_STREAM, 0);
+  if (b->listenFD == -1) {
+    bridge_del(b);
+    return NULL;
+  }
+
+  int one = 1;
+  setsockopt(b->listenFD, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  // Only from this machine
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(b->listenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(b->listenFD, 1) != 0 ||
+      bridge_set_nonblocking(b->listenFD) == false)
+  {
+    bridge_del(b);
+    return NULL;
+  }
+
+  // The port that was picked, if asked for any
+  socklen_t addrLength = sizeof(addr);
+  if (getsockname(b->listenFD, (struct sockaddr *)&addr, &addrLength) == 0) {
+    port = ntohs(addr.sin_port);
+  }
+  snprintf(b->name, sizeof(b->name), "127.0.0.1:%u", port);
+
+  return bridge_start(b);
+}
+
+void bridge_del(bridge_t *b) {
+  if (b == NULL) {
+    return;
+  }
+
+  if (b->running == true) {
+    __atomic_store_n(&b->quit, 1, __ATOMIC_RELEASE);
+    bridge_wake(b);
+    pthread_join(b->thread, NULL);
+  }
+
+  int fds[] = { b->clientFD, b->listenFD, b->slaveFD, b->ptyFD, b->wakePipe[0], b->wakePipe[1] };
+  for (size_t i=0; i<sizeof(fds) / sizeof(fds[0]); i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
+    }
+  }
+  ring_free(&b->tx);
+  free(b);
+}
+
+BridgeType bridge_get_type(bridge_t *b) {
+  return b->type;
+}
+
+const char *bridge_get_name(bridge_t *b) {
+  return b->name;
+}
+
+uint32_t bridge_get_dropped(bridge_t *b) {
+  return b->dropped;
+}
+
+void bridge_write(bridge_t *b, const uint8_t *data, uint32_t length) {
+  uint32_t written = ring_write(&b->tx, data, length);
+  b->dropped += length - written;
+  if (written > 0) {
+    bridge_wake(b);
+  }
+}
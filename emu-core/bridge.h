@@ -0,0 +1,48 @@
+//
+//  bridge.h
+//  Leibniz
+//
+//  Connects an SCC channel to the host, as a pseudo-terminal or as a
+//  TCP socket on localhost that one client at a time can connect to.
+//  A thread of the bridge's own does the reading and writing, without
+//  blocking, so that a slow or absent client never holds up the
+//  emulator:
+//
+//  - bytes the Newton sends go into a ring from the emulator thread,
+//    and the bridge thread writes them out. When the ring is full,
+//    they are dropped, as on a real line with nobody listening.
+//  - bytes read from the host are handed to the send function from
+//    the bridge thread. Whatever it doesn't take is offered again a
+//    little later, and nothing more is read until it has all gone.
+//
+
+#ifndef __Leibniz__bridge__
+#define __Leibniz__bridge__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  BridgePTY,
+  BridgeTCP,
+} BridgeType;
+
+// Returns how many bytes were taken
+typedef uint32_t (*bridge_send_f) (void *ext, uint8_t channel, const uint8_t *data, uint32_t length);
+
+typedef struct bridge_s bridge_t;
+
+bridge_t *bridge_new_pty(uint8_t channel, void *ext, bridge_send_f send);
+bridge_t *bridge_new_tcp(uint8_t channel, uint16_t port, void *ext, bridge_send_f send);
+void bridge_del(bridge_t *b);
+
+BridgeType bridge_get_type(bridge_t *b);
+// The path of the terminal, or the address to connect to
+const char *bridge_get_name(bridge_t *b);
+// Bytes from the Newton that didn't fit
+uint32_t bridge_get_dropped(bridge_t *b);
+
+// From the Newton. Call from the emulator thread only.
+void bridge_write(bridge_t *b, const uint8_t *data, uint32_t length);
+
+#endif /* defined(__Leibniz__bridge__) */
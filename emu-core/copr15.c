@@ -28,6 +28,7 @@
 
 #include "arm.h"
 #include "internal.h"
+#include "state.h"
 
 
 static int cp15_reset (arm_t *c, arm_copr_t *p);
@@ -82,6 +83,41 @@ void cp15_del (arm_copr15_t *p)
 	free (p);
 }
 
+void cp15_save_state (arm_t *c, state_t *st)
+{
+	unsigned     i;
+	arm_copr15_t *p;
+
+	p = &c->copr15;
+
+	for (i = 0; i < 16; i++) {
+		state_put_u32 (st, p->reg[i]);
+	}
+
+	state_put_u32 (st, p->cache_type);
+	state_put_u32 (st, p->auxiliary_control);
+}
+
+int cp15_load_state (arm_t *c, state_t *st)
+{
+	unsigned     i;
+	arm_copr15_t *p;
+
+	p = &c->copr15;
+
+	for (i = 0; i < 16; i++) {
+		p->reg[i] = state_get_u32 (st);
+	}
+
+	p->cache_type = state_get_u32 (st);
+	p->auxiliary_control = state_get_u32 (st);
+
+	arm_tlb_flush (c);
+	arm_jit_reset (c);
+
+	return (st->error ? 1 : 0);
+}
+
 
 /*
  * Get CP15/0 (ID)
@@ -238,7 +274,10 @@ int cp15_set_reg7 (arm_t *c, arm_copr15_t *p)
 	return (1);
 }
 
-/* TLB functions */
+/*
+ * TLB functions. The software TLBs and the translation cache are
+ * flushed completely, even for the single entry operations.
+ */
 static
 int cp15_set_reg8 (arm_t *c, arm_copr15_t *p)
 {
@@ -247,41 +286,23 @@ int cp15_set_reg8 (arm_t *c, arm_copr15_t *p)
 	rm = arm_ir_rm (c->ir);
 	op2 = arm_get_bits (c->ir, 5, 3);
 
-	if (rm == 5) {
-		switch (op2) {
-		case 0x00:
-			/* invalidate entire instruction tlb */
-			return (0);
-
-		case 0x01:
-			/* invalidate instruction tlb single entry */
-			return (0);
-		}
+	if ((rm < 5) || (rm > 7) || (op2 > 1)) {
+		return (1);
 	}
-	else if (rm == 6) {
-		switch (op2) {
-		case 0x00:
-			/* invalidate entire data tlb */
-			return (0);
 
-		case 0x01:
-			/* invalidate data tlb single entry */
-			return (0);
-		}
-	}
-	else if (rm == 7) {
-		switch (op2) {
-		case 0x00:
-			/* invalidate entire unified tlb */
-			return (0);
+	/*
+	 * rm = 5: instruction tlb
+	 * rm = 6: data tlb
+	 * rm = 7: unified tlb
+	 *
+	 * op2 = 0: invalidate entire tlb
+	 * op2 = 1: invalidate single entry
+	 */
 
-		case 0x01:
-			/* invalidate unified tlb single entry */
-			return (0);
-		}
-	}
+	arm_tlb_flush (c);
+	arm_jit_flush (c);
 
-	return (1);
+	return (0);
 }
 
 static
@@ -389,9 +410,6 @@ int cp15_op_mcr (arm_t *c, arm_copr_t *p)
 
 	val = arm_get_rd (c, c->ir);
 
-	/* conservative flushing of translation buffer */
-	arm_tbuf_flush (c);
-
 	switch (arm_ir_rn (c->ir)) {
 	case 0x00: /* id register */
 		// Register 0 is a read-only identity register that returns the ARM Ltd code for this chip: 0x4156061x.
@@ -399,16 +417,22 @@ int cp15_op_mcr (arm_t *c, arm_copr_t *p)
 
 	case 0x01: /* control register */
 		// Register 1 is write only and contains control bits. All bits in this register are forced LOW by reset.
+		arm_tlb_flush (c);
+		arm_jit_flush (c);
 		return (cp15_set_reg1 (c, p15, op2, val));
 
 	case 0x02: /* translation table base */
 		// Register 2 is a write-only register which holds the base of the currently active Level One page table.
 		p15->reg[2] = val & 0xffffc000;
+		arm_tlb_flush (c);
+		arm_jit_flush (c);
 		break;
 
 	case 0x03: /* domain access control */
 		// Register 3 is a write-only register which holds the current access control for domains 0 to 15.
 		p15->reg[3] = val & 0xffffffff;
+		arm_tlb_flush (c);
+		arm_jit_flush (c);
 		break;
 		
 	case 0x04:
@@ -417,16 +441,23 @@ int cp15_op_mcr (arm_t *c, arm_copr_t *p)
 
 	case 0x05: // page fault / tlb flush
 		// Writing Register 5 flushes the TLB. (The data written is discarded).
+		arm_tlb_flush (c);
+		arm_jit_flush (c);
 		break;
 
 	case 0x06: // data fault address / tlb purge
 		// Writing Register 6 purges the TLB
+		arm_tlb_flush (c);
+		arm_jit_flush (c);
 		break;
       
 	case 0x07: // idc flush?
 		// Register 7 is a write-only register. The data written to this register is discarded and the IDC is flushed.
 		return (cp15_set_reg7 (c, p15));
 
+	case 0x08: /* tlb functions */
+		return (cp15_set_reg8 (c, p15));
+
 	// Registers 8 -15 Reserved
 	// Accessing any of these registers will cause the undefined instruction trap to be taken.
 
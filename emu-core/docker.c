@@ -96,6 +96,7 @@ int8_t docker_install_package_at_path(docker_t *c, const char *path) {
 void docker_reset(docker_t *c) {
   memset(c->buffer, 0x00, c->bufferLen);
   c->bufferIdx = 0;
+  c->frameState = DockerFrameSYN;
   
   if (c->response != NULL) {
     free(c->response);
@@ -240,8 +241,8 @@ void docker_make_package_data_response(docker_t *c, uint8_t seqNo) {
 }
 
 void docker_parse_newt_dock_payload(docker_t *c) {
-  const char *command = (const char *)c->buffer + 14;
-  uint8_t seqNo = c->buffer[5];
+  const char *command = (const char *)c->buffer + 11;
+  uint8_t seqNo = c->buffer[2];
 
   docker_make_la_response(c, seqNo);
   
@@ -255,7 +256,7 @@ void docker_parse_newt_dock_payload(docker_t *c) {
     docker_make_dock_response(c, "stim", seqNo, seconds, sizeof(seconds));
   }
   else if (strncmp(command, "dres", 4) == 0) {
-    uint32_t errCode = *(uint32_t *)&c->buffer[22];
+    uint32_t errCode = *(uint32_t *)&c->buffer[19];
     if (errCode != 0) {
       // Newton formats suggests the Newton will disconnect
       // after sending an error code
@@ -278,7 +279,7 @@ void docker_parse_newt_dock_payload(docker_t *c) {
 }
 
 void docker_parse_payload(docker_t *c) {
-  switch(c->buffer[4]) {
+  switch(c->buffer[1]) {
     case LR: {
       if (c->connected != NULL) {
         c->connected(c->ext);
@@ -290,8 +291,8 @@ void docker_parse_payload(docker_t *c) {
       break;
     }
     case LT: {
-      if (strncmp((const char *)c->buffer + 6, "newt", 4) == 0) {
-        if (strncmp((const char *)c->buffer + 10, "dock", 4) == 0) {
+      if (strncmp((const char *)c->buffer + 3, "newt", 4) == 0) {
+        if (strncmp((const char *)c->buffer + 7, "dock", 4) == 0) {
           docker_parse_newt_dock_payload(c);
         }
       }
@@ -299,7 +300,7 @@ void docker_parse_payload(docker_t *c) {
     }
     case LA:
       if (c->packageSeqNo != -1) {
-        docker_make_package_data_response(c, c->buffer[5]);
+        docker_make_package_data_response(c, c->buffer[2]);
       }
       break;
     case LD:
@@ -309,58 +310,104 @@ void docker_parse_payload(docker_t *c) {
       docker_close_package_file(c);
       break;
     default:
-      printf("Unhandled frame type: 0x%02x\n", c->buffer[4]);
+      printf("Unhandled frame type: 0x%02x\n", c->buffer[1]);
       break;
   }
   
   c->bufferIdx = 0;
+  c->frameState = DockerFrameSYN;
 }
 
 bool docker_can_parse_payload(docker_t *c) {
-  if (c->bufferIdx < 4) {
-    return false;
-  }
-  
-  uint32_t payloadLength = 3; // SYN, DLE, STX
-  payloadLength += 2; // DLE, ETX
-  payloadLength += 2; // crc16
-  payloadLength += c->buffer[3]; // header length
-  payloadLength += 1; // header length bit
-  
-  if (c->bufferIdx < payloadLength) {
-    return false;
-  }
-  
-  // Check for DLE, ETX, with enough room for CRC16
-  for (uint32_t i=5; i<c->bufferIdx-3; i++) {
-    if (c->buffer[i-1] != DLE && c->buffer[i] == DLE && c->buffer[i + 1] == ETX) {
-      // XXX: Check the checksum!?
-      return true;
-    }
-  }
-  
-  return false;
+  return (c->frameState == DockerFrameComplete);
 }
 
-void docker_receive_byte(docker_t *c, uint8_t byte) {
-  // Ensure we're dealing with a bisync frame
-  if (c->bufferIdx == 0 && byte != SYN) {
-    return;
-  }
-  if (c->bufferIdx == 1 && byte != DLE) {
-    c->bufferIdx = 0;
-    return;
-  }
-  if (c->bufferIdx == 2 && byte != STX) {
-    c->bufferIdx = 0;
-    return;
-  }
-
+static void docker_append_byte(docker_t *c, uint8_t byte) {
   if (c->bufferIdx >= c->bufferLen) {
     c->bufferLen += 256;
     c->buffer = realloc(c->buffer, c->bufferLen);
   }
   
-  c->buffer[c->bufferIdx] = byte;
-  c->bufferIdx++;
+  c->buffer[c->bufferIdx++] = byte;
+  c->frameCRC = crc16_update(c->frameCRC, byte);
+}
+
+static void docker_drop_frame(docker_t *c, const char *reason) {
+  printf("Dropped dock frame: %s\n", reason);
+  c->badFrames++;
+  c->bufferIdx = 0;
+  c->frameState = DockerFrameSYN;
+}
+
+void docker_receive_byte(docker_t *c, uint8_t byte) {
+  switch (c->frameState) {
+    case DockerFrameComplete:
+      // Nobody parsed the last one
+      c->bufferIdx = 0;
+      c->frameState = DockerFrameSYN;
+      // Fall through
+    case DockerFrameSYN:
+      if (byte == SYN) {
+        c->frameState = DockerFrameDLE;
+      }
+      break;
+    case DockerFrameDLE:
+      if (byte == DLE) {
+        c->frameState = DockerFrameSTX;
+      }
+      else if (byte != SYN) {
+        c->frameState = DockerFrameSYN;
+      }
+      break;
+    case DockerFrameSTX:
+      if (byte == STX) {
+        c->bufferIdx = 0;
+        c->frameCRC = 0;
+        c->frameState = DockerFrameData;
+      }
+      else {
+        c->frameState = (byte == SYN) ? DockerFrameDLE : DockerFrameSYN;
+      }
+      break;
+    case DockerFrameData:
+      if (byte == DLE) {
+        c->frameState = DockerFrameDataDLE;
+      }
+      else {
+        docker_append_byte(c, byte);
+      }
+      break;
+    case DockerFrameDataDLE:
+      if (byte == DLE) {
+        // An escaped DLE in the data
+        docker_append_byte(c, byte);
+        c->frameState = DockerFrameData;
+      }
+      else if (byte == ETX) {
+        c->frameCRC = crc16_update(c->frameCRC, ETX);
+        c->frameState = DockerFrameCRCLow;
+      }
+      else {
+        docker_drop_frame(c, "bad DLE sequence");
+      }
+      break;
+    case DockerFrameCRCLow:
+      c->frameCRCLow = byte;
+      c->frameState = DockerFrameCRCHigh;
+      break;
+    case DockerFrameCRCHigh: {
+      uint16_t crc = c->frameCRCLow | (byte << 8);
+      if (crc != c->frameCRC) {
+        docker_drop_frame(c, "bad CRC");
+      }
+      // The header length, then the header
+      else if (c->bufferIdx < 2 || c->bufferIdx < (uint32_t)c->buffer[0] + 1) {
+        docker_drop_frame(c, "short header");
+      }
+      else {
+        c->frameState = DockerFrameComplete;
+      }
+      break;
+    }
+  }
 }
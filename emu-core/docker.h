@@ -17,10 +17,29 @@ typedef void (*docker_connected_f) (void *ext);
 typedef void (*docker_disconnected_f) (void *ext);
 typedef void (*docker_install_progress_f) (void *ext, double progress);
 
+// Where docker_receive_byte is in the frame being received
+typedef enum {
+  DockerFrameSYN = 0,
+  DockerFrameDLE,
+  DockerFrameSTX,
+  DockerFrameData,
+  DockerFrameDataDLE,
+  DockerFrameCRCLow,
+  DockerFrameCRCHigh,
+  DockerFrameComplete,
+} DockerFrameState;
+
 typedef struct docker_s {
+  // The frame's data as it arrives, without the framing and the DLE
+  // escapes
   uint8_t *buffer;
   uint32_t bufferLen;
   uint32_t bufferIdx;
+  
+  DockerFrameState frameState;
+  uint16_t frameCRC;
+  uint8_t frameCRCLow;
+  uint32_t badFrames;
 
   uint8_t *response;
   uint32_t responseLen;
@@ -47,6 +66,7 @@ void docker_reset(docker_t *c);
 uint8_t *docker_get_response(docker_t *c, uint32_t *outLength);
 
 void docker_parse_payload(docker_t *c);
+// Whether a whole frame with a good CRC has been received
 bool docker_can_parse_payload(docker_t *c);
 void docker_receive_byte(docker_t *c, uint8_t byte);
 
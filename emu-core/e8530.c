@@ -24,6 +24,7 @@
 #include <stdio.h>
 
 #include "e8530.h"
+#include "state.h"
 
 
 #define DEBUG_SCC 0
@@ -130,15 +131,25 @@ void e8530_set_comm_fct (e8530_t *scc, unsigned chn, void *ext, void *fct)
 
 void e8530_set_multichar (e8530_t *scc, unsigned chn, unsigned read_max, unsigned write_max)
 {
+	e8530_chn_t *c;
+
 	if (chn > 1) {
 		return;
 	}
 
-	scc->chn[chn].read_char_cnt = 0;
-	scc->chn[chn].read_char_max = (read_max < 1) ? 1 : read_max;
+	c = &scc->chn[chn];
 
-	scc->chn[chn].write_char_cnt = 0;
-	scc->chn[chn].write_char_max = (write_max < 1) ? 1 : write_max;
+	c->read_char_max = (read_max < 1) ? 1 : read_max;
+	c->write_char_max = (write_max < 1) ? 1 : write_max;
+
+	/* setting the same limits again changes nothing */
+	if (c->read_char_cnt > c->read_char_max) {
+		c->read_char_cnt = c->read_char_max;
+	}
+
+	if (c->write_char_cnt > c->write_char_max) {
+		c->write_char_cnt = c->write_char_max;
+	}
 }
 
 void e8530_set_clock (e8530_t *scc, unsigned long pclk, unsigned long rtxca, unsigned long rtxcb)
@@ -1203,6 +1214,104 @@ void e8530_reset (e8530_t *scc)
 	e8530_set_irq (scc, 0);
 }
 
+static
+void e8530_save_chn (e8530_chn_t *c, state_t *st)
+{
+	state_put_bytes (st, c->wr, 16);
+	state_put_bytes (st, c->rr, 16);
+
+	state_put_u8 (st, c->rr0_latch_msk);
+	state_put_u8 (st, c->rr0_latch_val);
+
+	state_put_u8 (st, c->txd_empty);
+	state_put_u8 (st, c->rxd_empty);
+
+	state_put_u32 (st, c->bps);
+	state_put_u32 (st, c->parity);
+	state_put_u32 (st, c->bpc);
+	state_put_u32 (st, c->stop);
+
+	state_put_u32 (st, c->char_clk_cnt);
+	state_put_u32 (st, c->char_clk_div);
+
+	state_put_u32 (st, c->read_char_cnt);
+	state_put_u32 (st, c->read_char_max);
+
+	state_put_u32 (st, c->write_char_cnt);
+	state_put_u32 (st, c->write_char_max);
+
+	state_put_u32 (st, c->rtxc);
+
+	state_put_u32 (st, c->tx_i);
+	state_put_u32 (st, c->tx_j);
+	state_put_bytes (st, c->txbuf, E8530_BUF_MAX);
+
+	state_put_u32 (st, c->rx_i);
+	state_put_u32 (st, c->rx_j);
+	state_put_bytes (st, c->rxbuf, E8530_BUF_MAX);
+}
+
+static
+void e8530_load_chn (e8530_chn_t *c, state_t *st)
+{
+	state_get_bytes (st, c->wr, 16);
+	state_get_bytes (st, c->rr, 16);
+
+	c->rr0_latch_msk = state_get_u8 (st);
+	c->rr0_latch_val = state_get_u8 (st);
+
+	c->txd_empty = state_get_u8 (st);
+	c->rxd_empty = state_get_u8 (st);
+
+	c->bps = state_get_u32 (st);
+	c->parity = state_get_u32 (st);
+	c->bpc = state_get_u32 (st);
+	c->stop = state_get_u32 (st);
+
+	c->char_clk_cnt = state_get_u32 (st);
+	c->char_clk_div = state_get_u32 (st);
+
+	c->read_char_cnt = state_get_u32 (st);
+	c->read_char_max = state_get_u32 (st);
+
+	c->write_char_cnt = state_get_u32 (st);
+	c->write_char_max = state_get_u32 (st);
+
+	c->rtxc = state_get_u32 (st);
+
+	c->tx_i = state_get_u32 (st) % E8530_BUF_MAX;
+	c->tx_j = state_get_u32 (st) % E8530_BUF_MAX;
+	state_get_bytes (st, c->txbuf, E8530_BUF_MAX);
+
+	c->rx_i = state_get_u32 (st) % E8530_BUF_MAX;
+	c->rx_j = state_get_u32 (st) % E8530_BUF_MAX;
+	state_get_bytes (st, c->rxbuf, E8530_BUF_MAX);
+}
+
+void e8530_save_state (e8530_t *scc, state_t *st)
+{
+	state_put_u32 (st, scc->index);
+
+	e8530_save_chn (&scc->chn[0], st);
+	e8530_save_chn (&scc->chn[1], st);
+
+	state_put_u32 (st, scc->pclk);
+	state_put_u8 (st, scc->irq_val);
+}
+
+int e8530_load_state (e8530_t *scc, state_t *st)
+{
+	scc->index = state_get_u32 (st) & 15;
+
+	e8530_load_chn (&scc->chn[0], st);
+	e8530_load_chn (&scc->chn[1], st);
+
+	scc->pclk = state_get_u32 (st);
+	scc->irq_val = state_get_u8 (st);
+
+	return (st->error ? 1 : 0);
+}
+
 static inline
 void e8530_chn_clock (e8530_t *scc, unsigned chn, unsigned n)
 {
@@ -1231,8 +1340,50 @@ void e8530_chn_clock (e8530_t *scc, unsigned chn, unsigned n)
 	e8530_check_txd (scc, chn);
 }
 
+/*
+ * Move characters between the buffers and the data registers now,
+ * as far as the current character time still allows, instead of
+ * waiting for the next one.
+ */
+void e8530_poll (e8530_t *scc, unsigned chn)
+{
+	if (chn > 1) {
+		return;
+	}
+
+	e8530_check_rxd (scc, chn);
+	e8530_check_txd (scc, chn);
+}
+
 void e8530_clock (e8530_t *scc, unsigned n)
 {
 	e8530_chn_clock (scc, 0, n);
 	e8530_chn_clock (scc, 1, n);
 }
+
+unsigned long e8530_get_clock_cnt (e8530_t *scc)
+{
+	unsigned long n0, n1;
+
+	n0 = (scc->chn[0].char_clk_cnt > 0) ? scc->chn[0].char_clk_cnt : 1;
+	n1 = (scc->chn[1].char_clk_cnt > 0) ? scc->chn[1].char_clk_cnt : 1;
+
+	return ((n0 < n1) ? n0 : n1);
+}
+
+int e8530_get_busy (e8530_t *scc)
+{
+	unsigned i;
+
+	for (i = 0; i < 2; i++) {
+		if ((scc->chn[i].rx_i != scc->chn[i].rx_j) && scc->chn[i].rxd_empty) {
+			return (1);
+		}
+
+		if (scc->chn[i].txd_empty == 0) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
@@ -30,6 +30,9 @@
 #define E8530_BUF_MAX 256
 
 
+struct state_s;
+
+
 typedef struct {
 	unsigned char wr[16];
 	unsigned char rr[16];
@@ -101,6 +104,7 @@ void e8530_set_out_fct (e8530_t *scc, unsigned chn, void *ext, void *fct);
 void e8530_set_rts_fct (e8530_t *scc, unsigned chn, void *ext, void *fct);
 void e8530_set_comm_fct (e8530_t *scc, unsigned chn, void *ext, void *fct);
 
+/* at most read_max / write_max characters per character time */
 void e8530_set_multichar (e8530_t *scc, unsigned chn, unsigned read_max, unsigned write_max);
 
 void e8530_set_clock (e8530_t *scc, unsigned long pclk, unsigned long rtxca, unsigned long rtxcb);
@@ -141,7 +145,18 @@ int e8530_inp_full (e8530_t *scc, unsigned chn);
 int e8530_out_empty (e8530_t *scc, unsigned chn);
 
 void e8530_reset (e8530_t *scc);
+void e8530_poll (e8530_t *scc, unsigned chn);
 void e8530_clock (e8530_t *scc, unsigned n);
 
+/* save and restore the registers and the buffers, but not the callbacks */
+void e8530_save_state (e8530_t *scc, struct state_s *st);
+int e8530_load_state (e8530_t *scc, struct state_s *st);
+
+/* the number of clocks until the next character time on either channel */
+unsigned long e8530_get_clock_cnt (e8530_t *scc);
+
+/* check if the next character time would move a received or transmitted character */
+int e8530_get_busy (e8530_t *scc);
+
 
 #endif
@@ -19,19 +19,30 @@
 #endif
 
 
-extern FPA11* qemufpa;
-
 extern unsigned int EmulateAll(unsigned int opcode, FPA11* qfpa);
 
-static arm_copr_t fpa_bridge;
+// One FPA per ARM, registered as its coprocessor 1
+typedef struct fpa_s {
+  arm_copr_t copr;
+  arm_t *arm;
+  FPA11 fpa11;
+} fpa_t;
+
+// The NetWinder code reaches the CPU through the functions below,
+// which have no context argument. fpa_arm points at the CPU whose
+// instruction is being emulated; being thread-local, machines on
+// different threads never see each other's.
+static __thread arm_t *fpa_arm;
 
 int fpa_exec(arm_t *arm, arm_copr_t *copro) 
 {
+	fpa_t *fpa = copro->ext;
 	int r;
 
     FPA_Debug("[FPA] %s executing 0x%08x at PC:0x%08x\n", __PRETTY_FUNCTION__, arm->ir, arm_get_pc(arm));
 
-    r = EmulateAll(arm->ir, qemufpa);
+	fpa_arm = arm;
+    r = EmulateAll(arm->ir, &fpa->fpa11);
 	if (r) {
 		arm_set_clk (arm, 4, 1);
 	}
@@ -40,31 +51,107 @@ int fpa_exec(arm_t *arm, arm_copr_t *copro)
 
 int fpa_reset(arm_t *arm, arm_copr_t *copro) 
 {
+	fpa_t *fpa = copro->ext;
+
+	qemufpa = &fpa->fpa11;
 	resetFPA11();
 	return 0;
 }
 
+static fpa_t *fpa_get(arm_t *arm)
+{
+	arm_copr_t *copro = arm->copr[1];
+
+	if (copro != NULL && copro->exec == fpa_exec) {
+		return copro->ext;
+	}
+	return NULL;
+}
+
 void fpa_init(arm_t *arm) 
 {
-	fpa_bridge.copr_idx = 1;
-	fpa_bridge.exec = fpa_exec;
-	fpa_bridge.reset = fpa_reset;
-	fpa_bridge.ext = arm;
-	arm_set_copr(arm, 1, &fpa_bridge);
-	
-	qemufpa = calloc(1, sizeof(FPA11));
+	fpa_t *fpa = calloc(1, sizeof(fpa_t));
+
+	fpa->copr.copr_idx = 1;
+	fpa->copr.exec = fpa_exec;
+	fpa->copr.reset = fpa_reset;
+	fpa->copr.ext = fpa;
+	fpa->arm = arm;
+	arm_set_copr(arm, 1, &fpa->copr);
+}
+
+void fpa_delete(arm_t *arm)
+{
+	fpa_t *fpa = fpa_get(arm);
+
+	if (fpa != NULL) {
+		arm_set_copr(arm, 1, NULL);
+		free(fpa);
+	}
 }
 
-void fpa_delete(void)
+// The registers are saved in their extended layout, which overlays
+// the double and single precision ones.
+void fpa_save_state(arm_t *arm, state_t *st)
 {
-	fpa_bridge.ext = 0;
-	free(qemufpa);
+	fpa_t *fpa = fpa_get(arm);
+	if (fpa == NULL) {
+		return;
+	}
+
+	FPA11 *f = &fpa->fpa11;
+	for (int i=0; i<8; i++) {
+		state_put_u8(st, f->fType[i]);
+		state_put_u64(st, f->fpreg[i].fExtended.low);
+		state_put_u16(st, f->fpreg[i].fExtended.high);
+	}
+	state_put_u32(st, f->fpsr);
+	state_put_u32(st, f->fpcr);
+	state_put_u32(st, f->initflag);
+
+	state_put_u8(st, f->fp_status.float_detect_tininess);
+	state_put_u8(st, f->fp_status.float_rounding_mode);
+	state_put_u8(st, f->fp_status.float_exception_flags);
+	state_put_u8(st, f->fp_status.floatx80_rounding_precision);
+	state_put_u8(st, f->fp_status.flush_to_zero);
+	state_put_u8(st, f->fp_status.flush_inputs_to_zero);
+	state_put_u8(st, f->fp_status.default_nan_mode);
+	state_put_u8(st, f->fp_status.snan_bit_is_one);
+}
+
+bool fpa_load_state(arm_t *arm, state_t *st)
+{
+	fpa_t *fpa = fpa_get(arm);
+	if (fpa == NULL) {
+		return true;
+	}
+
+	FPA11 *f = &fpa->fpa11;
+	for (int i=0; i<8; i++) {
+		f->fType[i] = state_get_u8(st);
+		f->fpreg[i].fExtended.low = state_get_u64(st);
+		f->fpreg[i].fExtended.high = state_get_u16(st);
+	}
+	f->fpsr = state_get_u32(st);
+	f->fpcr = state_get_u32(st);
+	f->initflag = state_get_u32(st);
+
+	f->fp_status.float_detect_tininess = state_get_u8(st);
+	f->fp_status.float_rounding_mode = state_get_u8(st);
+	f->fp_status.float_exception_flags = state_get_u8(st);
+	f->fp_status.floatx80_rounding_precision = state_get_u8(st);
+	f->fp_status.flush_to_zero = state_get_u8(st);
+	f->fp_status.flush_inputs_to_zero = state_get_u8(st);
+	f->fp_status.default_nan_mode = state_get_u8(st);
+	f->fp_status.snan_bit_is_one = state_get_u8(st);
+
+	return (st->error == false);
 }
 
 // Previously implemented in fpmodule.inl
 uint32_t readRegister(const unsigned int nReg)
 {
-	arm_t *arm = (arm_t *)fpa_bridge.ext;
+	arm_t *arm = fpa_arm;
 	uint32_t result = arm_get_gpr(arm, nReg);
     FPA_Debug("[FPA] %s %i => 0x%08x\n", __PRETTY_FUNCTION__, nReg, result);
     return result;
@@ -73,14 +160,14 @@ uint32_t readRegister(const unsigned int nReg)
 void writeRegister(const unsigned int nReg, const uint32_t val)
 {
 	FPA_Debug("[FPA] %s %i 0x%08x\n", __PRETTY_FUNCTION__, nReg, val);
-	arm_t *arm = (arm_t *)fpa_bridge.ext;
+	arm_t *arm = fpa_arm;
 	arm_set_gpr(arm, nReg, val);
 }
 
 void writeConditionCodes(const unsigned int val)
 {
 	FPA_Debug("[FPA] %s 0x%08x\n", __PRETTY_FUNCTION__, val);
-    arm_t *arm = (arm_t *)fpa_bridge.ext;
+    arm_t *arm = fpa_arm;
     uint32_t cpsr = arm_get_cpsr(arm);
     cpsr &= ~ARM_PSR_CC;
     cpsr |= val;
@@ -89,7 +176,7 @@ void writeConditionCodes(const unsigned int val)
 
 void get_user_u32(uint32_t *val, uint32_t addr)
 {
-	arm_t *arm = (arm_t *)fpa_bridge.ext;
+	arm_t *arm = fpa_arm;
 	arm_dload32_t(arm, addr, val);
     FPA_Debug("[FPA] %s %08x %08x\n", __PRETTY_FUNCTION__, addr, *val);
 }
@@ -97,7 +184,7 @@ void get_user_u32(uint32_t *val, uint32_t addr)
 void put_user_u32(uint32_t val, uint32_t addr)
 {
 	FPA_Debug("[FPA] %s %08x %08x\n", __PRETTY_FUNCTION__, addr, val);
-	arm_t *arm = (arm_t *)fpa_bridge.ext;
+	arm_t *arm = fpa_arm;
 	arm_dstore32_t(arm, addr, val);
 }
 
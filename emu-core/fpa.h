@@ -10,8 +10,12 @@
 #define __FPA_H
 
 #include "arm.h"
+#include "state.h"
 
 void fpa_init(arm_t *arm);
-void fpa_delete(void);
+void fpa_delete(arm_t *arm);
+
+void fpa_save_state(arm_t *arm, state_t *st);
+bool fpa_load_state(arm_t *arm, state_t *st);
 
 #endif
@@ -0,0 +1,332 @@
+//
+//  history.c
+//  Leibniz
+//
+
+#include "history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#if DISABLE_LOGGING
+#define LOG_STR(...) {}
+#else
+#define LOG_STR(...) logger_log(c->logger, LoggerNewton, __VA_ARGS__)
+#endif
+
+typedef struct newton_history_entry_s {
+  newton_snapshot_t *snap;
+  uint64_t oprcnt;
+  // Where the input applied after the snapshot starts
+  newton_input_log_mark_t mark;
+} newton_history_entry_t;
+
+struct newton_history_s {
+  uint64_t interval;
+  uint32_t limit;
+
+  // Oldest first
+  newton_history_entry_t *entries;
+  uint32_t count;
+
+  uint64_t nextOprcnt;
+  uint64_t lastOprcnt;
+
+  newton_input_log_t *log;
+
+  // Running forward from a snapshot: nothing is recorded
+  bool rewinding;
+};
+
+static void newton_history_clear(newton_history_t *h) {
+  for (uint32_t i=0; i<h->count; i++) {
+    newton_snapshot_del(h->entries[i].snap);
+  }
+  h->count = 0;
+  h->nextOprcnt = 0;
+  h->lastOprcnt = 0;
+
+  newton_input_log_mark_t start = { 0, 0, 0 };
+  newton_input_log_truncate(h->log, &start);
+}
+
+static void newton_history_free(newton_history_t *h) {
+  newton_history_clear(h);
+  newton_input_log_close(h->log);
+  free(h->entries);
+  free(h);
+}
+
+int newton_history_set(newton_t *c, uint64_t interval, uint32_t limit) {
+  if (c->history != NULL) {
+    newton_history_free(c->history);
+    c->history = NULL;
+  }
+  if (interval == 0) {
+    return 0;
+  }
+  if (limit == 0) {
+    return -1;
+  }
+
+  newton_history_t *h = calloc(1, sizeof(newton_history_t));
+  if (h == NULL) {
+    return -1;
+  }
+  h->entries = calloc(limit, sizeof(newton_history_entry_t));
+  h->log = newton_input_log_new();
+  if (h->entries == NULL || h->log == NULL) {
+    newton_input_log_close(h->log);
+    free(h->entries);
+    free(h);
+    return -1;
+  }
+  h->interval = interval;
+  h->limit = limit;
+
+  c->history = h;
+  return 0;
+}
+
+void newton_history_reset(newton_t *c) {
+  if (c->history != NULL) {
+    newton_history_clear(c->history);
+  }
+}
+
+bool newton_history_is_rewinding(newton_t *c) {
+  return (c->history != NULL && c->history->rewinding == true);
+}
+
+#pragma mark - Recording
+static void newton_history_drop_oldest(newton_history_t *h) {
+  newton_snapshot_del(h->entries[0].snap);
+  h->count--;
+  memmove(&h->entries[0], &h->entries[1], h->count * sizeof(newton_history_entry_t));
+
+  // Nothing can go back to before the oldest snapshot now
+  if (h->count > 0) {
+    size_t dropped = newton_input_log_discard(h->log, &h->entries[0].mark);
+    for (uint32_t i=0; i<h->count; i++) {
+      h->entries[i].mark.offset -= dropped;
+    }
+  }
+}
+
+void newton_history_step(newton_t *c) {
+  newton_history_t *h = c->history;
+  if (h == NULL || h->rewinding == true) {
+    return;
+  }
+
+  uint64_t oprcnt = arm_get_opcnt(c->arm);
+  if (oprcnt < h->lastOprcnt) {
+    // A reboot: there is no running forward to here from before
+    newton_history_clear(h);
+  }
+  h->lastOprcnt = oprcnt;
+  if (h->count > 0 && oprcnt < h->nextOprcnt) {
+    return;
+  }
+
+  newton_snapshot_t *snap = newton_snapshot_save(c);
+  if (snap == NULL) {
+    return;
+  }
+  if (h->count == h->limit) {
+    newton_history_drop_oldest(h);
+  }
+
+  newton_history_entry_t *entry = &h->entries[h->count++];
+  entry->snap = snap;
+  entry->oprcnt = oprcnt;
+  newton_input_log_get_mark(h->log, &entry->mark);
+  h->nextOprcnt = oprcnt + h->interval;
+}
+
+void newton_history_record_input(newton_t *c, newton_input_t *input) {
+  newton_history_t *h = c->history;
+  if (h == NULL || h->rewinding == true || h->count == 0) {
+    return;
+  }
+  newton_input_log_write(h->log, input);
+}
+
+#pragma mark - Going back
+// Restore a snapshot, and feed the input logged after it back in
+static bool newton_history_restore(newton_t *c, uint32_t idx) {
+  newton_history_t *h = c->history;
+  newton_history_entry_t *entry = &h->entries[idx];
+
+  h->rewinding = true;
+  newton_input_replay_stop(c);
+  if (newton_snapshot_restore(c, entry->snap) == false) {
+    return false;
+  }
+  c->inputPlayer = newton_input_log_open_at(h->log, &entry->mark);
+  return (c->inputPlayer != NULL);
+}
+
+// Run up to just after instruction end. With stop, breakpoints and
+// watchpoints stop the machine on the way, and stop is set to the
+// last place they did before end.
+static void newton_history_run(newton_t *c, uint64_t end, uint64_t *stop) {
+#if !DISABLE_DEBUGGER
+  bp_entry_t *breakpoints = c->breakpoints;
+  bool instructionTrace = c->instructionTrace;
+  bool memTrace = c->memTrace;
+  bool pcSpy = c->pcSpy;
+  bool spSpy = c->spSpy;
+  if (stop == NULL) {
+    c->breakpoints = NULL;
+  }
+  c->instructionTrace = false;
+  c->memTrace = false;
+  c->pcSpy = false;
+  c->spSpy = false;
+#endif
+
+  uint64_t oprcnt = arm_get_opcnt(c->arm);
+  while (oprcnt < end) {
+    uint64_t count = end - oprcnt;
+    // INT32_MAX runs without a limit
+    newton_emulate(c, (count < INT32_MAX) ? (int32_t)count : INT32_MAX - 1);
+
+    uint64_t now = arm_get_opcnt(c->arm);
+    if (now == oprcnt) {
+      // Interrupted while asleep
+      break;
+    }
+    oprcnt = now;
+    if (stop != NULL && oprcnt < end) {
+      *stop = oprcnt;
+    }
+  }
+
+#if !DISABLE_DEBUGGER
+  c->breakpoints = breakpoints;
+  c->instructionTrace = instructionTrace;
+  c->memTrace = memTrace;
+  c->pcSpy = pcSpy;
+  c->spSpy = spSpy;
+#endif
+}
+
+// Back at idx: what was recorded past here is forgotten
+static void newton_history_finish(newton_t *c, uint32_t idx) {
+  newton_history_t *h = c->history;
+
+  newton_input_log_mark_t mark;
+  if (c->inputPlayer != NULL) {
+    newton_input_log_get_mark(c->inputPlayer, &mark);
+    newton_input_log_close(c->inputPlayer);
+    c->inputPlayer = NULL;
+  }
+  else {
+    newton_input_log_get_mark(h->log, &mark);
+  }
+  newton_input_log_truncate(h->log, &mark);
+
+  for (uint32_t i=idx+1; i<h->count; i++) {
+    newton_snapshot_del(h->entries[i].snap);
+  }
+  h->count = idx + 1;
+  h->nextOprcnt = h->entries[idx].oprcnt + h->interval;
+  h->lastOprcnt = arm_get_opcnt(c->arm);
+  h->rewinding = false;
+}
+
+static bool newton_history_can_rewind(newton_t *c) {
+  if (c->history == NULL || c->history->count == 0) {
+    LOG_STR("History: nothing recorded\n");
+    return false;
+  }
+  if (c->inputRecorder != NULL || c->inputPlayer != NULL) {
+    LOG_STR("History: can't go back while input is recorded or replayed\n");
+    return false;
+  }
+  return true;
+}
+
+int newton_history_rewind(newton_t *c, uint64_t oprcnt) {
+  if (newton_history_can_rewind(c) == false) {
+    return -1;
+  }
+
+  newton_history_t *h = c->history;
+  if (oprcnt > arm_get_opcnt(c->arm) || oprcnt < h->entries[0].oprcnt) {
+    LOG_STR("History: %llu is outside %llu to %llu\n", (unsigned long long)oprcnt,
+            (unsigned long long)h->entries[0].oprcnt, (unsigned long long)arm_get_opcnt(c->arm));
+    return -1;
+  }
+
+  uint32_t idx = 0;
+  while (idx + 1 < h->count && h->entries[idx + 1].oprcnt <= oprcnt) {
+    idx++;
+  }
+
+  bool ok = newton_history_restore(c, idx);
+  if (ok == true) {
+    newton_history_run(c, oprcnt, NULL);
+  }
+  newton_history_finish(c, idx);
+
+  if (ok == false || arm_get_opcnt(c->arm) != oprcnt) {
+    LOG_STR("History: couldn't go back to %llu\n", (unsigned long long)oprcnt);
+    return -1;
+  }
+  return 0;
+}
+
+int newton_reverse_step(newton_t *c, uint64_t count) {
+  if (newton_history_can_rewind(c) == false) {
+    return -1;
+  }
+
+  uint64_t oldest = c->history->entries[0].oprcnt;
+  uint64_t oprcnt = arm_get_opcnt(c->arm);
+  uint64_t target = (oprcnt > count) ? oprcnt - count : 0;
+  if (target < oldest) {
+    LOG_STR("History: only goes back to %llu\n", (unsigned long long)oldest);
+    target = oldest;
+  }
+  return newton_history_rewind(c, target);
+}
+
+int newton_reverse_continue(newton_t *c) {
+  if (newton_history_can_rewind(c) == false) {
+    return -1;
+  }
+
+  // Look for the last stop between each snapshot and the next,
+  // from the newest on back
+  newton_history_t *h = c->history;
+  uint64_t end = arm_get_opcnt(c->arm);
+  for (int32_t idx=h->count-1; idx>=0; idx--) {
+    if (h->entries[idx].oprcnt >= end) {
+      continue;
+    }
+
+    uint64_t stop = 0;
+    if (newton_history_restore(c, idx) == true) {
+      newton_history_run(c, end, &stop);
+    }
+    if (stop != 0) {
+      // Back to it again, without stopping on the way
+      bool ok = newton_history_restore(c, idx);
+      if (ok == true) {
+        newton_history_run(c, stop, NULL);
+      }
+      newton_history_finish(c, idx);
+      return (ok == true && arm_get_opcnt(c->arm) == stop) ? 0 : -1;
+    }
+    end = h->entries[idx].oprcnt;
+  }
+
+  LOG_STR("History: no earlier stop, going back to %llu\n", (unsigned long long)h->entries[0].oprcnt);
+  bool ok = newton_history_restore(c, 0);
+  newton_history_finish(c, 0);
+  return (ok == true) ? 0 : -1;
+}
@@ -0,0 +1,50 @@
+//
+//  history.h
+//  Leibniz
+//
+//  Going back in time. Every interval instructions newton_emulate()
+//  takes a snapshot (see snapshot.h), and the input applied since
+//  the oldest one is kept in an input log in memory (see input.h).
+//  Going back restores the last snapshot before the target and runs
+//  forward from it, feeding in the same input, which lands on the
+//  state the machine was in then. Only the newest limit snapshots
+//  are kept.
+//
+//  What was recorded past the point gone back to is forgotten: from
+//  there on the machine takes new input from the host.
+//
+
+#ifndef __Leibniz__history__
+#define __Leibniz__history__
+
+#include "input.h"
+#include "newton.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NEWTON_HISTORY_DEFAULT_INTERVAL 5000000
+#define NEWTON_HISTORY_DEFAULT_LIMIT    32
+
+typedef struct newton_history_s newton_history_t;
+
+// An interval of 0 turns history off. Returns 0 on success, -1 on
+// error.
+int newton_history_set(newton_t *c, uint64_t interval, uint32_t limit);
+// Forget everything, e.g. after loading another state
+void newton_history_reset(newton_t *c);
+
+// Called by newton_emulate() between two bursts, and for each input
+// applied
+void newton_history_step(newton_t *c);
+void newton_history_record_input(newton_t *c, newton_input_t *input);
+bool newton_history_is_rewinding(newton_t *c);
+
+// Go back to just after instruction oprcnt, by count instructions,
+// or to the last time the machine was stopped by a breakpoint or a
+// watchpoint. Return 0 on success, -1 on error.
+int newton_history_rewind(newton_t *c, uint64_t oprcnt);
+int newton_reverse_step(newton_t *c, uint64_t count);
+int newton_reverse_continue(newton_t *c);
+
+#endif /* defined(__Leibniz__history__) */
@@ -0,0 +1,368 @@
+//
+//  input.c
+//  Leibniz
+//
+
+#include "input.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "state.h"
+
+#define NEWTON_INPUT_LOG_MAGIC       "LBZINPUT"
+#define NEWTON_INPUT_LOG_HEADER_SIZE 36
+
+// How much is buffered before going out to the file
+#define NEWTON_INPUT_LOG_BLOCK_SIZE  (64 * 1024)
+
+struct newton_input_log_s {
+  uint64_t startOprcnt;
+  uint64_t startClock;
+
+  // The input before, which the next one is relative to
+  uint64_t lastOprcnt;
+  uint64_t lastClock;
+
+  // Writing, to the file or to memory when there is none
+  FILE *fp;
+  state_t buffer;
+  bool error;
+
+  // Reading
+  void *mapping;
+  size_t mappingLength;
+  state_t st;
+  newton_input_t current;
+  size_t currentOffset;
+  bool haveCurrent;
+};
+
+// The arguments each type has, after the timing
+static const struct {
+  uint8_t argCount;
+  bool hasData;
+} newton_input_formats[] = {
+  [NewtonInputTouchDown]   = { 2, false },
+  [NewtonInputTouchUp]     = { 0, false },
+  [NewtonInputSwitch]      = { 2, false },
+  [NewtonInputSerial]      = { 1, true  },
+  [NewtonInputFileNotify]  = { 2, false },
+  [NewtonInputBootMode]    = { 1, false },
+  [NewtonInputReboot]      = { 1, false },
+  [NewtonInputTapFileCntl] = { 2, true  },
+};
+
+static inline bool newton_input_type_is_valid(uint32_t type) {
+  return (type >= NewtonInputTouchDown && type <= NewtonInputTapFileCntl);
+}
+
+#pragma mark - Inputs
+newton_input_t *newton_input_new(NewtonInputType type, uint32_t arg0, uint32_t arg1, const void *data, uint32_t length) {
+  newton_input_t *input = calloc(1, sizeof(newton_input_t));
+  if (input == NULL) {
+    return NULL;
+  }
+
+  input->type = type;
+  input->args[0] = arg0;
+  input->args[1] = arg1;
+  if (length > 0) {
+    input->data = malloc(length);
+    if (input->data == NULL) {
+      free(input);
+      return NULL;
+    }
+    memcpy(input->data, data, length);
+    input->length = length;
+  }
+  return input;
+}
+
+void newton_input_del(newton_input_t *input) {
+  if (input == NULL) {
+    return;
+  }
+  free(input->data);
+  free(input);
+}
+
+#pragma mark - Queue
+void newton_input_queue_init(newton_input_queue_t *q) {
+  pthread_mutex_init(&q->lock, NULL);
+  q->head = NULL;
+  q->tail = NULL;
+}
+
+void newton_input_queue_free(newton_input_queue_t *q) {
+  newton_input_t *input = newton_input_queue_take(q);
+  while (input != NULL) {
+    newton_input_t *next = input->next;
+    newton_input_del(input);
+    input = next;
+  }
+  pthread_mutex_destroy(&q->lock);
+}
+
+void newton_input_queue_push(newton_input_queue_t *q, newton_input_t *input) {
+  input->next = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->tail == NULL) {
+    q->head = input;
+  }
+  else {
+    q->tail->next = input;
+  }
+  q->tail = input;
+  pthread_mutex_unlock(&q->lock);
+}
+
+newton_input_t *newton_input_queue_take(newton_input_queue_t *q) {
+  pthread_mutex_lock(&q->lock);
+  newton_input_t *head = q->head;
+  q->head = NULL;
+  q->tail = NULL;
+  pthread_mutex_unlock(&q->lock);
+  return head;
+}
+
+#pragma mark - Writing
+static void newton_input_log_flush(newton_input_log_t *log) {
+  if (log->fp == NULL || log->buffer.length == 0) {
+    return;
+  }
+  if (log->buffer.error == true || fwrite(log->buffer.data, 1, log->buffer.length, log->fp) != log->buffer.length) {
+    log->error = true;
+  }
+  state_clear(&log->buffer);
+}
+
+newton_input_log_t *newton_input_log_create(const char *path, uint64_t romHash, uint64_t oprcnt, uint64_t clock) {
+  newton_input_log_t *log = calloc(1, sizeof(newton_input_log_t));
+  if (log == NULL) {
+    return NULL;
+  }
+
+  log->fp = fopen(path, "wb");
+  if (log->fp == NULL) {
+    free(log);
+    return NULL;
+  }
+
+  log->startOprcnt = oprcnt;
+  log->startClock = clock;
+  log->lastOprcnt = oprcnt;
+  log->lastClock = clock;
+
+  state_init(&log->buffer);
+  state_put_bytes(&log->buffer, NEWTON_INPUT_LOG_MAGIC, 8);
+  state_put_u32(&log->buffer, NEWTON_INPUT_LOG_VERSION);
+  state_put_u64(&log->buffer, romHash);
+  state_put_u64(&log->buffer, oprcnt);
+  state_put_u64(&log->buffer, clock);
+  newton_input_log_flush(log);
+  return log;
+}
+
+bool newton_input_log_write(newton_input_log_t *log, newton_input_t *input) {
+  state_t *st = &log->buffer;
+  state_put_u8(st, (uint8_t)input->type);
+  state_put_svarint(st, (int64_t)(input->oprcnt - log->lastOprcnt));
+  state_put_svarint(st, (int64_t)(input->clock - log->lastClock));
+  for (int i=0; i<newton_input_formats[input->type].argCount; i++) {
+    state_put_svarint(st, (int32_t)input->args[i]);
+  }
+  if (newton_input_formats[input->type].hasData == true) {
+    state_put_varint(st, input->length);
+    state_put_bytes(st, input->data, input->length);
+  }
+
+  log->lastOprcnt = input->oprcnt;
+  log->lastClock = input->clock;
+
+  if (st->length >= NEWTON_INPUT_LOG_BLOCK_SIZE) {
+    newton_input_log_flush(log);
+  }
+  return (log->error == false && st->error == false);
+}
+
+#pragma mark - Reading
+newton_input_log_t *newton_input_log_open(const char *path, uint64_t romHash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size < NEWTON_INPUT_LOG_HEADER_SIZE) {
+    close(fd);
+    return NULL;
+  }
+  void *mapping = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  newton_input_log_t *log = calloc(1, sizeof(newton_input_log_t));
+  if (log == NULL) {
+    munmap(mapping, (size_t)sb.st_size);
+    return NULL;
+  }
+  log->mapping = mapping;
+  log->mappingLength = (size_t)sb.st_size;
+  state_init_view(&log->st, mapping, log->mappingLength);
+
+  char magic[8];
+  state_get_bytes(&log->st, magic, sizeof(magic));
+  uint32_t version = state_get_u32(&log->st);
+  uint64_t hash = state_get_u64(&log->st);
+  log->startOprcnt = state_get_u64(&log->st);
+  log->startClock = state_get_u64(&log->st);
+  log->lastOprcnt = log->startOprcnt;
+  log->lastClock = log->startClock;
+
+  if (memcmp(magic, NEWTON_INPUT_LOG_MAGIC, sizeof(magic)) != 0 ||
+      version != NEWTON_INPUT_LOG_VERSION || hash != romHash) {
+    newton_input_log_close(log);
+    return NULL;
+  }
+  return log;
+}
+
+void newton_input_log_get_start(newton_input_log_t *log, uint64_t *oprcnt, uint64_t *clock) {
+  *oprcnt = log->startOprcnt;
+  *clock = log->startClock;
+}
+
+newton_input_t *newton_input_log_peek(newton_input_log_t *log) {
+  if (log->haveCurrent == true) {
+    return &log->current;
+  }
+
+  state_t *st = &log->st;
+  if (st->error == true || st->offset == st->length) {
+    return NULL;
+  }
+
+  newton_input_t *input = &log->current;
+  memset(input, 0, sizeof(newton_input_t));
+  log->currentOffset = st->offset;
+  uint8_t type = state_get_u8(st);
+  if (newton_input_type_is_valid(type) == false) {
+    st->error = true;
+    return NULL;
+  }
+  input->type = type;
+  input->oprcnt = log->lastOprcnt + (uint64_t)state_get_svarint(st);
+  input->clock = log->lastClock + (uint64_t)state_get_svarint(st);
+  for (int i=0; i<newton_input_formats[type].argCount; i++) {
+    input->args[i] = (uint32_t)state_get_svarint(st);
+  }
+  if (newton_input_formats[type].hasData == true) {
+    uint64_t length = state_get_varint(st);
+    if (st->error == true || length > st->length - st->offset) {
+      st->error = true;
+      return NULL;
+    }
+    // Points into the mapping
+    input->data = st->data + st->offset;
+    input->length = (uint32_t)length;
+    st->offset += length;
+  }
+  if (st->error == true) {
+    return NULL;
+  }
+
+  log->haveCurrent = true;
+  return input;
+}
+
+void newton_input_log_next(newton_input_log_t *log) {
+  if (log->haveCurrent == true) {
+    log->lastOprcnt = log->current.oprcnt;
+    log->lastClock = log->current.clock;
+    log->haveCurrent = false;
+  }
+}
+
+bool newton_input_log_close(newton_input_log_t *log) {
+  if (log == NULL) {
+    return true;
+  }
+
+  bool ok = true;
+  if (log->fp != NULL) {
+    newton_input_log_flush(log);
+    ok = (fclose(log->fp) == 0 && log->error == false);
+  }
+  else if (log->st.data != NULL) {
+    ok = (log->st.error == false);
+    if (log->mapping != NULL) {
+      munmap(log->mapping, log->mappingLength);
+    }
+  }
+  state_free(&log->buffer);
+  free(log);
+  return ok;
+}
+
+#pragma mark - In memory
+newton_input_log_t *newton_input_log_new(void) {
+  newton_input_log_t *log = calloc(1, sizeof(newton_input_log_t));
+  if (log == NULL) {
+    return NULL;
+  }
+  state_init(&log->buffer);
+  return log;
+}
+
+void newton_input_log_get_mark(newton_input_log_t *log, newton_input_log_mark_t *mark) {
+  if (log->st.data != NULL) {
+    // A reader, before the input it peeked at
+    mark->offset = (log->haveCurrent == true) ? log->currentOffset : log->st.offset;
+    mark->oprcnt = log->lastOprcnt;
+    mark->clock = log->lastClock;
+    return;
+  }
+  mark->offset = log->buffer.length;
+  mark->oprcnt = log->lastOprcnt;
+  mark->clock = log->lastClock;
+}
+
+newton_input_log_t *newton_input_log_open_at(newton_input_log_t *log, const newton_input_log_mark_t *mark) {
+  newton_input_log_t *reader = calloc(1, sizeof(newton_input_log_t));
+  if (reader == NULL) {
+    return NULL;
+  }
+  state_init(&reader->buffer);
+  // A view of nothing still needs a pointer to tell it's a reader
+  state_init_view(&reader->st, (log->buffer.data != NULL) ? log->buffer.data : (uint8_t *)"", log->buffer.length);
+  reader->st.offset = mark->offset;
+  reader->lastOprcnt = mark->oprcnt;
+  reader->lastClock = mark->clock;
+  return reader;
+}
+
+void newton_input_log_truncate(newton_input_log_t *log, const newton_input_log_mark_t *mark) {
+  if (mark->offset < log->buffer.length) {
+    log->buffer.length = mark->offset;
+  }
+  log->lastOprcnt = mark->oprcnt;
+  log->lastClock = mark->clock;
+}
+
+size_t newton_input_log_discard(newton_input_log_t *log, const newton_input_log_mark_t *mark) {
+  size_t length = mark->offset;
+  if (length == 0 || length > log->buffer.length) {
+    return 0;
+  }
+  memmove(log->buffer.data, log->buffer.data + length, log->buffer.length - length);
+  log->buffer.length -= length;
+  return length;
+}
@@ -0,0 +1,129 @@
+//
+//  input.h
+//  Leibniz
+//
+//  Input from outside the machine: the pen, the switches, bytes
+//  arriving on the serial ports, TapFileCntl and reboots. The host
+//  can send it from any thread; it is queued, and applied by
+//  newton_emulate() between two bursts of instructions, so that
+//  it lands on a well defined instruction.
+//
+//  An input log records every input with the instruction count
+//  (oprcnt) and RUNT clock at which it was applied. Replaying the
+//  log from the same starting state applies each input at exactly
+//  the same point, which makes a session reproducible. The log is
+//  a header:
+//
+//    "LBZINPUT"  magic
+//    u32         format version
+//    u64         hash of the ROM image
+//    u64         oprcnt at the start
+//    u64         RUNT clock at the start
+//
+//  followed by the inputs, each a type byte, the change in oprcnt
+//  and in the clock since the previous input (signed varints, see
+//  state.h) and the arguments of the type.
+//
+
+#ifndef __Leibniz__input__
+#define __Leibniz__input__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  // x, y
+  NewtonInputTouchDown = 1,
+  NewtonInputTouchUp,
+  // switch, state (or NEWTON_INPUT_SWITCH_TOGGLE until applied)
+  NewtonInputSwitch,
+  // channel, bytes
+  NewtonInputSerial,
+  // address, value
+  NewtonInputFileNotify,
+  // boot mode
+  NewtonInputBootMode,
+  // reboot style
+  NewtonInputReboot,
+  // The outcome of a TapFileCntl call into the host: command,
+  // result and the bytes read. It is taken from the log when the
+  // call happens rather than applied between bursts.
+  NewtonInputTapFileCntl,
+} NewtonInputType;
+
+#define NEWTON_INPUT_LOG_VERSION   1
+#define NEWTON_INPUT_SWITCH_TOGGLE 0xffffffff
+
+typedef struct newton_input_s {
+  NewtonInputType type;
+  uint32_t args[2];
+  uint8_t *data;
+  uint32_t length;
+
+  // When it was applied
+  uint64_t oprcnt;
+  uint64_t clock;
+
+  struct newton_input_s *next;
+} newton_input_t;
+
+newton_input_t *newton_input_new(NewtonInputType type, uint32_t arg0, uint32_t arg1, const void *data, uint32_t length);
+void newton_input_del(newton_input_t *input);
+
+// Inputs waiting to be applied. Safe to push to from any thread.
+typedef struct newton_input_queue_s {
+  pthread_mutex_t lock;
+  newton_input_t *head;
+  newton_input_t *tail;
+} newton_input_queue_t;
+
+void newton_input_queue_init(newton_input_queue_t *q);
+void newton_input_queue_free(newton_input_queue_t *q);
+void newton_input_queue_push(newton_input_queue_t *q, newton_input_t *input);
+// Takes everything queued, oldest first
+newton_input_t *newton_input_queue_take(newton_input_queue_t *q);
+
+static inline bool newton_input_queue_is_empty(newton_input_queue_t *q) {
+  // Only a hint, taken without the lock
+  return (q->head == NULL);
+}
+
+typedef struct newton_input_log_s newton_input_log_t;
+
+// Writing. The inputs are written out in blocks, and on close.
+newton_input_log_t *newton_input_log_create(const char *path, uint64_t romHash, uint64_t oprcnt, uint64_t clock);
+bool newton_input_log_write(newton_input_log_t *log, newton_input_t *input);
+
+// Reading. Fails if the file is damaged or for a different ROM.
+newton_input_log_t *newton_input_log_open(const char *path, uint64_t romHash);
+void newton_input_log_get_start(newton_input_log_t *log, uint64_t *oprcnt, uint64_t *clock);
+// The next input, or NULL at the end. Stays valid until the next
+// call to newton_input_log_next().
+newton_input_t *newton_input_log_peek(newton_input_log_t *log);
+void newton_input_log_next(newton_input_log_t *log);
+
+// Returns false if anything couldn't be written
+bool newton_input_log_close(newton_input_log_t *log);
+
+// Logs kept in memory, without the header, for going back in time.
+// A mark is a position in one.
+typedef struct newton_input_log_mark_s {
+  size_t offset;
+  uint64_t oprcnt;
+  uint64_t clock;
+} newton_input_log_mark_t;
+
+newton_input_log_t *newton_input_log_new(void);
+// The end of a log being written, or the position of one being read
+void newton_input_log_get_mark(newton_input_log_t *log, newton_input_log_mark_t *mark);
+// Read a log in memory from mark on. Nothing may be written to the
+// log until the reader is closed.
+newton_input_log_t *newton_input_log_open_at(newton_input_log_t *log, const newton_input_log_mark_t *mark);
+// Drop the inputs from mark on
+void newton_input_log_truncate(newton_input_log_t *log, const newton_input_log_mark_t *mark);
+// Drop the inputs before mark. Returns by how much the offsets of
+// the marks after it go down.
+size_t newton_input_log_discard(newton_input_log_t *log, const newton_input_log_mark_t *mark);
+
+#endif /* defined(__Leibniz__input__) */
@@ -39,6 +39,8 @@
  *****************************************************************************/
 
 int arm_ifetch (arm_t *c, uint32_t addr, uint32_t *val);
+void arm_ifetch_real (arm_t *c, uint32_t addr, uint32_t *val);
+int arm_translate_ifetch (arm_t *c, uint32_t *addr);
 
 int arm_dload8 (arm_t *c, uint32_t addr, uint8_t *val);
 int arm_dload16 (arm_t *c, uint32_t addr, uint16_t *val);
@@ -56,6 +58,61 @@ int arm_dstore8_t (arm_t *c, uint32_t addr, uint8_t val);
 int arm_dstore16_t (arm_t *c, uint32_t addr, uint16_t val);
 int arm_dstore32_t (arm_t *c, uint32_t addr, uint32_t val);
 
+int arm_translate_block (arm_t *c, uint32_t *addr, unsigned size, int write,
+	unsigned char **host
+);
+
+/*
+ * Get a word from a host pointer returned by arm_translate_block(),
+ * in the byte order of the emulated CPU.
+ */
+static inline
+uint32_t arm_host_get32 (arm_t *c, const unsigned char *p)
+{
+	if (c->bigendian) {
+#ifdef ARM_HOST_BE
+		return (*(const uint32_t *) p);
+#else
+		return (((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | p[3]
+		);
+#endif
+	}
+
+#ifdef ARM_HOST_LE
+	return (*(const uint32_t *) p);
+#else
+	return (p[0] | ((uint32_t) p[1] << 8) |
+		((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24)
+	);
+#endif
+}
+
+static inline
+void arm_host_set32 (arm_t *c, unsigned char *p, uint32_t val)
+{
+	if (c->bigendian) {
+#ifdef ARM_HOST_BE
+		*(uint32_t *) p = val;
+#else
+		p[0] = (val >> 24) & 0xff;
+		p[1] = (val >> 16) & 0xff;
+		p[2] = (val >> 8) & 0xff;
+		p[3] = val & 0xff;
+#endif
+		return;
+	}
+
+#ifdef ARM_HOST_LE
+	*(uint32_t *) p = val;
+#else
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+#endif
+}
+
 
 /*****************************************************************************
  * arm
@@ -143,22 +200,114 @@ uint32_t arm_asr32 (uint32_t v, unsigned n)
 	return (v);
 }
 
+
+
+/*
+ * Set the N and Z condition codes according to a 32 bit result
+ */
+static inline
+void arm_set_cc_nz (arm_t *c, uint32_t val)
+{
+	if (c->cc_op >= ARM_CC_LOG) {
+		arm_cc_eval (c);
+	}
+
+	c->cc_op = ARM_CC_NZ;
+	c->cc_d = val & 0xffffffff;
+}
+
+/*
+ * Set the N and Z condition codes according to a 32 bit result and
+ * the C condition code to the shifter carry out
+ */
 static inline
-void arm_tbuf_flush (arm_t *c)
+void arm_set_cc_log (arm_t *c, uint32_t val, uint32_t cry)
 {
-	arm_copr15_t *mmu = arm_get_mmu (c);
+	if (c->cc_op >= ARM_CC_ADD) {
+		arm_cc_eval (c);
+	}
 
-	mmu->tbuf_exec.valid = 0;
-	mmu->tbuf_read.valid = 0;
-	mmu->tbuf_write.valid = 0;
+	c->cc_op = ARM_CC_LOG;
+	c->cc_d = val & 0xffffffff;
+	c->cc_s1 = cry;
 }
 
+/*
+ * Set the condition codes after an addition
+ */
+static inline
+void arm_set_cc_add (arm_t *c, uint32_t d, uint32_t s1, uint32_t s2)
+{
+	c->cc_op = ARM_CC_ADD;
+	c->cc_d = d;
+	c->cc_s1 = s1;
+	c->cc_s2 = s2;
+}
+
+/*
+ * Set the condition codes after a subtraction
+ */
+static inline
+void arm_set_cc_sub (arm_t *c, uint32_t d, uint32_t s1, uint32_t s2)
+{
+	c->cc_op = ARM_CC_SUB;
+	c->cc_d = d;
+	c->cc_s1 = s1;
+	c->cc_s2 = s2;
+}
 
 int arm_write_cpsr (arm_t *c, uint32_t val, int prvchk);
 
 int arm_check_cond (arm_t *c, unsigned cond);
 
+extern const uint16_t arm_cond_tab[16];
+
+/* the same as arm_check_cond() but without the switch */
+#define arm_check_cond_tab(c, cond) \
+	(arm_cc_sync (c), (arm_cond_tab[(cond) & 0x0f] >> ((c)->cpsr >> 28)) & 1)
+
 void arm_set_opcodes (arm_t *c);
 
+void op_undefined (arm_t *c);
+void op_trap (arm_t *c);
+
+#define arm_is_trap(ir) (((ir) & 0xfffff0ffUL) == 0xe6000010UL)
+
+
+/*****************************************************************************
+ * Breakpoints
+ *****************************************************************************/
+
+/*
+ * Check for a breakpoint before executing the instruction at addr.
+ * Only called if c->brk is not NULL.
+ */
+static inline
+int arm_brk_hit (arm_t *c, uint32_t addr)
+{
+	uint32_t page;
+
+	page = addr >> ARM_BRK_PAGE_SHIFT;
+
+	if ((c->brk[page >> 3] & (1U << (page & 7))) == 0) {
+		return (0);
+	}
+
+	if ((c->oprcnt == c->brk_oprcnt) && (addr == c->brk_pc)) {
+		return (0);
+	}
+
+	return (c->brk_check (c->brk_ext, addr) != 0);
+}
+
+
+/*****************************************************************************
+ * JIT
+ *****************************************************************************/
+
+const arm_jit_op_t *arm_jit_fetch (arm_t *c, uint32_t addr);
+
+void arm_jit_run (arm_t *c, unsigned long n);
+
 
 #endif
@@ -0,0 +1,272 @@
+//
+//  irlink.c
+//  Leibniz
+//
+
+#include "irlink.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ring.h"
+
+#define IRLINK_RING_SIZE  16384
+// Longer writes go across as more than one record
+#define IRLINK_RECORD_MAX 256
+
+typedef struct {
+  uint64_t arrival;
+  uint32_t length;
+} irlink_header_t;
+
+typedef struct {
+  // On their way to this side. Written by the other side only.
+  ring_t ring;
+  // When the last byte sent this way is through the air, and what
+  // was lost on the way. Kept by the other side only.
+  uint64_t lineFree;
+  uint32_t dropped;
+
+  // The record being taken in, by this side only
+  irlink_header_t record;
+  uint8_t recordData[IRLINK_RECORD_MAX];
+  uint32_t recordOffset;
+  bool hasRecord;
+
+  // Seen by the other side
+  int attached;
+  int asleep;
+  int waiting;
+  uint64_t clock;
+
+  void *ext;
+  irlink_wake_f wake;
+} irlink_side_t;
+
+struct irlink_s {
+  uint64_t lookahead;
+  irlink_side_t sides[2];
+
+  // Taken to attach, detach and wake a side, and to wait on the
+  // other side's clock
+  pthread_mutex_t lock;
+  pthread_cond_t moved;
+};
+
+irlink_t *irlink_new(uint64_t lookahead) {
+  irlink_t *l = calloc(1, sizeof(irlink_t));
+  if (l == NULL) {
+    return NULL;
+  }
+  l->lookahead = lookahead;
+
+  for (int i=0; i<2; i++) {
+    if (ring_init(&l->sides[i].ring, IRLINK_RING_SIZE) == false) {
+      ring_free(&l->sides[0].ring);
+      free(l);
+      return NULL;
+    }
+  }
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->moved, NULL);
+  return l;
+}
+
+void irlink_del(irlink_t *l) {
+  if (l == NULL) {
+    return;
+  }
+  for (int i=0; i<2; i++) {
+    ring_free(&l->sides[i].ring);
+  }
+  pthread_cond_destroy(&l->moved);
+  pthread_mutex_destroy(&l->lock);
+  free(l);
+}
+
+// Let a side waiting on this one know that something changed
+static void irlink_notify(irlink_t *l, uint8_t side) {
+  irlink_side_t *other = &l->sides[(side & 1) ^ 1];
+  if (__atomic_load_n(&other->waiting, __ATOMIC_SEQ_CST) != 0) {
+    pthread_mutex_lock(&l->lock);
+    pthread_cond_broadcast(&l->moved);
+    pthread_mutex_unlock(&l->lock);
+  }
+}
+
+int irlink_attach(irlink_t *l, uint8_t side, void *ext, irlink_wake_f wake) {
+  irlink_side_t *s = &l->sides[side & 1];
+  int result = -1;
+
+  pthread_mutex_lock(&l->lock);
+  if (__atomic_load_n(&s->attached, __ATOMIC_ACQUIRE) == 0) {
+    s->ext = ext;
+    s->wake = wake;
+    s->hasRecord = false;
+    ring_clear(&s->ring);
+    __atomic_store_n(&s->asleep, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&s->attached, 1, __ATOMIC_SEQ_CST);
+    result = 0;
+  }
+  pthread_mutex_unlock(&l->lock);
+  return result;
+}
+
+void irlink_detach(irlink_t *l, uint8_t side) {
+  irlink_side_t *s = &l->sides[side & 1];
+
+  pthread_mutex_lock(&l->lock);
+  __atomic_store_n(&s->attached, 0, __ATOMIC_SEQ_CST);
+  s->ext = NULL;
+  s->wake = NULL;
+  pthread_mutex_unlock(&l->lock);
+
+  irlink_notify(l, side);
+}
+
+#pragma mark - Sending
+static void irlink_write_record(irlink_t *l, irlink_side_t *to, uint64_t clock, uint64_t ticksPerByte, const uint8_t *data, uint32_t length) {
+  uint8_t record[sizeof(irlink_header_t) + IRLINK_RECORD_MAX];
+
+  // One byte after another, as the air only carries one at a time
+  uint64_t start = (to->lineFree > clock) ? to->lineFree : clock;
+  irlink_header_t header = {
+    .arrival = start + ticksPerByte * length,
+    .length = length,
+  };
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), data, length);
+
+  // All of it or none of it, so the receiver never sees half
+  uint32_t size = (uint32_t)sizeof(header) + length;
+  if (ring_space(&to->ring) < size) {
+    to->dropped += length;
+    return;
+  }
+  ring_write(&to->ring, record, size);
+  to->lineFree = header.arrival;
+}
+
+void irlink_write(irlink_t *l, uint8_t side, uint64_t clock, uint64_t ticksPerByte, const uint8_t *data, uint32_t length) {
+  irlink_side_t *to = &l->sides[(side & 1) ^ 1];
+  if (length == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&l->lock);
+  if (__atomic_load_n(&to->attached, __ATOMIC_ACQUIRE) == 0) {
+    to->dropped += length;
+  }
+  else {
+    while (length > 0) {
+      uint32_t chunk = (length < IRLINK_RECORD_MAX) ? length : IRLINK_RECORD_MAX;
+      irlink_write_record(l, to, clock, ticksPerByte, data, chunk);
+      data += chunk;
+      length -= chunk;
+    }
+    to->wake(to->ext);
+  }
+  pthread_mutex_unlock(&l->lock);
+}
+
+#pragma mark - Receiving
+// Bring in the next record from the ring, if there's one to bring
+static bool irlink_take_record(irlink_side_t *s) {
+  if (s->hasRecord == true) {
+    return true;
+  }
+  // The sender writes a record in one go, so with the header comes
+  // the rest of it
+  if (ring_count(&s->ring) < sizeof(irlink_header_t)) {
+    return false;
+  }
+  ring_read(&s->ring, (uint8_t *)&s->record, sizeof(irlink_header_t));
+  ring_read(&s->ring, s->recordData, s->record.length);
+  s->recordOffset = 0;
+  s->hasRecord = true;
+  return true;
+}
+
+uint32_t irlink_read(irlink_t *l, uint8_t side, uint64_t clock, uint8_t *data, uint32_t length) {
+  irlink_side_t *s = &l->sides[side & 1];
+  uint32_t read = 0;
+
+  while (read < length && irlink_take_record(s) == true && s->record.arrival <= clock) {
+    uint32_t remaining = s->record.length - s->recordOffset;
+    uint32_t chunk = (remaining < length - read) ? remaining : length - read;
+    memcpy(data + read, s->recordData + s->recordOffset, chunk);
+    read += chunk;
+    s->recordOffset += chunk;
+    if (s->recordOffset == s->record.length) {
+      s->hasRecord = false;
+    }
+  }
+  return read;
+}
+
+uint64_t irlink_get_arrival(irlink_t *l, uint8_t side) {
+  irlink_side_t *s = &l->sides[side & 1];
+  if (irlink_take_record(s) == false) {
+    return IRLINK_NEVER;
+  }
+  return s->record.arrival;
+}
+
+uint32_t irlink_get_dropped(irlink_t *l, uint8_t side) {
+  pthread_mutex_lock(&l->lock);
+  uint32_t dropped = l->sides[side & 1].dropped;
+  pthread_mutex_unlock(&l->lock);
+  return dropped;
+}
+
+#pragma mark - Clocks
+void irlink_set_clock(irlink_t *l, uint8_t side, uint64_t clock) {
+  __atomic_store_n(&l->sides[side & 1].clock, clock, __ATOMIC_SEQ_CST);
+  irlink_notify(l, side);
+}
+
+uint64_t irlink_get_clock(irlink_t *l, uint8_t side) {
+  return __atomic_load_n(&l->sides[side & 1].clock, __ATOMIC_SEQ_CST);
+}
+
+void irlink_set_asleep(irlink_t *l, uint8_t side, bool asleep) {
+  __atomic_store_n(&l->sides[side & 1].asleep, (asleep == true) ? 1 : 0, __ATOMIC_SEQ_CST);
+  irlink_notify(l, side);
+}
+
+uint64_t irlink_get_horizon(irlink_t *l, uint8_t side) {
+  irlink_side_t *other = &l->sides[(side & 1) ^ 1];
+  if (__atomic_load_n(&other->attached, __ATOMIC_SEQ_CST) == 0 ||
+      __atomic_load_n(&other->asleep, __ATOMIC_SEQ_CST) != 0)
+  {
+    return IRLINK_NEVER;
+  }
+  return __atomic_load_n(&other->clock, __ATOMIC_SEQ_CST) + l->lookahead;
+}
+
+void irlink_wait(irlink_t *l, uint8_t side, uint64_t clock, int timeout) {
+  irlink_side_t *s = &l->sides[side & 1];
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  struct timespec deadline;
+  deadline.tv_sec = now.tv_sec + timeout / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000 + (long)(timeout % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&l->lock);
+  // The other side looks at waiting after it has moved, and this
+  // side at the horizon after it has started waiting, so one of the
+  // two sees the other
+  __atomic_store_n(&s->waiting, 1, __ATOMIC_SEQ_CST);
+  if (irlink_get_horizon(l, side) <= clock) {
+    pthread_cond_timedwait(&l->moved, &l->lock, &deadline);
+  }
+  __atomic_store_n(&s->waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&l->lock);
+}
@@ -0,0 +1,63 @@
+//
+//  irlink.h
+//  Leibniz
+//
+//  An infrared link between two Newtons running in the same process,
+//  so that beaming can be tried out without the hardware. Each way
+//  across is a lock-free ring of records, stamped with the time on
+//  the sender's clock that their last byte would be through the air,
+//  and the receiver takes them in once its own clock gets there.
+//
+//  The two clocks are kept together as well: each side tells the
+//  link how far its clock has got, and holds back while it is more
+//  than the lookahead past the other one. A side that sleeps until
+//  something wakes it doesn't hold the other one back; it catches up
+//  with it when it wakes instead.
+//
+//  The sides are numbered 0 and 1, and the functions for a side are
+//  only called from that side's emulator thread.
+//
+
+#ifndef __Leibniz__irlink__
+#define __Leibniz__irlink__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IRLINK_NEVER UINT64_MAX
+
+// Called from the other side's thread when something is sent
+typedef void (*irlink_wake_f) (void *ext);
+
+typedef struct irlink_s irlink_t;
+
+irlink_t *irlink_new(uint64_t lookahead);
+// Once neither side is attached
+void irlink_del(irlink_t *l);
+
+// Returns -1 if the side is already taken
+int irlink_attach(irlink_t *l, uint8_t side, void *ext, irlink_wake_f wake);
+// Once it returns, the other side no longer calls wake
+void irlink_detach(irlink_t *l, uint8_t side);
+
+// Bytes sent at clock, each ticksPerByte on the air. Like light with
+// nobody to see it, they are lost when the other side isn't there or
+// has fallen too far behind to take them in.
+void irlink_write(irlink_t *l, uint8_t side, uint64_t clock, uint64_t ticksPerByte, const uint8_t *data, uint32_t length);
+// Up to length of the bytes that have arrived by clock
+uint32_t irlink_read(irlink_t *l, uint8_t side, uint64_t clock, uint8_t *data, uint32_t length);
+// When the next bytes arrive, or IRLINK_NEVER
+uint64_t irlink_get_arrival(irlink_t *l, uint8_t side);
+// Bytes sent to the side that were lost
+uint32_t irlink_get_dropped(irlink_t *l, uint8_t side);
+
+void irlink_set_clock(irlink_t *l, uint8_t side, uint64_t clock);
+uint64_t irlink_get_clock(irlink_t *l, uint8_t side);
+void irlink_set_asleep(irlink_t *l, uint8_t side, bool asleep);
+// How far the side's clock can go: the lookahead past the other
+// side's, or IRLINK_NEVER if that isn't attached or is asleep
+uint64_t irlink_get_horizon(irlink_t *l, uint8_t side);
+// Wait up to timeout ms for the horizon to move past clock
+void irlink_wait(irlink_t *l, uint8_t side, uint64_t clock, int timeout);
+
+#endif /* defined(__Leibniz__irlink__) */
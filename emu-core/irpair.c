@@ -0,0 +1,126 @@
+//
+//  irpair.c
+//  Leibniz
+//
+//  Beaming load test: runs pairs of Newtons booted from the same ROM,
+//  each on a thread of its own and on the virtual clock, with the IR
+//  ports of each pair linked, and reports how far each one got and
+//  how much was lost on the way.
+//
+//  usage: irpair [-n pairs] [-t instructions] romfile
+//
+
+#include "newton.h"
+#include "irlink.h"
+#include "runt.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define IRPAIR_MAX_PAIRS 64
+
+typedef struct {
+  newton_t *newton;
+  int32_t count;
+  pthread_t thread;
+} irpair_side_t;
+
+static void *irpair_run(void *arg) {
+  irpair_side_t *side = (irpair_side_t *)arg;
+  newton_emulate(side->newton, side->count);
+  // Or the other side would wait for this one forever
+  newton_ir_unlink(side->newton);
+  return NULL;
+}
+
+static void print_usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n pairs] [-t instructions] romfile\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  extern char *optarg;
+  int c, err = 0;
+
+  int pairs = 1;
+  int32_t count = 100000000;
+
+  while ((c = getopt(argc, argv, "n:t:")) != -1) {
+    switch (c) {
+      case 'n':
+        pairs = atoi(optarg);
+        break;
+      case 't':
+        count = atoi(optarg);
+        break;
+      case '?':
+        err = 1;
+        break;
+    }
+  }
+
+  if (err || optind == argc || pairs < 1 || pairs > IRPAIR_MAX_PAIRS || count < 1) {
+    print_usage(argv[0]);
+  }
+
+  char *romFile = argv[optind];
+
+  static irpair_side_t sides[IRPAIR_MAX_PAIRS * 2];
+  static irlink_t *links[IRPAIR_MAX_PAIRS];
+
+  for (int i=0; i<pairs * 2; i++) {
+    newton_t *newton = newton_new();
+    if (newton == NULL || newton_load_rom(newton, romFile) == -1) {
+      return -1;
+    }
+    runt_set_clock_mode(newton_get_runt(newton), RuntClockVirtual);
+    sides[i].newton = newton;
+    sides[i].count = count;
+  }
+
+  for (int i=0; i<pairs; i++) {
+    links[i] = irlink_new(NEWTON_IR_LOOKAHEAD);
+    if (links[i] == NULL ||
+        newton_ir_link(sides[i * 2].newton, links[i], 0) != 0 ||
+        newton_ir_link(sides[i * 2 + 1].newton, links[i], 1) != 0)
+    {
+      fprintf(stderr, "Couldn't link pair %i\n", i);
+      return -1;
+    }
+  }
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  for (int i=0; i<pairs * 2; i++) {
+    pthread_create(&sides[i].thread, NULL, irpair_run, &sides[i]);
+  }
+  for (int i=0; i<pairs * 2; i++) {
+    pthread_join(sides[i].thread, NULL);
+  }
+  gettimeofday(&end, NULL);
+
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  if (secs <= 0) {
+    secs = 0.000001;
+  }
+
+  for (int i=0; i<pairs * 2; i++) {
+    newton_t *newton = sides[i].newton;
+    fprintf(stderr, "pair %i side %i: clock %llu, PC=0x%08x, %u bytes lost on the way in\n",
+            i / 2, i % 2, (unsigned long long)runt_get_clock(newton_get_runt(newton)),
+            arm_get_pc(newton->arm), irlink_get_dropped(links[i / 2], i % 2));
+  }
+  fprintf(stderr, "%i x %i instructions in %.3f s (%.2f MIPS)\n",
+          pairs * 2, count, secs, (double)pairs * 2 * count / secs / 1000000.0);
+
+  for (int i=0; i<pairs * 2; i++) {
+    newton_del(sides[i].newton);
+  }
+  for (int i=0; i<pairs; i++) {
+    irlink_del(links[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,967 @@
+/*****************************************************************************
+ * File name:   jit.c                                                        *
+ *****************************************************************************/
+
+/*****************************************************************************
+ * This program is free software. You can redistribute it and / or modify it *
+ * under the terms of the GNU General Public License version 2 as  published *
+ * by the Free Software Foundation.                                          *
+ *                                                                           *
+ * This program is distributed in the hope  that  it  will  be  useful,  but *
+ * WITHOUT  ANY   WARRANTY,   without   even   the   implied   warranty   of *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU  General *
+ * Public License for more details.                                          *
+ *****************************************************************************/
+
+/*
+ * Basic block translation cache
+ *
+ * Guest code is translated into blocks of pre-resolved opcode
+ * handlers. A block starts at a physical address and ends with
+ * the first instruction that may change the pc or the processor
+ * mode, or at a ARM_JIT_BLOCK_SIZE boundary. Consecutive blocks
+ * are chained so that following a branch usually needs neither
+ * an address translation nor a hash lookup.
+ *
+ * Each instruction is decoded once when it is translated. The
+ * common data processing, load/store and branch forms get a
+ * specialized handler that works on the pre-decoded operands,
+ * everything else is executed by its handler from c->opcodes.
+ * Translated code behaves exactly like the interpreter. What is
+ * saved is the address translation, the memory access and the
+ * decoding of each instruction fetch.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm.h"
+#include "internal.h"
+
+
+#define arm_jit_hash(addr) (((addr) >> 2) & (ARM_JIT_HASH_CNT - 1))
+#define arm_jit_page_hash(addr) (((addr) >> ARM_JIT_PAGE_SHIFT) & (ARM_JIT_HASH_CNT - 1))
+
+
+int arm_set_jit (arm_t *c, int enable)
+{
+	arm_jit_t *jit;
+
+	if (enable == 0) {
+		if (c->jit != NULL) {
+			free (c->jit->op);
+			free (c->jit->block);
+			free (c->jit);
+			c->jit = NULL;
+		}
+
+		return (0);
+	}
+
+	if (c->jit != NULL) {
+		return (0);
+	}
+
+	jit = calloc (1, sizeof (arm_jit_t));
+	if (jit == NULL) {
+		return (1);
+	}
+
+	jit->block = malloc (ARM_JIT_BLOCK_CNT * sizeof (arm_jit_block_t));
+	jit->op = malloc (ARM_JIT_OP_CNT * sizeof (arm_jit_op_t));
+
+	if ((jit->block == NULL) || (jit->op == NULL)) {
+		free (jit->op);
+		free (jit->block);
+		free (jit);
+		return (1);
+	}
+
+	c->jit = jit;
+
+	arm_jit_reset (c);
+
+	return (0);
+}
+
+void arm_jit_reset (arm_t *c)
+{
+	arm_jit_t *jit;
+
+	jit = c->jit;
+
+	if (jit == NULL) {
+		return;
+	}
+
+	jit->gen += 1;
+
+	jit->cur = NULL;
+	jit->idx = 0;
+	jit->pc = 0;
+
+	memset (jit->hash, 0, sizeof (jit->hash));
+	memset (jit->page, 0, sizeof (jit->page));
+	memset (jit->code, 0, sizeof (jit->code));
+
+	jit->block_cnt = 0;
+	jit->op_cnt = 0;
+}
+
+void arm_jit_flush (arm_t *c)
+{
+	arm_jit_t *jit;
+
+	jit = c->jit;
+
+	if (jit == NULL) {
+		return;
+	}
+
+	jit->gen += 1;
+	jit->cur = NULL;
+}
+
+static
+void arm_jit_unhash (arm_jit_t *jit, arm_jit_block_t *blk)
+{
+	arm_jit_block_t **p;
+
+	p = &jit->hash[arm_jit_hash (blk->paddr)];
+
+	while (*p != NULL) {
+		if (*p == blk) {
+			*p = blk->hnext;
+			return;
+		}
+
+		p = &(*p)->hnext;
+	}
+}
+
+void arm_jit_invalidate_page (arm_t *c, uint32_t addr)
+{
+	arm_jit_t       *jit;
+	arm_jit_block_t **p, *blk;
+	uint32_t        page;
+
+	jit = c->jit;
+
+	if (jit == NULL) {
+		return;
+	}
+
+	page = addr >> ARM_JIT_PAGE_SHIFT;
+
+	jit->code[page >> 3] &= ~(1U << (page & 7));
+
+	p = &jit->page[arm_jit_page_hash (addr)];
+
+	while (*p != NULL) {
+		blk = *p;
+
+		if ((blk->paddr >> ARM_JIT_PAGE_SHIFT) != page) {
+			p = &blk->pnext;
+			continue;
+		}
+
+		*p = blk->pnext;
+
+		arm_jit_unhash (jit, blk);
+
+		blk->valid = 0;
+
+		if (jit->cur == blk) {
+			jit->cur = NULL;
+		}
+	}
+}
+
+
+/*
+ * Check if an instruction ends a block. These are the instructions
+ * that may write the pc or change the processor mode.
+ */
+static
+int arm_jit_is_last (uint32_t ir)
+{
+	switch ((ir >> 25) & 0x07) {
+	case 0x00:
+	case 0x01:
+		if ((ir & 0x0e000090UL) == 0x00000090UL) {
+			/* multiply, swap and halfword transfers */
+			return (arm_get_bit (ir, 20) && arm_rd_is_pc (ir));
+		}
+
+		if ((ir & 0x01900000UL) == 0x01000000UL) {
+			/* msr and bx end a block, mrs does not */
+			return (arm_get_bit (ir, 21) || arm_rd_is_pc (ir));
+		}
+
+		return (arm_rd_is_pc (ir));
+
+	case 0x02:
+	case 0x03:
+		if ((ir & 0x02000010UL) == 0x02000010UL) {
+			/* undefined, including the host traps */
+			return (1);
+		}
+		return (arm_get_bit (ir, 20) && arm_rd_is_pc (ir));
+
+	case 0x04:
+		/* ldm with pc in the register list */
+		return (arm_get_bit (ir, 20) && arm_get_bit (ir, 15));
+
+	case 0x05:
+		/* b, bl */
+		return (1);
+
+	case 0x06:
+		return (0);
+
+	case 0x07:
+		/* swi */
+		return (arm_get_bit (ir, 24));
+	}
+
+	return (1);
+}
+
+
+/*
+ * The specialized handlers. These replicate the corresponding
+ * handlers in opcodes.c for the cases the decoder accepts, which
+ * never write the pc and never change the processor mode.
+ *
+ * The handler bodies are macros so that they can be expanded both
+ * into functions, for arm_execute(), and into the labels of the
+ * threaded interpreter in arm_jit_run(). The bodies must not
+ * return.
+ */
+
+/*
+ * Get an immediate shifted register operand. cry can be NULL if
+ * the carry out is not used.
+ */
+static inline
+uint32_t arm_jit_get_sh (arm_t *c, const arm_jit_op_t *op, uint32_t *cry)
+{
+	unsigned n;
+	uint32_t v, tmp;
+
+	/* don't evaluate the condition codes if the carry is not used */
+	if (cry == NULL) {
+		cry = &tmp;
+	}
+
+	v = arm_get_reg_pc (c, op->rm, 8);
+	n = op->amount;
+
+	switch (op->shift) {
+	case 0x00: /* lsl */
+		if (n == 0) {
+			*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
+			return (v);
+		}
+		*cry = (v >> (32 - n)) & 0x01;
+		return ((v << n) & 0xffffffff);
+
+	case 0x01: /* lsr */
+		if (n == 0) {
+			*cry = (v >> 31) & 0x01;
+			return (0);
+		}
+		*cry = (v >> (n - 1)) & 0x01;
+		return (v >> n);
+
+	case 0x02: /* asr */
+		if (n == 0) {
+			*cry = (v >> 31) & 0x01;
+			return (*cry ? 0xffffffffUL : 0x00000000UL);
+		}
+		*cry = (v >> (n - 1)) & 0x01;
+		return (arm_asr32 (v, n));
+
+	default: /* ror / rrx */
+		if (n == 0) {
+			*cry = v & 0x01;
+			return ((v >> 1) | (arm_get_cc_c (c) << 31));
+		}
+		*cry = (v >> (n - 1)) & 0x01;
+		return (arm_ror32 (v, n));
+	}
+}
+
+/*
+ * Get the address of a single data transfer in offset mode
+ */
+static inline
+uint32_t arm_jit_get_addr (arm_t *c, const arm_jit_op_t *op)
+{
+	uint32_t base, index;
+
+	base = arm_get_reg_pc (c, op->rn, 8);
+
+	if (op->rm == 0xff) {
+		return ((base + op->imm) & 0xffffffff);
+	}
+
+	index = arm_jit_get_sh (c, op, NULL);
+
+	if (op->flags & ARM_JIT_OP_SUB) {
+		return ((base - index) & 0xffffffff);
+	}
+
+	return ((base + index) & 0xffffffff);
+}
+
+#define ARM_JIT_IS_LOG_NONE 0
+#define ARM_JIT_IS_LOG_LOG  1
+#define ARM_JIT_IS_LOG_ADD  0
+#define ARM_JIT_IS_LOG_SUB  0
+#define ARM_JIT_IS_LOG_RSB  0
+
+#define ARM_JIT_CC_NONE() do { } while (0)
+#define ARM_JIT_CC_LOG() do { arm_set_cc_log (c, d, cry); } while (0)
+#define ARM_JIT_CC_ADD() do { arm_set_cc_add (c, d, s1, s2); } while (0)
+#define ARM_JIT_CC_SUB() do { arm_set_cc_sub (c, d, s1, s2); } while (0)
+#define ARM_JIT_CC_RSB() do { arm_set_cc_sub (c, d, s2, s1); } while (0)
+
+/*
+ * Data processing with an immediate (I) or a register (R) operand.
+ * wr is zero for the test instructions.
+ */
+#define ARM_JIT_DP_I(wr, expr, cc) do { \
+	uint32_t s1, s2, d, cry; \
+	s1 = arm_get_reg_pc (c, op->rn, 8); \
+	s2 = op->imm; \
+	cry = s2 >> 31; \
+	d = (expr) & 0xffffffff; \
+	if (wr) { \
+		arm_set_gpr (c, op->rd, d); \
+	} \
+	if (ARM_JIT_IS_LOG_##cc && ((op->flags & ARM_JIT_OP_CRY) == 0)) { \
+		/* the carry is unchanged */ \
+		arm_set_cc_nz (c, d); \
+	} \
+	else { \
+		ARM_JIT_CC_##cc (); \
+	} \
+	(void) s1; \
+	(void) cry; \
+	arm_set_clk (c, 4, 1); \
+} while (0)
+
+#define ARM_JIT_DP_R(wr, expr, cc) do { \
+	uint32_t s1, s2, d, cry; \
+	s1 = arm_get_reg_pc (c, op->rn, 8); \
+	s2 = arm_jit_get_sh (c, op, ARM_JIT_IS_LOG_##cc ? &cry : NULL); \
+	d = (expr) & 0xffffffff; \
+	if (wr) { \
+		arm_set_gpr (c, op->rd, d); \
+	} \
+	ARM_JIT_CC_##cc (); \
+	(void) s1; \
+	(void) cry; \
+	arm_set_clk (c, 4, 1); \
+} while (0)
+
+/* str[cond] rd, [rn, offset] */
+#define ARM_JIT_STR() do { \
+	if (arm_dstore32 (c, arm_jit_get_addr (c, op), arm_get_gpr (c, op->rd)) == 0) { \
+		arm_set_clk (c, 4, 1); \
+	} \
+} while (0)
+
+/* ldr[cond] rd, [rn, offset] */
+#define ARM_JIT_LDR() do { \
+	uint32_t addr, val; \
+	addr = arm_jit_get_addr (c, op); \
+	if (arm_dload32 (c, addr & 0xfffffffc, &val) == 0) { \
+		if (addr & 0x03) { \
+			val = arm_ror32 (val, (addr & 0x03) << 3); \
+		} \
+		arm_set_gpr (c, op->rd, val); \
+		arm_set_clk (c, 4, 1); \
+	} \
+} while (0)
+
+/* str[cond]b rd, [rn, offset] */
+#define ARM_JIT_STRB() do { \
+	if (arm_dstore8 (c, arm_jit_get_addr (c, op), arm_get_gpr (c, op->rd)) == 0) { \
+		arm_set_clk (c, 4, 1); \
+	} \
+} while (0)
+
+/* ldr[cond]b rd, [rn, offset] */
+#define ARM_JIT_LDRB() do { \
+	uint8_t val; \
+	if (arm_dload8 (c, arm_jit_get_addr (c, op), &val) == 0) { \
+		arm_set_gpr (c, op->rd, val & 0xff); \
+		arm_set_clk (c, 4, 1); \
+	} \
+} while (0)
+
+/* b[cond] target */
+#define ARM_JIT_B() do { \
+	arm_set_pc (c, (arm_get_pc (c) + op->imm) & 0xffffffff); \
+	arm_set_clk (c, 0, 1); \
+} while (0)
+
+/* bl[cond] target */
+#define ARM_JIT_BL() do { \
+	arm_set_lr (c, (arm_get_pc (c) + 4) & 0xffffffff); \
+	arm_set_pc (c, (arm_get_pc (c) + op->imm) & 0xffffffff); \
+	arm_set_clk (c, 0, 1); \
+} while (0)
+
+/* everything else */
+#define ARM_JIT_GENERIC() do { \
+	op->fct (c); \
+} while (0)
+
+/*
+ * All handlers as X (KIND, name, body). GENERIC must be first.
+ */
+#define ARM_JIT_OP_LIST(X) \
+	X (GENERIC, generic, ARM_JIT_GENERIC ()) \
+	X (AND_I,  and_i,  ARM_JIT_DP_I (1, s1 & s2, NONE)) \
+	X (AND_R,  and_r,  ARM_JIT_DP_R (1, s1 & s2, NONE)) \
+	X (ANDS_I, ands_i, ARM_JIT_DP_I (1, s1 & s2, LOG)) \
+	X (ANDS_R, ands_r, ARM_JIT_DP_R (1, s1 & s2, LOG)) \
+	X (EOR_I,  eor_i,  ARM_JIT_DP_I (1, s1 ^ s2, NONE)) \
+	X (EOR_R,  eor_r,  ARM_JIT_DP_R (1, s1 ^ s2, NONE)) \
+	X (EORS_I, eors_i, ARM_JIT_DP_I (1, s1 ^ s2, LOG)) \
+	X (EORS_R, eors_r, ARM_JIT_DP_R (1, s1 ^ s2, LOG)) \
+	X (SUB_I,  sub_i,  ARM_JIT_DP_I (1, s1 - s2, NONE)) \
+	X (SUB_R,  sub_r,  ARM_JIT_DP_R (1, s1 - s2, NONE)) \
+	X (SUBS_I, subs_i, ARM_JIT_DP_I (1, s1 - s2, SUB)) \
+	X (SUBS_R, subs_r, ARM_JIT_DP_R (1, s1 - s2, SUB)) \
+	X (RSB_I,  rsb_i,  ARM_JIT_DP_I (1, s2 - s1, NONE)) \
+	X (RSB_R,  rsb_r,  ARM_JIT_DP_R (1, s2 - s1, NONE)) \
+	X (RSBS_I, rsbs_i, ARM_JIT_DP_I (1, s2 - s1, RSB)) \
+	X (RSBS_R, rsbs_r, ARM_JIT_DP_R (1, s2 - s1, RSB)) \
+	X (ADD_I,  add_i,  ARM_JIT_DP_I (1, s1 + s2, NONE)) \
+	X (ADD_R,  add_r,  ARM_JIT_DP_R (1, s1 + s2, NONE)) \
+	X (ADDS_I, adds_i, ARM_JIT_DP_I (1, s1 + s2, ADD)) \
+	X (ADDS_R, adds_r, ARM_JIT_DP_R (1, s1 + s2, ADD)) \
+	X (TST_I,  tst_i,  ARM_JIT_DP_I (0, s1 & s2, LOG)) \
+	X (TST_R,  tst_r,  ARM_JIT_DP_R (0, s1 & s2, LOG)) \
+	X (TEQ_I,  teq_i,  ARM_JIT_DP_I (0, s1 ^ s2, LOG)) \
+	X (TEQ_R,  teq_r,  ARM_JIT_DP_R (0, s1 ^ s2, LOG)) \
+	X (CMP_I,  cmp_i,  ARM_JIT_DP_I (0, s1 - s2, SUB)) \
+	X (CMP_R,  cmp_r,  ARM_JIT_DP_R (0, s1 - s2, SUB)) \
+	X (CMN_I,  cmn_i,  ARM_JIT_DP_I (0, s1 + s2, ADD)) \
+	X (CMN_R,  cmn_r,  ARM_JIT_DP_R (0, s1 + s2, ADD)) \
+	X (ORR_I,  orr_i,  ARM_JIT_DP_I (1, s1 | s2, NONE)) \
+	X (ORR_R,  orr_r,  ARM_JIT_DP_R (1, s1 | s2, NONE)) \
+	X (ORRS_I, orrs_i, ARM_JIT_DP_I (1, s1 | s2, LOG)) \
+	X (ORRS_R, orrs_r, ARM_JIT_DP_R (1, s1 | s2, LOG)) \
+	X (MOV_I,  mov_i,  ARM_JIT_DP_I (1, s2, NONE)) \
+	X (MOV_R,  mov_r,  ARM_JIT_DP_R (1, s2, NONE)) \
+	X (MOVS_I, movs_i, ARM_JIT_DP_I (1, s2, LOG)) \
+	X (MOVS_R, movs_r, ARM_JIT_DP_R (1, s2, LOG)) \
+	X (BIC_I,  bic_i,  ARM_JIT_DP_I (1, s1 & ~s2, NONE)) \
+	X (BIC_R,  bic_r,  ARM_JIT_DP_R (1, s1 & ~s2, NONE)) \
+	X (BICS_I, bics_i, ARM_JIT_DP_I (1, s1 & ~s2, LOG)) \
+	X (BICS_R, bics_r, ARM_JIT_DP_R (1, s1 & ~s2, LOG)) \
+	X (MVN_I,  mvn_i,  ARM_JIT_DP_I (1, ~s2, NONE)) \
+	X (MVN_R,  mvn_r,  ARM_JIT_DP_R (1, ~s2, NONE)) \
+	X (MVNS_I, mvns_i, ARM_JIT_DP_I (1, ~s2, LOG)) \
+	X (MVNS_R, mvns_r, ARM_JIT_DP_R (1, ~s2, LOG)) \
+	X (STR,    str,    ARM_JIT_STR ()) \
+	X (LDR,    ldr,    ARM_JIT_LDR ()) \
+	X (STRB,   strb,   ARM_JIT_STRB ()) \
+	X (LDRB,   ldrb,   ARM_JIT_LDRB ()) \
+	X (B,      b,      ARM_JIT_B ()) \
+	X (BL,     bl,     ARM_JIT_BL ())
+
+#define ARM_JIT_KIND(KIND, name, body) ARM_JIT_##KIND,
+#define ARM_JIT_FCT(KIND, name, body) \
+static void arm_jit_##name (arm_t *c, const arm_jit_op_t *op) { body; }
+#define ARM_JIT_FCT_TAB(KIND, name, body) arm_jit_##name,
+
+enum {
+	ARM_JIT_OP_LIST (ARM_JIT_KIND)
+	ARM_JIT_KIND_CNT
+};
+
+ARM_JIT_OP_LIST (ARM_JIT_FCT)
+
+static const arm_jit_exec_f arm_jit_exec[ARM_JIT_KIND_CNT] = {
+	ARM_JIT_OP_LIST (ARM_JIT_FCT_TAB)
+};
+
+/* data processing kinds, indexed by bits 20..24 of the instruction */
+static const unsigned char arm_jit_dp_i[32] = {
+	ARM_JIT_AND_I, ARM_JIT_ANDS_I, ARM_JIT_EOR_I, ARM_JIT_EORS_I,
+	ARM_JIT_SUB_I, ARM_JIT_SUBS_I, ARM_JIT_RSB_I, ARM_JIT_RSBS_I,
+	ARM_JIT_ADD_I, ARM_JIT_ADDS_I, 0, 0,
+	0, 0, 0, 0,
+	0, ARM_JIT_TST_I, 0, ARM_JIT_TEQ_I,
+	0, ARM_JIT_CMP_I, 0, ARM_JIT_CMN_I,
+	ARM_JIT_ORR_I, ARM_JIT_ORRS_I, ARM_JIT_MOV_I, ARM_JIT_MOVS_I,
+	ARM_JIT_BIC_I, ARM_JIT_BICS_I, ARM_JIT_MVN_I, ARM_JIT_MVNS_I
+};
+
+static const unsigned char arm_jit_dp_r[32] = {
+	ARM_JIT_AND_R, ARM_JIT_ANDS_R, ARM_JIT_EOR_R, ARM_JIT_EORS_R,
+	ARM_JIT_SUB_R, ARM_JIT_SUBS_R, ARM_JIT_RSB_R, ARM_JIT_RSBS_R,
+	ARM_JIT_ADD_R, ARM_JIT_ADDS_R, 0, 0,
+	0, 0, 0, 0,
+	0, ARM_JIT_TST_R, 0, ARM_JIT_TEQ_R,
+	0, ARM_JIT_CMP_R, 0, ARM_JIT_CMN_R,
+	ARM_JIT_ORR_R, ARM_JIT_ORRS_R, ARM_JIT_MOV_R, ARM_JIT_MOVS_R,
+	ARM_JIT_BIC_R, ARM_JIT_BICS_R, ARM_JIT_MVN_R, ARM_JIT_MVNS_R
+};
+
+static
+void arm_jit_decode_dp (arm_jit_op_t *op, uint32_t ir)
+{
+	unsigned n;
+
+	if ((ir & 0x02000010UL) == 0x00000010UL) {
+		/* register shifts and the extension space */
+		return;
+	}
+
+	if (op->rd == 15) {
+		return;
+	}
+
+	if (arm_get_bit (ir, 25)) {
+		n = (ir >> 7) & 0x1e;
+
+		op->imm = arm_ror32 (ir & 0xff, n);
+
+		if (n != 0) {
+			op->flags |= ARM_JIT_OP_CRY;
+		}
+
+		op->kind = arm_jit_dp_i[(ir >> 20) & 0x1f];
+	}
+	else {
+		op->kind = arm_jit_dp_r[(ir >> 20) & 0x1f];
+	}
+}
+
+static
+void arm_jit_decode_ldst (arm_jit_op_t *op, uint32_t ir)
+{
+	if ((ir & 0x02000010UL) == 0x02000010UL) {
+		/* undefined */
+		return;
+	}
+
+	if ((arm_get_bit (ir, 24) == 0) || arm_get_bit (ir, 21)) {
+		/* post-indexed or writeback */
+		return;
+	}
+
+	if (op->rd == 15) {
+		return;
+	}
+
+	if (arm_get_bit (ir, 25)) {
+		if (arm_get_bit (ir, 23) == 0) {
+			op->flags |= ARM_JIT_OP_SUB;
+		}
+	}
+	else {
+		op->rm = 0xff;
+		op->imm = arm_extu (ir, 12);
+
+		if (arm_get_bit (ir, 23) == 0) {
+			op->imm = (~op->imm + 1) & 0xffffffff;
+		}
+	}
+
+	switch ((ir >> 20) & 0x05) {
+	case 0x00:
+		op->kind = ARM_JIT_STR;
+		break;
+
+	case 0x01:
+		op->kind = ARM_JIT_LDR;
+		break;
+
+	case 0x04:
+		op->kind = ARM_JIT_STRB;
+		break;
+
+	case 0x05:
+		op->kind = ARM_JIT_LDRB;
+		break;
+	}
+}
+
+/*
+ * Decode an instruction. Everything not handled by a specialized
+ * handler is executed by its handler from c->opcodes.
+ */
+static
+void arm_jit_decode (arm_t *c, arm_jit_op_t *op, uint32_t ir)
+{
+	op->ir = ir;
+	op->imm = 0;
+	op->cond = arm_ir_cond (ir);
+	op->rd = arm_ir_rd (ir);
+	op->rn = arm_ir_rn (ir);
+	op->rm = arm_ir_rm (ir);
+	op->shift = arm_get_bits (ir, 5, 2);
+	op->amount = arm_get_bits (ir, 7, 5);
+	op->flags = 0;
+	op->kind = ARM_JIT_GENERIC;
+	op->exec = arm_jit_generic;
+
+	if (arm_is_trap (ir)) {
+		op->fct = op_trap;
+		return;
+	}
+
+	op->fct = c->opcodes[(ir >> 20) & 0xff];
+
+	if (op->cond == 0x0f) {
+		/* unconditional extension space */
+		return;
+	}
+
+	switch ((ir >> 25) & 0x07) {
+	case 0x00:
+	case 0x01:
+		arm_jit_decode_dp (op, ir);
+		break;
+
+	case 0x02:
+	case 0x03:
+		arm_jit_decode_ldst (op, ir);
+		break;
+
+	case 0x05:
+		op->imm = ((arm_exts (ir, 24) << 2) + 8) & 0xffffffff;
+		op->kind = arm_get_bit (ir, 24) ? ARM_JIT_BL : ARM_JIT_B;
+		break;
+	}
+
+	op->exec = arm_jit_exec[op->kind];
+}
+
+static
+void arm_jit_translate (arm_t *c, arm_jit_block_t *blk)
+{
+	arm_jit_t    *jit;
+	arm_jit_op_t *op;
+	uint32_t     ir;
+
+	jit = c->jit;
+
+	arm_ifetch_real (c, blk->paddr + 4 * blk->cnt, &ir);
+
+	op = &blk->op[blk->cnt];
+
+	arm_jit_decode (c, op, ir);
+
+	blk->cnt += 1;
+	jit->op_cnt += 1;
+
+	if (arm_jit_is_last (ir)) {
+		blk->closed = 1;
+	}
+	else if (blk->cnt >= ARM_JIT_BLOCK_MAX) {
+		blk->closed = 1;
+	}
+	else if (((blk->paddr + 4 * blk->cnt) & (ARM_JIT_BLOCK_SIZE - 1)) == 0) {
+		blk->closed = 1;
+	}
+}
+
+/*
+ * Check if a block can grow by one instruction. Only the block
+ * at the top of the instruction arena can grow.
+ */
+static
+int arm_jit_can_grow (arm_jit_t *jit, arm_jit_block_t *blk)
+{
+	if (blk->closed) {
+		return (0);
+	}
+
+	if ((blk->op + blk->cnt) != (jit->op + jit->op_cnt)) {
+		blk->closed = 1;
+		return (0);
+	}
+
+	if (jit->op_cnt >= ARM_JIT_OP_CNT) {
+		blk->closed = 1;
+		return (0);
+	}
+
+	return (1);
+}
+
+static
+arm_jit_block_t *arm_jit_new_block (arm_t *c, uint32_t paddr)
+{
+	arm_jit_t       *jit;
+	arm_jit_block_t *blk;
+	uint32_t        page;
+
+	jit = c->jit;
+
+	if ((jit->block_cnt >= ARM_JIT_BLOCK_CNT) || (jit->op_cnt >= ARM_JIT_OP_CNT)) {
+		arm_jit_reset (c);
+	}
+
+	blk = &jit->block[jit->block_cnt];
+	jit->block_cnt += 1;
+
+	blk->paddr = paddr;
+	blk->cnt = 0;
+	blk->op = &jit->op[jit->op_cnt];
+	blk->valid = 1;
+	blk->closed = 0;
+	blk->link = NULL;
+	blk->link_vaddr = 0;
+	blk->link_gen = 0;
+	blk->link_priv = 0;
+
+	blk->hnext = jit->hash[arm_jit_hash (paddr)];
+	jit->hash[arm_jit_hash (paddr)] = blk;
+
+	blk->pnext = jit->page[arm_jit_page_hash (paddr)];
+	jit->page[arm_jit_page_hash (paddr)] = blk;
+
+	page = paddr >> ARM_JIT_PAGE_SHIFT;
+	jit->code[page >> 3] |= 1U << (page & 7);
+
+	arm_jit_translate (c, blk);
+
+	return (blk);
+}
+
+static
+arm_jit_block_t *arm_jit_find_block (arm_jit_t *jit, uint32_t paddr)
+{
+	arm_jit_block_t *blk;
+
+	blk = jit->hash[arm_jit_hash (paddr)];
+
+	while (blk != NULL) {
+		if (blk->paddr == paddr) {
+			return (blk);
+		}
+
+		blk = blk->hnext;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Get the block starting at virtual address addr. This is where
+ * prefetch aborts happen.
+ */
+static
+arm_jit_block_t *arm_jit_get_block (arm_t *c, uint32_t addr)
+{
+	arm_jit_t       *jit;
+	arm_jit_block_t *prev, *blk;
+	uint32_t        paddr;
+	unsigned        gen;
+	int             priv;
+
+	jit = c->jit;
+	prev = jit->cur;
+	priv = arm_is_privileged (c);
+
+	if (prev != NULL) {
+		blk = prev->link;
+
+		if ((blk != NULL) && blk->valid) {
+			if ((prev->link_vaddr == addr) && (prev->link_gen == jit->gen) && (prev->link_priv == priv)) {
+				return (blk);
+			}
+		}
+	}
+
+	paddr = addr;
+
+	if (arm_translate_ifetch (c, &paddr)) {
+		return (NULL);
+	}
+
+	gen = jit->gen;
+
+	blk = arm_jit_find_block (jit, paddr);
+
+	if (blk == NULL) {
+		blk = arm_jit_new_block (c, paddr);
+	}
+
+	/* the cache may have been reset while allocating the block */
+	if ((prev != NULL) && (gen == jit->gen)) {
+		prev->link = blk;
+		prev->link_vaddr = addr;
+		prev->link_gen = gen;
+		prev->link_priv = priv;
+	}
+
+	return (blk);
+}
+
+static
+const arm_jit_op_t *arm_jit_fetch_block (arm_t *c, uint32_t addr)
+{
+	arm_jit_t       *jit;
+	arm_jit_block_t *blk;
+
+	jit = c->jit;
+	blk = jit->cur;
+
+	if ((blk != NULL) && (addr == jit->pc)) {
+		if (arm_jit_can_grow (jit, blk)) {
+			arm_jit_translate (c, blk);
+			jit->pc += 4;
+			return (&blk->op[jit->idx++]);
+		}
+	}
+
+	addr &= ~0x03UL;
+
+	blk = arm_jit_get_block (c, addr);
+
+	if (blk == NULL) {
+		jit->cur = NULL;
+		return (NULL);
+	}
+
+	jit->cur = blk;
+	jit->idx = 1;
+	jit->pc = addr + 4;
+
+	return (&blk->op[0]);
+}
+
+/*
+ * Get the instruction at addr. The common case is the next
+ * instruction in the current block.
+ */
+static inline
+const arm_jit_op_t *arm_jit_next (arm_t *c, uint32_t addr)
+{
+	arm_jit_t       *jit;
+	arm_jit_block_t *blk;
+
+	jit = c->jit;
+	blk = jit->cur;
+
+	if ((blk != NULL) && (addr == jit->pc) && (jit->idx < blk->cnt)) {
+		jit->pc += 4;
+		return (&blk->op[jit->idx++]);
+	}
+
+	return (arm_jit_fetch_block (c, addr));
+}
+
+const arm_jit_op_t *arm_jit_fetch (arm_t *c, uint32_t addr)
+{
+	return (arm_jit_next (c, addr));
+}
+
+
+#if !DISABLE_THREADED
+
+/*
+ * Finish the current instruction and dispatch the next one. This
+ * is expanded at the end of every handler, so each handler has its
+ * own indirect jump.
+ */
+#define ARM_JIT_NEXT() do { \
+	if (c->irq_or_fiq) { \
+		if (c->fiq && (arm_get_cpsr_f (c) == 0)) { \
+			arm_exception_fiq (c); \
+		} \
+		else if (c->irq && (arm_get_cpsr_i (c) == 0)) { \
+			arm_exception_irq (c); \
+		} \
+	} \
+	ARM_JIT_DISPATCH (); \
+} while (0)
+
+#define ARM_JIT_DISPATCH() do { \
+	if (c->run_cnt == 0) { \
+		return; \
+	} \
+	if ((c->brk != NULL) && arm_brk_hit (c, arm_get_pc (c))) { \
+		c->run_cnt = 0; \
+		return; \
+	} \
+	c->run_cnt -= 1; \
+	c->oprcnt += 1; \
+	c->lastpc[1] = c->lastpc[0]; \
+	c->lastpc[0] = arm_get_pc (c); \
+	op = arm_jit_next (c, c->lastpc[0]); \
+	if (op == NULL) { \
+		goto prefetch_abort; \
+	} \
+	c->ir = op->ir; \
+	if ((op->cond == 0x0e) || arm_check_cond_tab (c, op->cond)) { \
+		goto *lbl[op->kind]; \
+	} \
+	arm_set_clk (c, 4, 1); \
+	goto skip; \
+} while (0)
+
+#define ARM_JIT_LBL(KIND, name, body) \
+lbl_##name: \
+	body; \
+	ARM_JIT_NEXT ();
+
+#define ARM_JIT_LBL_TAB(KIND, name, body) &&lbl_##name,
+
+/*
+ * The threaded interpreter. This does exactly what n calls to
+ * arm_execute() would do, but jumps from handler to handler
+ * through a table of labels.
+ */
+void arm_jit_run (arm_t *c, unsigned long n)
+{
+	static const void *const lbl[ARM_JIT_KIND_CNT] = {
+		ARM_JIT_OP_LIST (ARM_JIT_LBL_TAB)
+	};
+
+	const arm_jit_op_t *op;
+
+	c->run_cnt = n;
+
+	ARM_JIT_DISPATCH ();
+
+	ARM_JIT_OP_LIST (ARM_JIT_LBL)
+
+skip:
+	ARM_JIT_NEXT ();
+
+prefetch_abort:
+	ARM_JIT_DISPATCH ();
+}
+
+#else
+
+void arm_jit_run (arm_t *c, unsigned long n)
+{
+	c->run_cnt = n;
+
+	while (c->run_cnt > 0) {
+		if ((c->brk != NULL) && arm_brk_hit (c, arm_get_pc (c))) {
+			c->run_cnt = 0;
+			break;
+		}
+
+		c->run_cnt -= 1;
+		arm_execute (c);
+	}
+}
+
+#endif
@@ -13,7 +13,10 @@
 #define SLEEP_COLOR 0xcc
 #define WHITE_COLOR 0xff
 
-extern void newton_display_open(int width, int height);
-extern void newton_display_set_framebuffer(const char *display, int width, int height);
+#include <stdint.h>
+
+// Display callbacks, registered per LCD driver by the host
+typedef void (*lcd_display_open_f) (void *ext, int width, int height);
+typedef void (*lcd_display_update_f) (void *ext, const uint8_t *framebuffer, int width, int height);
 
 #endif /* lcd_h */
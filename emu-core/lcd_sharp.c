@@ -231,7 +231,9 @@ static inline void lcd_sharp_write_pixels(lcd_sharp_t *c, uint8_t val) {
 }
 
 static inline void lcd_sharp_flush_framebuffer(lcd_sharp_t *c) {
-  newton_display_set_framebuffer((const char *)c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+  if (c->display_update != NULL) {
+    c->display_update(c->display_ext, c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+  }
   c->displayDirty = false;
 }
 
@@ -431,6 +433,71 @@ void lcd_sharp_set_log_file (lcd_sharp_t *c, FILE *file) {
   c->logFile = file;
 }
 
+void lcd_sharp_set_display_fct (lcd_sharp_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update) {
+  c->display_ext = ext;
+  c->display_open = open;
+  c->display_update = update;
+  
+  if (c->display_open != NULL) {
+    c->display_open(c->display_ext, SCREEN_HEIGHT, SCREEN_WIDTH);
+  }
+}
+
+void lcd_sharp_save_state (lcd_sharp_t *c, state_t *st) {
+  state_put_bytes(st, c->memory, 32);
+  
+  state_put_u16(st, c->writeX);
+  state_put_u16(st, c->writeY);
+  state_put_u16(st, c->readX);
+  state_put_u16(st, c->readY);
+  
+  state_put_u16(st, c->windowLeft);
+  state_put_u16(st, c->windowTop);
+  state_put_u16(st, c->windowRight);
+  state_put_u16(st, c->windowBottom);
+  
+  state_put_u8(st, c->idw);
+  state_put_u8(st, c->idr);
+  state_put_u8(st, c->contrast);
+  state_put_u8(st, c->fillMode);
+  state_put_u8(st, c->bitMask);
+  
+  state_put_u32(st, c->displayBusy);
+  state_put_bool(st, c->displayDirty);
+  state_put_bytes(st, c->displayFramebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+bool lcd_sharp_load_state (lcd_sharp_t *c, state_t *st) {
+  state_get_bytes(st, c->memory, 32);
+  
+  c->writeX = state_get_u16(st);
+  c->writeY = state_get_u16(st);
+  c->readX = state_get_u16(st);
+  c->readY = state_get_u16(st);
+  
+  c->windowLeft = state_get_u16(st);
+  c->windowTop = state_get_u16(st);
+  c->windowRight = state_get_u16(st);
+  c->windowBottom = state_get_u16(st);
+  
+  c->idw = state_get_u8(st);
+  c->idr = state_get_u8(st);
+  c->contrast = state_get_u8(st);
+  c->fillMode = state_get_u8(st);
+  c->bitMask = state_get_u8(st);
+  
+  c->displayBusy = state_get_u32(st);
+  c->displayDirty = state_get_bool(st);
+  state_get_bytes(st, c->displayFramebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+  
+  // Show the restored picture
+  if (c->display_update != NULL) {
+    c->display_update(c->display_ext, c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+  }
+  
+  return (st->error == false);
+}
+
 void lcd_sharp_init (lcd_sharp_t *c) {
   c->memory = calloc(32, sizeof(uint8_t));
   
@@ -445,8 +512,6 @@ void lcd_sharp_init (lcd_sharp_t *c) {
   memset(c->displayFramebuffer, 0xff, SCREEN_WIDTH * SCREEN_HEIGHT);
   
   c->logFile = stdout;
-  
-  newton_display_open(SCREEN_HEIGHT, SCREEN_WIDTH);
 }
 
 lcd_sharp_t *lcd_sharp_new () {
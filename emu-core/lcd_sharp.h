@@ -11,6 +11,7 @@
 
 #include "arm.h"
 #include "lcd.h"
+#include "state.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -38,6 +39,10 @@ typedef struct lcd_sharp_s {
   int displayBusy;
   bool displayDirty;
   unsigned char *displayFramebuffer;
+  
+  void *display_ext;
+  lcd_display_open_f display_open;
+  lcd_display_update_f display_update;
 } lcd_sharp_t;
 
 void lcd_sharp_init (lcd_sharp_t *c);
@@ -46,6 +51,10 @@ void lcd_sharp_free (lcd_sharp_t *c);
 void lcd_sharp_del (lcd_sharp_t *c);
 
 void lcd_sharp_set_log_file (lcd_sharp_t *c, FILE *file);
+void lcd_sharp_save_state (lcd_sharp_t *c, state_t *st);
+bool lcd_sharp_load_state (lcd_sharp_t *c, state_t *st);
+
+void lcd_sharp_set_display_fct (lcd_sharp_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update);
 
 void lcd_sharp_set_powered (lcd_sharp_t *c, bool powered);
 
@@ -72,7 +72,9 @@ const char *lcd_squirt_get_address_name(lcd_squirt_t *c, uint8_t addr) {
 }
 
 static inline void lcd_squirt_flush_framebuffer(lcd_squirt_t *c) {
-    newton_display_set_framebuffer((const char *)c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (c->display_update != NULL) {
+      c->display_update(c->display_ext, c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
     c->displayDirty = 0;
     c->stepsSinceLastFlush = 0;
 }
@@ -149,9 +151,9 @@ uint8_t lcd_squirt_set_mem8(lcd_squirt_t *c, uint8_t addr, uint8_t val) {
   return val;
 }
 
-void lcd_squirt_step(lcd_squirt_t *c) {
+void lcd_squirt_step(lcd_squirt_t *c, unsigned steps) {
   if (c->displayDirty != 0) {
-    c->stepsSinceLastFlush++;
+    c->stepsSinceLastFlush += steps;
     
     if (c->stepsSinceLastFlush >= 500) {
         lcd_squirt_flush_framebuffer(c);
@@ -200,6 +202,55 @@ void lcd_squirt_set_log_file (lcd_squirt_t *c, FILE *file) {
   c->logFile = file;
 }
 
+void lcd_squirt_set_display_fct (lcd_squirt_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update) {
+  c->display_ext = ext;
+  c->display_open = open;
+  c->display_update = update;
+  
+  if (c->display_open != NULL) {
+    c->display_open(c->display_ext, SCREEN_HEIGHT, SCREEN_WIDTH);
+  }
+}
+
+void lcd_squirt_save_state (lcd_squirt_t *c, state_t *st) {
+  state_put_bytes(st, c->memory, 0xff);
+  
+  state_put_u32(st, c->displayFillMode);
+  state_put_u32(st, c->displayOrientation);
+  state_put_u32(st, c->displayInverse);
+  
+  state_put_u8(st, c->cursorLow);
+  state_put_u8(st, c->cursorHigh);
+  state_put_u8(st, c->displayMode);
+  
+  state_put_u32(st, c->displayDirty);
+  state_put_u32(st, c->stepsSinceLastFlush);
+  state_put_bytes(st, c->displayFramebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+bool lcd_squirt_load_state (lcd_squirt_t *c, state_t *st) {
+  state_get_bytes(st, c->memory, 0xff);
+  
+  c->displayFillMode = state_get_u32(st);
+  c->displayOrientation = state_get_u32(st);
+  c->displayInverse = state_get_u32(st);
+  
+  c->cursorLow = state_get_u8(st);
+  c->cursorHigh = state_get_u8(st);
+  c->displayMode = state_get_u8(st);
+  
+  c->displayDirty = state_get_u32(st);
+  c->stepsSinceLastFlush = state_get_u32(st);
+  state_get_bytes(st, c->displayFramebuffer, SCREEN_WIDTH * SCREEN_HEIGHT);
+  
+  // Show the restored picture
+  if (c->display_update != NULL) {
+    c->display_update(c->display_ext, c->displayFramebuffer, SCREEN_WIDTH, SCREEN_HEIGHT);
+  }
+  
+  return (st->error == false);
+}
+
 void lcd_squirt_init (lcd_squirt_t *c) {
   c->memory = calloc(0xff, sizeof(uint8_t));
   
@@ -208,8 +259,6 @@ void lcd_squirt_init (lcd_squirt_t *c) {
   //
   c->displayFramebuffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, 1);
   memset(c->displayFramebuffer, 0xff, SCREEN_WIDTH * SCREEN_HEIGHT);
-  
-  newton_display_open(SCREEN_HEIGHT, SCREEN_WIDTH);
 
   c->logFile = stdout;
 }
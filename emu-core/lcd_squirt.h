@@ -11,6 +11,7 @@
 
 #include "arm.h"
 #include "lcd.h"
+#include "state.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,6 +31,10 @@ typedef struct lcd_squirt_s {
   int displayDirty;
   int stepsSinceLastFlush;
   unsigned char *displayFramebuffer;
+  
+  void *display_ext;
+  lcd_display_open_f display_open;
+  lcd_display_update_f display_update;
 } lcd_squirt_t;
 
 void lcd_squirt_init (lcd_squirt_t *c);
@@ -38,8 +43,12 @@ void lcd_squirt_free (lcd_squirt_t *c);
 void lcd_squirt_del (lcd_squirt_t *c);
 
 void lcd_squirt_set_log_file (lcd_squirt_t *c, FILE *file);
+void lcd_squirt_save_state (lcd_squirt_t *c, state_t *st);
+bool lcd_squirt_load_state (lcd_squirt_t *c, state_t *st);
+
+void lcd_squirt_set_display_fct (lcd_squirt_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update);
 
-void lcd_squirt_step(lcd_squirt_t *c);
+void lcd_squirt_step(lcd_squirt_t *c, unsigned steps);
 
 uint8_t lcd_squirt_set_mem8(lcd_squirt_t *c, uint8_t addr, uint8_t val);
 uint8_t lcd_squirt_get_mem8(lcd_squirt_t *c, uint8_t addr);
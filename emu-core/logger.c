@@ -0,0 +1,548 @@
+//
+//  logger.c
+//  Leibniz
+//
+
+#include "logger.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Records, a power of two
+#define LOGGER_RING_SIZE   4096
+#define LOGGER_MAX_ARGS    10
+#define LOGGER_STRING_SIZE 232
+#define LOGGER_OUT_SIZE    8192
+
+// A string argument that was NULL
+#define LOGGER_NULL_STRING UINT64_MAX
+
+typedef struct logger_record_s {
+  // NULL if it was formatted right away, into strings
+  const char *format;
+  uint64_t timestamp;
+  bool timestamped;
+  uint8_t subsystem;
+  // Numbers as they are, doubles by their bits and strings as an
+  // offset into strings
+  uint64_t args[LOGGER_MAX_ARGS];
+  char strings[LOGGER_STRING_SIZE];
+} logger_record_t;
+
+struct logger_s {
+  logger_record_t *records;
+  // Only the logging thread writes head, and only the writer thread
+  // writes tail. Both only ever go up.
+  uint32_t head;
+  uint32_t tail;
+  // Up to where the records have reached the file, a little behind tail
+  uint32_t written;
+
+  FILE *file;
+  // Read by the logging thread only
+  const unsigned long long *clock;
+  bool timestamps;
+  uint32_t enabled;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // Set by the writer thread while it waits for records
+  int sleeping;
+  bool quit;
+
+  // The writer thread's text, written out a batch of records at a
+  // time so that other writers to the file don't land mid-line
+  char out[LOGGER_OUT_SIZE];
+  size_t outLength;
+  // The writer thread is at the start of a line
+  bool lineStart;
+};
+
+#pragma mark - Formats
+typedef enum {
+  LoggerArgNone,
+  LoggerArgInt,
+  LoggerArgLong,
+  LoggerArgLongLong,
+  LoggerArgSize,
+  LoggerArgDouble,
+  LoggerArgString,
+  LoggerArgPointer,
+} LoggerArgType;
+
+typedef struct logger_spec_s {
+  // From the % on
+  const char *start;
+  size_t length;
+  // How many of width and precision are given as *
+  uint8_t stars;
+  LoggerArgType type;
+} logger_spec_t;
+
+// Find the next conversion in format. Returns false if there are
+// none left, or the rest can't be understood and is to be printed as
+// it is.
+static bool logger_next_spec(const char *format, logger_spec_t *spec) {
+  const char *p = strchr(format, '%');
+  if (p == NULL) {
+    return false;
+  }
+
+  spec->start = p++;
+  spec->stars = 0;
+  spec->type = LoggerArgNone;
+
+  if (*p == '%') {
+    spec->length = 2;
+    return true;
+  }
+
+  while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+    p++;
+  }
+  if (*p == '*') {
+    spec->stars++;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9') {
+    p++;
+  }
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec->stars++;
+      p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+
+  LoggerArgType integer = LoggerArgInt;
+  if (p[0] == 'h') {
+    p += (p[1] == 'h') ? 2 : 1;
+  }
+  else if (p[0] == 'l' && p[1] == 'l') {
+    integer = LoggerArgLongLong;
+    p += 2;
+  }
+  else if (p[0] == 'l') {
+    integer = LoggerArgLong;
+    p++;
+  }
+  else if (p[0] == 'j' || p[0] == 'q') {
+    integer = LoggerArgLongLong;
+    p++;
+  }
+  else if (p[0] == 'z' || p[0] == 't') {
+    integer = LoggerArgSize;
+    p++;
+  }
+
+  switch (*p) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+      spec->type = integer;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      spec->type = LoggerArgDouble;
+      break;
+    case 's':
+      spec->type = LoggerArgString;
+      break;
+    case 'p':
+      spec->type = LoggerArgPointer;
+      break;
+    default:
+      return false;
+  }
+
+  spec->length = (size_t)(p + 1 - spec->start);
+  return true;
+}
+
+#pragma mark - Logging
+static inline void logger_wake(logger_t *l) {
+  if (__atomic_load_n(&l->sleeping, __ATOMIC_SEQ_CST) != 0) {
+    pthread_mutex_lock(&l->lock);
+    pthread_cond_signal(&l->cond);
+    pthread_mutex_unlock(&l->lock);
+  }
+}
+
+static logger_record_t *logger_reserve(logger_t *l) {
+  uint32_t head = l->head;
+  while (head - __atomic_load_n(&l->tail, __ATOMIC_ACQUIRE) >= LOGGER_RING_SIZE) {
+    // Full: let the writer catch up
+    logger_wake(l);
+    sched_yield();
+  }
+  return &l->records[head & (LOGGER_RING_SIZE - 1)];
+}
+
+static void logger_commit(logger_t *l) {
+  __atomic_store_n(&l->head, l->head + 1, __ATOMIC_SEQ_CST);
+  logger_wake(l);
+}
+
+// Copy the arguments format takes. Returns false if there are more
+// than a record holds.
+static bool logger_capture(logger_record_t *record, const char *format, va_list ap) {
+  size_t stringsUsed = 0;
+  int count = 0;
+
+  logger_spec_t spec;
+  const char *p = format;
+  while (logger_next_spec(p, &spec) == true) {
+    p = spec.start + spec.length;
+    if (spec.type == LoggerArgNone) {
+      continue;
+    }
+    if (count + spec.stars + 1 > LOGGER_MAX_ARGS) {
+      return false;
+    }
+
+    for (int i=0; i<spec.stars; i++) {
+      record->args[count++] = (uint64_t)va_arg(ap, unsigned int);
+    }
+
+    uint64_t value = 0;
+    switch (spec.type) {
+      case LoggerArgInt:
+        value = va_arg(ap, unsigned int);
+        break;
+      case LoggerArgLong:
+        value = va_arg(ap, unsigned long);
+        break;
+      case LoggerArgLongLong:
+        value = va_arg(ap, unsigned long long);
+        break;
+      case LoggerArgSize:
+        value = va_arg(ap, size_t);
+        break;
+      case LoggerArgDouble: {
+        double d = va_arg(ap, double);
+        memcpy(&value, &d, sizeof(value));
+        break;
+      }
+      case LoggerArgPointer:
+        value = (uintptr_t)va_arg(ap, void *);
+        break;
+      case LoggerArgString: {
+        const char *str = va_arg(ap, const char *);
+        if (str == NULL) {
+          value = LOGGER_NULL_STRING;
+          break;
+        }
+        // Whatever doesn't fit is cut off
+        size_t room = LOGGER_STRING_SIZE - stringsUsed;
+        size_t length = strlen(str);
+        if (length >= room) {
+          length = (room > 0) ? room - 1 : 0;
+        }
+        if (room == 0) {
+          value = LOGGER_NULL_STRING;
+          break;
+        }
+        memcpy(record->strings + stringsUsed, str, length);
+        record->strings[stringsUsed + length] = '\0';
+        value = stringsUsed;
+        stringsUsed += length + 1;
+        break;
+      }
+      case LoggerArgNone:
+        break;
+    }
+    record->args[count++] = value;
+  }
+  return true;
+}
+
+void logger_log(logger_t *l, LoggerSubsystem subsystem, const char *format, ...) {
+  va_list ap;
+  if (l == NULL) {
+    va_start(ap, format);
+    vfprintf(stdout, format, ap);
+    va_end(ap);
+    return;
+  }
+  if ((l->enabled & (1U << subsystem)) == 0) {
+    return;
+  }
+
+  logger_record_t *record = logger_reserve(l);
+  record->format = format;
+  record->subsystem = subsystem;
+  record->timestamp = (l->clock != NULL) ? *l->clock : 0;
+  record->timestamped = l->timestamps;
+
+  va_start(ap, format);
+  va_list copy;
+  va_copy(copy, ap);
+  if (logger_capture(record, format, ap) == false) {
+    // Too much for a record: format it now, as much as fits
+    record->format = NULL;
+    vsnprintf(record->strings, LOGGER_STRING_SIZE, format, copy);
+  }
+  va_end(copy);
+  va_end(ap);
+
+  logger_commit(l);
+}
+
+void logger_flush(logger_t *l) {
+  if (l == NULL) {
+    fflush(stdout);
+    return;
+  }
+
+  while (__atomic_load_n(&l->written, __ATOMIC_ACQUIRE) != l->head) {
+    logger_wake(l);
+    sched_yield();
+  }
+  fflush(__atomic_load_n(&l->file, __ATOMIC_ACQUIRE));
+}
+
+#pragma mark - Writing out
+static void logger_write_out(logger_t *l, FILE *fp) {
+  if (l->outLength > 0) {
+    fwrite(l->out, 1, l->outLength, fp);
+    l->outLength = 0;
+  }
+}
+
+static void logger_append(logger_t *l, FILE *fp, const char *text, size_t length) {
+  while (length > 0) {
+    if (l->outLength == LOGGER_OUT_SIZE) {
+      logger_write_out(l, fp);
+    }
+    size_t chunk = LOGGER_OUT_SIZE - l->outLength;
+    if (chunk > length) {
+      chunk = length;
+    }
+    memcpy(l->out + l->outLength, text, chunk);
+    l->outLength += chunk;
+    text += chunk;
+    length -= chunk;
+  }
+}
+
+static void logger_write_text(logger_t *l, FILE *fp, const logger_record_t *record, const char *text, size_t length) {
+  while (length > 0) {
+    if (l->lineStart == true && record->timestamped == true) {
+      char stamp[32];
+      int stampLength = snprintf(stamp, sizeof(stamp), "[%llu] ", (unsigned long long)record->timestamp);
+      logger_append(l, fp, stamp, (size_t)stampLength);
+    }
+
+    const char *newline = memchr(text, '\n', length);
+    size_t chunk = (newline != NULL) ? (size_t)(newline - text) + 1 : length;
+    logger_append(l, fp, text, chunk);
+    l->lineStart = (newline != NULL);
+
+    text += chunk;
+    length -= chunk;
+  }
+}
+
+#define LOGGER_FORMAT(__value__) \
+  ((spec->stars == 0) ? snprintf(buf, size, conv, __value__) : \
+   (spec->stars == 1) ? snprintf(buf, size, conv, star0, __value__) : \
+                        snprintf(buf, size, conv, star0, star1, __value__))
+
+static void logger_format_arg(char *buf, size_t size, const logger_spec_t *spec, const logger_record_t *record, const uint64_t *args) {
+  char conv[32];
+  if (spec->length >= sizeof(conv)) {
+    buf[0] = '\0';
+    return;
+  }
+  memcpy(conv, spec->start, spec->length);
+  conv[spec->length] = '\0';
+
+  int star0 = (spec->stars > 0) ? (int)args[0] : 0;
+  int star1 = (spec->stars > 1) ? (int)args[1] : 0;
+  uint64_t value = args[spec->stars];
+
+  switch (spec->type) {
+    case LoggerArgInt:
+      LOGGER_FORMAT((unsigned int)value);
+      break;
+    case LoggerArgLong:
+      LOGGER_FORMAT((unsigned long)value);
+      break;
+    case LoggerArgLongLong:
+      LOGGER_FORMAT((unsigned long long)value);
+      break;
+    case LoggerArgSize:
+      LOGGER_FORMAT((size_t)value);
+      break;
+    case LoggerArgDouble: {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      LOGGER_FORMAT(d);
+      break;
+    }
+    case LoggerArgPointer:
+      LOGGER_FORMAT((void *)(uintptr_t)value);
+      break;
+    case LoggerArgString:
+      LOGGER_FORMAT((value == LOGGER_NULL_STRING) ? "(null)" : record->strings + value);
+      break;
+    case LoggerArgNone:
+      buf[0] = '\0';
+      break;
+  }
+}
+
+static void logger_write_record(logger_t *l, FILE *fp, const logger_record_t *record) {
+  if (record->format == NULL) {
+    logger_write_text(l, fp, record, record->strings, strlen(record->strings));
+    return;
+  }
+
+  const uint64_t *args = record->args;
+  const char *p = record->format;
+  logger_spec_t spec;
+  while (logger_next_spec(p, &spec) == true) {
+    logger_write_text(l, fp, record, p, (size_t)(spec.start - p));
+    p = spec.start + spec.length;
+
+    if (spec.type == LoggerArgNone) {
+      logger_write_text(l, fp, record, "%", 1);
+      continue;
+    }
+
+    char buf[256];
+    logger_format_arg(buf, sizeof(buf), &spec, record, args);
+    logger_write_text(l, fp, record, buf, strlen(buf));
+    args += spec.stars + 1;
+  }
+  logger_write_text(l, fp, record, p, strlen(p));
+}
+
+static void *logger_thread(void *arg) {
+  logger_t *l = arg;
+  bool wrote = false;
+
+  while (true) {
+    uint32_t tail = l->tail;
+    uint32_t head = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+      FILE *fp = __atomic_load_n(&l->file, __ATOMIC_ACQUIRE);
+      for (; tail != head; tail++) {
+        // Keep a record that fits in one piece
+        if (l->outLength > LOGGER_OUT_SIZE / 2) {
+          logger_write_out(l, fp);
+        }
+        logger_write_record(l, fp, &l->records[tail & (LOGGER_RING_SIZE - 1)]);
+        // Let a full ring go on as soon as there's room
+        __atomic_store_n(&l->tail, tail + 1, __ATOMIC_RELEASE);
+      }
+      logger_write_out(l, fp);
+      __atomic_store_n(&l->written, tail, __ATOMIC_RELEASE);
+      wrote = true;
+      continue;
+    }
+
+    // Nothing left: get what was written out of the FILE's buffer,
+    // and wait for more
+    if (wrote == true) {
+      fflush(__atomic_load_n(&l->file, __ATOMIC_ACQUIRE));
+      wrote = false;
+    }
+
+    pthread_mutex_lock(&l->lock);
+    __atomic_store_n(&l->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&l->head, __ATOMIC_SEQ_CST) == tail) {
+      if (l->quit == true) {
+        pthread_mutex_unlock(&l->lock);
+        break;
+      }
+
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      struct timespec deadline;
+      deadline.tv_sec = now.tv_sec + 1;
+      deadline.tv_nsec = now.tv_usec * 1000;
+      pthread_cond_timedwait(&l->cond, &l->lock, &deadline);
+    }
+    __atomic_store_n(&l->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&l->lock);
+  }
+  return NULL;
+}
+
+#pragma mark -
+logger_t *logger_new(FILE *file) {
+  logger_t *l = calloc(1, sizeof(logger_t));
+  if (l == NULL) {
+    return NULL;
+  }
+  l->records = calloc(LOGGER_RING_SIZE, sizeof(logger_record_t));
+  if (l->records == NULL) {
+    free(l);
+    return NULL;
+  }
+
+  l->file = file;
+  l->enabled = (1U << LoggerSubsystemCount) - 1;
+  l->lineStart = true;
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->cond, NULL);
+
+  if (pthread_create(&l->thread, NULL, logger_thread, l) != 0) {
+    pthread_cond_destroy(&l->cond);
+    pthread_mutex_destroy(&l->lock);
+    free(l->records);
+    free(l);
+    return NULL;
+  }
+  return l;
+}
+
+void logger_del(logger_t *l) {
+  if (l == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&l->lock);
+  l->quit = true;
+  pthread_cond_signal(&l->cond);
+  pthread_mutex_unlock(&l->lock);
+  pthread_join(l->thread, NULL);
+
+  pthread_cond_destroy(&l->cond);
+  pthread_mutex_destroy(&l->lock);
+  free(l->records);
+  free(l);
+}
+
+void logger_set_file(logger_t *l, FILE *file) {
+  logger_flush(l);
+  __atomic_store_n(&l->file, file, __ATOMIC_RELEASE);
+}
+
+void logger_set_clock(logger_t *l, const unsigned long long *clock) {
+  l->clock = clock;
+}
+
+void logger_set_timestamps(logger_t *l, bool timestamps) {
+  l->timestamps = timestamps;
+}
+
+void logger_set_enabled(logger_t *l, LoggerSubsystem subsystem, bool enabled) {
+  if (enabled == true) {
+    l->enabled |= (1U << subsystem);
+  }
+  else {
+    l->enabled &= ~(1U << subsystem);
+  }
+}
+
+bool logger_get_enabled(logger_t *l, LoggerSubsystem subsystem) {
+  return ((l->enabled & (1U << subsystem)) != 0);
+}
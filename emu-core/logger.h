@@ -0,0 +1,55 @@
+//
+//  logger.h
+//  Leibniz
+//
+//  Buffered logging. A log call while the machine runs doesn't format
+//  anything: it copies a record of the instruction count, the
+//  subsystem, the format and the arguments into a ring buffer, and a
+//  thread of the logger's own formats the records and writes them
+//  out. The format is the event: only its address is kept, so it has
+//  to be a literal. Strings passed for %s are copied, up to a limit.
+//
+//  One thread at a time may log to a logger and change what it logs.
+//  Logging to a NULL logger writes to stdout right away.
+//
+
+#ifndef __Leibniz__logger__
+#define __Leibniz__logger__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  LoggerNewton = 0,
+  LoggerRunt,
+  LoggerMemory,
+  LoggerPCMCIA,
+  LoggerSubsystemCount,
+} LoggerSubsystem;
+
+typedef struct logger_s logger_t;
+
+logger_t *logger_new(FILE *file);
+// Writes out everything logged before it goes
+void logger_del(logger_t *l);
+
+void logger_set_file(logger_t *l, FILE *file);
+// Where the instruction count for each record comes from
+void logger_set_clock(logger_t *l, const unsigned long long *clock);
+// Start each line with the instruction count it was logged at
+void logger_set_timestamps(logger_t *l, bool timestamps);
+// Drop what a subsystem logs. All are enabled to begin with.
+void logger_set_enabled(logger_t *l, LoggerSubsystem subsystem, bool enabled);
+bool logger_get_enabled(logger_t *l, LoggerSubsystem subsystem);
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 3, 4)))
+#endif
+void logger_log(logger_t *l, LoggerSubsystem subsystem, const char *format, ...);
+
+// Wait until everything logged so far has been written out, e.g.
+// before writing to the same file directly
+void logger_flush(logger_t *l);
+
+#endif /* defined(__Leibniz__logger__) */
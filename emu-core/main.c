@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 
 #define MAX(a, b)    (((a) > (b)) ? (a) : (b))
 
@@ -109,25 +110,70 @@ int32_t leibniz_sys_set_input_notify(void *ext, uint32_t fildes, uint32_t addr)
 }
 
 #pragma mark -
-void newton_display_open(int width, int height) {}
-void newton_display_set_framebuffer(const char *display, int width, int height) {}
 
-#pragma mark -
+// Boots the ROM without the monitor for the given number of
+// instructions and reports the time taken.
+void run_benchmark(newton_t *newton, int32_t count) {
+  struct timeval start, end;
+  
+  gettimeofday(&start, NULL);
+  newton_emulate(newton, count);
+  gettimeofday(&end, NULL);
+  
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+  if (secs <= 0) {
+    secs = 0.000001;
+  }
+  
+  fprintf(stderr, "%i instructions in %.3f s (%.2f MIPS), PC=0x%08x\n",
+          count, secs, count / secs / 1000000.0, arm_get_pc(newton->arm));
+}
 
 void print_usage(const char *name) {
-  fprintf(stderr, "usage: %s [-b bootmode] [-d debugmode] [-m mapfile] romfile\n", name);
+  fprintf(stderr, "usage: %s [-b bootmode] [-c host|virtual|synced] [-d debugmode] [-f] [-m mapfile] [-r recordfile] [-p replayfile] [-t instructions] [-s pty|tcp:port] [-i pty|tcp:port] romfile\n", name);
   exit(1);
 }
 
+// spec is "pty" or "tcp:port"
+int open_serial_bridge(newton_t *newton, uint8_t channel, const char *spec) {
+  unsigned int port = 0;
+  int result = -1;
+  if (strcmp(spec, "pty") == 0) {
+    result = newton_serial_bridge_pty(newton, channel);
+  }
+  else if (sscanf(spec, "tcp:%u", &port) == 1 && port <= 0xffff) {
+    result = newton_serial_bridge_tcp(newton, channel, (uint16_t)port);
+  }
+  else {
+    return -1;
+  }
+  
+  const char *channelName = (channel == RuntSerialChannelA) ? "serial" : "IR";
+  if (result != 0) {
+    fprintf(stderr, "Couldn't bridge the %s port to %s\n", channelName, spec);
+  }
+  else {
+    fprintf(stderr, "%s port bridged to %s\n", channelName, bridge_get_name(newton_get_serial_bridge(newton, channel)));
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
   extern char *optarg;
   int c, err = 0;
   
   char *bootmode = NULL;
+  char *clockmode = NULL;
   char *mapname = NULL;
+  char *recordFile = NULL;
+  char *replayFile = NULL;
+  char *serialBridge = NULL;
+  char *irBridge = NULL;
   int debugmode = 0;
+  bool fastSerial = false;
+  int32_t benchmark = 0;
   
-  while ((c = getopt(argc, argv, "b:m:d:")) != -1) {
+  while ((c = getopt(argc, argv, "b:c:m:d:fi:p:r:s:t:")) != -1) {
     switch (c) {
       case 'd':
         debugmode = atoi(optarg);
@@ -135,9 +181,30 @@ int main(int argc, char **argv) {
       case 'b':
         bootmode = optarg;
         break;
+      case 'c':
+        clockmode = optarg;
+        break;
+      case 'f':
+        fastSerial = true;
+        break;
       case 'm':
         mapname = optarg;
         break;
+      case 'r':
+        recordFile = optarg;
+        break;
+      case 'p':
+        replayFile = optarg;
+        break;
+      case 't':
+        benchmark = atoi(optarg);
+        break;
+      case 's':
+        serialBridge = optarg;
+        break;
+      case 'i':
+        irBridge = optarg;
+        break;
       case '?':
         err = 1;
         break;
@@ -155,6 +222,15 @@ int main(int argc, char **argv) {
     return -1;
   }
   
+  // Before anything is sent to the machine, so that the boot mode
+  // gets recorded, or comes from the recording
+  if (recordFile != NULL && newton_input_record_start(newton, recordFile) == -1) {
+    return -1;
+  }
+  if (replayFile != NULL && newton_input_replay_start(newton, replayFile) == -1) {
+    return -1;
+  }
+  
   if (bootmode != NULL) {
     newton_set_bootmode(newton, atoi(bootmode));
   }
@@ -163,12 +239,48 @@ int main(int argc, char **argv) {
     newton_load_mapfile(newton, mapname);
   }
   
-  newton_set_log_flags(newton, NewtonLogAll, 1);
+  if (fastSerial == true) {
+    runt_set_fast_serial(newton_get_runt(newton), true);
+  }
+  
+  if (serialBridge != NULL && open_serial_bridge(newton, RuntSerialChannelA, serialBridge) != 0) {
+    print_usage(argv[0]);
+  }
+  if (irBridge != NULL && open_serial_bridge(newton, RuntSerialChannelB, irBridge) != 0) {
+    print_usage(argv[0]);
+  }
+  
+  // Benchmarks run on the virtual clock, so that the ROM does the
+  // same work on every host
+  if (clockmode == NULL && benchmark > 0) {
+    clockmode = "virtual";
+  }
   
-  runt_t *runt = newton_get_runt(newton);
-  runt_set_log_flags(runt, RuntLogAll, 1);
+  if (clockmode != NULL) {
+    runt_t *runt = newton_get_runt(newton);
+    if (strcmp(clockmode, "host") == 0) {
+      runt_set_clock_mode(runt, RuntClockHost);
+    }
+    else if (strcmp(clockmode, "virtual") == 0) {
+      runt_set_clock_mode(runt, RuntClockVirtual);
+    }
+    else if (strcmp(clockmode, "synced") == 0) {
+      runt_set_clock_mode(runt, RuntClockSynced);
+    }
+    else {
+      print_usage(argv[0]);
+    }
+  }
+  
+  if (benchmark == 0) {
+    newton_set_log_flags(newton, NewtonLogAll, 1);
+    
+    runt_t *runt = newton_get_runt(newton);
+    runt_set_log_flags(runt, RuntLogAll, 1);
+    
+    newton_set_break_on_unknown_memory(newton, true);
+  }
   
-  newton_set_break_on_unknown_memory(newton, true);
   if (debugmode) {
     newton_set_debugger_bits(newton, 1);
     newton_set_newt_config(newton, kConfigBit3 | kDontPauseCPU | kStopOnThrows | kEnableStdout | kDefaultStdioOn | kEnableListener);
@@ -183,6 +295,12 @@ int main(int argc, char **argv) {
                    leibniz_sys_write,
                    leibniz_sys_set_input_notify);
   
+  if (benchmark > 0) {
+    run_benchmark(newton, benchmark);
+    newton_del(newton);
+    return 0;
+  }
+  
   monitor_t *monitor = monitor_new();
   monitor_set_newton(monitor, newton);
   monitor_run(monitor);
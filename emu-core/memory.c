@@ -10,17 +10,54 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #if DISABLE_LOGGING
 #define LOG_STR(...) {}
 #define LOG_READS (false)
 #define LOG_WRITES (false)
 #else
-#define LOG_STR(...) fprintf(mem->logFile, __VA_ARGS__)
+#define LOG_STR(...) logger_log(mem->logger, LoggerMemory, __VA_ARGS__)
 #define LOG_READS (mem->logsReads)
 #define LOG_WRITES (mem->logsWrites)
 #endif
 
+static inline uint32_t memory_load32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void memory_store32(uint8_t *p, uint32_t val) {
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+}
+
+struct memory_page_s {
+  uint32_t refs;
+  uint8_t data[MEMORY_PAGE_SIZE];
+};
+
+struct memory_snapshot_s {
+  uint32_t length;
+  uint32_t pageCount;
+  int8_t flashSequence;
+  memory_page_t *pages[];
+};
+
+static inline void memory_mark_page(memory_t *mem, uint32_t physaddr) {
+  if (mem->dirty != NULL) {
+    uint32_t page = physaddr >> MEMORY_PAGE_SHIFT;
+    mem->dirty[page >> 3] |= (1 << (page & 7));
+  }
+}
+
+static void memory_page_release(memory_page_t *page) {
+  if (page != NULL && --page->refs == 0) {
+    free(page);
+  }
+}
+
 memory_t *memory_new(char *name, uint32_t base, uint32_t length) {
   memory_t *mem = calloc(1, sizeof(memory_t));
   mem->contents = calloc(length, sizeof(uint8_t));
@@ -28,7 +65,23 @@ memory_t *memory_new(char *name, uint32_t base, uint32_t length) {
   
   memory_add_mapping(mem, base, 0, length);
   
-  mem->logFile = stdout;
+  if (name != NULL) {
+    mem->name = calloc(strlen(name) + 1, sizeof(char));
+    strcpy(mem->name, name);
+  }
+  
+  return mem;
+}
+
+memory_t *memory_new_mapped(char *name, uint32_t base, void *mapping, size_t mappingLength, uint32_t offset, uint32_t length) {
+  memory_t *mem = calloc(1, sizeof(memory_t));
+  mem->mapping = mapping;
+  mem->mappingLength = mappingLength;
+  mem->contents = (uint8_t *)mapping + offset;
+  mem->length = length;
+  mem->readOnly = true;
+  
+  memory_add_mapping(mem, base, 0, length);
   
   if (name != NULL) {
     mem->name = calloc(strlen(name) + 1, sizeof(char));
@@ -39,7 +92,10 @@ memory_t *memory_new(char *name, uint32_t base, uint32_t length) {
 }
 
 void memory_delete(memory_t *mem) {
-  if (mem->contents != NULL) {
+  if (mem->mapping != NULL) {
+    munmap(mem->mapping, mem->mappingLength);
+  }
+  else if (mem->contents != NULL) {
     free(mem->contents);
   }
   if (mem->name != NULL) {
@@ -50,15 +106,40 @@ void memory_delete(memory_t *mem) {
     free(mem->mappings);
     mem->mappings = next;
   }
+  if (mem->pages != NULL) {
+    uint32_t pageCount = (mem->length + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+    for (uint32_t i=0; i<pageCount; i++) {
+      memory_page_release(mem->pages[i]);
+    }
+    free(mem->pages);
+    free(mem->dirty);
+  }
   free(mem);
 }
 
 void memory_clear(memory_t *mem) {
+  if (mem->mapping != NULL) {
+    return;
+  }
   memset(mem->contents, 0, memory_get_length(mem));
+  if (mem->dirty != NULL) {
+    uint32_t pageCount = (mem->length + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+    memset(mem->dirty, 0xff, (pageCount + 7) / 8);
+  }
 }
 
 uint32_t memory_get_length(memory_t *mem) {
-  return mem->mappings->length;
+  return mem->length;
+}
+
+uint8_t *memory_get_contents(memory_t *mem) {
+  return mem->contents;
+}
+
+// Whether the CPU may access the contents directly, i.e. whether
+// nothing needs to see the individual accesses.
+bool memory_is_direct(memory_t *mem) {
+  return (mem->flashCode == 0 && LOG_READS == false && LOG_WRITES == false);
 }
 
 void memory_set_flash_code(memory_t *mem, uint32_t flashCode) {
@@ -66,6 +147,10 @@ void memory_set_flash_code(memory_t *mem, uint32_t flashCode) {
 }
 
 void memory_set_readonly(memory_t *mem, bool readOnly) {
+  // The pages of a file mapping can't be written
+  if (mem->mapping != NULL) {
+    return;
+  }
   mem->readOnly = readOnly;
 }
 
@@ -89,20 +174,16 @@ bool memory_get_logs_writes(memory_t *mem) {
   return mem->logsWrites;
 }
 
-void memory_set_log_file(memory_t *mem, FILE *logFile) {
-  mem->logFile = logFile;
-}
-
-FILE *memory_get_log_file(memory_t *mem) {
-  return mem->logFile;
+void memory_set_logger(memory_t *mem, logger_t *logger) {
+  mem->logger = logger;
 }
 
 void memory_write_to_file(memory_t *mem, const char *file) {
-  FILE *fp = fopen(file, "w");
-  for (uint32_t i=0; i<mem->length/4; i++) {
-    uint32_t word = htonl(*(mem->contents + i));
-    fwrite(&word, sizeof(word), 1, fp);
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    return;
   }
+  fwrite(mem->contents, 1, mem->length, fp);
   fclose(fp);
 }
 
@@ -133,7 +214,7 @@ static inline uint32_t memory_physaddr_for_virtaddr(memory_t *mem, uint32_t virt
 
 uint32_t memory_get_uint32(memory_t *mem, uint32_t address, uint32_t pc) {
   uint32_t physaddr = memory_physaddr_for_virtaddr(mem, address);
-  uint32_t result = mem->contents[physaddr/4];
+  uint32_t result = memory_load32(mem->contents + (physaddr & ~3));
   
   if (mem->flashSequence == 4 && physaddr == 4) {
     result = mem->flashCode;
@@ -203,7 +284,8 @@ uint32_t memory_set_uint32(memory_t *mem, uint32_t address, uint32_t val, uint32
       }
     }
     
-    mem->contents[physaddr/4] = val;
+    memory_store32(mem->contents + (physaddr & ~3), val);
+    memory_mark_page(mem, physaddr);
   }
   
   return val;
@@ -215,10 +297,7 @@ uint8_t memory_get_uint8(memory_t *mem, uint32_t addr, uint32_t pc) {
   
   uint32_t physaddr = memory_physaddr_for_virtaddr(mem, aligned);
   
-  uint32_t word = mem->contents[physaddr/4];
-  word >>= ((3-bytenum) * 8);
-  
-  uint8_t result = (word & 0xff);
+  uint8_t result = mem->contents[(physaddr & ~3) + bytenum];
   
   if (LOG_READS) {
     LOG_STR("[%s:READ] PC:0x%08x addr:0x%08x => val:0x%02x\n", mem->name, pc, addr, result);
@@ -228,19 +307,10 @@ uint8_t memory_get_uint8(memory_t *mem, uint32_t addr, uint32_t pc) {
 }
 
 uint8_t memory_set_uint8(memory_t *mem, uint32_t addr, uint8_t val, uint32_t pc) {
-  static const unsigned masktab[] = {
-    0x00ffffff, 0xff00ffff, 0xffff00ff, 0xffffff00
-  };
-  
   int bytenum = addr & 3;
   uint32_t aligned = addr - bytenum;
-  uint32_t mask = masktab[addr & 3];
   
   uint32_t physaddr = memory_physaddr_for_virtaddr(mem, aligned);
-  uint32_t word = mem->contents[physaddr/4];
-  
-  uint32_t newval = word & mask;
-  newval |= (val << ((3 - bytenum) * 8));
   
   if (LOG_WRITES) {
     LOG_STR("[%s:WRITE] PC:0x%08x addr:0x%08x => val:0x%02x\n", mem->name, pc, addr, val);
@@ -250,9 +320,150 @@ uint8_t memory_set_uint8(memory_t *mem, uint32_t addr, uint8_t val, uint32_t pc)
     LOG_STR("[%s:WRITE] Attempted write to read-only memory! PC:0x%08x addr:0x%08x => val:0x%02x\n", mem->name, pc, addr, val);
   }
   else {
-    mem->contents[physaddr/4] = newval;
+    mem->contents[(physaddr & ~3) + bytenum] = val;
+    memory_mark_page(mem, physaddr);
   }
   
   
   return val;
 }
+
+void memory_mark_dirty(memory_t *mem, uint32_t address) {
+  if (mem->dirty != NULL) {
+    memory_mark_page(mem, memory_physaddr_for_virtaddr(mem, address));
+  }
+}
+
+#pragma mark - Snapshots
+static bool memory_snapshot_prepare(memory_t *mem, uint32_t pageCount) {
+  if (mem->pages != NULL) {
+    return true;
+  }
+  
+  // Until the first snapshot nothing is known about the contents,
+  // so every page counts as written.
+  mem->pages = calloc(pageCount, sizeof(memory_page_t *));
+  mem->dirty = calloc((pageCount + 7) / 8, sizeof(uint8_t));
+  if (mem->pages == NULL || mem->dirty == NULL) {
+    free(mem->pages);
+    free(mem->dirty);
+    mem->pages = NULL;
+    mem->dirty = NULL;
+    return false;
+  }
+  memset(mem->dirty, 0xff, (pageCount + 7) / 8);
+  return true;
+}
+
+static inline bool memory_page_is_dirty(memory_t *mem, uint32_t page) {
+  return ((mem->dirty[page >> 3] >> (page & 7)) & 1) != 0;
+}
+
+static inline uint32_t memory_page_length(memory_t *mem, uint32_t page) {
+  uint32_t offset = page << MEMORY_PAGE_SHIFT;
+  return (mem->length - offset < MEMORY_PAGE_SIZE) ? mem->length - offset : MEMORY_PAGE_SIZE;
+}
+
+memory_snapshot_t *memory_snapshot_save(memory_t *mem) {
+  uint32_t pageCount = (mem->length + MEMORY_PAGE_SIZE - 1) >> MEMORY_PAGE_SHIFT;
+  if (mem->mapping != NULL) {
+    pageCount = 0;
+  }
+  else if (memory_snapshot_prepare(mem, pageCount) == false) {
+    return NULL;
+  }
+  
+  memory_snapshot_t *snap = calloc(1, sizeof(memory_snapshot_t) + pageCount * sizeof(memory_page_t *));
+  if (snap == NULL) {
+    return NULL;
+  }
+  snap->length = mem->length;
+  snap->pageCount = pageCount;
+  snap->flashSequence = mem->flashSequence;
+  
+  for (uint32_t i=0; i<pageCount; i++) {
+    memory_page_t *page = mem->pages[i];
+    if (page == NULL || memory_page_is_dirty(mem, i) == true) {
+      page = malloc(sizeof(memory_page_t));
+      if (page == NULL) {
+        memory_snapshot_delete(snap);
+        return NULL;
+      }
+      page->refs = 1;
+      memcpy(page->data, mem->contents + (i << MEMORY_PAGE_SHIFT), memory_page_length(mem, i));
+      
+      memory_page_release(mem->pages[i]);
+      mem->pages[i] = page;
+      mem->dirty[i >> 3] &= ~(1 << (i & 7));
+    }
+    
+    page->refs++;
+    snap->pages[i] = page;
+  }
+  
+  return snap;
+}
+
+bool memory_snapshot_restore(memory_t *mem, memory_snapshot_t *snap) {
+  if (snap->length != mem->length) {
+    return false;
+  }
+  if (snap->pageCount == 0) {
+    return true;
+  }
+  if (mem->mapping != NULL || memory_snapshot_prepare(mem, snap->pageCount) == false) {
+    return false;
+  }
+  
+  // A page needs copying if it was written since the last snapshot,
+  // or if it last matched a different saved page
+  for (uint32_t i=0; i<snap->pageCount; i++) {
+    memory_page_t *page = snap->pages[i];
+    if (mem->pages[i] != page || memory_page_is_dirty(mem, i) == true) {
+      memcpy(mem->contents + (i << MEMORY_PAGE_SHIFT), page->data, memory_page_length(mem, i));
+      
+      page->refs++;
+      memory_page_release(mem->pages[i]);
+      mem->pages[i] = page;
+    }
+  }
+  memset(mem->dirty, 0, (snap->pageCount + 7) / 8);
+  
+  mem->flashSequence = snap->flashSequence;
+  
+  return true;
+}
+
+void memory_snapshot_delete(memory_snapshot_t *snap) {
+  if (snap == NULL) {
+    return;
+  }
+  for (uint32_t i=0; i<snap->pageCount; i++) {
+    memory_page_release(snap->pages[i]);
+  }
+  free(snap);
+}
+
+uint32_t memory_snapshot_get_length(memory_snapshot_t *snap) {
+  return snap->length;
+}
+
+int8_t memory_snapshot_get_flash_sequence(memory_snapshot_t *snap) {
+  return snap->flashSequence;
+}
+
+uint32_t memory_snapshot_get_page_count(memory_snapshot_t *snap) {
+  return snap->pageCount;
+}
+
+const uint8_t *memory_snapshot_get_page(memory_snapshot_t *snap, uint32_t page) {
+  return snap->pages[page]->data;
+}
+
+void memory_load_page(memory_t *mem, uint32_t page, const uint8_t *data) {
+  if (mem->mapping != NULL || (page << MEMORY_PAGE_SHIFT) >= mem->length) {
+    return;
+  }
+  memcpy(mem->contents + (page << MEMORY_PAGE_SHIFT), data, memory_page_length(mem, page));
+  memory_mark_page(mem, page << MEMORY_PAGE_SHIFT);
+}
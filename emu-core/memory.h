@@ -10,11 +10,22 @@
 #define memory_h
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "logger.h"
+
 typedef struct memory_map_s memory_map_t;
 
+// Snapshots copy the contents a page at a time. A page that was not
+// written between two snapshots is shared by both.
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE  (1 << MEMORY_PAGE_SHIFT)
+
+typedef struct memory_page_s memory_page_t;
+typedef struct memory_snapshot_s memory_snapshot_t;
+
 struct memory_map_s {
   uint32_t virtaddr;
   uint32_t physaddr;
@@ -25,26 +36,41 @@ struct memory_map_s {
 typedef struct memory_s {
   char *name;
   
-  uint32_t *contents;
+  uint8_t *contents; // in guest (big endian) byte order
   uint32_t length;
+  
+  // The read-only file mapping holding contents, if any
+  void *mapping;
+  size_t mappingLength;
   uint32_t flashCode;
   int8_t flashSequence;
   
   memory_map_t *mappings;
   uint32_t mappingCount;
   
+  // The saved page that each page of contents matched at the last
+  // snapshot, and a bit for each page written since. NULL until
+  // the first snapshot.
+  memory_page_t **pages;
+  uint8_t *dirty;
+  
   bool readOnly;
   bool logsReads;
   bool logsWrites;
-  FILE *logFile;
+  logger_t *logger;
 } memory_t;
 
 memory_t *memory_new(char *name, uint32_t base, uint32_t length);
+// Read-only memory served straight from a file mapping, starting
+// offset bytes in. The memory takes ownership of the mapping.
+memory_t *memory_new_mapped(char *name, uint32_t base, void *mapping, size_t mappingLength, uint32_t offset, uint32_t length);
 void memory_delete(memory_t *mem);
 
 void memory_clear(memory_t *mem);
 
 uint32_t memory_get_length(memory_t *mem);
+uint8_t *memory_get_contents(memory_t *mem);
+bool memory_is_direct(memory_t *mem);
 
 void memory_write_to_file(memory_t *mem, const char *file);
 
@@ -59,8 +85,7 @@ bool memory_get_logs_reads(memory_t *mem);
 void memory_set_logs_writes(memory_t *mem, bool logsWrites);
 bool memory_get_logs_writes(memory_t *mem);
 
-void memory_set_log_file(memory_t *mem, FILE *logFile);
-FILE *memory_get_log_file(memory_t *mem);
+void memory_set_logger(memory_t *mem, logger_t *logger);
 
 void memory_add_mapping(memory_t *mem, uint32_t virtaddr, uint32_t physaddr, uint32_t length);
 
@@ -70,4 +95,24 @@ uint32_t memory_set_uint32(memory_t *mem, uint32_t address, uint32_t val, uint32
 uint8_t memory_get_uint8(memory_t *mem, uint32_t address, uint32_t pc);
 uint8_t memory_set_uint8(memory_t *mem, uint32_t address, uint8_t val, uint32_t pc);
 
+// Note a write to the contents that did not go through the set
+// functions, e.g. by the CPU through a direct RAM window
+void memory_mark_dirty(memory_t *mem, uint32_t address);
+
+// Only the pages written since the last snapshot (or restore) are
+// copied. Memory served from a file mapping isn't saved.
+memory_snapshot_t *memory_snapshot_save(memory_t *mem);
+bool memory_snapshot_restore(memory_t *mem, memory_snapshot_t *snap);
+void memory_snapshot_delete(memory_snapshot_t *snap);
+
+uint32_t memory_snapshot_get_length(memory_snapshot_t *snap);
+int8_t memory_snapshot_get_flash_sequence(memory_snapshot_t *snap);
+// Zero for memory that isn't saved
+uint32_t memory_snapshot_get_page_count(memory_snapshot_t *snap);
+// Snapshots that share a page return the same pointer for it
+const uint8_t *memory_snapshot_get_page(memory_snapshot_t *snap, uint32_t page);
+
+// Overwrite a page of contents (the last one may be short)
+void memory_load_page(memory_t *mem, uint32_t page, const uint8_t *data);
+
 #endif /* memory_h */
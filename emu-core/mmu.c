@@ -74,14 +74,105 @@ void arm_mmu_permission_fault (arm_t *c, uint32_t addr, unsigned domn, int sect)
 }
 
 
+/*
+ * Get the host address of size bytes at physical address addr or
+ * NULL if they are not all in one (writable, if write is true) RAM
+ * window, or are in a slow page.
+ */
 static inline
-void arm_tbuf_set (arm_tbuf_t *tb, uint32_t vaddr, uint32_t raddr, uint32_t mask)
+unsigned char *arm_get_ram (arm_t *c, uint32_t addr, unsigned size, int write)
 {
-	tb->vaddr = vaddr & mask;
-	tb->vmask = mask;
-	tb->raddr = raddr & mask;
-	tb->rmask = ~mask;
-	tb->valid = 1;
+	unsigned  i;
+	uint32_t  offs;
+	arm_ram_t *ram;
+
+	if (arm_is_slow_page (c, addr)) {
+		return (NULL);
+	}
+
+	for (i = 0; i < c->ram_cnt; i++) {
+		ram = &c->ram[i];
+		offs = addr - ram->base;
+
+		if ((offs < ram->size) && (size <= (ram->size - offs))) {
+			if (write && (ram->writable == 0)) {
+				return (NULL);
+			}
+
+			return (ram->data + offs);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Like arm_get_ram() for a single access. size must be a power of
+ * two. Unaligned accesses are left to the memory functions.
+ */
+static inline
+unsigned char *arm_get_host (arm_t *c, uint32_t addr, unsigned size, int write)
+{
+	if (addr & (size - 1)) {
+		return (NULL);
+	}
+
+	return (arm_get_ram (c, addr, size, write));
+}
+
+void arm_tlb_flush (arm_t *c)
+{
+	unsigned     i;
+	arm_copr15_t *mmu;
+
+	mmu = arm_get_mmu (c);
+
+	for (i = 0; i < ARM_TLB_CNT; i++) {
+		mmu->tlb_exec.entry[i].vaddr = ARM_TLB_INVALID;
+		mmu->tlb_read.entry[i].vaddr = ARM_TLB_INVALID;
+		mmu->tlb_write.entry[i].vaddr = ARM_TLB_INVALID;
+	}
+}
+
+static
+void arm_tlb_set (arm_t *c, arm_tlb_t *tlb, uint32_t vaddr, uint32_t raddr,
+	uint32_t mask, unsigned perm, int write)
+{
+	arm_tlb_entry_t *ent;
+
+	if ((mask & 0x00000fff) != 0) {
+		/* tiny page */
+		return;
+	}
+
+	ent = &tlb->entry[(vaddr >> 12) & (ARM_TLB_CNT - 1)];
+
+	ent->vaddr = vaddr & 0xfffff000;
+	ent->raddr = raddr & 0xfffff000;
+	ent->host = arm_get_host (c, ent->raddr, 0x1000, write);
+	ent->perm = perm;
+}
+
+/*
+ * Look up a virtual address in a TLB. Returns NULL if the address
+ * is not in the TLB or the access is not permitted.
+ */
+static inline
+arm_tlb_entry_t *arm_tlb_get (arm_tlb_t *tlb, uint32_t vaddr, int priv)
+{
+	arm_tlb_entry_t *ent;
+
+	ent = &tlb->entry[(vaddr >> 12) & (ARM_TLB_CNT - 1)];
+
+	if (ent->vaddr != (vaddr & 0xfffff000)) {
+		return (NULL);
+	}
+
+	if ((ent->perm & (priv ? ARM_TLB_PRIV : ARM_TLB_USER)) == 0) {
+		return (NULL);
+	}
+
+	return (ent);
 }
 
 
@@ -255,8 +346,15 @@ int arm_translate (arm_t *c, uint32_t *addr, uint32_t *mask,
 		/* small page */
 		ap = 4 + 2 * arm_get_bits (*addr, 10, 2);
 		*addr = (desc2 & 0xfffff000) | (*addr & 0x00000fff);
-		*mask = 0xfffff000;
 		*perm = arm_get_bits (desc2, ap, 2);
+
+		if (arm_get_bits (desc2, 4, 8) == 0x55 * arm_get_bits (desc2, 4, 2)) {
+			*mask = 0xfffff000;
+		}
+		else {
+			/* subpages differ, don't cache the whole page */
+			*mask = 0xfffffc00;
+		}
 		return (0);
 
 	case 0x03:
@@ -282,13 +380,50 @@ int arm_translate (arm_t *c, uint32_t *addr, uint32_t *mask,
 	return (1);
 }
 
+static
+unsigned arm_tlb_perm_read (uint32_t cr, unsigned perm)
+{
+	unsigned ret;
+
+	ret = 0;
+
+	if (arm_mmu_check_perm_read (cr, perm, 0)) {
+		ret |= ARM_TLB_USER;
+	}
+
+	if (arm_mmu_check_perm_read (cr, perm, 1)) {
+		ret |= ARM_TLB_PRIV;
+	}
+
+	return (ret);
+}
+
+static
+unsigned arm_tlb_perm_write (uint32_t cr, unsigned perm)
+{
+	unsigned ret;
+
+	ret = 0;
+
+	if (arm_mmu_check_perm_write (cr, perm, 0)) {
+		ret |= ARM_TLB_USER;
+	}
+
+	if (arm_mmu_check_perm_write (cr, perm, 1)) {
+		ret |= ARM_TLB_PRIV;
+	}
+
+	return (ret);
+}
+
 static
 int arm_translate_exec (arm_t *c, uint32_t *addr, int priv)
 {
-	arm_copr15_t *mmu;
-	unsigned     domn, perm;
-	int          sect;
-	uint32_t     vaddr, mask;
+	arm_copr15_t    *mmu;
+	arm_tlb_entry_t *ent;
+	unsigned        domn, perm;
+	int             sect;
+	uint32_t        vaddr, mask;
 
 	mmu = arm_get_mmu (c);
 
@@ -298,13 +433,11 @@ int arm_translate_exec (arm_t *c, uint32_t *addr, int priv)
 
 	vaddr = *addr;
 
-	if (mmu->tbuf_exec.valid) {
-		arm_tbuf_t *tb = &mmu->tbuf_exec;
+	ent = arm_tlb_get (&mmu->tlb_exec, vaddr, priv);
 
-		if ((vaddr & tb->vmask) == tb->vaddr) {
-			*addr = tb->raddr | (vaddr & tb->rmask);
-			return (0);
-		}
+	if (ent != NULL) {
+		*addr = ent->raddr | (vaddr & 0x00000fff);
+		return (0);
 	}
 
 	if (arm_translate (c, addr, &mask, &domn, &perm, &sect)) {
@@ -323,14 +456,18 @@ int arm_translate_exec (arm_t *c, uint32_t *addr, int priv)
 			arm_exception_prefetch_abort (c);
 			return (1);
 		}
-		arm_tbuf_set (&mmu->tbuf_exec, vaddr, *addr, mask);
+		arm_tlb_set (c, &mmu->tlb_exec, vaddr, *addr, mask,
+			arm_tlb_perm_read (mmu->reg[1], perm), 0
+		);
 		return (0);
 
 	case 0x02: /* undefined */
 		return (0);
 
 	case 0x03: /* manager */
-		arm_tbuf_set (&mmu->tbuf_exec, vaddr, *addr, mask);
+		arm_tlb_set (c, &mmu->tlb_exec, vaddr, *addr, mask,
+			ARM_TLB_USER | ARM_TLB_PRIV, 0
+		);
 		return (0);
 	}
 
@@ -338,7 +475,7 @@ int arm_translate_exec (arm_t *c, uint32_t *addr, int priv)
 }
 
 static
-int arm_translate_read (arm_t *c, uint32_t *addr, int priv)
+int arm_translate_read_miss (arm_t *c, uint32_t *addr, int priv)
 {
 	arm_copr15_t *mmu;
 	unsigned     domn, perm;
@@ -347,21 +484,8 @@ int arm_translate_read (arm_t *c, uint32_t *addr, int priv)
 
 	mmu = arm_get_mmu (c);
 
-	if ((mmu->reg[1] & ARM_C15_CR_M) == 0) {
-		return (0);
-	}
-
 	vaddr = *addr;
 
-	if (mmu->tbuf_read.valid) {
-		arm_tbuf_t *tb = &mmu->tbuf_read;
-
-		if ((vaddr & tb->vmask) == tb->vaddr) {
-			*addr = tb->raddr | (vaddr & tb->rmask);
-			return (0);
-		}
-	}
-
 	if (arm_translate (c, addr, &mask, &domn, &perm, &sect)) {
 		arm_mmu_translation_fault (c, vaddr, domn, sect);
 		return (1);
@@ -378,22 +502,62 @@ int arm_translate_read (arm_t *c, uint32_t *addr, int priv)
 			arm_mmu_permission_fault (c, vaddr, domn, sect);
 			return (1);
 		}
-		arm_tbuf_set (&mmu->tbuf_read, vaddr, *addr, mask);
+		arm_tlb_set (c, &mmu->tlb_read, vaddr, *addr, mask,
+			arm_tlb_perm_read (mmu->reg[1], perm), 0
+		);
 		return (0);
 
 	case 0x02: /* undefined */
 		return (0);
 
 	case 0x03: /* manager */
-		arm_tbuf_set (&mmu->tbuf_read, vaddr, *addr, mask);
+		arm_tlb_set (c, &mmu->tlb_read, vaddr, *addr, mask,
+			ARM_TLB_USER | ARM_TLB_PRIV, 0
+		);
 		return (0);
 	}
 
 	return (0);
 }
 
+/*
+ * Translate a virtual address for reading size bytes. If the data
+ * is in RAM, *host is set to its host address, otherwise to NULL.
+ */
+static inline
+int arm_translate_read (arm_t *c, uint32_t *addr, unsigned size, int priv,
+	unsigned char **host)
+{
+	arm_copr15_t    *mmu;
+	arm_tlb_entry_t *ent;
+	uint32_t        offs;
+
+	mmu = arm_get_mmu (c);
+
+	if (mmu->reg[1] & ARM_C15_CR_M) {
+		ent = arm_tlb_get (&mmu->tlb_read, *addr, priv);
+
+		if (ent != NULL) {
+			offs = *addr & 0x00000fff;
+			*addr = ent->raddr | offs;
+
+			if ((ent->host != NULL) && ((offs & (size - 1)) == 0)) {
+				*host = ent->host + offs;
+				return (0);
+			}
+		}
+		else if (arm_translate_read_miss (c, addr, priv)) {
+			return (1);
+		}
+	}
+
+	*host = arm_get_host (c, *addr, size, 0);
+
+	return (0);
+}
+
 static
-int arm_translate_write (arm_t *c, uint32_t *addr, int priv)
+int arm_translate_write_miss (arm_t *c, uint32_t *addr, int priv)
 {
 	arm_copr15_t *mmu;
 	unsigned     domn, perm;
@@ -402,23 +566,8 @@ int arm_translate_write (arm_t *c, uint32_t *addr, int priv)
 
 	mmu = arm_get_mmu (c);
 
-	if ((mmu->reg[1] & ARM_C15_CR_M) == 0) {
-		return (0);
-	}
-
 	vaddr = *addr;
 
-#if 0
-	if (mmu->tbuf_write.valid) {
-		arm_tbuf_t *tb = &mmu->tbuf_write;
-
-		if ((vaddr & tb->vmask) == tb->vaddr) {
-			*addr = tb->raddr | (vaddr & tb->rmask);
-			return (0);
-		}
-	}
-#endif
-	
 	if (arm_translate (c, addr, &mask, &domn, &perm, &sect)) {
 		arm_mmu_translation_fault (c, vaddr, domn, sect);
 		return (1);
@@ -435,19 +584,117 @@ int arm_translate_write (arm_t *c, uint32_t *addr, int priv)
 			arm_mmu_permission_fault (c, vaddr, domn, sect);
 			return (1);
 		}
-
-		arm_tbuf_set (&mmu->tbuf_write, vaddr, *addr, mask);
-
+		arm_tlb_set (c, &mmu->tlb_write, vaddr, *addr, mask,
+			arm_tlb_perm_write (mmu->reg[1], perm), 1
+		);
 		return (0);
 
 	case 0x02: /* undefined */
 		return (0);
 
 	case 0x03: /* manager */
-		arm_tbuf_set (&mmu->tbuf_write, vaddr, *addr, mask);
+		arm_tlb_set (c, &mmu->tlb_write, vaddr, *addr, mask,
+			ARM_TLB_USER | ARM_TLB_PRIV, 1
+		);
+		return (0);
+	}
+
+	return (0);
+}
+
+/*
+ * Translate a virtual address for writing size bytes. If the data
+ * is in RAM, *host is set to its host address, otherwise to NULL.
+ */
+static inline
+int arm_translate_write (arm_t *c, uint32_t *addr, unsigned size, int priv,
+	unsigned char **host)
+{
+	arm_copr15_t    *mmu;
+	arm_tlb_entry_t *ent;
+	uint32_t        offs;
+
+	mmu = arm_get_mmu (c);
+
+	if (mmu->reg[1] & ARM_C15_CR_M) {
+		ent = arm_tlb_get (&mmu->tlb_write, *addr, priv);
+
+		if (ent != NULL) {
+			offs = *addr & 0x00000fff;
+			*addr = ent->raddr | offs;
+
+			if ((ent->host != NULL) && ((offs & (size - 1)) == 0)) {
+				*host = ent->host + offs;
+				return (0);
+			}
+		}
+		else if (arm_translate_write_miss (c, addr, priv)) {
+			return (1);
+		}
+	}
+
+	*host = arm_get_host (c, *addr, size, 1);
+
+	return (0);
+}
+
+/*
+ * Translate a block transfer of size bytes at virtual address addr
+ * that does not cross a 4K page. If all of it is in RAM, *host is
+ * set to its host address, otherwise to NULL and the words must be
+ * transferred one at a time. A fault is raised exactly as for an
+ * access to the first word.
+ */
+int arm_translate_block (arm_t *c, uint32_t *addr, unsigned size, int write,
+	unsigned char **host)
+{
+	arm_copr15_t    *mmu;
+	arm_tlb_t       *tlb;
+	arm_tlb_entry_t *ent;
+	uint32_t        vaddr;
+	int             priv;
+
+	*host = NULL;
+
+	mmu = arm_get_mmu (c);
+
+	if ((mmu->reg[1] & ARM_C15_CR_M) == 0) {
+		*host = arm_get_ram (c, *addr, size, write);
 		return (0);
 	}
 
+	priv = arm_is_privileged (c);
+	tlb = write ? &mmu->tlb_write : &mmu->tlb_read;
+	vaddr = *addr;
+
+	ent = arm_tlb_get (tlb, vaddr, priv);
+
+	if (ent == NULL) {
+		if (write) {
+			if (arm_translate_write_miss (c, addr, priv)) {
+				return (1);
+			}
+		}
+		else {
+			if (arm_translate_read_miss (c, addr, priv)) {
+				return (1);
+			}
+		}
+
+		/* tiny pages and undefined domains are not in the TLB */
+		ent = arm_tlb_get (tlb, vaddr, priv);
+
+		if (ent == NULL) {
+			return (0);
+		}
+	}
+
+	*addr = ent->raddr | (vaddr & 0x00000fff);
+
+	if (ent->host != NULL) {
+		*host = ent->host + (vaddr & 0x00000fff);
+	}
+
 	return (0);
 }
 
@@ -491,17 +738,26 @@ int arm_translate_extern (arm_t *c, uint32_t *addr, unsigned xlat,
 
 int arm_ifetch (arm_t *c, uint32_t addr, uint32_t *val)
 {
-	uint32_t tmp;
-
 	addr &= ~0x03UL;
 
 	if (arm_translate_exec (c, &addr, arm_is_privileged (c))) {
 		return (1);
 	}
 
-	if (addr < c->ram_cnt) {
-		unsigned char *p = &c->ram[addr];
+	arm_ifetch_real (c, addr, val);
+
+	return (0);
+}
+
+/* fetch an instruction from a physical address */
+void arm_ifetch_real (arm_t *c, uint32_t addr, uint32_t *val)
+{
+	uint32_t      tmp;
+	unsigned char *p;
+
+	p = arm_get_host (c, addr, 4, 0);
 
+	if (p != NULL) {
 		if (c->bigendian) {
 #ifdef ARM_HOST_BE
 			tmp = *(uint32_t *)p;
@@ -528,18 +784,24 @@ int arm_ifetch (arm_t *c, uint32_t addr, uint32_t *val)
 	}
 
 	*val = tmp;
+}
 
-	return (0);
+/* translate a virtual address for execution */
+int arm_translate_ifetch (arm_t *c, uint32_t *addr)
+{
+	return (arm_translate_exec (c, addr, arm_is_privileged (c)));
 }
 
 int arm_dload8 (arm_t *c, uint32_t addr, uint8_t *val)
 {
-	if (arm_translate_read (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 1, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if (addr < c->ram_cnt) {
-		*val = c->ram[addr];
+	if (p != NULL) {
+		*val = *p;
 	}
 	else {
 		*val = c->get_uint8 (c->mem_ext, addr);
@@ -550,13 +812,13 @@ int arm_dload8 (arm_t *c, uint32_t addr, uint8_t *val)
 
 int arm_dload16 (arm_t *c, uint32_t addr, uint16_t *val)
 {
-	if (arm_translate_read (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 2, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if ((addr + 1) < c->ram_cnt) {
-		unsigned char *p = &c->ram[addr];
-
+	if (p != NULL) {
 		if (c->bigendian) {
 #ifdef ARM_HOST_BE
 			*val = *(uint16_t *) p;
@@ -581,13 +843,13 @@ int arm_dload16 (arm_t *c, uint32_t addr, uint16_t *val)
 
 int arm_dload32 (arm_t *c, uint32_t addr, uint32_t *val)
 {
-	if (arm_translate_read (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 4, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if ((addr + 3) < c->ram_cnt) {
-		unsigned char *p = &c->ram[addr];
-
+	if (p != NULL) {
 		if (c->bigendian) {
 #ifdef ARM_HOST_BE
 			*val = *(uint32_t *) p;
@@ -618,12 +880,15 @@ int arm_dload32 (arm_t *c, uint32_t addr, uint32_t *val)
 
 int arm_dstore8 (arm_t *c, uint32_t addr, uint8_t val)
 {
-	if (arm_translate_write (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 1, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if (addr < c->ram_cnt) {
-		c->ram[addr] = val;
+	if (p != NULL) {
+		*p = val;
+		arm_mem_write (c, addr);
 	}
 	else {
 		c->set_uint8 (c->mem_ext, addr, val);
@@ -634,12 +899,14 @@ int arm_dstore8 (arm_t *c, uint32_t addr, uint8_t val)
 
 int arm_dstore16 (arm_t *c, uint32_t addr, uint16_t val)
 {
-	if (arm_translate_write (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 2, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if ((addr + 1) < c->ram_cnt) {
-		unsigned char *p = &c->ram[addr];
+	if (p != NULL) {
+		arm_mem_write (c, addr);
 
 		if (c->bigendian) {
 #ifdef ARM_HOST_BE
@@ -667,12 +934,14 @@ int arm_dstore16 (arm_t *c, uint32_t addr, uint16_t val)
 
 int arm_dstore32 (arm_t *c, uint32_t addr, uint32_t val)
 {
-	if (arm_translate_write (c, &addr, arm_is_privileged (c))) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 4, arm_is_privileged (c), &p)) {
 		return (1);
 	}
 
-	if ((addr + 3) < c->ram_cnt) {
-		unsigned char *p = &c->ram[addr];
+	if (p != NULL) {
+		arm_mem_write (c, addr);
 
 		if (c->bigendian) {
 #ifdef ARM_HOST_BE
@@ -704,7 +973,9 @@ int arm_dstore32 (arm_t *c, uint32_t addr, uint32_t val)
 
 int arm_dload8_t (arm_t *c, uint32_t addr, uint8_t *val)
 {
-	if (arm_translate_read (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 1, 0, &p)) {
 		return (1);
 	}
 
@@ -715,7 +986,9 @@ int arm_dload8_t (arm_t *c, uint32_t addr, uint8_t *val)
 
 int arm_dload16_t (arm_t *c, uint32_t addr, uint16_t *val)
 {
-	if (arm_translate_read (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 2, 0, &p)) {
 		return (1);
 	}
 
@@ -726,7 +999,9 @@ int arm_dload16_t (arm_t *c, uint32_t addr, uint16_t *val)
 
 int arm_dload32_t (arm_t *c, uint32_t addr, uint32_t *val)
 {
-	if (arm_translate_read (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_read (c, &addr, 4, 0, &p)) {
 		return (1);
 	}
 
@@ -737,7 +1012,9 @@ int arm_dload32_t (arm_t *c, uint32_t addr, uint32_t *val)
 
 int arm_dstore8_t (arm_t *c, uint32_t addr, uint8_t val)
 {
-	if (arm_translate_write (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 1, 0, &p)) {
 		return (1);
 	}
 
@@ -748,7 +1025,9 @@ int arm_dstore8_t (arm_t *c, uint32_t addr, uint8_t val)
 
 int arm_dstore16_t (arm_t *c, uint32_t addr, uint16_t val)
 {
-	if (arm_translate_write (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 2, 0, &p)) {
 		return (1);
 	}
 
@@ -759,7 +1038,9 @@ int arm_dstore16_t (arm_t *c, uint32_t addr, uint16_t val)
 
 int arm_dstore32_t (arm_t *c, uint32_t addr, uint32_t val)
 {
-	if (arm_translate_write (c, &addr, 0)) {
+	unsigned char *p;
+
+	if (arm_translate_write (c, &addr, 4, 0, &p)) {
 		return (1);
 	}
 
@@ -16,25 +16,45 @@
 #include "linenoise.h"
 #include "internal.h"
 
-monitor_t *gMonitor = NULL;
+// SIGINT is process-wide: it stops the machine of the monitor that
+// claimed it in monitor_run(). Other monitors run without it.
+static monitor_t *monitor_interrupt_owner = NULL;
+static struct sigaction monitor_interrupt_previous;
 
 void monitor_interrupt() {
-  if (gMonitor == NULL) {
+  if (monitor_interrupt_owner == NULL) {
     exit(-1);
   }
   
-  newton_stop(gMonitor->newton);
+  newton_stop(monitor_interrupt_owner->newton);
 }
 
-void monitor_init (monitor_t *c) {
-  linenoiseHistoryLoad("history.txt"); /* Load the history at startup */
+static void monitor_claim_interrupt(monitor_t *c) {
+  if (monitor_interrupt_owner != NULL) {
+    return;
+  }
+  
+  monitor_interrupt_owner = c;
   
   struct sigaction action;
   action.sa_handler = monitor_interrupt;
   sigemptyset (&action.sa_mask);
   action.sa_flags = 0;
   
-  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGINT, &action, &monitor_interrupt_previous);
+}
+
+static void monitor_release_interrupt(monitor_t *c) {
+  if (monitor_interrupt_owner != c) {
+    return;
+  }
+  
+  sigaction(SIGINT, &monitor_interrupt_previous, NULL);
+  monitor_interrupt_owner = NULL;
+}
+
+void monitor_init (monitor_t *c) {
+  linenoiseHistoryLoad("history.txt"); /* Load the history at startup */
   
   c->lastInput = strdup("");
 }
@@ -56,6 +76,7 @@ void monitor_free (monitor_t *c) {
   if (c->lastInput != NULL) {
     free(c->lastInput);
   }
+  newton_snapshot_del(c->snapshot);
 }
 
 void monitor_del (monitor_t *c) {
@@ -67,6 +88,7 @@ void monitor_del (monitor_t *c) {
 
 void monitor_set_newton (monitor_t *c, newton_t *newton) {
   c->newton = newton;
+  newton_history_set(newton, NEWTON_HISTORY_DEFAULT_INTERVAL, NEWTON_HISTORY_DEFAULT_LIMIT);
 }
 
 void monitor_dump_mmu (monitor_t *c) {
@@ -175,10 +197,84 @@ void monitor_dump_mmu (monitor_t *c) {
   c->newton->memTrace = trace;
 }
 
+static const char *monitor_log_subsystems[LoggerSubsystemCount] = {
+  [LoggerNewton] = "newton",
+  [LoggerRunt] = "runt",
+  [LoggerMemory] = "memory",
+  [LoggerPCMCIA] = "pcmcia",
+};
+
+static void monitor_set_log(monitor_t *c, const char *name, const char *state) {
+  bool on = (strcmp(state, "on") == 0);
+  if (on == false && strcmp(state, "off") != 0) {
+    printf("Expected on or off: %s\n", state);
+    return;
+  }
+  
+  if (strcmp(name, "timestamps") == 0) {
+    newton_set_log_timestamps(c->newton, on);
+    printf("Log timestamps now %s\n", state);
+    return;
+  }
+  
+  for (int i=0; i<LoggerSubsystemCount; i++) {
+    if (strcmp(name, monitor_log_subsystems[i]) == 0) {
+      newton_set_log_enabled(c->newton, i, on);
+      printf("Logging %s now %s\n", name, state);
+      return;
+    }
+  }
+  printf("Unknown log: %s\n", name);
+}
+
+static void monitor_set_bridge(monitor_t *c, char channelName, const char *type, int port) {
+  uint8_t channel;
+  if (channelName == 'a') {
+    channel = RuntSerialChannelA;
+  }
+  else if (channelName == 'b') {
+    channel = RuntSerialChannelB;
+  }
+  else {
+    printf("Unknown serial channel: %c\n", channelName);
+    return;
+  }
+  
+  int result = 0;
+  if (strcmp(type, "off") == 0) {
+    newton_serial_bridge_close(c->newton, channel);
+    printf("Serial channel %c bridge off\n", channelName);
+    return;
+  }
+  else if (strcmp(type, "pty") == 0) {
+    result = newton_serial_bridge_pty(c->newton, channel);
+  }
+  else if (strcmp(type, "tcp") == 0) {
+    result = newton_serial_bridge_tcp(c->newton, channel, (uint16_t)port);
+  }
+  else {
+    printf("Expected pty, tcp or off: %s\n", type);
+    return;
+  }
+  
+  if (result != 0) {
+    printf("Couldn't bridge serial channel %c\n", channelName);
+  }
+  else {
+    printf("Serial channel %c bridged to %s\n", channelName, bridge_get_name(newton_get_serial_bridge(c->newton, channel)));
+  }
+}
+
 void monitor_parse_input(monitor_t *c, const char *input) {
   int argValue = 0;
   int arg2Value = 0;
   char strValue[255];
+  char str2Value[8];
+  char charValue = 0;
+  
+  // Whatever was logged comes before what the command prints
+  newton_log_flush(c->newton);
+  
   if (strcmp(input, "go") == 0 || strcmp(input, "run") == 0) {
     c->instructionsToExecute = INT32_MAX;
   }
@@ -232,6 +328,27 @@ void monitor_parse_input(monitor_t *c, const char *input) {
   else if (strcmp(input, "step") == 0 || strcmp(input, "s") == 0) {
     c->instructionsToExecute = 1;
   }
+  else if (sscanf(input, "reverse-step %i", &argValue) == 1 || sscanf(input, "rs %i", &argValue) == 1) {
+    c->rewound = (argValue > 0 && newton_reverse_step(c->newton, argValue) == 0);
+  }
+  else if (strcmp(input, "reverse-step") == 0 || strcmp(input, "rs") == 0) {
+    c->rewound = (newton_reverse_step(c->newton, 1) == 0);
+  }
+  else if (strcmp(input, "reverse-continue") == 0 || strcmp(input, "rc") == 0) {
+    c->rewound = (newton_reverse_continue(c->newton) == 0);
+  }
+  else if (strcmp(input, "history off") == 0) {
+    newton_history_set(c->newton, 0, 0);
+    printf("History off\n");
+  }
+  else if (sscanf(input, "history %i %i", &argValue, &arg2Value) == 2) {
+    if (argValue <= 0 || arg2Value <= 0 || newton_history_set(c->newton, argValue, arg2Value) != 0) {
+      printf("Couldn't set up history\n");
+    }
+    else {
+      printf("Snapshot every %i instructions, keeping %i\n", argValue, arg2Value);
+    }
+  }
   else if (strcmp(input, "pcspy") == 0) {
     bool pcspy = !newton_get_pc_spy(c->newton);
     newton_set_pc_spy(c->newton, pcspy);
@@ -243,10 +360,60 @@ void monitor_parse_input(monitor_t *c, const char *input) {
     printf("SP spying now %s\n", spspy ? "on" : "off");
   }
   else if (strcmp(input, "mem-trace") == 0) {
-    bool trace = !c->newton->memTrace;
-    c->newton->memTrace = trace;
+    bool trace = !newton_get_mem_trace(c->newton);
+    newton_set_mem_trace(c->newton, trace);
     printf("Mem tracing now %s\n", trace ? "on" : "off");
   }
+  else if (strcmp(input, "snapshot") == 0) {
+    newton_snapshot_t *snapshot = newton_snapshot_save(c->newton);
+    if (snapshot == NULL) {
+      printf("Couldn't take a snapshot\n");
+    }
+    else {
+      newton_snapshot_del(c->snapshot);
+      c->snapshot = snapshot;
+      printf("Snapshot taken\n");
+    }
+  }
+  else if (strcmp(input, "restore") == 0) {
+    if (c->snapshot == NULL) {
+      printf("No snapshot to restore\n");
+    }
+    else if (newton_snapshot_restore(c->newton, c->snapshot) == false) {
+      printf("Couldn't restore the snapshot\n");
+    }
+    newton_history_reset(c->newton);
+  }
+  else if (sscanf(input, "save-delta %254s", strValue) == 1) {
+    if (newton_savestate_write(c->newton, strValue, true) == 0) {
+      printf("Saved delta: %s\n", strValue);
+    }
+  }
+  else if (sscanf(input, "save %254s", strValue) == 1) {
+    if (newton_savestate_write(c->newton, strValue, false) == 0) {
+      printf("Saved: %s\n", strValue);
+    }
+  }
+  else if (sscanf(input, "load %254s", strValue) == 1) {
+    if (newton_savestate_read(c->newton, strValue) == 0) {
+      printf("Loaded: %s\n", strValue);
+    }
+  }
+  else if (sscanf(input, "record %254s", strValue) == 1) {
+    if (newton_input_record_start(c->newton, strValue) == 0) {
+      printf("Recording input to %s\n", strValue);
+    }
+  }
+  else if (strcmp(input, "record-stop") == 0) {
+    if (newton_input_record_stop(c->newton) != 0) {
+      printf("Error writing the recording\n");
+    }
+  }
+  else if (sscanf(input, "replay %254s", strValue) == 1) {
+    if (newton_input_replay_start(c->newton, strValue) == 0) {
+      printf("Replaying input from %s\n", strValue);
+    }
+  }
   else if (strcmp(input, "mmu") == 0) {
     monitor_dump_mmu(c);
   }
@@ -255,6 +422,17 @@ void monitor_parse_input(monitor_t *c, const char *input) {
     newton_set_instruction_trace(c->newton, trace);
     printf("Tracing now %s\n", trace ? "on" : "off");
   }
+  else if (sscanf(input, "bridge %c %7s %i", &charValue, str2Value, &argValue) >= 2) {
+    monitor_set_bridge(c, charValue, str2Value, argValue);
+  }
+  else if (sscanf(input, "fastserial %7s", str2Value) == 1) {
+    bool fastSerial = (strcmp(str2Value, "on") == 0);
+    runt_set_fast_serial(newton_get_runt(c->newton), fastSerial);
+    printf("Fast serial now %s\n", fastSerial ? "on" : "off");
+  }
+  else if (sscanf(input, "log %254s %7s", strValue, str2Value) == 2) {
+    monitor_set_log(c, strValue, str2Value);
+  }
   else if (sscanf(input, "write 0x%x 0x%x", &argValue, &arg2Value) == 2) {
     newton_set_mem32(c->newton, argValue, arg2Value);
   }
@@ -282,7 +460,7 @@ void monitor_parse_input(monitor_t *c, const char *input) {
   }
   else if (sscanf(input, "switch %i %i", &argValue, &arg2Value) == 2) {
     printf("Setting switch %i to %i\n", argValue, arg2Value);
-    runt_switch_set_state(newton_get_runt(c->newton), argValue, arg2Value);
+    newton_switch_set_state(c->newton, argValue, arg2Value);
     c->newton->arm->reg[argValue] = arg2Value;
   }
   else {
@@ -293,9 +471,7 @@ void monitor_parse_input(monitor_t *c, const char *input) {
 }
 
 void monitor_run(monitor_t *c) {
-  if (gMonitor == NULL) {
-    gMonitor = c;
-  }
+  monitor_claim_interrupt(c);
   
   bool dumpState = true;
   while (true) {
@@ -303,6 +479,7 @@ void monitor_run(monitor_t *c) {
       newton_print_state(c->newton);
     }
     
+    newton_log_flush(c->newton);
     char *line = linenoise("newton> ");
     if (line == NULL) {
       break;
@@ -326,13 +503,12 @@ void monitor_run(monitor_t *c) {
       dumpState = true;
     }
     else {
-      dumpState = false;
+      dumpState = c->rewound;
     }
     
     c->instructionsToExecute = 0;
+    c->rewound = false;
   }
   
-  if (gMonitor == c) {
-    gMonitor = NULL;
-  }
+  monitor_release_interrupt(c);
 }
@@ -10,12 +10,18 @@
 #define __Leibniz__monitor__
 
 #include <stdio.h>
+#include "history.h"
 #include "newton.h"
+#include "savestate.h"
+#include "snapshot.h"
 
 typedef struct monitor_s {
   newton_t *newton;
+  newton_snapshot_t *snapshot;
   
   int32_t instructionsToExecute;
+  // Set when a command went back in time
+  bool rewound;
   char *lastInput;
 } monitor_t;
 
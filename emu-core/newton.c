@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "arm.h"
@@ -20,51 +22,94 @@
 #include "hexdump.h"
 #include "newton.h"
 #include "runt.h"
+#include "history.h"
 #include "pcmcia.h"
+#include "snapshot.h"
 #include "HammerConfigBits.h"
 
 #define countof(__a__) (sizeof(__a__) / sizeof(__a__[0]))
 
+#define AIF_HEADER_SIZE 128
+
 
 #if DISABLE_LOGGING
 #define LOG_STR(...) {}
 #define SHOULD_LOG(__x__) false
 #else
-#define LOG_STR(...) fprintf(c->logFile, __VA_ARGS__)
+#define LOG_STR(...) logger_log(c->logger, LoggerNewton, __VA_ARGS__)
 #define SHOULD_LOG(__x__) ((c->logFlags & __x__) == __x__)
 #endif
 
 
+static void newton_update_direct_memory(newton_t *c);
+static void newton_input_post(newton_t *c, NewtonInputType type, uint32_t arg0, uint32_t arg1, const void *data, uint32_t length);
+static void newton_input_apply(newton_t *c, newton_input_t *input);
+static bool newton_tapfile_replay(newton_t *c, uint32_t command, int32_t *result, uint8_t *buffer, uint32_t length);
+static void newton_tapfile_record(newton_t *c, uint32_t command, int32_t result, const uint8_t *buffer, uint32_t length);
+static bool newton_ir_is_timed(newton_t *c);
+static void newton_ir_receive(newton_t *c);
+static bool newton_ir_hold(newton_t *c);
+static void newton_ir_idle(newton_t *c);
+
 #pragma mark - Debugging helpers
 #if !DISABLE_DEBUGGER
+// The CPU only calls back for instructions in pages with a PC
+// breakpoint, and only accesses to pages with a watchpoint go through
+// newton_get_mem32() and friends. Everywhere else runs at full speed.
+static void newton_update_breakpoints(newton_t *c) {
+  arm_clear_brk(c->arm);
+  arm_clear_slow(c->arm);
+  
+  for (bp_entry_t *bp = c->breakpoints; bp != NULL; bp = bp->next) {
+    if (bp->type == BP_PC) {
+      arm_set_brk_page(c->arm, bp->addr);
+    }
+    else {
+      arm_set_slow_page(c->arm, bp->addr);
+    }
+  }
+}
+
+static int newton_breakpoint_check(void *ext, uint32_t addr) {
+  newton_t *c = ext;
+  for (bp_entry_t *bp = c->breakpoints; bp != NULL; bp = bp->next) {
+    if (bp->addr == addr && bp->type == BP_PC) {
+      newton_stop(c);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void newton_breakpoint_add(newton_t *c, uint32_t address, bp_type type) {
   bp_entry_t *bp = calloc(1, sizeof(bp_entry_t));
+  if (bp == NULL) {
+    return;
+  }
   bp->addr = address;
   bp->type = type;
   bp->next = c->breakpoints;
   
   c->breakpoints = bp;
+  
+  newton_update_breakpoints(c);
 }
 
 void newton_breakpoint_del(newton_t *c, uint32_t address, bp_type type) {
-  bp_entry_t *cur = c->breakpoints;
-  bp_entry_t *last = NULL;
+  bp_entry_t **link = &c->breakpoints;
   
-  while (cur != NULL) {
-    if (cur->addr != address || cur->type != address) {
-      last = cur;
-      cur = cur->next;
+  while (*link != NULL) {
+    bp_entry_t *cur = *link;
+    if (cur->addr != address || cur->type != type) {
+      link = &cur->next;
       continue;
     }
     
-    if (last == NULL) {
-      c->breakpoints = cur->next;
-    }
-    else {
-      last->next = cur->next;
-    }
+    *link = cur->next;
     free(cur);
   }
+  
+  newton_update_breakpoints(c);
 }
 
 
@@ -84,6 +129,15 @@ bool newton_get_instruction_trace(newton_t *c) {
   return c->instructionTrace;
 }
 
+void newton_set_mem_trace(newton_t *c, bool memTrace) {
+  c->memTrace = memTrace;
+  newton_update_direct_memory(c);
+}
+
+bool newton_get_mem_trace(newton_t *c) {
+  return c->memTrace;
+}
+
 void newton_set_pc_spy(newton_t *c, bool pcSpy) {
   c->pcSpy = pcSpy;
 }
@@ -101,34 +155,37 @@ bool newton_get_sp_spy(newton_t *c) {
 }
 
 uint32_t newton_address_for_symbol(newton_t *c, const char *symbol) {
-  symbol_t *sym = c->symbols;
-  while(sym != NULL) {
-    if (strcasecmp(sym->name, symbol) == 0) {
-      return sym->address;
-    }
+  if (c->symbols == NULL) {
+    return 0;
   }
-  return 0;
+  const symbol_t *sym = symbol_table_find_name(c->symbols, symbol);
+  return (sym != NULL) ? sym->address : 0;
 }
 
 void newton_add_symbol(newton_t *c, uint32_t address, const char *name) {
-  symbol_t *sym = calloc(1, sizeof(symbol_t));
-  sym->address = address;
-  sym->name = calloc(strlen(name)+1, sizeof(char));
-  strcpy(sym->name, name);
-  sym->next = c->symbols;
-  c->symbols = sym;
+  if (c->symbols == NULL) {
+    c->symbols = symbol_table_new();
+    if (c->symbols == NULL) {
+      return;
+    }
+  }
+  symbol_table_add(c->symbols, address, name);
 }
 
 const char *newton_get_symbol_for_address(newton_t *c, uint32_t addr) {
-  symbol_t *sym = c->symbols;
-  while(sym != NULL) {
-    if (sym->address == addr) {
-      return sym->name;
-    }
-    sym = sym->next;
+  if (c->symbols == NULL) {
+    return NULL;
   }
-  
-  return NULL;
+  const symbol_t *sym = symbol_table_find_address(c->symbols, addr);
+  return (sym != NULL) ? sym->name : NULL;
+}
+
+const char *newton_get_symbol_near_address(newton_t *c, uint32_t addr, uint32_t *offset) {
+  if (c->symbols == NULL) {
+    return NULL;
+  }
+  const symbol_t *sym = symbol_table_find_nearest(c->symbols, addr, offset);
+  return (sym != NULL) ? sym->name : NULL;
 }
 
 void newton_mem_hexdump(newton_t *c, uint32_t addr, uint32_t length) {
@@ -144,6 +201,7 @@ void newton_mem_hexdump(newton_t *c, uint32_t addr, uint32_t length) {
     if (i < length) data[i++] = (word >> 16) & 0xff;
     if (i < length) data[i++] = (word >> 24) & 0xff;
   }
+  logger_flush(c->logger);
   hexdump(c->logFile, data, translated, length);
   free(data);
 }
@@ -289,10 +347,10 @@ void newton_print_state(newton_t *c) {
   c->memTrace = memTrace;
 }
 
-void newton_parse_aif_debug_data(newton_t *c, void *debugData, uint32_t length) {
+void newton_parse_aif_debug_data(newton_t *c, const void *debugData, uint32_t length) {
   LOG_STR("%s debugData=%p, length=%i\n", __PRETTY_FUNCTION__, debugData, length);
   
-  uint32_t *bytes = (uint32_t *)debugData;
+  const uint32_t *bytes = (const uint32_t *)debugData;
   bytes += 8; // skip past header
   
   uint32_t numOfEntries = htonl(bytes[0]);
@@ -317,6 +375,9 @@ void newton_parse_aif_debug_data(newton_t *c, void *debugData, uint32_t length)
     entry++;
   }
   
+  if (c->symbols != NULL) {
+    symbol_table_index(c->symbols);
+  }
   LOG_STR("Parsed %i symbols from AIF debug data\n", entry);
 }
 
@@ -368,13 +429,25 @@ void newton_load_mapfile(newton_t *c, const char *mapfile) {
     }
   }
   
+  if (c->symbols != NULL) {
+    symbol_table_index(c->symbols);
+  }
   LOG_STR("Loaded %i symbols\n", symbolIndex);
   fclose(fp);
 }
 #endif
 
 #pragma mark - Memory helpers
-static inline membank_t* newton_get_membank_for_address(newton_t *c, uint32_t addr) {
+static membank_t* newton_get_unknown_membank(newton_t *c, uint32_t addr) {
+  LOG_STR("UNKNOWN MEMORY READ: 0x%08x, PC=0x%08x\n", addr, arm_get_pc(c->arm));
+  if (c->breakOnUnknownMemory) {
+    newton_stop(c);
+  }
+  
+  return NULL;
+}
+
+static membank_t* newton_find_membank_for_address(newton_t *c, uint32_t addr) {
   membank_t *membank = c->membanks;
   while (membank != NULL) {
     if (addr >= membank->base && addr < membank->base + membank->length) {
@@ -385,12 +458,25 @@ static inline membank_t* newton_get_membank_for_address(newton_t *c, uint32_t ad
     }
   }
   
-  LOG_STR("UNKNOWN MEMORY READ: 0x%08x, PC=0x%08x\n", addr, arm_get_pc(c->arm));
-  if (c->breakOnUnknownMemory) {
-    newton_stop(c);
+  return newton_get_unknown_membank(c, addr);
+}
+
+static inline membank_t* newton_get_membank_for_address(newton_t *c, uint32_t addr) {
+  if (c->memmap == NULL) {
+    return newton_get_unknown_membank(c, addr);
   }
   
-  return NULL;
+  membank_t *membank = c->memmap[addr >> NEWTON_MEMMAP_SHIFT];
+  if (membank == NULL) {
+    return newton_get_unknown_membank(c, addr);
+  }
+  
+  if (addr - membank->base < membank->length) {
+    return membank;
+  }
+  
+  // The granule is only partially covered by the bank in its slot
+  return newton_find_membank_for_address(c, addr);
 }
 
 #if DISABLE_DEBUGGER
@@ -411,7 +497,7 @@ static inline bool newton_has_breakpoint_at_address(newton_t *c, uint32_t addr,
 }
 
 static inline void newton_get_mem_entry(newton_t *c, uint32_t addr) {
-  if (newton_has_breakpoint_at_address(c, addr, BP_READ) == true) {
+  if (arm_is_slow_page(c->arm, addr) && newton_has_breakpoint_at_address(c, addr, BP_READ) == true) {
     LOG_STR("\n\nAddress 0x%08x read from PC 0x%08x\n", addr, arm_get_pc(c->arm));
     newton_stop(c);
   }
@@ -430,7 +516,7 @@ static inline void newton_get_mem_exit(newton_t *c, uint32_t addr, uint32_t resu
 }
 
 static inline void newton_set_mem_entry(newton_t *c, uint32_t addr, uint32_t val) {
-  if (newton_has_breakpoint_at_address(c, addr, BP_WRITE) == true) {
+  if (arm_is_slow_page(c->arm, addr) && newton_has_breakpoint_at_address(c, addr, BP_WRITE) == true) {
     LOG_STR("\n\nAddress 0x%08x changed from:0x%08x to:0x%08x from PC 0x%08x\n", addr, newton_get_mem32(c, addr), val, arm_get_pc(c->arm));
     newton_stop(c);
   }
@@ -485,6 +571,7 @@ uint32_t newton_set_mem32 (newton_t *c, uint32_t addr, uint32_t val) {
   if (membank != NULL) {
     val = membank->set_uint32(membank->context, addr, val, arm_get_pc(c->arm));
   }
+  arm_jit_write(c->arm, addr);
   
   newton_set_mem_exit(c, addr, val);
   
@@ -520,6 +607,7 @@ uint8_t newton_set_mem8 (newton_t *c, uint32_t addr, uint8_t val) {
   membank_t *membank = newton_get_membank_for_address(c, addr);
   if (membank != NULL && membank->set_uint8 != NULL) {
     result = membank->set_uint8(membank->context, addr, val, arm_get_pc(c->arm));
+    arm_jit_write(c->arm, addr);
   }
   else {
     static const unsigned masktab[] = {
@@ -544,10 +632,12 @@ uint8_t newton_set_mem8 (newton_t *c, uint32_t addr, uint8_t val) {
 
 
 uint16_t newton_get_mem16 (newton_t *c, uint32_t addr) {
+  logger_flush(c->logger);
   abort();
 }
 
 uint16_t newton_set_mem16 (newton_t *c, uint32_t addr, uint16_t val) {
+  logger_flush(c->logger);
   abort();
 }
 
@@ -578,11 +668,24 @@ uint32_t newton_get_newt_tests(newton_t *c) {
 
 void newton_set_logfile(newton_t *c, FILE *file) {
   c->logFile = file;
-  if (c->runt != NULL) {
-    runt_set_log_file(c->runt, file);
+  if (c->logger != NULL) {
+    logger_set_file(c->logger, file);
+  }
+}
+
+void newton_log_flush(newton_t *c) {
+  logger_flush(c->logger);
+}
+
+void newton_set_log_timestamps(newton_t *c, bool timestamps) {
+  if (c->logger != NULL) {
+    logger_set_timestamps(c->logger, timestamps);
   }
-  if (c->pcmcia != NULL) {
-    pcmcia_set_log_file(c->pcmcia, file);
+}
+
+void newton_set_log_enabled(newton_t *c, LoggerSubsystem subsystem, bool enabled) {
+  if (c->logger != NULL) {
+    logger_set_enabled(c->logger, subsystem, enabled);
   }
 }
 
@@ -638,6 +741,15 @@ char *newton_get_cstring(newton_t *c, uint32_t address) {
 }
 
 #pragma mark - TapFileCntl
+enum {
+  do_sys_open = 0x10,
+  do_sys_close = 0x11,
+  do_sys_istty = 0x12,
+  do_sys_read = 0x13,
+  do_sys_write = 0x14,
+  do_sys_set_input_notify = 0x15,
+};
+
 int32_t newton_do_sys_open(newton_t *c) {
   if (c->do_sys_open == NULL) {
     return -1;
@@ -657,8 +769,9 @@ int32_t newton_do_sys_open(newton_t *c) {
     fp = -1;
     free(name);
   }
-  else {
+  else if (newton_tapfile_replay(c, do_sys_open, &fp, NULL, 0) == false) {
     fp = c->do_sys_open(c->tapfilecntl_ext, name, mode);
+    newton_tapfile_record(c, do_sys_open, fp, NULL, 0);
   }
   
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
@@ -692,11 +805,14 @@ int32_t newton_do_sys_close(newton_t *c) {
   }
   
   uint32_t fp = 0;
-  uint32_t result = 0;
+  int32_t result = 0;
   
   arm_get_mem32(c->arm, c->arm->reg[1], 0, &fp);
   
-  result = c->do_sys_close(c->tapfilecntl_ext, fp);
+  if (newton_tapfile_replay(c, do_sys_close, &result, NULL, 0) == false) {
+    result = c->do_sys_close(c->tapfilecntl_ext, fp);
+    newton_tapfile_record(c, do_sys_close, result, NULL, 0);
+  }
   
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
     LOG_STR("close fp=%i => %i", fp, result);
@@ -716,10 +832,13 @@ int32_t newton_do_sys_istty(newton_t *c) {
   }
   
   uint32_t fp = 0;
-  uint32_t result = 0;
+  int32_t result = 0;
   
   arm_get_mem32(c->arm, c->arm->reg[1], 0, &fp);
-  result = c->do_sys_istty(c->tapfilecntl_ext, fp);
+  if (newton_tapfile_replay(c, do_sys_istty, &result, NULL, 0) == false) {
+    result = c->do_sys_istty(c->tapfilecntl_ext, fp);
+    newton_tapfile_record(c, do_sys_istty, result, NULL, 0);
+  }
   
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
     LOG_STR("istty, fp=%i, result=%i", fp, result);
@@ -751,7 +870,10 @@ int32_t newton_do_sys_read(newton_t *c) {
   arm_translate_extern(c->arm, &addr, 0, NULL, NULL);
   
   uint8_t *buffer = calloc(len, sizeof(uint8_t));
-  result = c->do_sys_read(c->tapfilecntl_ext, fp, buffer, len);
+  if (newton_tapfile_replay(c, do_sys_read, &result, buffer, len) == false) {
+    result = c->do_sys_read(c->tapfilecntl_ext, fp, buffer, len);
+    newton_tapfile_record(c, do_sys_read, result, buffer, (result > 0) ? (uint32_t)result : 0);
+  }
   
   if (result == 0) {
     buffer[0] = 0x00;
@@ -795,7 +917,11 @@ int32_t newton_do_sys_write(newton_t *c) {
   
   char *msg = newton_get_string(c, addr, len);
   
-  uint32_t result = c->do_sys_write(c->tapfilecntl_ext, fp, msg, len);
+  int32_t result = 0;
+  if (newton_tapfile_replay(c, do_sys_write, &result, NULL, 0) == false) {
+    result = c->do_sys_write(c->tapfilecntl_ext, fp, msg, len);
+    newton_tapfile_record(c, do_sys_write, result, NULL, 0);
+  }
   
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
     LOG_STR("write(fp=%i, len=0x%08x, buf=0x%08x)\n", fp, len, addr);
@@ -817,11 +943,15 @@ int32_t newton_do_sys_set_input_notify(newton_t *c) {
     return -1;
   }
   
-  uint32_t fp, input_notify, result;
+  uint32_t fp, input_notify;
+  int32_t result = 0;
   arm_get_mem32(c->arm, c->arm->reg[1], 0, &fp);
   arm_get_mem32(c->arm, c->arm->reg[1] + 4, 0, &input_notify);
   
-  result = c->do_sys_set_input_notify(c->tapfilecntl_ext, fp, input_notify);
+  if (newton_tapfile_replay(c, do_sys_set_input_notify, &result, NULL, 0) == false) {
+    result = c->do_sys_set_input_notify(c->tapfilecntl_ext, fp, input_notify);
+    newton_tapfile_record(c, do_sys_set_input_notify, result, NULL, 0);
+  }
   
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
     LOG_STR("set_input_notify: fp=%i, addr=%08x => %i", fp, input_notify, result);
@@ -829,7 +959,7 @@ int32_t newton_do_sys_set_input_notify(newton_t *c) {
   return result;
 }
 
-void newton_file_input_notify(newton_t *c, uint32_t addr, uint32_t value)
+static void newton_file_input_set(newton_t *c, uint32_t addr, uint32_t value)
 {
   uint32_t translated = addr;
   arm_translate_extern(c->arm, &translated, 0, NULL, NULL);
@@ -838,15 +968,6 @@ void newton_file_input_notify(newton_t *c, uint32_t addr, uint32_t value)
 
 void newton_tap_file_control(newton_t *c)
 {
-  enum {
-    do_sys_open = 0x10,
-    do_sys_close = 0x11,
-    do_sys_istty = 0x12,
-    do_sys_read = 0x13,
-    do_sys_write = 0x14,
-    do_sys_set_input_notify = 0x15,
-  };
-  
   if (SHOULD_LOG(NewtonLogTapFileCntl)) {
     LOG_STR("TapFileCntl: ");
   }
@@ -1133,54 +1254,64 @@ void newton_log_exception (void *ext, uint32_t addr) {
 }
 
 #pragma mark - Serial
-void newton_serial_channel_enqueue_data(newton_t *c, uint8_t channel, uint8_t *data, uint32_t size) {
-  newton_serial_queue_t *queue = &c->serialQueues[channel];
-  
-  if (queue->buffer == NULL) {
-    queue->length = size;
-    queue->buffer = malloc(size);
-    queue->offset = 0;
-    memcpy(queue->buffer, data, size);
-  }
-  else {
-    uint32_t newLength = queue->length + size;
-    queue->buffer = realloc(queue->buffer, newLength);
-    
-    memcpy(queue->buffer + queue->length, data, size);
-    queue->length = newLength;
-  }
-}
-
+// The SCC has room for another byte
 void newton_serial_channel_dequeue_data(newton_t *c, uint8_t channel) {
   e8530_t *scc = runt_get_scc(c->runt);
   
   newton_serial_queue_t *queue = &c->serialQueues[channel];
-  if (queue->length == 0) {
+  uint8_t val = 0;
+  if (ring_peek(&queue->pending, &val) == false) {
     return;
   }
   
-  int success = e8530_receive(scc, channel, queue->buffer[queue->offset]);
+  int success = e8530_receive(scc, channel, val);
   if (success == 0) {
-    queue->offset++;
-    if (queue->offset >= queue->length) {
-      free(queue->buffer);
-      queue->buffer = NULL;
-      queue->length = 0;
-      queue->offset = 0;
-    }
+    ring_skip(&queue->pending, 1);
   }
 }
 
-void newton_serial_channel_send(newton_t *c, uint8_t channel, uint8_t *data, uint32_t size) {
+static void newton_serial_channel_receive(newton_t *c, uint8_t channel, const uint8_t *data, uint32_t size) {
   e8530_t *scc = runt_get_scc(c->runt);
-  for (uint32_t i=0; i<size; i++) {
-    int success = e8530_receive(scc, channel, data[i]);
-    if (success != 0) {
-      uint32_t remaining = (size - i);
-      newton_serial_channel_enqueue_data(c, channel, data + i, remaining);
-      return;
+  newton_serial_queue_t *queue = &c->serialQueues[channel];
+  
+  uint32_t i = 0;
+  // Behind what's already waiting
+  if (ring_count(&queue->pending) == 0) {
+    for (; i<size; i++) {
+      if (e8530_receive(scc, channel, data[i]) != 0) {
+        break;
+      }
     }
   }
+  
+  uint32_t remaining = size - i;
+  uint32_t written = ring_write(&queue->pending, data + i, remaining);
+  if (written != remaining) {
+    LOG_STR("Serial: channel %i overflowed, dropped %u bytes\n", channel, remaining - written);
+  }
+}
+
+// Take in what the host has sent, as much as there's room for. It goes
+// in as input of its own so that it's recorded.
+static void newton_serial_channel_take(newton_t *c, uint8_t channel) {
+  newton_serial_queue_t *queue = &c->serialQueues[channel];
+  if (ring_count(&queue->host) == 0) {
+    return;
+  }
+  
+  uint8_t data[NEWTON_SERIAL_RING_SIZE];
+  uint32_t length = ring_read(&queue->host, data, ring_space(&queue->pending));
+  if (length == 0) {
+    return;
+  }
+  
+  newton_input_t input = {
+    .type = NewtonInputSerial,
+    .args = { channel, 0 },
+    .data = data,
+    .length = length,
+  };
+  newton_input_apply(c, &input);
 }
 
 void newton_handle_docker_payload(newton_t *c, uint8_t channel) {
@@ -1191,22 +1322,53 @@ void newton_handle_docker_payload(newton_t *c, uint8_t channel) {
   uint32_t rspLen = 0;
   uint8_t *response = docker_get_response(docker, &rspLen);
   if (rspLen > 0 && response != NULL) {
-    newton_serial_channel_send(c, channel, response, rspLen);
+    newton_serial_channel_receive(c, channel, response, rspLen);
   }
   
   docker_reset(docker);
 }
 
+// How long a character takes the IR channel to send, going by the
+// SCC's own character time
+static uint64_t newton_ir_ticks_per_byte(newton_t *c) {
+  if (runt_get_fast_serial(c->runt) == true) {
+    return 0;
+  }
+  e8530_t *scc = runt_get_scc(c->runt);
+  return (uint64_t)scc->chn[RuntSerialChannelIR].char_clk_div * RUNT_TICKS_PER_SCC_CLOCK;
+}
+
+// To a bridge, or across the IR link
+static void newton_serial_channel_forward(newton_t *c, uint8_t channel, const uint8_t *data, uint32_t length) {
+  if (c->serialBridges[channel] != NULL) {
+    bridge_write(c->serialBridges[channel], data, length);
+  }
+  else {
+    irlink_write(c->irLink, c->irSide, runt_get_clock(c->runt), newton_ir_ticks_per_byte(c), data, length);
+  }
+}
+
 void newton_serial_channel_flush_output(newton_t *c, uint8_t channel) {
   e8530_t *scc = runt_get_scc(c->runt);
   docker_t *docker = c->docker;
   
+  bool forward = (c->serialBridges[channel] != NULL || (channel == RuntSerialChannelIR && c->irLink != NULL));
+  uint8_t bridged[64];
+  uint32_t bridgedLength = 0;
+  
   while (e8530_out_empty(scc, channel) == false) {
     uint8_t val = e8530_send(scc, channel);
     if (c->bootMode != NewtonBootModeNormal) {
       // Do a serial loopback for diagnostics
       e8530_receive(scc, channel, val);
     }
+    else if (forward == true) {
+      bridged[bridgedLength++] = val;
+      if (bridgedLength == sizeof(bridged)) {
+        newton_serial_channel_forward(c, channel, bridged, bridgedLength);
+        bridgedLength = 0;
+      }
+    }
     else {
       if (channel == RuntSerialChannelSerial) {
         docker_receive_byte(docker, val);
@@ -1216,6 +1378,10 @@ void newton_serial_channel_flush_output(newton_t *c, uint8_t channel) {
       }
     }
   }
+  
+  if (bridgedLength > 0) {
+    newton_serial_channel_forward(c, channel, bridged, bridgedLength);
+  }
 }
 
 void newton_serial_chanA_output(void *ext, uint8_t val) {
@@ -1240,7 +1406,7 @@ void newton_serial_chanB_input(void *ext, uint8_t val) {
 
 #pragma mark -
 #pragma mark
-void newton_set_bootmode(newton_t *c, NewtonBootMode bootMode) {
+static void newton_bootmode_apply(newton_t *c, NewtonBootMode bootMode) {
   c->bootMode = bootMode;
   
   switch (bootMode) {
@@ -1265,11 +1431,7 @@ void newton_set_bootmode(newton_t *c, NewtonBootMode bootMode) {
   }
 }
 
-void newton_stop(newton_t *c) {
-  c->stop = true;
-}
-
-void newton_reboot(newton_t *c, NewtonRebootStyle style) {
+static void newton_reboot_apply(newton_t *c, NewtonRebootStyle style) {
   arm_reset(c->arm);
   runt_reset(c->runt);
   if (style == NewtonRebootStyleCold) {
@@ -1278,58 +1440,365 @@ void newton_reboot(newton_t *c, NewtonRebootStyle style) {
   docker_reset(c->docker);
 }
 
+void newton_set_bootmode(newton_t *c, NewtonBootMode bootMode) {
+  newton_input_post(c, NewtonInputBootMode, bootMode, 0, NULL, 0);
+}
+
+void newton_reboot(newton_t *c, NewtonRebootStyle style) {
+  newton_input_post(c, NewtonInputReboot, style, 0, NULL, 0);
+}
+
+#pragma mark - Input
+// Queue input from the host for newton_emulate() to apply
+static void newton_input_post(newton_t *c, NewtonInputType type, uint32_t arg0, uint32_t arg1, const void *data, uint32_t length) {
+  // While replaying, the log is the only source of input
+  if (c->inputPlayer != NULL) {
+    return;
+  }
+  
+  newton_input_t *input = newton_input_new(type, arg0, arg1, data, length);
+  if (input == NULL) {
+    return;
+  }
+  newton_input_queue_push(&c->inputQueue, input);
+  if (c->runt != NULL) {
+    runt_wake(c->runt);
+  }
+}
+
+static void newton_input_record(newton_t *c, newton_input_t *input) {
+  input->oprcnt = arm_get_opcnt(c->arm);
+  input->clock = runt_get_clock(c->runt);
+  newton_history_record_input(c, input);
+  if (c->inputRecorder != NULL && newton_input_log_write(c->inputRecorder, input) == false) {
+    LOG_STR("Input: error writing the recording, stopping it\n");
+    newton_input_record_stop(c);
+  }
+}
+
+static void newton_input_apply(newton_t *c, newton_input_t *input) {
+  if (input->type == NewtonInputSwitch && input->args[1] == NEWTON_INPUT_SWITCH_TOGGLE) {
+    input->args[1] = !c->runt->switches[input->args[0] % 3];
+  }
+  if (c->inputRecorder != NULL || c->history != NULL) {
+    newton_input_record(c, input);
+  }
+  
+  switch (input->type) {
+    case NewtonInputTouchDown:
+      runt_touch_down(c->runt, (int32_t)input->args[0], (int32_t)input->args[1]);
+      break;
+    case NewtonInputTouchUp:
+      runt_touch_up(c->runt);
+      break;
+    case NewtonInputSwitch:
+      runt_switch_set_state(c->runt, input->args[0] % 3, input->args[1]);
+      break;
+    case NewtonInputSerial:
+      newton_serial_channel_receive(c, input->args[0] & 1, input->data, input->length);
+      runt_serial_poll(c->runt, input->args[0] & 1);
+      break;
+    case NewtonInputFileNotify:
+      newton_file_input_set(c, input->args[0], input->args[1]);
+      break;
+    case NewtonInputBootMode:
+      newton_bootmode_apply(c, input->args[0]);
+      break;
+    case NewtonInputReboot:
+      newton_reboot_apply(c, input->args[0]);
+      break;
+    case NewtonInputTapFileCntl:
+      break;
+  }
+}
+
+// The replay has gone somewhere the recording didn't
+static void newton_input_replay_diverged(newton_t *c, newton_input_t *input) {
+  LOG_STR("Input: replay diverged at oprcnt %llu, expected input %i at oprcnt %llu, stopping it\n",
+          (unsigned long long)arm_get_opcnt(c->arm), input->type, (unsigned long long)input->oprcnt);
+  newton_input_replay_stop(c);
+}
+
+// Apply the recorded input that has come due
+static void newton_input_replay(newton_t *c) {
+  newton_input_log_t *log = c->inputPlayer;
+  while (true) {
+    newton_input_t *input = newton_input_log_peek(log);
+    if (input == NULL) {
+      if (newton_history_is_rewinding(c) == false) {
+        LOG_STR("Input: replay finished at oprcnt %llu\n", (unsigned long long)arm_get_opcnt(c->arm));
+      }
+      newton_input_replay_stop(c);
+      return;
+    }
+    
+    uint64_t oprcnt = arm_get_opcnt(c->arm);
+    if (input->oprcnt > oprcnt) {
+      return;
+    }
+    // TapFileCntl outcomes are taken when the call happens
+    if (input->oprcnt < oprcnt || input->type == NewtonInputTapFileCntl) {
+      newton_input_replay_diverged(c, input);
+      return;
+    }
+    // While the CPU sleeps, the clock moves on to the input
+    if (input->clock > runt_get_clock(c->runt)) {
+      return;
+    }
+    
+    newton_input_apply(c, input);
+    newton_input_log_next(log);
+  }
+}
+
+// Apply the input that is due. Called between two bursts.
+static void newton_input_run(newton_t *c) {
+  if (c->inputPlayer != NULL) {
+    newton_input_replay(c);
+    return;
+  }
+  
+  newton_ir_receive(c);
+  newton_serial_channel_take(c, RuntSerialChannelA);
+  newton_serial_channel_take(c, RuntSerialChannelB);
+  
+  if (newton_input_queue_is_empty(&c->inputQueue) == true) {
+    return;
+  }
+  newton_input_t *input = newton_input_queue_take(&c->inputQueue);
+  while (input != NULL) {
+    newton_input_t *next = input->next;
+    newton_input_apply(c, input);
+    newton_input_del(input);
+    input = next;
+  }
+}
+
+// While replaying, a burst ends where the next input goes in
+static unsigned long newton_input_get_burst(newton_t *c, unsigned long burst) {
+  newton_input_t *input = (c->inputPlayer != NULL) ? newton_input_log_peek(c->inputPlayer) : NULL;
+  if (input == NULL) {
+    return burst;
+  }
+  
+  uint64_t oprcnt = arm_get_opcnt(c->arm);
+  if (input->oprcnt > oprcnt && input->oprcnt - oprcnt < burst) {
+    burst = (unsigned long)(input->oprcnt - oprcnt);
+  }
+  return burst;
+}
+
+// In place of runt_idle(): while replaying, input that was recorded
+// while the CPU slept goes in at its time on the clock
+static void newton_input_idle(newton_t *c) {
+  newton_input_t *input = (c->inputPlayer != NULL) ? newton_input_log_peek(c->inputPlayer) : NULL;
+  if (input != NULL && input->oprcnt == arm_get_opcnt(c->arm)) {
+    runt_idle_until(c->runt, input->clock);
+  }
+  else if (newton_ir_is_timed(c) == true) {
+    newton_ir_idle(c);
+  }
+  else {
+    runt_idle(c->runt);
+  }
+}
+
+static bool newton_tapfile_replay(newton_t *c, uint32_t command, int32_t *result, uint8_t *buffer, uint32_t length) {
+  if (c->inputPlayer == NULL) {
+    return false;
+  }
+  
+  newton_input_t *input = newton_input_log_peek(c->inputPlayer);
+  if (input == NULL || input->type != NewtonInputTapFileCntl || input->args[0] != command ||
+      input->oprcnt != arm_get_opcnt(c->arm)) {
+    if (input != NULL) {
+      newton_input_replay_diverged(c, input);
+    }
+    return false;
+  }
+  
+  *result = (int32_t)input->args[1];
+  if (buffer != NULL) {
+    memcpy(buffer, input->data, (input->length < length) ? input->length : length);
+  }
+  newton_input_log_next(c->inputPlayer);
+  return true;
+}
+
+static void newton_tapfile_record(newton_t *c, uint32_t command, int32_t result, const uint8_t *buffer, uint32_t length) {
+  if (c->inputRecorder == NULL && c->history == NULL) {
+    return;
+  }
+  
+  newton_input_t input = {
+    .type = NewtonInputTapFileCntl,
+    .args = { command, (uint32_t)result },
+    .data = (uint8_t *)buffer,
+    .length = length,
+  };
+  newton_input_record(c, &input);
+}
+
+int newton_input_record_start(newton_t *c, const char *path) {
+  if (c->runt == NULL || c->inputPlayer != NULL) {
+    return -1;
+  }
+  newton_input_record_stop(c);
+  
+  c->inputRecorder = newton_input_log_create(path, c->romHash, arm_get_opcnt(c->arm), runt_get_clock(c->runt));
+  if (c->inputRecorder == NULL) {
+    LOG_STR("Input: couldn't create %s\n", path);
+    return -1;
+  }
+  if (runt_get_clock_mode(c->runt) == RuntClockHost) {
+    LOG_STR("Input: the RTC follows the host clock, the recording may not replay exactly\n");
+  }
+  return 0;
+}
+
+int newton_input_record_stop(newton_t *c) {
+  if (c->inputRecorder == NULL) {
+    return 0;
+  }
+  bool ok = newton_input_log_close(c->inputRecorder);
+  c->inputRecorder = NULL;
+  return ok ? 0 : -1;
+}
+
+int newton_input_replay_start(newton_t *c, const char *path) {
+  if (c->runt == NULL || c->inputRecorder != NULL) {
+    return -1;
+  }
+  newton_input_replay_stop(c);
+  
+  newton_input_log_t *log = newton_input_log_open(path, c->romHash);
+  if (log == NULL) {
+    LOG_STR("Input: %s isn't a recording for this ROM\n", path);
+    return -1;
+  }
+  
+  uint64_t oprcnt, clock;
+  newton_input_log_get_start(log, &oprcnt, &clock);
+  if (oprcnt != arm_get_opcnt(c->arm) || clock != runt_get_clock(c->runt)) {
+    LOG_STR("Input: %s was recorded from another state\n", path);
+    newton_input_log_close(log);
+    return -1;
+  }
+  
+  // Drop what the host sent before
+  newton_input_t *input = newton_input_queue_take(&c->inputQueue);
+  while (input != NULL) {
+    newton_input_t *next = input->next;
+    newton_input_del(input);
+    input = next;
+  }
+  
+  c->inputPlayer = log;
+  return 0;
+}
+
+void newton_input_replay_stop(newton_t *c) {
+  if (c->inputPlayer == NULL) {
+    return;
+  }
+  if (newton_input_log_close(c->inputPlayer) == false) {
+    LOG_STR("Input: the recording is damaged\n");
+  }
+  c->inputPlayer = NULL;
+}
+
+bool newton_input_is_replaying(newton_t *c) {
+  return (c->inputPlayer != NULL);
+}
+
+#pragma mark -
+void newton_stop(newton_t *c) {
+  c->stop = true;
+  arm_run_limit(c->arm, 0);
+  runt_wake(c->runt);
+}
+
+#if !DISABLE_DEBUGGER
+// The debugger features that look at every instruction
+static bool newton_needs_single_step(newton_t *c) {
+  return (c->instructionTrace == true || c->pcSpy == true || c->spSpy == true);
+}
+#endif
+
 void newton_emulate(newton_t *c, int32_t count) {
   int32_t remaining = count;
   c->stop = false;
   
-  bool armAwake = true;
+  bool armAwake = runt_arm_is_awake(c->runt);
+#if !DISABLE_DEBUGGER
+  // Running on from a breakpoint
+  arm_brk_skip(c->arm);
+#endif
   while (remaining > 0 && c->stop == false) {
+    if (newton_ir_hold(c) == true) {
+      continue;
+    }
 #if !DISABLE_DEBUGGER
+    bool singleStep = newton_needs_single_step(c);
     if (c->instructionTrace == true) {
       newton_print_state(c);
     }
 #endif
     
+    if (c->history != NULL) {
+      newton_history_step(c);
+    }
+    newton_input_run(c);
+    
     if (armAwake == false) {
-      usleep(10);
+      newton_input_idle(c);
     }
     else {
-      arm_execute(c->arm);
+      // Run up to the next RUNT event, or the next replayed input
+      unsigned long burst = newton_input_get_burst(c, runt_get_burst(c->runt));
+      if (count != INT32_MAX && burst > (unsigned long)remaining) {
+        burst = remaining;
+      }
+#if !DISABLE_DEBUGGER
+      if (singleStep == true) {
+        burst = 1;
+      }
+#endif
+      
+      unsigned long long start = arm_get_opcnt(c->arm);
+      arm_run(c->arm, burst);
       
       if (count != INT32_MAX) {
-        remaining--;
+        unsigned long long executed = arm_get_opcnt(c->arm) - start;
+        remaining = (executed < (unsigned long long)remaining) ? (int32_t)(remaining - executed) : 0;
       }
       
 #if !DISABLE_DEBUGGER
-      uint32_t pc = arm_get_pc (c->arm);
-      if (pc != c->lastPc + 4) {
-        if (c->pcSpy) {
-          const char *symbol = newton_get_symbol_for_address(c, pc);
-          if (symbol == NULL) {
-            symbol = "";
+      if (singleStep == true) {
+        uint32_t pc = arm_get_pc (c->arm);
+        if (pc != c->lastPc + 4) {
+          if (c->pcSpy) {
+            char symbol[128] = "";
+            uint32_t offset = 0;
+            const char *name = newton_get_symbol_near_address(c, pc, &offset);
+            if (name != NULL && offset == 0) {
+              snprintf(symbol, sizeof(symbol), "%s", name);
+            }
+            else if (name != NULL) {
+              snprintf(symbol, sizeof(symbol), "%s+0x%x", name, offset);
+            }
+            
+            LOG_STR("PC changed to 0x%08x %s (from 0x%08x)\n", pc, symbol, c->lastPc);
           }
-          
-          LOG_STR("PC changed to 0x%08x %s (from 0x%08x)\n", pc, symbol, c->lastPc);
-          fflush(c->logFile);
         }
-      }
-      
-      if (c->lastSp != c->arm->reg[13] && c->spSpy) {
-        LOG_STR("SP changed from 0x%08x to 0x%08x (at PC 0x%08x)\n", c->lastSp, c->arm->reg[13], pc);
-        fflush(c->logFile);
-        c->lastSp = c->arm->reg[13];
-      }
-      
-      bp_entry_t *bp = c->breakpoints;
-      while(bp != NULL) {
-        if (bp->addr == pc && bp->type == BP_PC) {
-          remaining = 0;
-          break;
+        
+        if (c->lastSp != c->arm->reg[13] && c->spSpy) {
+          LOG_STR("SP changed from 0x%08x to 0x%08x (at PC 0x%08x)\n", c->lastSp, c->arm->reg[13], pc);
+          c->lastSp = c->arm->reg[13];
         }
-        bp = bp->next;
+        
+        c->lastPc = pc;
       }
-      
-      c->lastPc = pc;
 #endif
     }
     
@@ -1389,16 +1858,174 @@ void newton_set_debugstr(newton_t *c, newton_debugstr_f debugstr) {
   c->debug_str = debugstr;
 }
 
-void newton_touch_down(newton_t *c, int x, int y) {
+void newton_set_display_functions (newton_t *c, void *ext,
+                                   lcd_display_open_f display_open,
+                                   lcd_display_update_f display_update)
+{
+  c->display_ext = ext;
+  c->display_open = display_open;
+  c->display_update = display_update;
+  
   if (c->runt != NULL) {
-    runt_touch_down(c->runt, x, y);
+    runt_set_display_fct(c->runt, ext, display_open, display_update);
   }
 }
 
+void newton_touch_down(newton_t *c, int x, int y) {
+  newton_input_post(c, NewtonInputTouchDown, x, y, NULL, 0);
+}
+
 void newton_touch_up(newton_t *c) {
-  if (c->runt != NULL) {
-    runt_touch_up(c->runt);
+  newton_input_post(c, NewtonInputTouchUp, 0, 0, NULL, 0);
+}
+
+void newton_switch_set_state(newton_t *c, int switchNum, int state) {
+  newton_input_post(c, NewtonInputSwitch, switchNum, (state != 0), NULL, 0);
+}
+
+void newton_switch_toggle(newton_t *c, int switchNum) {
+  newton_input_post(c, NewtonInputSwitch, switchNum, NEWTON_INPUT_SWITCH_TOGGLE, NULL, 0);
+}
+
+static uint32_t newton_serial_bridge_send(void *ext, uint8_t channel, const uint8_t *data, uint32_t length) {
+  return newton_serial_channel_send(ext, channel, data, length);
+}
+
+int newton_serial_bridge_pty(newton_t *c, uint8_t channel) {
+  newton_serial_bridge_close(c, channel);
+  if ((channel & 1) == RuntSerialChannelIR) {
+    newton_ir_unlink(c);
+  }
+  c->serialBridges[channel & 1] = bridge_new_pty(channel & 1, c, newton_serial_bridge_send);
+  return (c->serialBridges[channel & 1] != NULL) ? 0 : -1;
+}
+
+int newton_serial_bridge_tcp(newton_t *c, uint8_t channel, uint16_t port) {
+  newton_serial_bridge_close(c, channel);
+  if ((channel & 1) == RuntSerialChannelIR) {
+    newton_ir_unlink(c);
+  }
+  c->serialBridges[channel & 1] = bridge_new_tcp(channel & 1, port, c, newton_serial_bridge_send);
+  return (c->serialBridges[channel & 1] != NULL) ? 0 : -1;
+}
+
+void newton_serial_bridge_close(newton_t *c, uint8_t channel) {
+  bridge_del(c->serialBridges[channel & 1]);
+  c->serialBridges[channel & 1] = NULL;
+}
+
+bridge_t *newton_get_serial_bridge(newton_t *c, uint8_t channel) {
+  return c->serialBridges[channel & 1];
+}
+
+#pragma mark - IR link
+static void newton_ir_wake(void *ext) {
+  newton_t *c = (newton_t *)ext;
+  runt_wake(c->runt);
+}
+
+int newton_ir_link(newton_t *c, irlink_t *link, uint8_t side) {
+  newton_ir_unlink(c);
+  newton_serial_bridge_close(c, RuntSerialChannelIR);
+  
+  if (irlink_attach(link, side & 1, c, newton_ir_wake) != 0) {
+    return -1;
+  }
+  irlink_set_clock(link, side & 1, runt_get_clock(c->runt));
+  c->irLink = link;
+  c->irSide = side & 1;
+  return 0;
+}
+
+void newton_ir_unlink(newton_t *c) {
+  if (c->irLink == NULL) {
+    return;
+  }
+  irlink_detach(c->irLink, c->irSide);
+  c->irLink = NULL;
+}
+
+// Whether the two sides' clocks are kept together. They only are on
+// the virtual clock; otherwise both follow the host already, and
+// what comes across goes in as soon as it's there.
+static bool newton_ir_is_timed(newton_t *c) {
+  return (c->irLink != NULL && c->inputPlayer == NULL && runt_get_clock_mode(c->runt) == RuntClockVirtual);
+}
+
+// Bring in what has come across by now. It goes through the host
+// queue, so that it's recorded like anything else from outside.
+static void newton_ir_receive(newton_t *c) {
+  if (c->irLink == NULL) {
+    return;
+  }
+  
+  uint64_t clock = (newton_ir_is_timed(c) == true) ? runt_get_clock(c->runt) : IRLINK_NEVER;
+  uint8_t data[NEWTON_SERIAL_RING_SIZE];
+  uint32_t space = ring_space(&c->serialQueues[RuntSerialChannelIR].host);
+  uint32_t length = irlink_read(c->irLink, c->irSide, clock, data, (space < sizeof(data)) ? space : sizeof(data));
+  if (length > 0) {
+    newton_serial_channel_send(c, RuntSerialChannelIR, data, length);
+  }
+}
+
+// Between two bursts: tell the other side how far this one has got,
+// and wait a little for it if that's too far ahead
+static bool newton_ir_hold(newton_t *c) {
+  if (newton_ir_is_timed(c) == false) {
+    return false;
+  }
+  
+  uint64_t clock = runt_get_clock(c->runt);
+  irlink_set_clock(c->irLink, c->irSide, clock);
+  if (clock < irlink_get_horizon(c->irLink, c->irSide)) {
+    return false;
   }
+  irlink_wait(c->irLink, c->irSide, clock, NEWTON_IR_WAIT_MS);
+  return true;
+}
+
+// In place of runt_idle() while beaming: the clock goes no further
+// than the next bytes to arrive and the other side allows. With
+// nothing at all to go to, the other side runs on without this one
+// until something wakes it, and then this one catches up.
+static void newton_ir_idle(newton_t *c) {
+  irlink_t *link = c->irLink;
+  uint64_t arrival = irlink_get_arrival(link, c->irSide);
+  // Already there, and only waiting for room
+  if (arrival <= runt_get_clock(c->runt)) {
+    arrival = IRLINK_NEVER;
+  }
+  
+  if (arrival == IRLINK_NEVER && runt_get_idle_deadline(c->runt) == SCHED_NEVER) {
+    irlink_set_asleep(link, c->irSide, true);
+    runt_idle(c->runt);
+    irlink_set_asleep(link, c->irSide, false);
+    
+    arrival = irlink_get_arrival(link, c->irSide);
+    uint64_t other = irlink_get_clock(link, c->irSide ^ 1);
+    runt_idle_until(c->runt, (arrival < other) ? arrival : other);
+    return;
+  }
+  
+  uint64_t horizon = irlink_get_horizon(link, c->irSide);
+  runt_idle_until(c->runt, (arrival < horizon) ? arrival : horizon);
+}
+
+uint32_t newton_serial_channel_send(newton_t *c, uint8_t channel, const uint8_t *data, uint32_t size) {
+  // While replaying, the log is the only source of input
+  if (c->inputPlayer != NULL) {
+    return size;
+  }
+  
+  uint32_t sent = ring_write(&c->serialQueues[channel & 1].host, data, size);
+  if (sent > 0 && c->runt != NULL) {
+    runt_wake(c->runt);
+  }
+  return sent;
+}
+
+void newton_file_input_notify(newton_t *c, uint32_t addr, uint32_t value) {
+  newton_input_post(c, NewtonInputFileNotify, addr, value, NULL, 0);
 }
 
 #pragma mark -
@@ -1434,6 +2061,14 @@ void newton_init (newton_t *c)
                   newton_set_mem8, newton_set_mem16, newton_set_mem32);
   arm_reset(c->arm);
   
+#if !DISABLE_JIT
+  arm_set_jit(c->arm, 1);
+#endif
+  
+#if !DISABLE_DEBUGGER
+  arm_set_brk_fct(c->arm, c, newton_breakpoint_check);
+#endif
+  
   //
   // Setup floating point coprocessor
   //
@@ -1442,6 +2077,10 @@ void newton_init (newton_t *c)
   //
   // Logging
   //
+  c->logger = logger_new(stdout);
+  if (c->logger != NULL) {
+    logger_set_clock(c->logger, &c->arm->oprcnt);
+  }
   newton_set_logfile(c, stdout);
   
   //
@@ -1449,6 +2088,15 @@ void newton_init (newton_t *c)
   //
   c->docker = docker_new();
   
+  //
+  // Input from the host
+  //
+  newton_input_queue_init(&c->inputQueue);
+  for (int i=0; i<2; i++) {
+    ring_init(&c->serialQueues[i].host, NEWTON_SERIAL_RING_SIZE);
+    ring_init(&c->serialQueues[i].pending, NEWTON_SERIAL_RING_SIZE);
+  }
+  
   //
   //
   //
@@ -1458,7 +2106,7 @@ void newton_init (newton_t *c)
 #endif
 }
 
-void newton_install_memory_handler(newton_t *c,
+membank_t *newton_install_memory_handler(newton_t *c,
                                    uint32_t base,
                                    uint32_t length,
                                    void *context,
@@ -1481,14 +2129,89 @@ void newton_install_memory_handler(newton_t *c,
   
   bank->next = c->membanks;
   c->membanks = bank;
+  
+  if (c->memmap == NULL) {
+    c->memmap = calloc(NEWTON_MEMMAP_CNT, sizeof(membank_t *));
+  }
+  
+  if (length > 0) {
+    uint32_t first = base >> NEWTON_MEMMAP_SHIFT;
+    uint64_t last = ((uint64_t)base + length - 1) >> NEWTON_MEMMAP_SHIFT;
+    if (last >= NEWTON_MEMMAP_CNT) {
+      last = NEWTON_MEMMAP_CNT - 1;
+    }
+    for (uint32_t slot=first; slot<=last; slot++) {
+      c->memmap[slot] = bank;
+    }
+  }
+  
+  return bank;
 }
 
 void newton_install_memory(newton_t *c, memory_t *memory, uint32_t base, uint32_t length) {
-  newton_install_memory_handler(c, base, length,
-                                memory,
-                                memory_get_uint32, memory_set_uint32,
-                                memory_get_uint8, memory_set_uint8,
-                                memory_delete);
+  membank_t *bank = newton_install_memory_handler(c, base, length,
+                                                  memory,
+                                                  memory_get_uint32, memory_set_uint32,
+                                                  memory_get_uint8, memory_set_uint8,
+                                                  memory_delete);
+  bank->memory = memory;
+  memory_set_logger(memory, c->logger);
+}
+
+static bool newton_membank_overlaps(membank_t *bank, uint32_t base, uint32_t length) {
+  return (base < (uint64_t)bank->base + bank->length && bank->base < (uint64_t)base + length);
+}
+
+// Lets the CPU load and store plain ROM and RAM directly instead of
+// going through the membank callbacks. Memory tracing needs to see
+// every access, so it turns this off. Data breakpoints only take the
+// pages they're in out, see newton_update_breakpoints().
+static void newton_update_direct_memory(newton_t *c) {
+  arm_clear_ram(c->arm);
+  
+#if !DISABLE_DEBUGGER
+  if (c->memTrace == true) {
+    return;
+  }
+#endif
+  
+  for (membank_t *bank = c->membanks; bank != NULL; bank = bank->next) {
+    memory_t *memory = bank->memory;
+    if (memory == NULL || memory_is_direct(memory) == false) {
+      continue;
+    }
+    
+    uint32_t base = bank->base;
+    uint32_t length = memory_get_length(memory);
+    if (length > bank->length) {
+      length = bank->length;
+    }
+    
+    // Banks installed later take precedence
+    bool shadowed = false;
+    for (membank_t *other = c->membanks; other != bank; other = other->next) {
+      if (newton_membank_overlaps(other, base, length)) {
+        shadowed = true;
+        break;
+      }
+    }
+    if (shadowed == true) {
+      continue;
+    }
+    
+    uint8_t *contents = memory_get_contents(memory);
+    int writable = (memory_get_readonly(memory) == false);
+    
+    // Leave out the words newton_get_mem32 answers itself
+    if (base <= 0x000013f4 && 0x00001400 <= base + length) {
+      uint32_t hole = 0x000013f4 - base;
+      arm_add_ram(c->arm, base, hole, contents, writable);
+      arm_add_ram(c->arm, base + hole + 12, length - hole - 12, contents + hole + 12, writable);
+    }
+    else {
+      arm_add_ram(c->arm, base, length, contents, writable);
+    }
+  }
 }
 
 
@@ -1552,7 +2275,10 @@ int newton_configure_runt(newton_t *c, memory_t *rom) {
   // Configure the Runt ASIC
   c->runt = runt_new(c->machineType);
   runt_set_arm(c->runt, c->arm);
-  runt_set_log_file(c->runt, c->logFile);
+  runt_set_logger(c->runt, c->logger);
+  if (c->display_open != NULL || c->display_update != NULL) {
+    runt_set_display_fct(c->runt, c->display_ext, c->display_open, c->display_update);
+  }
   newton_install_memory_handler(c, 0x01400000, 0x00400000, c->runt, runt_get_mem32, runt_set_mem32, runt_get_mem8, runt_set_mem8, runt_del);
   
   //
@@ -1566,7 +2292,7 @@ int newton_configure_runt(newton_t *c, memory_t *rom) {
   
   // Configure pcmcia handler
   pcmcia_t *pcmcia = pcmcia_new();
-  pcmcia_set_log_file(pcmcia, c->logFile);
+  pcmcia_set_logger(pcmcia, c->logger);
   pcmcia_set_runt(pcmcia, c->runt);
   c->pcmcia = pcmcia;
   
@@ -1577,73 +2303,66 @@ int newton_configure_runt(newton_t *c, memory_t *rom) {
   // No delete, as the above will get it.
   newton_install_memory_handler(c, 0x70000000, 0x0fffffff, pcmcia, pcmcia_get_mem32, pcmcia_set_mem32, NULL, NULL, NULL);
   
+  newton_update_direct_memory(c);
+  
   return 0;
 }
 
 int newton_load_rom(newton_t *c, const char *path) {
-  FILE *romFP = fopen(path, "r");
-  if (romFP == NULL) {
+  int romFD = open(path, O_RDONLY);
+  if (romFD == -1) {
     LOG_STR("Couldn't open ROM '%s': %s\n", path, strerror(errno));
     return -1;
   }
   
-  fseek(romFP, 0l, SEEK_END);
-  uint32_t romSize = (uint32_t)ftell(romFP);
-  fseek(romFP, 0l, SEEK_SET);
+  struct stat romStat;
+  if (fstat(romFD, &romStat) == -1) {
+    LOG_STR("Couldn't stat ROM '%s': %s\n", path, strerror(errno));
+    close(romFD);
+    return -1;
+  }
   
-  if (romSize % 4 != 0) {
+  size_t fileSize = (size_t)romStat.st_size;
+  uint32_t romSize = (uint32_t)fileSize;
+  if (romSize == 0 || romSize % 4 != 0) {
     LOG_STR("Bad ROM size: %i\n", romSize);
+    close(romFD);
     return -1;
   }
   
-  uint32_t romWord = 0;
-  if (fread(&romWord, 1, sizeof(romWord), romFP) == sizeof(romWord)) {
-    if (htonl(romWord) == 0xE1A00000) {
-      LOG_STR("ROM file appears to be an AIF image\n");
-      romSize -= 128;
-      
-      fseek(romFP, 0x14, SEEK_SET);
-      
-#define AIF_HEADER_SIZE 128
-      uint32_t readOnlySize=0, readWriteSize=0, debugSize=0;
-      
-      fread(&readOnlySize, 1, sizeof(readOnlySize), romFP);
-      readOnlySize = htonl(readOnlySize);
-      fread(&readWriteSize, 1, sizeof(readWriteSize), romFP);
-      readWriteSize = htonl(readWriteSize);
-      fread(&debugSize, 1, sizeof(debugSize), romFP);
-      debugSize = htonl(debugSize);
-      
-      if (readOnlySize + readWriteSize + debugSize != romSize) {
-        LOG_STR("readOnlySize:%i + readWriteSize:%i + debugSize:%i != romSize:%i\n", readOnlySize, readWriteSize, debugSize, romSize);
-      }
-      else {
-#if !DISABLE_DEBUGGER
-        void *debugData = malloc(debugSize);
-        fseek(romFP, AIF_HEADER_SIZE + readOnlySize + readWriteSize, SEEK_SET);
-        if (fread(debugData, 1, debugSize, romFP) == debugSize) {
-          newton_parse_aif_debug_data(c, debugData, debugSize);
-        }
-        free(debugData);
-#endif
-      }
-      fseek(romFP, AIF_HEADER_SIZE, SEEK_SET);
+  // The image is already in guest byte order, so it is served straight
+  // from a read-only mapping. Every instance loading the same file
+  // shares its pages.
+  uint8_t *romImage = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, romFD, 0);
+  close(romFD);
+  if (romImage == MAP_FAILED) {
+    LOG_STR("Couldn't map ROM '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+  
+  uint32_t romOffset = 0;
+  const uint32_t *romWords = (const uint32_t *)romImage;
+  if (fileSize >= AIF_HEADER_SIZE && htonl(romWords[0]) == 0xE1A00000) {
+    LOG_STR("ROM file appears to be an AIF image\n");
+    romSize -= AIF_HEADER_SIZE;
+    romOffset = AIF_HEADER_SIZE;
+    
+    uint32_t readOnlySize = htonl(romWords[0x14 / 4]);
+    uint32_t readWriteSize = htonl(romWords[0x18 / 4]);
+    uint32_t debugSize = htonl(romWords[0x1c / 4]);
+    
+    if (readOnlySize + readWriteSize + debugSize != romSize) {
+      LOG_STR("readOnlySize:%i + readWriteSize:%i + debugSize:%i != romSize:%i\n", readOnlySize, readWriteSize, debugSize, romSize);
     }
     else {
-      fseek(romFP, 0, SEEK_SET);
+#if !DISABLE_DEBUGGER
+      newton_parse_aif_debug_data(c, romImage + AIF_HEADER_SIZE + readOnlySize + readWriteSize, debugSize);
+#endif
     }
   }
   
-  memory_t *rom = memory_new("ROM", 0x0, romSize);
-  memory_set_readonly(rom, true);
-  uint32_t i=0;
-  while (fread(&romWord, 1, sizeof(romWord), romFP) == sizeof(romWord)) {
-    rom->contents[i++] = (((romWord    ) & 0xff) << 24) |
-    (((romWord >>  8) & 0xff) << 16) |
-    (((romWord >> 16) & 0xff) << 8 ) |
-    (((romWord >> 24) & 0xff));
-  }
-  fclose(romFP);
+  memory_t *rom = memory_new_mapped("ROM", 0x0, romImage, fileSize, romOffset, romSize);
+  c->romHash = state_hash(romImage + romOffset, romSize);
   
   LOG_STR("Loaded ROM: %s => %i bytes\n", path, romSize);
   
@@ -1710,6 +2429,17 @@ int newton_load_rom(newton_t *c, const char *path) {
 
 void newton_free (newton_t *c)
 {
+  // Before anything they send to goes
+  newton_serial_bridge_close(c, RuntSerialChannelA);
+  newton_serial_bridge_close(c, RuntSerialChannelB);
+  newton_ir_unlink(c);
+  
+  newton_snapshot_del(c->savestateBase);
+  newton_history_set(c, 0, 0);
+  newton_input_record_stop(c);
+  newton_input_replay_stop(c);
+  newton_input_queue_free(&c->inputQueue);
+  
 #if !DISABLE_DEBUGGER
   bp_entry_t *bp = c->breakpoints;
   while (bp != NULL) {
@@ -1718,13 +2448,7 @@ void newton_free (newton_t *c)
     bp = next;
   }
   
-  symbol_t *sym = c->symbols;
-  while(sym != NULL) {
-    symbol_t *next = sym->next;
-    free(sym->name);
-    free(sym);
-    sym = next;
-  }
+  symbol_table_del(c->symbols);
 #endif
   
   membank_t *membank = c->membanks;
@@ -1737,16 +2461,20 @@ void newton_free (newton_t *c)
     membank = next;
   }
   
-  if (c->serialQueues[0].buffer != NULL) {
-    free(c->serialQueues[0].buffer);
+  if (c->memmap != NULL) {
+    free(c->memmap);
   }
-  if (c->serialQueues[1].buffer != NULL) {
-    free(c->serialQueues[1].buffer);
+  
+  for (int i=0; i<2; i++) {
+    ring_free(&c->serialQueues[i].host);
+    ring_free(&c->serialQueues[i].pending);
   }
   
   docker_del(c->docker);
+  fpa_delete(c->arm);
   arm_del(c->arm);
-  fpa_delete();
+  
+  logger_del(c->logger);
 }
 
 void newton_del (newton_t *c)
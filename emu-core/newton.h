@@ -10,10 +10,16 @@
 #define Leibniz_newton_h
 
 #include "arm.h"
+#include "bridge.h"
 #include "docker.h"
+#include "input.h"
+#include "irlink.h"
+#include "logger.h"
 #include "memory.h"
 #include "pcmcia.h"
+#include "ring.h"
 #include "runt.h"
+#include "symbols.h"
 
 #include <stdio.h>
 
@@ -29,13 +35,6 @@
 #define kGestalt_MachineType_Emate      0x10004000
 #define kGestalt_MachineType_Lindy			0x00726377
 
-typedef struct symbol_s symbol_t;
-struct symbol_s {
-  char *name;
-  uint32_t address;
-  symbol_t *next;
-};
-
 typedef enum {
   BP_NONE   = 0,
   BP_PC     = 1,
@@ -95,9 +94,17 @@ struct membank_s {
   membank_set_uint8_f set_uint8;
   membank_del_f del;
   
+  // The memory behind the bank, if it is plain memory
+  memory_t *memory;
+  
   membank_t *next;
 };
 
+// Physical address dispatch: one slot per 64KB granule of the 4GB
+// address space, pointing at the bank installed there (or NULL).
+#define NEWTON_MEMMAP_SHIFT 16
+#define NEWTON_MEMMAP_CNT   (1UL << (32 - NEWTON_MEMMAP_SHIFT))
+
 //
 //
 //
@@ -117,10 +124,17 @@ typedef enum {
   NewtonRebootStyleWarm,
 } NewtonRebootStyle;
 
+#define NEWTON_SERIAL_RING_SIZE 4096
+// How far ahead of the other Newton on an IR link one can run
+#define NEWTON_IR_LOOKAHEAD     (RUNT_TICKS_PER_SECOND / 1000)
+// How long to wait for it at a time, in ms
+#define NEWTON_IR_WAIT_MS       10
+
 typedef struct {
-  uint8_t *buffer;
-  uint32_t offset;
-  uint32_t length;
+  // Bytes sent by the host, for newton_emulate() to take in
+  ring_t host;
+  // Bytes taken in that the SCC hasn't had room for yet
+  ring_t pending;
 } newton_serial_queue_t;
 
 struct newton_s {
@@ -132,6 +146,7 @@ struct newton_s {
   memory_t *ram;
   
   membank_t *membanks;
+  membank_t **memmap;
   
   uint32_t machineType;
   uint32_t romManufacturer;
@@ -143,6 +158,12 @@ struct newton_s {
   
   docker_t *docker;
   newton_serial_queue_t serialQueues[2];
+  // Host connections to the serial ports. On channel A, one takes the
+  // place of the docker.
+  bridge_t *serialBridges[2];
+  // Beaming to another Newton in this process, as side irSide
+  irlink_t *irLink;
+  uint8_t irSide;
   
   // TapFileCntl related
   bool supportsRegularFiles;
@@ -154,10 +175,29 @@ struct newton_s {
   newton_do_sys_write_f do_sys_write;
   newton_do_sys_set_input_notify_f do_sys_set_input_notify;
   
+  // Display
+  void *display_ext;
+  lcd_display_open_f display_open;
+  lcd_display_update_f display_update;
+  
+  // Savestates: a hash of the ROM image, and the last full savestate
+  // written or read, which delta savestates are relative to
+  uint64_t romHash;
+  struct newton_snapshot_s *savestateBase;
+  uint64_t savestateId;
+  
+  // Input from the host, and its recording or replay. See input.h.
+  newton_input_queue_t inputQueue;
+  newton_input_log_t *inputRecorder;
+  newton_input_log_t *inputPlayer;
+  
+  // Snapshots for going back in time, see history.h
+  struct newton_history_s *history;
+  
   //
 #if !DISABLE_DEBUGGER
   bp_entry_t *breakpoints;
-  symbol_t *symbols;
+  symbol_table_t *symbols;
   
   bool instructionTrace;
   bool memTrace;
@@ -170,7 +210,9 @@ struct newton_s {
 
 	bool breakOnUnknownMemory;
 
+  // Where the logger writes, and where the monitor writes directly
   FILE *logFile;
+  logger_t *logger;
   uint32_t logFlags;
   
   newton_undefined_opcode_f  undefined_opcode;
@@ -214,8 +256,16 @@ void newton_set_newt_tests(newton_t *c, uint32_t newt_tests);
 uint32_t newton_get_newt_tests(newton_t *c);
 
 uint32_t newton_address_for_symbol(newton_t *c, const char *symbol);
+const char *newton_get_symbol_for_address(newton_t *c, uint32_t addr);
+// The symbol at addr or the closest before it, with the offset from it
+const char *newton_get_symbol_near_address(newton_t *c, uint32_t addr, uint32_t *offset);
 void newton_load_mapfile(newton_t *c, const char *mapfile);
 void newton_set_logfile(newton_t *c, FILE *file);
+// Wait for what was logged to be written out, before writing to the
+// log file directly
+void newton_log_flush(newton_t *c);
+void newton_set_log_timestamps(newton_t *c, bool timestamps);
+void newton_set_log_enabled(newton_t *c, LoggerSubsystem subsystem, bool enabled);
 void newton_print_state(newton_t *c);
 
 void newton_breakpoint_add(newton_t *c, uint32_t address, bp_type type);
@@ -227,6 +277,9 @@ bool newton_get_break_on_unknown_memory(newton_t *c);
 void newton_set_instruction_trace(newton_t *c, bool instructionTrace);
 bool newton_get_instruction_trace(newton_t *c);
 
+void newton_set_mem_trace(newton_t *c, bool memTrace);
+bool newton_get_mem_trace(newton_t *c);
+
 void newton_mem_hexdump(newton_t *c, uint32_t addr, uint32_t length);
 
 void newton_set_pc_spy(newton_t *c, bool pcSpy);
@@ -240,6 +293,37 @@ void newton_file_input_notify(newton_t *c, uint32_t addr, uint32_t value);
 void newton_touch_down(newton_t *c, int x, int y);
 void newton_touch_up(newton_t *c);
 
+void newton_switch_set_state(newton_t *c, int switchNum, int state);
+void newton_switch_toggle(newton_t *c, int switchNum);
+
+// Can be called from any thread, one at a time per channel. Returns
+// how much of data there was room for; send the rest again later.
+uint32_t newton_serial_channel_send(newton_t *c, uint8_t channel, const uint8_t *data, uint32_t size);
+// Connect a serial channel to a new pseudo-terminal, or to a socket
+// on localhost (port 0 for any free one). Replaces any bridge the
+// channel had. Returns -1 on failure.
+int newton_serial_bridge_pty(newton_t *c, uint8_t channel);
+int newton_serial_bridge_tcp(newton_t *c, uint8_t channel, uint16_t port);
+void newton_serial_bridge_close(newton_t *c, uint8_t channel);
+bridge_t *newton_get_serial_bridge(newton_t *c, uint8_t channel);
+// Connect the IR port to another Newton in this process, as side 0
+// or 1 of a link made with irlink_new(NEWTON_IR_LOOKAHEAD). On the
+// virtual clock, the two are kept within the lookahead of each other,
+// so each needs running for the other to get far. Replaces any bridge
+// the IR channel had, and the other way around. Returns -1 if the
+// side is taken. Delete the link once neither Newton is on it.
+int newton_ir_link(newton_t *c, irlink_t *link, uint8_t side);
+void newton_ir_unlink(newton_t *c);
+
+// Record the input from here on, or replay a recording made from
+// the same state. Both return 0 on success and -1 on error. While
+// replaying, input from the host is ignored.
+int newton_input_record_start(newton_t *c, const char *path);
+int newton_input_record_stop(newton_t *c);
+int newton_input_replay_start(newton_t *c, const char *path);
+void newton_input_replay_stop(newton_t *c);
+bool newton_input_is_replaying(newton_t *c);
+
 
 //
 void newton_set_system_panic(newton_t *c, newton_system_panic_f system_panic);
@@ -254,5 +338,9 @@ void newton_set_tapfilecntl_functions (newton_t *c, void *ext,
                      newton_do_sys_write_f do_sys_write,
                      newton_do_sys_set_input_notify_f do_sys_set_input_notify);
 
+void newton_set_display_functions (newton_t *c, void *ext,
+                     lcd_display_open_f display_open,
+                     lcd_display_update_f display_update);
+
 
 #endif
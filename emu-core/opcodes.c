@@ -64,91 +64,9 @@ int arm_write_cpsr (arm_t *c, uint32_t val, int prvchk)
 
 	c->privileged = ((val & 0x1f) != ARM_MODE_USR);
 
-	arm_tbuf_flush (c);
-
 	return (0);
 }
 
-/*
- * Set the N and Z condition codes according to a 32 bit result
- */
-static
-void arm_set_cc_nz (arm_t *c, uint32_t val)
-{
-	uint32_t cc;
-
-	val &= 0xffffffff;
-	cc = 0;
-
-	if (val == 0) {
-		cc |= ARM_PSR_Z;
-	}
-	else if (val & 0x80000000) {
-		cc |= ARM_PSR_N;
-	}
-
-	c->cpsr &= ~(ARM_PSR_Z | ARM_PSR_N);
-	c->cpsr |= cc;
-}
-
-/*
- * Set the condition codes after an addition
- */
-static
-void arm_set_cc_add (arm_t *c, uint32_t d, uint32_t s1, uint32_t s2)
-{
-	uint32_t cc;
-
-	cc = 0;
-
-	if (d == 0) {
-		cc |= ARM_PSR_Z;
-	}
-	else if (d & 0x80000000) {
-		cc |= ARM_PSR_N;
-	}
-
-	if ((d < s1) || ((d == s1) && (s2 != 0))) {
-		cc |= ARM_PSR_C;
-	}
-
-	if ((d ^ s1) & (d ^ s2) & 0x80000000) {
-		cc |= ARM_PSR_V;
-	}
-
-	c->cpsr &= ~(ARM_PSR_Z | ARM_PSR_N | ARM_PSR_C | ARM_PSR_V);
-	c->cpsr |= cc;
-}
-
-/*
- * Set the condition codes after a subtraction
- */
-static
-void arm_set_cc_sub (arm_t *c, uint32_t d, uint32_t s1, uint32_t s2)
-{
-	uint32_t cc;
-
-	cc = 0;
-
-	if (d == 0) {
-		cc |= ARM_PSR_Z;
-	}
-	else if (d & 0x80000000) {
-		cc |= ARM_PSR_N;
-	}
-
-	if (!((d > s1) || ((d == s1) && (s2 != 0)))) {
-		cc |= ARM_PSR_C;
-	}
-
-	if ((d ^ s1) & (s1 ^ s2) & 0x80000000) {
-		cc |= ARM_PSR_V;
-	}
-
-	c->cpsr &= ~(ARM_PSR_Z | ARM_PSR_N | ARM_PSR_C | ARM_PSR_V);
-	c->cpsr |= cc;
-}
-
 static
 uint32_t arm_set_psr_field (uint32_t psr, uint32_t val, unsigned fld)
 {
@@ -175,6 +93,29 @@ uint32_t arm_set_psr_field (uint32_t psr, uint32_t val, unsigned fld)
 	return (psr);
 }
 
+/*
+ * The conditions as a table, bit n of entry cond is set if cond
+ * is met for NZCV == n.
+ */
+const uint16_t arm_cond_tab[16] = {
+	0xf0f0, /* eq */
+	0x0f0f, /* ne */
+	0xcccc, /* cs */
+	0x3333, /* cc */
+	0xff00, /* mi */
+	0x00ff, /* pl */
+	0xaaaa, /* vs */
+	0x5555, /* vc */
+	0x0c0c, /* hi */
+	0xf3f3, /* ls */
+	0xaa55, /* ge */
+	0x55aa, /* lt */
+	0x0a05, /* gt */
+	0xf5fa, /* le */
+	0xffff, /* al */
+	0x0000  /* nv */
+};
+
 /*
  * Check if condition cond is met
  */
@@ -239,6 +180,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 	unsigned n;
 	uint32_t v, tmp;
 
+	/* don't evaluate the condition codes if the carry is not used */
 	if (cry == NULL) {
 		cry = &tmp;
 	}
@@ -250,7 +192,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 		n = (ir >> 7) & 0x1e;
 
 		if (n == 0) {
-			*cry = arm_get_cc_c (c);
+			*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 		}
 		else {
 			v = ((v >> n) | (v << (32 - n))) & 0xffffffff;
@@ -276,7 +218,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 		switch (arm_get_bits (ir, 5, 2)) {
 		case 0x00: /* lsl */
 			if (n == 0) {
-				*cry = arm_get_cc_c (c);
+				*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 			}
 			else if (n <= 32) {
 				*cry = (v >> (32 - n)) & 0x01;
@@ -290,7 +232,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 
 		case 0x01: /* lsr */
 			if (n == 0) {
-				*cry = arm_get_cc_c (c);
+				*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 			}
 			else if (n <= 32) {
 				*cry = (v >> (n - 1)) & 0x01;
@@ -304,7 +246,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 
 		case 0x02: /* asr */
 			if (n == 0) {
-				*cry = arm_get_cc_c (c);
+				*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 			}
 			else if (n < 32) {
 				*cry = (v >> (n - 1)) & 0x01;
@@ -324,7 +266,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 
 		case 0x03: /* ror */
 			if (n == 0) {
-				*cry = arm_get_cc_c (c);
+				*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 			}
 			else if ((n & 0x1f) == 0) {
 				*cry = (v >> 31) & 0x01;
@@ -345,7 +287,7 @@ uint32_t arm_get_sh (arm_t *c, uint32_t ir, uint32_t *cry)
 		switch (arm_get_bits (ir, 5, 2)) {
 		case 0x00: /* lsl */
 			if (n == 0) {
-				*cry = arm_get_cc_c (c);
+				*cry = (cry != &tmp) ? arm_get_cc_c (c) : 0;
 			}
 			else {
 				*cry = (v >> (32 - n)) & 0x01;
@@ -405,6 +347,20 @@ void op_undefined (arm_t *c)
 	arm_exception_undefined (c);
 }
 
+/* e6xx0010: undefined instruction used by the ROM to trap into the host */
+void op_trap (arm_t *c)
+{
+	uint32_t pc = arm_get_pc (c);
+
+	if (c->log_undef != NULL) {
+		c->log_undef (c->log_ext, c->ir);
+	}
+
+	if (pc == arm_get_pc (c)) {
+		arm_exception_undefined (c);
+	}
+}
+
 /* 00 09: mul[cond] rn, rm, rs */
 static
 void op00_09 (arm_t *c)
@@ -677,8 +633,7 @@ void op01 (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -789,8 +744,7 @@ void op03 (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -1588,8 +1542,7 @@ void op11 (arm_t *c)
 
 	d = s1 & s2;
 
-	arm_set_cc_nz (c, d);
-	arm_set_cc_c (c, shc);
+	arm_set_cc_log (c, d, shc);
 	arm_set_clk (c, 4, 1);
 }
 
@@ -1731,8 +1684,7 @@ void op13 (arm_t *c)
 
 	d = s1 ^ s2;
 
-	arm_set_cc_nz (c, d);
-	arm_set_cc_c (c, shc);
+	arm_set_cc_log (c, d, shc);
 	arm_set_clk (c, 4, 1);
 }
 
@@ -2027,8 +1979,7 @@ void op19 (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -2100,8 +2051,7 @@ void op1b (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -2179,8 +2129,7 @@ void op1d (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -2256,8 +2205,7 @@ void op1f (arm_t *c)
 		arm_set_clk (c, 0, 1);
 	}
 	else {
-		arm_set_cc_nz (c, d);
-		arm_set_cc_c (c, shc);
+		arm_set_cc_log (c, d, shc);
 		arm_set_clk (c, 4, 1);
 	}
 }
@@ -2509,6 +2457,21 @@ void op41 (arm_t *c)
 	arm_set_clk (c, arm_rd_is_pc (c->ir) ? 0 : 4, 1);
 }
 
+/*
+ * Get the number of words of a block transfer at addr that are in the
+ * same 4K page, where regs are the registers still to be transferred.
+ */
+static inline
+unsigned arm_block_words (uint32_t addr, unsigned regs)
+{
+	unsigned n, cnt;
+
+	n = (0x1000 - (addr & 0x00000ffc)) / 4;
+	cnt = arm_bitcnt32 (regs);
+
+	return ((cnt < n) ? cnt : n);
+}
+
 /* 80: stm[cond][mode] rn[!], registers[^] */
 static
 void op80 (arm_t *c)
@@ -2518,7 +2481,9 @@ void op80 (arm_t *c)
 	unsigned regs, regn;
 	unsigned mode;
 	uint32_t addr, base, writeback;
-	uint32_t val;
+	uint32_t val, raddr;
+	unsigned cnt;
+	unsigned char *host;
 	int aborted;
 
 	p = arm_get_bit (c->ir, 24);
@@ -2562,15 +2527,38 @@ void op80 (arm_t *c)
 		arm_set_reg_map (c, ARM_MODE_USR);
 	}
 
+	cnt = 0;
+	host = NULL;
+
 	for (i = 0; i < 16; i++) {
 		if (regs & (1U << i)) {
 			val = arm_get_reg_pc (c, i, 8);
 
-			if (arm_dstore32 (c, addr & 0xfffffffc, val)) {
+			if (cnt == 0) {
+				/* translate the words up to the end of the page */
+				cnt = arm_block_words (addr, regs >> i);
+				raddr = addr & 0xfffffffc;
+
+				if (arm_translate_block (c, &raddr, 4 * cnt, 1, &host)) {
+					aborted = 1;
+					break;
+				}
+
+				if (host != NULL) {
+					arm_mem_write (c, raddr);
+				}
+			}
+
+			if (host != NULL) {
+				arm_host_set32 (c, host, val);
+				host += 4;
+			}
+			else if (arm_dstore32 (c, addr & 0xfffffffc, val)) {
 				aborted = 1;
 				break;
 			}
 
+			cnt -= 1;
 			addr += 4;
 		}
 	}
@@ -2603,7 +2591,9 @@ void op81 (arm_t *c)
 	unsigned regs, regn;
 	unsigned mode;
 	uint32_t addr, base, writeback;
-	uint32_t val;
+	uint32_t val, raddr;
+	unsigned cnt;
+	unsigned char *host;
 
 	p = arm_get_bit (c->ir, 24);
 	u = arm_get_bit (c->ir, 23);
@@ -2645,9 +2635,26 @@ void op81 (arm_t *c)
 		arm_set_reg_map (c, ARM_MODE_USR);
 	}
 
+	cnt = 0;
+	host = NULL;
+
 	for (i = 0; i < 16; i++) {
 		if (regs & (1U << i)) {
-			if (arm_dload32 (c, addr & 0xfffffffc, &val)) {
+			if (cnt == 0) {
+				/* translate the words up to the end of the page */
+				cnt = arm_block_words (addr, regs >> i);
+				raddr = addr & 0xfffffffc;
+
+				if (arm_translate_block (c, &raddr, 4 * cnt, 0, &host)) {
+					return;
+				}
+			}
+
+			if (host != NULL) {
+				val = arm_host_get32 (c, host);
+				host += 4;
+			}
+			else if (arm_dload32 (c, addr & 0xfffffffc, &val)) {
 				return;
 			}
 
@@ -2659,6 +2666,7 @@ void op81 (arm_t *c)
 				arm_set_gpr (c, i, val);
 			}
 
+			cnt -= 1;
 			addr += 4;
 		}
 	}
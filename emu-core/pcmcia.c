@@ -27,9 +27,8 @@ enum {
 
 void pcmcia_init (pcmcia_t *c)
 {
-  c->registers = calloc(0xff, sizeof(uint8_t));
+  c->registers = calloc(PCMCIA_REGISTER_COUNT, sizeof(uint32_t));
   c->cardMemory = memory_new("SRAM", 0x10000000, 1024 * 1024);
-  c->logFile = stdout;
 }
 
 pcmcia_t *pcmcia_new (void)
@@ -67,8 +66,25 @@ void pcmcia_del (pcmcia_t *c)
 }
 
 #pragma mark -
-void pcmcia_set_log_file (pcmcia_t *c, FILE *file) {
-  c->logFile = file;
+void pcmcia_save_state (pcmcia_t *c, state_t *st) {
+  for (int i=0; i<PCMCIA_REGISTER_COUNT; i++) {
+    state_put_u32(st, c->registers[i]);
+  }
+  state_put_bool(st, c->cardInserted);
+}
+
+bool pcmcia_load_state (pcmcia_t *c, state_t *st) {
+  for (int i=0; i<PCMCIA_REGISTER_COUNT; i++) {
+    c->registers[i] = state_get_u32(st);
+  }
+  c->cardInserted = state_get_bool(st);
+  return (st->error == false);
+}
+
+#pragma mark -
+void pcmcia_set_logger (pcmcia_t *c, logger_t *logger) {
+  c->logger = logger;
+  memory_set_logger(c->cardMemory, logger);
 }
 
 void pcmcia_set_log_flags (pcmcia_t *c, uint32_t logFlags) {
@@ -144,7 +160,7 @@ uint32_t pcmcia_set_mem32(pcmcia_t *c, uint32_t addr, uint32_t val, uint32_t pc)
   }
   
   if (pcmcia_should_log_address(c, addr) == true) {
-    fprintf(c->logFile, "[PCMCIA:WRITE:%s] PC:0x%08x addr:0x%08x => val:0x%08x\n", pcmcia_get_adress_description(addr), pc, addr, val);
+    logger_log(c->logger, LoggerPCMCIA, "[PCMCIA:WRITE:%s] PC:0x%08x addr:0x%08x => val:0x%08x\n", pcmcia_get_adress_description(addr), pc, addr, val);
   }
   
   return val;
@@ -229,7 +245,7 @@ uint32_t pcmcia_get_mem32(pcmcia_t *c, uint32_t addr, uint32_t pc)
   }
   
   if (pcmcia_should_log_address(c, addr) == true) {
-    fprintf(c->logFile, "[PCMCIA:READ:%s] PC:0x%08x addr:0x%08x => val:0x%08x\n", pcmcia_get_adress_description(addr), pc, addr, result);
+    logger_log(c->logger, LoggerPCMCIA, "[PCMCIA:READ:%s] PC:0x%08x addr:0x%08x => val:0x%08x\n", pcmcia_get_adress_description(addr), pc, addr, result);
   }
   return result;
 }
@@ -15,6 +15,10 @@
 
 #include "memory.h"
 #include "runt.h"
+#include "state.h"
+
+// One register per word of the 256 byte register space
+#define PCMCIA_REGISTER_COUNT 64
 
 typedef struct pcmcia_s {
   uint32_t *registers;
@@ -24,7 +28,7 @@ typedef struct pcmcia_s {
   
   runt_t *runt;
   
-  FILE *logFile;
+  logger_t *logger;
   uint32_t logFlags;
 } pcmcia_t;
 
@@ -38,8 +42,12 @@ uint32_t pcmcia_get_mem32(pcmcia_t *c, uint32_t addr, uint32_t pc);
 
 void pcmcia_set_card_inserted (pcmcia_t *c, bool cardInserted);
 
+// The registers; the card memory is saved with the other memories
+void pcmcia_save_state (pcmcia_t *c, state_t *st);
+bool pcmcia_load_state (pcmcia_t *c, state_t *st);
+
 void pcmcia_set_log_flags (pcmcia_t *c, uint32_t logFlags);
-void pcmcia_set_log_file (pcmcia_t *c, FILE *file);
+void pcmcia_set_logger (pcmcia_t *c, logger_t *logger);
 void pcmcia_set_runt (pcmcia_t *c, runt_t *runt);
 
 #endif
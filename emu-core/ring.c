@@ -0,0 +1,107 @@
+//
+//  ring.c
+//  Leibniz
+//
+
+#include "ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool ring_init(ring_t *r, uint32_t size) {
+  uint32_t rounded = 1;
+  while (rounded < size) {
+    rounded *= 2;
+  }
+
+  r->buffer = calloc(rounded, sizeof(uint8_t));
+  if (r->buffer == NULL) {
+    r->size = 0;
+    return false;
+  }
+  r->size = rounded;
+  r->head = 0;
+  r->tail = 0;
+  return true;
+}
+
+void ring_free(ring_t *r) {
+  free(r->buffer);
+  r->buffer = NULL;
+  r->size = 0;
+}
+
+#pragma mark - Writer
+uint32_t ring_space(ring_t *r) {
+  uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  return r->size - (r->head - tail);
+}
+
+uint32_t ring_write(ring_t *r, const uint8_t *data, uint32_t length) {
+  uint32_t space = ring_space(r);
+  if (length > space) {
+    length = space;
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  // In up to two pieces, around the end of the buffer
+  uint32_t offset = r->head & (r->size - 1);
+  uint32_t first = r->size - offset;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(r->buffer + offset, data, first);
+  memcpy(r->buffer, data + first, length - first);
+
+  __atomic_store_n(&r->head, r->head + length, __ATOMIC_RELEASE);
+  return length;
+}
+
+#pragma mark - Reader
+uint32_t ring_count(ring_t *r) {
+  uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  return head - r->tail;
+}
+
+uint32_t ring_read(ring_t *r, uint8_t *data, uint32_t length) {
+  uint32_t count = ring_count(r);
+  if (length > count) {
+    length = count;
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  uint32_t offset = r->tail & (r->size - 1);
+  uint32_t first = r->size - offset;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(data, r->buffer + offset, first);
+  memcpy(data + first, r->buffer, length - first);
+
+  __atomic_store_n(&r->tail, r->tail + length, __ATOMIC_RELEASE);
+  return length;
+}
+
+bool ring_peek(ring_t *r, uint8_t *val) {
+  if (ring_count(r) == 0) {
+    return false;
+  }
+  *val = r->buffer[r->tail & (r->size - 1)];
+  return true;
+}
+
+void ring_skip(ring_t *r, uint32_t length) {
+  uint32_t count = ring_count(r);
+  if (length > count) {
+    length = count;
+  }
+  __atomic_store_n(&r->tail, r->tail + length, __ATOMIC_RELEASE);
+}
+
+void ring_clear(ring_t *r) {
+  ring_skip(r, ring_count(r));
+}
@@ -0,0 +1,44 @@
+//
+//  ring.h
+//  Leibniz
+//
+//  A fixed size ring of bytes for passing data from one thread to
+//  another without locks: one thread writes, one thread reads, and
+//  neither ever waits on the other. A write takes what fits and says
+//  how much that was, so the writer can hold on to the rest and try
+//  again later.
+//
+
+#ifndef __Leibniz__ring__
+#define __Leibniz__ring__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct ring_s {
+  uint8_t *buffer;
+  // A power of two
+  uint32_t size;
+  // Only the writer moves head and only the reader moves tail. Both
+  // only ever go up, and wrap around.
+  uint32_t head;
+  uint32_t tail;
+} ring_t;
+
+// size is rounded up to a power of two
+bool ring_init(ring_t *r, uint32_t size);
+void ring_free(ring_t *r);
+
+// Writer side. Returns how many bytes fit.
+uint32_t ring_write(ring_t *r, const uint8_t *data, uint32_t length);
+uint32_t ring_space(ring_t *r);
+
+// Reader side. Returns how many bytes were read.
+uint32_t ring_read(ring_t *r, uint8_t *data, uint32_t length);
+bool ring_peek(ring_t *r, uint8_t *val);
+void ring_skip(ring_t *r, uint32_t length);
+uint32_t ring_count(ring_t *r);
+// Drop everything written so far
+void ring_clear(ring_t *r);
+
+#endif /* defined(__Leibniz__ring__) */
@@ -9,6 +9,9 @@
 #include "runt.h"
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -29,7 +32,7 @@
 #define LOG_STR(...) {}
 #define SHOULD_LOG(__x__) false
 #else
-#define LOG_STR(...) fprintf(c->logFile, __VA_ARGS__)
+#define LOG_STR(...) logger_log(c->logger, LoggerRunt, __VA_ARGS__)
 #define SHOULD_LOG(__x__) ((c->logFlags & __x__) == __x__)
 #endif
 
@@ -222,6 +225,10 @@ void runt_log_access(runt_t *c, uint32_t addr, uint32_t val, bool write) {
 #endif
 
 #pragma mark -
+static void runt_update_inputs(runt_t *c);
+static void runt_scc_schedule(runt_t *c);
+static void runt_wait(runt_t *c, int timeout);
+
 static inline uint32_t runt_register_get(runt_t *c, uint8_t reg) {
   return c->memory[(reg<<8)/4];
 }
@@ -351,6 +358,10 @@ void runt_interrupt_raise(runt_t *c, uint32_t interrupt) {
     return;
   }
   
+  if (c->armAwake == false) {
+    runt_wake(c);
+  }
+  
   c->runtAwake = true;
   c->armAwake = true;
     
@@ -384,6 +395,8 @@ void runt_interrupt_lower(runt_t *c, uint32_t interrupt) {
   if (c->interrupt == 0x00) {
     arm_set_irq(c->arm, 0);
   }
+  
+  runt_update_inputs(c);
 }
 
 void runt_print_enabled_interrupts(runt_t *c) {
@@ -411,12 +424,15 @@ void runt_touch_down(runt_t *c, int x, int y) {
   c->touchX = x;
   c->touchY = y;
   c->touchActive = true;
+  runt_update_inputs(c);
+  runt_wake(c);
 }
 
 void runt_touch_up(runt_t *c) {
   c->touchX = 0;
   c->touchY = 0;
   c->touchActive = false;
+  runt_wake(c);
 }
 
 #pragma mark -
@@ -440,6 +456,13 @@ void runt_cpu_state_update(runt_t *c) {
     c->armAwake = true;
     c->runtAwake = true;
   }
+  
+  if (c->armAwake == false) {
+    // Don't let the current burst run past the pause
+    arm_run_limit(c->arm, 0);
+  }
+  
+  runt_update_inputs(c);
 }
 
 void runt_cpu_control_set(runt_t *c, uint32_t val) {
@@ -519,6 +542,7 @@ void runt_switch_set_state(runt_t *c, int switchNum, int state) {
       runt_interrupt_raise(c, RuntInterruptCardLock);
       break;
   }
+  runt_wake(c);
 }
 
 void runt_switch_toggle(runt_t *c, int switchNum) {
@@ -586,9 +610,11 @@ uint32_t runt_serial_set_value(runt_t *c, uint32_t addr, uint32_t val) {
 
   if (reg == RuntSerialData) {
     e8530_set_data(c->scc, channel, byteVal);
+    runt_scc_schedule(c);
   }
   else if (reg == RuntSerialConfig) {
     e8530_set_ctl(c->scc, channel, byteVal);
+    runt_scc_schedule(c);
   }
   else {
     if (runt_serial_should_log(c) == true) {
@@ -622,12 +648,252 @@ void runt_serial_chanB_rts(void *ext, uint8_t val) {
 
 
 #pragma mark - Clocks
+uint64_t runt_get_clock(runt_t *c) {
+  if (c->arm != NULL) {
+    unsigned long long oprcnt = arm_get_opcnt(c->arm);
+    // The counter starts over when the ARM is reset
+    if (oprcnt > c->clockOprcnt) {
+      c->clock += RUNT_TICKS_PER_INSTRUCTION * (oprcnt - c->clockOprcnt);
+    }
+    c->clockOprcnt = oprcnt;
+  }
+  return c->clock;
+}
+
+// Time passing without the ARM executing, e.g. while it is paused
+void runt_advance(runt_t *c, uint64_t ticks) {
+  if (c->runtAwake == true) {
+    c->clock = runt_get_clock(c) + ticks;
+  }
+}
+
 uint32_t runt_get_ticks(runt_t *c) {
-  return c->ticks;
+  return (uint32_t)runt_get_clock(c);
 }
 
 uint32_t runt_get_rtc(runt_t *c) {
-  return (uint32_t)(time(NULL) - c->bootTime);
+  if (c->clockMode == RuntClockHost) {
+    return (uint32_t)(time(NULL) - c->bootTime);
+  }
+  return c->rtcOffset + (uint32_t)((runt_get_clock(c) - c->rtcEpoch) / RUNT_TICKS_PER_SECOND);
+}
+
+static uint64_t runt_host_time(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Where the virtual clock should be according to the host clock, in
+// RuntClockSynced mode
+static uint64_t runt_get_sync_clock(runt_t *c) {
+  uint64_t host = runt_host_time();
+  uint64_t usecs = (host > c->syncHostTime) ? (host - c->syncHostTime) : 0;
+  return c->syncClock + (usecs / 1000000) * RUNT_TICKS_PER_SECOND + (usecs % 1000000) * RUNT_TICKS_PER_SECOND / 1000000;
+}
+
+static void runt_sync_reset(runt_t *c) {
+  c->syncClock = runt_get_clock(c);
+  c->syncHostTime = runt_host_time();
+}
+
+static int runt_ticks_to_ms(uint64_t ticks) {
+  uint64_t ms = (ticks / RUNT_TICKS_PER_SECOND) * 1000 + ((ticks % RUNT_TICKS_PER_SECOND) * 1000 + RUNT_TICKS_PER_SECOND - 1) / RUNT_TICKS_PER_SECOND;
+  return (ms < INT_MAX) ? (int)ms : INT_MAX;
+}
+
+#pragma mark - Events
+static unsigned long runt_instructions_until(runt_t *c, uint64_t deadline) {
+  uint64_t now = runt_get_clock(c);
+  if (deadline <= now) {
+    return 0;
+  }
+  
+  uint64_t count = (deadline - now + RUNT_TICKS_PER_INSTRUCTION - 1) / RUNT_TICKS_PER_INSTRUCTION;
+  return (count < RUNT_BURST_MAX) ? (unsigned long)count : RUNT_BURST_MAX;
+}
+
+// The number of instructions the ARM can run before the next event
+// is due.
+unsigned long runt_get_burst(runt_t *c) {
+  if (c->armAwake == false) {
+    return 1;
+  }
+  
+  unsigned long count = runt_instructions_until(c, sched_next(&c->sched));
+  return (count > 0) ? count : 1;
+}
+
+static void runt_schedule(runt_t *c, sched_event_t *event, uint64_t deadline) {
+  sched_add(&c->sched, event, deadline);
+  
+  // If this is called from within an instruction, end the burst
+  // the ARM is in before it runs past the new deadline.
+  if (c->arm != NULL) {
+    arm_run_limit(c->arm, runt_instructions_until(c, deadline));
+  }
+}
+
+static const uint32_t runt_ticks_alarm_interrupts[3] = {
+  RuntInterruptTimer1, RuntInterruptTimer2, RuntInterruptTimer3,
+};
+
+static void runt_ticks_alarm_fire(runt_t *c, int timer) {
+  runt_interrupt_raise(c, runt_ticks_alarm_interrupts[timer]);
+  c->ticksAlarm[timer] = 0;
+}
+
+static void runt_ticks_alarm1_event(void *ext, uint64_t now) {
+  runt_ticks_alarm_fire(ext, 0);
+}
+
+static void runt_ticks_alarm2_event(void *ext, uint64_t now) {
+  runt_ticks_alarm_fire(ext, 1);
+}
+
+static void runt_ticks_alarm3_event(void *ext, uint64_t now) {
+  runt_ticks_alarm_fire(ext, 2);
+}
+
+void runt_set_ticks_alarm(runt_t *c, int timer, uint32_t val) {
+  c->ticksAlarm[timer] = val;
+  if (val == 0) {
+    sched_remove(&c->sched, &c->ticksAlarmEvent[timer]);
+    return;
+  }
+  
+  // The alarm goes off once the ticks register reaches the value
+  uint64_t now = runt_get_clock(c);
+  uint32_t ticks = (uint32_t)now;
+  uint64_t deadline = now;
+  if (val > ticks) {
+    deadline += (val - ticks);
+  }
+  runt_schedule(c, &c->ticksAlarmEvent[timer], deadline);
+}
+
+static void runt_rtc_alarm_event(void *ext, uint64_t now) {
+  runt_t *c = (runt_t *)ext;
+  if (c->rtcAlarm == 0) {
+    return;
+  }
+  
+  if (runt_get_rtc(c) >= c->rtcAlarm) {
+    runt_interrupt_raise(c, RuntInterruptAlarm);
+    c->rtcAlarm = 0;
+  }
+  else {
+    runt_schedule(c, &c->rtcAlarmEvent, now + RUNT_RTC_POLL_TICKS);
+  }
+}
+
+void runt_set_rtc_alarm(runt_t *c, uint32_t val) {
+  c->rtcAlarm = val;
+  if (val == 0) {
+    sched_remove(&c->sched, &c->rtcAlarmEvent);
+  }
+  else if (c->clockMode == RuntClockHost) {
+    // The host clock can only be polled
+    runt_schedule(c, &c->rtcAlarmEvent, runt_get_clock(c));
+  }
+  else {
+    uint64_t deadline = c->rtcEpoch;
+    if (val > c->rtcOffset) {
+      deadline += (uint64_t)(val - c->rtcOffset) * RUNT_TICKS_PER_SECOND;
+    }
+    runt_schedule(c, &c->rtcAlarmEvent, deadline);
+  }
+}
+
+static void runt_set_rtc(runt_t *c, uint32_t seconds) {
+  c->bootTime = time(NULL) - seconds;
+  c->rtcOffset = seconds;
+  c->rtcEpoch = runt_get_clock(c);
+  runt_set_rtc_alarm(c, c->rtcAlarm);
+}
+
+void runt_set_clock_mode(runt_t *c, RuntClockMode mode) {
+  uint32_t rtc = runt_get_rtc(c);
+  c->clockMode = mode;
+  runt_set_rtc(c, rtc);
+  runt_sync_reset(c);
+}
+
+RuntClockMode runt_get_clock_mode(runt_t *c) {
+  return c->clockMode;
+}
+
+// The SCC only needs to be clocked when a character time ends on
+// one of its channels, so it is clocked in batches up to there.
+static void runt_scc_schedule(runt_t *c) {
+  uint64_t clocks = e8530_get_clock_cnt(c->scc);
+  runt_schedule(c, &c->sccEvent, c->sccNextClock + (clocks - 1) * RUNT_TICKS_PER_SCC_CLOCK);
+}
+
+static void runt_scc_event(void *ext, uint64_t now) {
+  runt_t *c = (runt_t *)ext;
+  if (now >= c->sccNextClock) {
+    uint64_t clocks = (now - c->sccNextClock) / RUNT_TICKS_PER_SCC_CLOCK + 1;
+    c->sccNextClock += clocks * RUNT_TICKS_PER_SCC_CLOCK;
+    e8530_clock(c->scc, (unsigned)clocks);
+  }
+  runt_scc_schedule(c);
+}
+
+// The SCC moves up to a buffer's worth of characters per character
+// time in fast mode, so it is never the guest that waits on the line
+void runt_set_fast_serial(runt_t *c, bool fastSerial) {
+  unsigned max = (fastSerial == true) ? E8530_BUF_MAX : 1;
+  c->fastSerial = fastSerial;
+  e8530_set_multichar(c->scc, RuntSerialChannelA, max, max);
+  e8530_set_multichar(c->scc, RuntSerialChannelB, max, max);
+}
+
+bool runt_get_fast_serial(runt_t *c) {
+  return c->fastSerial;
+}
+
+void runt_serial_poll(runt_t *c, uint8_t channel) {
+  if (c->fastSerial == true) {
+    e8530_poll(c->scc, channel);
+  }
+}
+
+static void runt_lcd_event(void *ext, uint64_t now) {
+  runt_t *c = (runt_t *)ext;
+  if (c->lcd_step != NULL) {
+    c->lcd_step(c->lcd_driver, (unsigned)((now - c->lcdLastStep) / RUNT_TICKS_PER_INSTRUCTION));
+    c->lcdLastStep = now;
+    runt_schedule(c, &c->lcdEvent, now + RUNT_LCD_STEP_TICKS);
+  }
+}
+
+// The tablet and the ADC keep their interrupts asserted for as long
+// as they have something to report, so they are raised again
+// whenever the state that they depend on changes.
+static void runt_update_inputs(runt_t *c) {
+  if (c->runtAwake == false) {
+    return;
+  }
+  
+  if (c->touchActive == true) {
+    runt_interrupt_raise(c, RuntInterruptTablet);
+  }
+  
+  uint32_t sampleSource = c->adcSource;
+  switch (sampleSource) {
+    case RuntADCSourceBackupBattery:
+    case RuntADCSourceMainBattery:
+    case RuntADCSourceThermistor:
+    case RuntADCSourceTabletPositionX:
+    case RuntADCSourceTabletPositionY:
+    case RuntADCSourceTabletPressureX:
+    case RuntADCSourceTabletPressureY:
+      if (runt_interrupt_is_enabled(c, RuntInterruptADConverter) == true && runt_power_state_get_subsystem(c, RuntPowerADC) == true) {
+        runt_interrupt_raise(c, RuntInterruptADConverter);
+      }
+      break;
+  }
 }
 
 #pragma mark - Memory access
@@ -647,6 +913,7 @@ uint32_t runt_set_mem32(runt_t *c, uint32_t addr, uint32_t val, uint32_t pc) {
       }
       break;
     case RuntLCD:
+      logger_flush(c->logger);
       fprintf(stderr, "Unsupported word set for Runt LCD (0x%08x) at PC:0x%08x\n", addr, pc);
       abort();
       break;
@@ -680,19 +947,19 @@ uint32_t runt_set_mem32(runt_t *c, uint32_t addr, uint32_t val, uint32_t pc) {
       runt_set_enabled_interrupts(c, val);
       break;
     case RuntRTC:
-      c->bootTime = time(NULL);
+      runt_set_rtc(c, 0);
       break;
     case RuntRTCAlarm:
-      c->rtcAlarm = val;
+      runt_set_rtc_alarm(c, val);
       break;
     case RuntTicksAlarm1:
-      c->ticksAlarm1 = val;
+      runt_set_ticks_alarm(c, 0, val);
       break;
     case RuntTicksAlarm2:
-      c->ticksAlarm2 = val;
+      runt_set_ticks_alarm(c, 1, val);
       break;
     case RuntTicksAlarm3:
-      c->ticksAlarm3 = val;
+      runt_set_ticks_alarm(c, 2, val);
       break;
     case RuntSoundDMA1Length:
     case RuntSoundDMA2Length:
@@ -704,6 +971,7 @@ uint32_t runt_set_mem32(runt_t *c, uint32_t addr, uint32_t val, uint32_t pc) {
   }
   
   c->memory[localAddr] = val;
+  runt_update_inputs(c);
   return val;
 }
 
@@ -713,6 +981,7 @@ uint32_t runt_get_mem32(runt_t *c, uint32_t addr, uint32_t pc) {
   
   switch ((addr >> 8) & 0xff) {
     case RuntLCD:
+      logger_flush(c->logger);
       fprintf(stderr, "Unsupported word set for Runt LCD (0x%08x) at PC:0x%08x\n", addr, pc);
       abort();
       break;
@@ -740,13 +1009,13 @@ uint32_t runt_get_mem32(runt_t *c, uint32_t addr, uint32_t pc) {
       result = c->rtcAlarm;
       break;
     case RuntTicksAlarm1:
-      result = c->ticksAlarm1;
+      result = c->ticksAlarm[0];
       break;
     case RuntTicksAlarm2:
-      result = c->ticksAlarm2;
+      result = c->ticksAlarm[1];
       break;
     case RuntTicksAlarm3:
-      result = c->ticksAlarm3;
+      result = c->ticksAlarm[2];
       break;
   }
   
@@ -770,6 +1039,7 @@ uint8_t runt_set_mem8(runt_t *c, uint32_t addr, uint8_t val, uint32_t pc) {
     case RuntADCValue:
       break;
     default:
+      logger_flush(c->logger);
       fprintf(stderr, "Unsupported byte set in Runt for address:0x%08x\n", addr);
       abort();
       break;
@@ -789,6 +1059,7 @@ uint8_t runt_get_mem8(runt_t *c, uint32_t addr, uint32_t pc) {
       result = runt_serial_get_value(c, addr);
       break;
     default:
+      logger_flush(c->logger);
       fprintf(stderr, "Unsupported byte set in Runt for address:0x%08x\n", addr);
       abort();
       break;
@@ -800,62 +1071,150 @@ uint8_t runt_get_mem8(runt_t *c, uint32_t addr, uint32_t pc) {
 
 
 #pragma mark -
+// Runs the events that have become due. Returns whether the ARM
+// should keep executing.
 bool runt_step(runt_t *c) {
   if (c->runtAwake == false) {
-    usleep(100);
     return false;
   }
-    
-  c->ticks += 2;
-
-  if (c->ticks % 10 == 4) {
-    e8530_clock (c->scc, 1);
+  
+  sched_run(&c->sched, runt_get_clock(c));
+  
+  if (c->clockMode == RuntClockSynced) {
+    // Hold the emulation back while it is ahead of the host, and
+    // give up on catching up if it has fallen far behind, e.g.
+    // after sitting in the monitor.
+    uint64_t now = runt_get_clock(c);
+    uint64_t host = runt_get_sync_clock(c);
+    if (now > host + RUNT_SYNC_SLACK_TICKS) {
+      runt_wait(c, runt_ticks_to_ms(now - host));
+    }
+    else if (host > now + RUNT_TICKS_PER_SECOND) {
+      runt_sync_reset(c);
+    }
   }
+  
+  return c->armAwake;
+}
 
-  if (c->rtcAlarm != 0 && runt_get_rtc(c) >= c->rtcAlarm) {
-    runt_interrupt_raise(c, RuntInterruptAlarm);
-    c->rtcAlarm = 0;
+bool runt_arm_is_awake(runt_t *c) {
+  return (c->runtAwake == true && c->armAwake == true);
+}
+
+#pragma mark - Idle
+// The earliest deadline that can end a CPU pause: the ticks alarms,
+// a due RTC alarm, and the SCC while it has characters to move.
+static uint64_t runt_get_wakeup(runt_t *c) {
+  uint64_t deadline = SCHED_NEVER;
+  for (int i=0; i<3; i++) {
+    sched_event_t *event = &c->ticksAlarmEvent[i];
+    if (sched_is_scheduled(event) == true && event->deadline < deadline) {
+      deadline = event->deadline;
+    }
   }
   
-  if (c->ticksAlarm1 != 0 && runt_get_ticks(c) >= c->ticksAlarm1) {
-    runt_interrupt_raise(c, RuntInterruptTimer1);
-    c->ticksAlarm1 = 0;
+  if (c->rtcAlarm != 0 && (c->clockMode != RuntClockHost || runt_get_rtc(c) >= c->rtcAlarm)) {
+    if (sched_is_scheduled(&c->rtcAlarmEvent) == true && c->rtcAlarmEvent.deadline < deadline) {
+      deadline = c->rtcAlarmEvent.deadline;
+    }
   }
   
-  if (c->ticksAlarm2 != 0 && runt_get_ticks(c) >= c->ticksAlarm2) {
-    runt_interrupt_raise(c, RuntInterruptTimer2);
-    c->ticksAlarm2 = 0;
+  if (e8530_get_busy(c->scc) != 0 && c->sccEvent.deadline < deadline) {
+    deadline = c->sccEvent.deadline;
   }
   
-  if (c->ticksAlarm3 != 0 && runt_get_ticks(c) >= c->ticksAlarm3) {
-    runt_interrupt_raise(c, RuntInterruptTimer3);
-    c->ticksAlarm3 = 0;
+  return deadline;
+}
+
+static void runt_wait(runt_t *c, int timeout) {
+  if (c->wakePipe[0] < 0) {
+    usleep(100);
+    return;
   }
   
-  if (c->touchActive == true) {
-    runt_interrupt_raise(c, RuntInterruptTablet);
+  struct pollfd fd = { .fd = c->wakePipe[0], .events = POLLIN };
+  if (poll(&fd, 1, timeout) > 0) {
+    uint8_t buf[64];
+    while (read(c->wakePipe[0], buf, sizeof(buf)) > 0) {
+    }
+  }
+}
+
+// Nothing is going to draw while we wait, so let the LCD flush
+// what it is holding back.
+static void runt_idle_flush_lcd(runt_t *c) {
+  if (c->lcd_step != NULL) {
+    c->lcd_step(c->lcd_driver, 0x10000);
   }
+}
+
+// Called in place of running the ARM while it is paused or asleep.
+void runt_idle(runt_t *c) {
+  uint64_t now = runt_get_clock(c);
   
-  uint32_t sampleSource = c->adcSource;
-  switch (sampleSource) {
-    case RuntADCSourceBackupBattery:
-    case RuntADCSourceMainBattery:
-    case RuntADCSourceThermistor:
-    case RuntADCSourceTabletPositionX:
-    case RuntADCSourceTabletPositionY:
-    case RuntADCSourceTabletPressureX:
-    case RuntADCSourceTabletPressureY:
-      if (runt_interrupt_is_enabled(c, RuntInterruptADConverter) == true && runt_power_state_get_subsystem(c, RuntPowerADC) == true) {
-        runt_interrupt_raise(c, RuntInterruptADConverter);
+  if (c->clockMode == RuntClockSynced) {
+    // Wait for the host clock to reach the next deadline, or for an
+    // external event, then move the virtual clock up to the host.
+    uint64_t deadline = (c->runtAwake == true) ? runt_get_wakeup(c) : SCHED_NEVER;
+    uint64_t host = runt_get_sync_clock(c);
+    if (deadline > host) {
+      runt_idle_flush_lcd(c);
+      runt_wait(c, (deadline != SCHED_NEVER) ? runt_ticks_to_ms(deadline - host) : -1);
+      host = runt_get_sync_clock(c);
+    }
+    
+    uint64_t target = (deadline < host) ? deadline : host;
+    if (target > now) {
+      // Time passes for the RTC while the RUNT is asleep too
+      c->clock = target;
+    }
+    return;
+  }
+  
+  if (c->runtAwake == true) {
+    // Nothing changes while the CPU is paused until an alarm goes
+    // off or the SCC moves a character, so skip straight to that.
+    uint64_t deadline = runt_get_wakeup(c);
+    if (deadline != SCHED_NEVER) {
+      if (deadline > now) {
+        runt_advance(c, deadline - now);
       }
-      break;
+      return;
+    }
   }
   
-  if (c->lcd_step != NULL) {
-    c->lcd_step(c->lcd_driver);
+  // Only an external event can wake us up now
+  runt_idle_flush_lcd(c);
+  
+  int timeout = -1;
+  if (c->runtAwake == true && c->rtcAlarm != 0 && c->clockMode == RuntClockHost) {
+    uint32_t rtc = runt_get_rtc(c);
+    uint32_t seconds = (c->rtcAlarm > rtc) ? (c->rtcAlarm - rtc) : 0;
+    timeout = (seconds < INT_MAX / 1000) ? (int)(seconds * 1000) : INT_MAX;
+  }
+  runt_wait(c, timeout);
+}
+
+uint64_t runt_get_idle_deadline(runt_t *c) {
+  return (c->runtAwake == true) ? runt_get_wakeup(c) : SCHED_NEVER;
+}
+
+void runt_idle_until(runt_t *c, uint64_t clock) {
+  uint64_t now = runt_get_clock(c);
+  uint64_t deadline = runt_get_idle_deadline(c);
+  uint64_t target = (deadline < clock) ? deadline : clock;
+  if (target > now) {
+    c->clock = target;
+  }
+}
+
+// End a runt_idle() wait. Can be called from any thread, and from
+// signal handlers.
+void runt_wake(runt_t *c) {
+  uint8_t val = 0;
+  if (c->wakePipe[1] < 0 || write(c->wakePipe[1], &val, 1) != 1) {
+    // A full pipe already has a wakeup pending
   }
-    
-  return c->armAwake;
 }
 
 #pragma mark -
@@ -869,8 +1228,8 @@ void runt_set_log_flags (runt_t *c, unsigned flags, int val) {
   }
 }
 
-void runt_set_log_file (runt_t *c, FILE *file) {
-  c->logFile = file;
+void runt_set_logger (runt_t *c, logger_t *logger) {
+  c->logger = logger;
 }
 
 #pragma mark -
@@ -880,7 +1239,8 @@ e8530_t * runt_get_scc(runt_t *c) {
 }
 
 void runt_set_lcd_fct(runt_t *c, void *ext,
-            void *get8, void *set8, void *getname, void *step, void *powered)
+            void *get8, void *set8, void *getname, void *step, void *powered, void *display,
+            void *save, void *load)
 {
   c->lcd_driver = ext;
   c->lcd_get_uint8 = get8;
@@ -888,27 +1248,195 @@ void runt_set_lcd_fct(runt_t *c, void *ext,
   c->lcd_get_address_name = getname;
   c->lcd_step = step;
   c->lcd_powered = powered;
+  c->lcd_set_display = display;
+  c->lcd_save_state = save;
+  c->lcd_load_state = load;
+}
+
+void runt_set_display_fct (runt_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update) {
+  c->lcd_set_display(c->lcd_driver, ext, open, update);
+}
+
+#pragma mark - State
+#define RUNT_EVENT_COUNT 6
+
+// The timed events, in the order they are numbered in saved state
+static void runt_get_events(runt_t *c, sched_event_t **events) {
+  events[0] = &c->ticksAlarmEvent[0];
+  events[1] = &c->ticksAlarmEvent[1];
+  events[2] = &c->ticksAlarmEvent[2];
+  events[3] = &c->rtcAlarmEvent;
+  events[4] = &c->sccEvent;
+  events[5] = &c->lcdEvent;
+}
+
+void runt_save_state(runt_t *c, state_t *st) {
+  // Most of the register file is never written, so only the
+  // non-zero words are saved
+  uint32_t used = 0;
+  for (uint32_t i=0; i<0xffff; i++) {
+    if (c->memory[i] != 0) {
+      used++;
+    }
+  }
+  state_put_u32(st, used);
+  for (uint32_t i=0; i<0xffff; i++) {
+    if (c->memory[i] != 0) {
+      state_put_u16(st, i);
+      state_put_u32(st, c->memory[i]);
+    }
+  }
+  
+  state_put_bool(st, c->runtAwake);
+  state_put_bool(st, c->armAwake);
+  
+  state_put_u32(st, c->rtcAlarm);
+  state_put_u64(st, c->bootTime);
+  state_put_u32(st, c->rtcOffset);
+  state_put_u64(st, c->rtcEpoch);
+  
+  for (int i=0; i<3; i++) {
+    state_put_u32(st, c->ticksAlarm[i]);
+  }
+  state_put_u32(st, c->adcSource);
+  
+  state_put_u64(st, c->clock);
+  state_put_u64(st, c->clockOprcnt);
+  
+  // The events in heap order: adding them back in the same order
+  // rebuilds the same heap, so events due at the same time still
+  // run in the same order.
+  sched_event_t *events[RUNT_EVENT_COUNT];
+  runt_get_events(c, events);
+  state_put_u8(st, c->sched.count);
+  for (int i=0; i<c->sched.count; i++) {
+    uint8_t id = 0;
+    while (id < RUNT_EVENT_COUNT - 1 && events[id] != c->sched.heap[i]) {
+      id++;
+    }
+    state_put_u8(st, id);
+    state_put_u64(st, c->sched.heap[i]->deadline);
+  }
+  state_put_u64(st, c->sccNextClock);
+  state_put_u64(st, c->lcdLastStep);
+  
+  state_put_u32(st, c->interrupt);
+  state_put_u32(st, c->interruptStick);
+  
+  for (int i=0; i<3; i++) {
+    state_put_u8(st, c->switches[i]);
+  }
+  
+  state_put_bool(st, c->touchActive);
+  state_put_u32(st, c->touchX);
+  state_put_u32(st, c->touchY);
+}
+
+void runt_save_lcd_state(runt_t *c, state_t *st) {
+  if (c->lcd_save_state != NULL) {
+    c->lcd_save_state(c->lcd_driver, st);
+  }
+}
+
+bool runt_load_lcd_state(runt_t *c, state_t *st) {
+  if (c->lcd_load_state != NULL) {
+    return c->lcd_load_state(c->lcd_driver, st);
+  }
+  return true;
+}
+
+bool runt_load_state(runt_t *c, state_t *st) {
+  memset(c->memory, 0, 0xffff * 4);
+  uint32_t used = state_get_u32(st);
+  for (uint32_t i=0; i<used && st->error == false; i++) {
+    uint16_t reg = state_get_u16(st);
+    uint32_t val = state_get_u32(st);
+    if (reg < 0xffff) {
+      c->memory[reg] = val;
+    }
+  }
+  
+  c->runtAwake = state_get_bool(st);
+  c->armAwake = state_get_bool(st);
+  
+  c->rtcAlarm = state_get_u32(st);
+  c->bootTime = (time_t)state_get_u64(st);
+  c->rtcOffset = state_get_u32(st);
+  c->rtcEpoch = state_get_u64(st);
+  
+  for (int i=0; i<3; i++) {
+    c->ticksAlarm[i] = state_get_u32(st);
+  }
+  c->adcSource = state_get_u32(st);
+  
+  c->clock = state_get_u64(st);
+  c->clockOprcnt = state_get_u64(st);
+  
+  sched_event_t *events[RUNT_EVENT_COUNT];
+  runt_get_events(c, events);
+  sched_clear(&c->sched);
+  int count = state_get_u8(st);
+  for (int i=0; i<count && st->error == false; i++) {
+    uint8_t id = state_get_u8(st);
+    uint64_t deadline = state_get_u64(st);
+    if (id >= RUNT_EVENT_COUNT || sched_is_scheduled(events[id]) == true) {
+      st->error = true;
+      break;
+    }
+    sched_add(&c->sched, events[id], deadline);
+  }
+  c->sccNextClock = state_get_u64(st);
+  c->lcdLastStep = state_get_u64(st);
+  
+  c->interrupt = state_get_u32(st);
+  c->interruptStick = state_get_u32(st);
+  
+  for (int i=0; i<3; i++) {
+    c->switches[i] = state_get_u8(st);
+  }
+  
+  c->touchActive = state_get_bool(st);
+  c->touchX = state_get_u32(st);
+  c->touchY = state_get_u32(st);
+  
+  // The host clock has moved on since the state was saved
+  runt_sync_reset(c);
+  
+  return (st->error == false);
 }
 
 void runt_reset(runt_t *c) {
   memset(c->memory, 0, 0xffff * 4);
 
-  c->ticks = 0;
   c->runtAwake = true;
   c->armAwake = true;
   
   c->rtcAlarm = 0;
   c->bootTime = time(NULL);
   
-  c->ticksAlarm1 = 0;
-  c->ticksAlarm2 = 0;
-  c->ticksAlarm3 = 0;
+  for (int i=0; i<3; i++) {
+    c->ticksAlarm[i] = 0;
+  }
   c->adcSource = 0;
   
   c->interrupt = 0;
   c->interruptStick = 0;
   
   e8530_reset(c->scc);
+  
+  c->clock = 0;
+  c->clockOprcnt = (c->arm != NULL) ? arm_get_opcnt(c->arm) : 0;
+  c->rtcOffset = 0;
+  c->rtcEpoch = 0;
+  runt_sync_reset(c);
+  
+  sched_clear(&c->sched);
+  c->sccNextClock = 4;
+  runt_scc_schedule(c);
+  c->lcdLastStep = 0;
+  if (c->lcd_step != NULL) {
+    runt_schedule(c, &c->lcdEvent, RUNT_LCD_STEP_TICKS);
+  }
 }
 
 void runt_init (runt_t *c, int machineType) {
@@ -929,12 +1457,12 @@ void runt_init (runt_t *c, int machineType) {
   //
   if (machineType == kGestalt_MachineType_Lindy) {
     lcd_squirt_t *squirt = lcd_squirt_new();
-    runt_set_lcd_fct(c, squirt, lcd_squirt_get_mem8, lcd_squirt_set_mem8, lcd_squirt_get_address_name, lcd_squirt_step, NULL);
+    runt_set_lcd_fct(c, squirt, lcd_squirt_get_mem8, lcd_squirt_set_mem8, lcd_squirt_get_address_name, lcd_squirt_step, NULL, lcd_squirt_set_display_fct, lcd_squirt_save_state, lcd_squirt_load_state);
     c->lcd_driver = squirt;
   }
   else {
     lcd_sharp_t *sharp = lcd_sharp_new();
-    runt_set_lcd_fct(c, sharp, lcd_sharp_get_mem8, lcd_sharp_set_mem8, lcd_sharp_get_address_name, NULL, lcd_sharp_set_powered);
+    runt_set_lcd_fct(c, sharp, lcd_sharp_get_mem8, lcd_sharp_set_mem8, lcd_sharp_get_address_name, NULL, lcd_sharp_set_powered, lcd_sharp_set_display_fct, lcd_sharp_save_state, lcd_sharp_load_state);
     c->lcd_driver = sharp;
   }
   
@@ -948,10 +1476,26 @@ void runt_init (runt_t *c, int machineType) {
   e8530_set_rts_fct (c->scc, 0, c, runt_serial_chanA_rts);
   e8530_set_rts_fct (c->scc, 1, c, runt_serial_chanB_rts);
   
+  //
+  // Events
+  //
+  sched_init(&c->sched);
+  sched_event_init(&c->ticksAlarmEvent[0], runt_ticks_alarm1_event, c);
+  sched_event_init(&c->ticksAlarmEvent[1], runt_ticks_alarm2_event, c);
+  sched_event_init(&c->ticksAlarmEvent[2], runt_ticks_alarm3_event, c);
+  sched_event_init(&c->rtcAlarmEvent, runt_rtc_alarm_event, c);
+  sched_event_init(&c->sccEvent, runt_scc_event, c);
+  sched_event_init(&c->lcdEvent, runt_lcd_event, c);
+  c->sccNextClock = 4;
+  runt_scc_schedule(c);
+  if (c->lcd_step != NULL) {
+    runt_schedule(c, &c->lcdEvent, RUNT_LCD_STEP_TICKS);
+  }
+  
   //
   // Logging
   //
-  c->logFile = stdout;
+  c->logger = NULL;
   runt_set_log_flags(c, RuntLogAll, 1);
   runt_set_log_flags(c, RuntLogTicks, 0);
   runt_set_log_flags(c, RuntLogInterrupts, 0);
@@ -966,6 +1510,19 @@ void runt_init (runt_t *c, int machineType) {
   runt_set_log_flags(c, RuntLogIR, 0);
   
   c->bootTime = time(NULL);
+  runt_sync_reset(c);
+  
+  //
+  // Idle
+  //
+  if (pipe(c->wakePipe) == 0) {
+    fcntl(c->wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(c->wakePipe[1], F_SETFL, O_NONBLOCK);
+  }
+  else {
+    c->wakePipe[0] = -1;
+    c->wakePipe[1] = -1;
+  }
 }
 
 runt_t *runt_new (int machineType) {
@@ -987,6 +1544,10 @@ void runt_set_arm(runt_t *c, arm_t *arm) {
 
 void runt_free (runt_t *c) {
   free(c->memory);
+  if (c->wakePipe[0] >= 0) {
+    close(c->wakePipe[0]);
+    close(c->wakePipe[1]);
+  }
   e8530_free(c->scc);
   free(c->scc);
   
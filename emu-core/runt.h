@@ -11,6 +11,10 @@
 
 #include "arm.h"
 #include "e8530.h"
+#include "lcd.h"
+#include "logger.h"
+#include "scheduler.h"
+#include "state.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -100,35 +104,98 @@ enum {
   RuntSerialChannelSerial = RuntSerialChannelA,
 };
 
+// The virtual clock advances by two ticks per instruction, and the
+// SCC is clocked once every five instructions.
+#define RUNT_TICKS_PER_INSTRUCTION 2
+#define RUNT_TICKS_PER_SCC_CLOCK   10
+
+// The ARM610 in the MessagePad runs at 20MHz. In the virtual clock
+// modes an instruction is taken to be one cycle.
+#define RUNT_ARM_CLOCK_HZ          20000000
+#define RUNT_TICKS_PER_SECOND      (RUNT_TICKS_PER_INSTRUCTION * (uint64_t)RUNT_ARM_CLOCK_HZ)
+
+// How far the virtual clock may run ahead of the host in
+// RuntClockSynced mode before the emulation is held back.
+#define RUNT_SYNC_SLACK_TICKS      (RUNT_TICKS_PER_SECOND / 100)
+
+// How often the RTC alarm is checked against the host clock, and
+// how often the LCD driver gets to flush, in ticks.
+#define RUNT_RTC_POLL_TICKS        4096
+#define RUNT_LCD_STEP_TICKS        512
+
+// Longest run of instructions between two looks at the scheduler
+#define RUNT_BURST_MAX             4096
+
+typedef enum {
+  // The RTC follows the host clock, the ticks follow the instructions
+  RuntClockHost = 0,
+  // Both follow the instructions: runs are reproducible, and idle
+  // time passes as fast as the host allows
+  RuntClockVirtual,
+  // Like RuntClockVirtual, but held back to the host clock
+  RuntClockSynced,
+} RuntClockMode;
+
 typedef struct runt_s runt_t;
 
 typedef uint8_t (*lcd_get_uint8_f) (void *ext, uint8_t addr);
 typedef uint8_t (*lcd_set_uint8_f) (void *ext, uint8_t addr, uint8_t val);
 typedef const char * (*lcd_get_address_name_f) (void *ext, uint8_t addr);
 typedef void (*lcd_set_powered_f)(void *ext, bool powered);
-typedef void (*lcd_step_f)(void *ext);
+typedef void (*lcd_step_f)(void *ext, unsigned steps);
+typedef void (*lcd_set_display_f)(void *ext, void *display_ext, lcd_display_open_f open, lcd_display_update_f update);
+typedef void (*lcd_save_state_f)(void *ext, state_t *st);
+typedef bool (*lcd_load_state_f)(void *ext, state_t *st);
 
 struct runt_s {
   arm_t *arm;
   uint32_t *memory;
-  uint32_t ticks;
   bool runtAwake;
   bool armAwake;
   int machineType;
 
+  RuntClockMode clockMode;
   uint32_t rtcAlarm;
   time_t bootTime;
+  
+  // RTC in the virtual clock modes: rtcOffset seconds at rtcEpoch
+  uint32_t rtcOffset;
+  uint64_t rtcEpoch;
+  
+  // RuntClockSynced: the virtual clock at a host time, in us
+  uint64_t syncClock;
+  uint64_t syncHostTime;
 
-  uint32_t ticksAlarm1;
-  uint32_t ticksAlarm2;
-  uint32_t ticksAlarm3;
+  uint32_t ticksAlarm[3];
   int32_t adcSource;
   
+  // Virtual clock, in ticks. Instructions are counted lazily from
+  // the ARM's instruction counter.
+  uint64_t clock;
+  unsigned long long clockOprcnt;
+  
+  // Timed events
+  sched_t sched;
+  sched_event_t ticksAlarmEvent[3];
+  sched_event_t rtcAlarmEvent;
+  sched_event_t sccEvent;
+  sched_event_t lcdEvent;
+  uint64_t sccNextClock;
+  uint64_t lcdLastStep;
+  
+  // Written to by runt_wake() to end a runt_idle() wait. A pipe
+  // rather than a condition variable, so that it is safe to wake
+  // from a signal handler.
+  int wakePipe[2];
+  
   e8530_t *scc;
+  // Characters go to and from the guest as fast as it takes them,
+  // instead of one per character time at the programmed baud rate
+  bool fastSerial;
 
   // Logging
   uint32_t logFlags;
-  FILE *logFile;
+  logger_t *logger;
   
   // Interrupts
   uint32_t interrupt;
@@ -141,6 +208,9 @@ struct runt_s {
   lcd_get_address_name_f lcd_get_address_name;
   lcd_step_f             lcd_step;
   lcd_set_powered_f      lcd_powered;
+  lcd_set_display_f      lcd_set_display;
+  lcd_save_state_f       lcd_save_state;
+  lcd_load_state_f       lcd_load_state;
   
   // Switches
   int8_t switches[3];
@@ -158,12 +228,45 @@ void runt_del (runt_t *c);
 
 void runt_set_arm (runt_t *c, arm_t *arm);
 bool runt_step(runt_t *c);
+// Whether the ARM runs, as runt_step() would tell
+bool runt_arm_is_awake(runt_t *c);
 void runt_reset(runt_t *c);
 
+uint64_t runt_get_clock(runt_t *c);
+void runt_advance(runt_t *c, uint64_t ticks);
+unsigned long runt_get_burst(runt_t *c);
+
+void runt_set_clock_mode(runt_t *c, RuntClockMode mode);
+RuntClockMode runt_get_clock_mode(runt_t *c);
+
+void runt_idle(runt_t *c);
+// Like runt_idle() in the virtual clock modes, but without going
+// past clock, and without waiting
+void runt_idle_until(runt_t *c, uint64_t clock);
+// Where runt_idle() would take the virtual clock to, or SCHED_NEVER
+// if only an external event can end the wait
+uint64_t runt_get_idle_deadline(runt_t *c);
+void runt_wake(runt_t *c);
+
 e8530_t * runt_get_scc(runt_t *c);
+void runt_set_fast_serial(runt_t *c, bool fastSerial);
+bool runt_get_fast_serial(runt_t *c);
+// In fast serial mode, hand the guest what was just received on
+// channel rather than waiting for the next character time
+void runt_serial_poll(runt_t *c, uint8_t channel);
 
 void runt_set_log_flags (runt_t *c, unsigned flags, int val);
-void runt_set_log_file (runt_t *c, FILE *file);
+void runt_set_logger (runt_t *c, logger_t *logger);
+
+void runt_set_display_fct (runt_t *c, void *ext, lcd_display_open_f open, lcd_display_update_f update);
+
+// The emulated state of the RUNT. Host side settings (clock mode,
+// logging) are kept. The SCC and the LCD are saved separately.
+void runt_save_state(runt_t *c, state_t *st);
+bool runt_load_state(runt_t *c, state_t *st);
+
+void runt_save_lcd_state(runt_t *c, state_t *st);
+bool runt_load_lcd_state(runt_t *c, state_t *st);
 
 uint32_t runt_set_mem32(runt_t *c, uint32_t addr, uint32_t val, uint32_t pc);
 uint32_t runt_get_mem32(runt_t *c, uint32_t addr, uint32_t pc);
@@ -0,0 +1,359 @@
+//
+//  savestate.c
+//  Leibniz
+//
+
+#include "savestate.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "memory.h"
+#include "snapshot.h"
+#include "state.h"
+
+#if DISABLE_LOGGING
+#define LOG_STR(...) {}
+#else
+#define LOG_STR(...) logger_log(c->logger, LoggerNewton, __VA_ARGS__)
+#endif
+
+#define SAVESTATE_MAGIC       "LBZSTATE"
+#define SAVESTATE_HEADER_SIZE 32
+#define SAVESTATE_TAG_DEVICES STATE_TAG('D', 'E', 'V', 'S')
+#define SAVESTATE_TAG_MEMORY  STATE_TAG('M', 'E', 'M', ' ')
+#define SAVESTATE_CHUNK_VERSION 1
+
+// Large enough that the pages go out in a few writes
+#define SAVESTATE_BUFFER_SIZE (1 << 20)
+
+static inline uint32_t savestate_page_length(uint32_t length, uint32_t page) {
+  uint32_t offset = page << MEMORY_PAGE_SHIFT;
+  return (length - offset < MEMORY_PAGE_SIZE) ? (length - offset) : MEMORY_PAGE_SIZE;
+}
+
+static inline bool savestate_page_included(const uint8_t *bitmap, uint32_t page) {
+  return (bitmap[page >> 3] & (1 << (page & 7))) != 0;
+}
+
+#pragma mark - Writing
+// The header of a memory chunk, up to the pages. A delta only
+// includes the pages that changed since base.
+static uint32_t savestate_put_memory_header(state_t *st, uint32_t idx, memory_snapshot_t *mem, memory_snapshot_t *base, uint8_t *bitmap) {
+  uint32_t length = memory_snapshot_get_length(mem);
+  uint32_t pageCount = memory_snapshot_get_page_count(mem);
+  uint32_t bitmapLength = (pageCount + 7) / 8;
+  uint32_t payloadLength = 4 + 4 + 1 + 4 + bitmapLength;
+  
+  memset(bitmap, 0, bitmapLength);
+  for (uint32_t page=0; page<pageCount; page++) {
+    const uint8_t *data = memory_snapshot_get_page(mem, page);
+    if (base != NULL && data == memory_snapshot_get_page(base, page)) {
+      continue;
+    }
+    bitmap[page >> 3] |= (1 << (page & 7));
+    payloadLength += savestate_page_length(length, page);
+  }
+  
+  state_put_u32(st, SAVESTATE_TAG_MEMORY);
+  state_put_u32(st, SAVESTATE_CHUNK_VERSION);
+  state_put_u32(st, payloadLength);
+  state_put_u32(st, idx);
+  state_put_u32(st, length);
+  state_put_u8(st, (uint8_t)memory_snapshot_get_flash_sequence(mem));
+  state_put_u32(st, pageCount);
+  state_put_bytes(st, bitmap, bitmapLength);
+  return pageCount;
+}
+
+static bool savestate_write_file(newton_t *c, const char *path, newton_snapshot_t *snap, newton_snapshot_t *base, uint64_t id) {
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    LOG_STR("Savestate: couldn't open %s for writing\n", path);
+    return false;
+  }
+  setvbuf(fp, NULL, _IOFBF, SAVESTATE_BUFFER_SIZE);
+  
+  state_t header;
+  state_init(&header);
+  state_put_bytes(&header, SAVESTATE_MAGIC, 8);
+  state_put_u32(&header, SAVESTATE_VERSION);
+  state_put_u32(&header, (base != NULL) ? SavestateFlagDelta : 0);
+  state_put_u64(&header, c->romHash);
+  state_put_u64(&header, id);
+  
+  state_t *devices = newton_snapshot_get_state(snap);
+  state_put_u32(&header, SAVESTATE_TAG_DEVICES);
+  state_put_u32(&header, SAVESTATE_CHUNK_VERSION);
+  state_put_u32(&header, (uint32_t)devices->length);
+  
+  bool ok = (header.error == false &&
+             fwrite(header.data, 1, header.length, fp) == header.length &&
+             fwrite(devices->data, 1, devices->length, fp) == devices->length);
+  
+  uint8_t *bitmap = NULL;
+  uint32_t count = newton_snapshot_get_memory_count(snap);
+  for (uint32_t idx=0; idx<count && ok == true; idx++) {
+    memory_snapshot_t *mem = newton_snapshot_get_memory(snap, idx);
+    uint32_t pageCount = memory_snapshot_get_page_count(mem);
+    if (pageCount == 0) {
+      continue;
+    }
+    
+    uint8_t *newBitmap = realloc(bitmap, (pageCount + 7) / 8);
+    if (newBitmap == NULL) {
+      ok = false;
+      break;
+    }
+    bitmap = newBitmap;
+    
+    state_clear(&header);
+    savestate_put_memory_header(&header, idx, mem, (base != NULL) ? newton_snapshot_get_memory(base, idx) : NULL, bitmap);
+    if (header.error == true || fwrite(header.data, 1, header.length, fp) != header.length) {
+      ok = false;
+      break;
+    }
+    
+    // The pages go straight from the snapshot to the file
+    uint32_t length = memory_snapshot_get_length(mem);
+    for (uint32_t page=0; page<pageCount && ok == true; page++) {
+      if (savestate_page_included(bitmap, page) == false) {
+        continue;
+      }
+      uint32_t pageLength = savestate_page_length(length, page);
+      ok = (fwrite(memory_snapshot_get_page(mem, page), 1, pageLength, fp) == pageLength);
+    }
+  }
+  
+  free(bitmap);
+  state_free(&header);
+  if (fclose(fp) != 0) {
+    ok = false;
+  }
+  if (ok == false) {
+    LOG_STR("Savestate: error writing %s\n", path);
+  }
+  return ok;
+}
+
+int newton_savestate_write(newton_t *c, const char *path, bool delta) {
+  if (delta == true && c->savestateBase == NULL) {
+    LOG_STR("Savestate: a delta needs a full savestate written or read first\n");
+    return -1;
+  }
+  
+  newton_snapshot_t *snap = newton_snapshot_save(c);
+  if (snap == NULL) {
+    LOG_STR("Savestate: couldn't snapshot the machine\n");
+    return -1;
+  }
+  
+  if (delta == true) {
+    bool ok = savestate_write_file(c, path, snap, c->savestateBase, c->savestateId);
+    newton_snapshot_del(snap);
+    return ok ? 0 : -1;
+  }
+  
+  // Tell apart full savestates of the same machine, so a delta
+  // can't be applied to the wrong base
+  state_t *devices = newton_snapshot_get_state(snap);
+  uint64_t id = state_hash(devices->data, devices->length);
+  id ^= ((uint64_t)time(NULL) << 32) ^ c->arm->oprcnt;
+  
+  if (savestate_write_file(c, path, snap, NULL, id) == false) {
+    newton_snapshot_del(snap);
+    return -1;
+  }
+  
+  newton_snapshot_del(c->savestateBase);
+  c->savestateBase = snap;
+  c->savestateId = id;
+  return 0;
+}
+
+#pragma mark - Reading
+// Check a memory chunk against the machine, and return its bitmap
+static const uint8_t *savestate_check_memory(state_t *st, memory_t **memories, uint32_t memoryCount, bool delta) {
+  uint32_t idx = state_get_u32(st);
+  uint32_t length = state_get_u32(st);
+  state_get_u8(st);
+  uint32_t pageCount = state_get_u32(st);
+  if (st->error == true || idx >= memoryCount) {
+    return NULL;
+  }
+  
+  memory_t *mem = memories[idx];
+  if (length != memory_get_length(mem) || mem->mapping != NULL ||
+      pageCount != (length + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE) {
+    return NULL;
+  }
+  
+  uint32_t bitmapLength = (pageCount + 7) / 8;
+  if (st->length - st->offset < bitmapLength) {
+    return NULL;
+  }
+  const uint8_t *bitmap = st->data + st->offset;
+  st->offset += bitmapLength;
+  
+  size_t pagesLength = 0;
+  for (uint32_t page=0; page<pageCount; page++) {
+    if (savestate_page_included(bitmap, page) == true) {
+      pagesLength += savestate_page_length(length, page);
+    }
+    else if (delta == false) {
+      // A full savestate has to hold every page
+      return NULL;
+    }
+  }
+  if (st->length - st->offset != pagesLength) {
+    return NULL;
+  }
+  return bitmap;
+}
+
+static bool savestate_check(newton_t *c, state_t *st, bool delta, state_t *devices) {
+  uint32_t memoryCount = newton_snapshot_get_memories(c, NULL);
+  memory_t *memories[memoryCount];
+  newton_snapshot_get_memories(c, memories);
+  
+  bool haveDevices = false;
+  uint32_t tag, version;
+  state_t payload;
+  while (state_get_chunk(st, &tag, &version, &payload) == true) {
+    if (version != SAVESTATE_CHUNK_VERSION) {
+      return false;
+    }
+    if (tag == SAVESTATE_TAG_DEVICES) {
+      *devices = payload;
+      haveDevices = true;
+    }
+    else if (tag == SAVESTATE_TAG_MEMORY) {
+      if (savestate_check_memory(&payload, memories, memoryCount, delta) == NULL) {
+        return false;
+      }
+    }
+    else {
+      return false;
+    }
+  }
+  return (st->error == false && haveDevices == true);
+}
+
+static void savestate_load_memory(state_t *st, memory_t **memories) {
+  uint32_t idx = state_get_u32(st);
+  uint32_t length = state_get_u32(st);
+  int8_t flashSequence = (int8_t)state_get_u8(st);
+  uint32_t pageCount = state_get_u32(st);
+  
+  memory_t *mem = memories[idx];
+  const uint8_t *bitmap = st->data + st->offset;
+  const uint8_t *data = bitmap + (pageCount + 7) / 8;
+  for (uint32_t page=0; page<pageCount; page++) {
+    if (savestate_page_included(bitmap, page) == false) {
+      continue;
+    }
+    memory_load_page(mem, page, data);
+    data += savestate_page_length(length, page);
+  }
+  mem->flashSequence = flashSequence;
+}
+
+static bool savestate_load(newton_t *c, state_t *st, state_t *devices) {
+  uint32_t memoryCount = newton_snapshot_get_memories(c, NULL);
+  memory_t *memories[memoryCount];
+  newton_snapshot_get_memories(c, memories);
+  
+  uint32_t tag, version;
+  state_t payload;
+  while (state_get_chunk(st, &tag, &version, &payload) == true) {
+    if (tag == SAVESTATE_TAG_MEMORY) {
+      savestate_load_memory(&payload, memories);
+    }
+  }
+  
+  // Last, as loading the CPU throws away the translated code
+  return newton_snapshot_load_devices(c, devices);
+}
+
+int newton_savestate_read(newton_t *c, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG_STR("Savestate: couldn't open %s\n", path);
+    return -1;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size < SAVESTATE_HEADER_SIZE) {
+    LOG_STR("Savestate: %s is too short\n", path);
+    close(fd);
+    return -1;
+  }
+  size_t length = (size_t)sb.st_size;
+  void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG_STR("Savestate: couldn't map %s\n", path);
+    return -1;
+  }
+  
+  int result = -1;
+  state_t st;
+  state_init_view(&st, mapping, length);
+  
+  char magic[8];
+  state_get_bytes(&st, magic, sizeof(magic));
+  uint32_t version = state_get_u32(&st);
+  uint32_t flags = state_get_u32(&st);
+  uint64_t romHash = state_get_u64(&st);
+  uint64_t id = state_get_u64(&st);
+  bool delta = ((flags & SavestateFlagDelta) == SavestateFlagDelta);
+  
+  state_t devices;
+  size_t chunks = st.offset;
+  if (memcmp(magic, SAVESTATE_MAGIC, sizeof(magic)) != 0) {
+    LOG_STR("Savestate: %s isn't a savestate\n", path);
+  }
+  else if (version != SAVESTATE_VERSION) {
+    LOG_STR("Savestate: %s has unsupported version %u\n", path, version);
+  }
+  else if (romHash != c->romHash) {
+    LOG_STR("Savestate: %s was saved with a different ROM\n", path);
+  }
+  else if (delta == true && (c->savestateBase == NULL || id != c->savestateId)) {
+    LOG_STR("Savestate: the base of delta %s isn't loaded\n", path);
+  }
+  else if (savestate_check(c, &st, delta, &devices) == false) {
+    LOG_STR("Savestate: %s is damaged or doesn't match this machine\n", path);
+  }
+  else {
+    // Nothing was changed so far. A delta goes on top of its base.
+    bool ok = true;
+    if (delta == true) {
+      ok = newton_snapshot_restore(c, c->savestateBase);
+    }
+    st.offset = chunks;
+    ok = savestate_load(c, &st, &devices) && ok;
+    // There is no running forward to here from before
+    newton_history_reset(c);
+    if (ok == false) {
+      LOG_STR("Savestate: error loading %s\n", path);
+    }
+    else if (delta == false) {
+      newton_snapshot_del(c->savestateBase);
+      c->savestateBase = newton_snapshot_save(c);
+      c->savestateId = id;
+      result = 0;
+    }
+    else {
+      result = 0;
+    }
+  }
+  
+  munmap(mapping, length);
+  return result;
+}
@@ -0,0 +1,46 @@
+//
+//  savestate.h
+//  Leibniz
+//
+//  Savestate files. A file starts with a header:
+//
+//    "LBZSTATE"  magic
+//    u32         format version
+//    u32         flags, SavestateFlagDelta for a delta file
+//    u64         hash of the ROM image the state belongs to
+//    u64         the id of the state; for a delta, the id of its base
+//
+//  followed by chunks (see state.h): one 'DEVS' chunk holding the
+//  CPU and device chunks of newton_snapshot_save_devices(), and one
+//  'MEM ' chunk per memory:
+//
+//    u32         index of the memory, see newton_snapshot_get_memories()
+//    u32         length of the memory
+//    u8          flash command sequence
+//    u32         page count
+//    u8[]        a bit per page, set if the page follows
+//    u8[]        the pages
+//
+//  A full savestate holds every page. A delta only holds the pages
+//  that differ from its base, the last full savestate written or
+//  read by the machine. Values are little endian.
+//
+
+#ifndef __Leibniz__savestate__
+#define __Leibniz__savestate__
+
+#include "newton.h"
+
+#include <stdbool.h>
+
+enum {
+  SavestateFlagDelta = (1 << 0),
+};
+
+#define SAVESTATE_VERSION 1
+
+// Both return 0 on success and -1 on error
+int newton_savestate_write(newton_t *c, const char *path, bool delta);
+int newton_savestate_read(newton_t *c, const char *path);
+
+#endif /* defined(__Leibniz__savestate__) */
@@ -0,0 +1,117 @@
+//
+//  scheduler.c
+//  Leibniz
+//
+
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static inline void sched_place(sched_t *s, sched_event_t *e, int i) {
+  s->heap[i] = e;
+  e->index = i;
+}
+
+static void sched_sift_up(sched_t *s, int i) {
+  sched_event_t *e = s->heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (s->heap[parent]->deadline <= e->deadline) {
+      break;
+    }
+    sched_place(s, s->heap[parent], i);
+    i = parent;
+  }
+  sched_place(s, e, i);
+}
+
+static void sched_sift_down(sched_t *s, int i) {
+  sched_event_t *e = s->heap[i];
+  while (1) {
+    int child = 2 * i + 1;
+    if (child >= s->count) {
+      break;
+    }
+    if (child + 1 < s->count && s->heap[child + 1]->deadline < s->heap[child]->deadline) {
+      child++;
+    }
+    if (e->deadline <= s->heap[child]->deadline) {
+      break;
+    }
+    sched_place(s, s->heap[child], i);
+    i = child;
+  }
+  sched_place(s, e, i);
+}
+
+void sched_event_init(sched_event_t *e, sched_event_f fct, void *ext) {
+  e->deadline = SCHED_NEVER;
+  e->index = -1;
+  e->fct = fct;
+  e->ext = ext;
+}
+
+void sched_add(sched_t *s, sched_event_t *e, uint64_t deadline) {
+  if (sched_is_scheduled(e) == false) {
+    if (s->count >= SCHED_EVENT_MAX) {
+      fprintf(stderr, "sched: too many events\n");
+      abort();
+    }
+    e->deadline = deadline;
+    sched_place(s, e, s->count++);
+    sched_sift_up(s, e->index);
+    return;
+  }
+
+  uint64_t old = e->deadline;
+  e->deadline = deadline;
+  if (deadline < old) {
+    sched_sift_up(s, e->index);
+  }
+  else {
+    sched_sift_down(s, e->index);
+  }
+}
+
+void sched_remove(sched_t *s, sched_event_t *e) {
+  if (sched_is_scheduled(e) == false) {
+    return;
+  }
+
+  int i = e->index;
+  e->index = -1;
+  s->count--;
+  if (i == s->count) {
+    return;
+  }
+
+  // Move the last event into the hole and restore the heap order
+  sched_event_t *last = s->heap[s->count];
+  sched_place(s, last, i);
+  if (i > 0 && s->heap[(i - 1) / 2]->deadline > last->deadline) {
+    sched_sift_up(s, i);
+  }
+  else {
+    sched_sift_down(s, i);
+  }
+}
+
+void sched_run(sched_t *s, uint64_t now) {
+  while (s->count > 0 && s->heap[0]->deadline <= now) {
+    sched_event_t *e = s->heap[0];
+    sched_remove(s, e);
+    e->fct(e->ext, now);
+  }
+}
+
+void sched_clear(sched_t *s) {
+  for (int i=0; i<s->count; i++) {
+    s->heap[i]->index = -1;
+  }
+  s->count = 0;
+}
+
+void sched_init(sched_t *s) {
+  s->count = 0;
+}
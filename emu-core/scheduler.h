@@ -0,0 +1,58 @@
+//
+//  scheduler.h
+//  Leibniz
+//
+//  Event scheduler: a binary min-heap of device events keyed on
+//  the virtual clock. The owner advances the clock, asks for the
+//  earliest deadline and runs whatever has become due.
+//
+
+#ifndef __Leibniz__scheduler__
+#define __Leibniz__scheduler__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCHED_EVENT_MAX 16
+#define SCHED_NEVER     UINT64_MAX
+
+typedef void (*sched_event_f) (void *ext, uint64_t now);
+
+typedef struct sched_event_s sched_event_t;
+struct sched_event_s {
+  uint64_t deadline;
+  int index;           // slot in the heap, -1 if not scheduled
+
+  sched_event_f fct;
+  void *ext;
+};
+
+typedef struct {
+  sched_event_t *heap[SCHED_EVENT_MAX];
+  int count;
+} sched_t;
+
+void sched_init(sched_t *s);
+void sched_clear(sched_t *s);
+
+void sched_event_init(sched_event_t *e, sched_event_f fct, void *ext);
+
+// Schedule e at deadline, moving it if it is already scheduled
+void sched_add(sched_t *s, sched_event_t *e, uint64_t deadline);
+void sched_remove(sched_t *s, sched_event_t *e);
+
+static inline bool sched_is_scheduled(const sched_event_t *e) {
+  return (e->index >= 0);
+}
+
+// The earliest deadline, SCHED_NEVER if nothing is scheduled
+static inline uint64_t sched_next(const sched_t *s) {
+  return (s->count > 0) ? s->heap[0]->deadline : SCHED_NEVER;
+}
+
+// Run every event whose deadline is <= now, earliest first. An
+// event is unscheduled before its callback runs, so the callback
+// may schedule it again.
+void sched_run(sched_t *s, uint64_t now);
+
+#endif /* defined(__Leibniz__scheduler__) */
@@ -20,7 +20,7 @@ newton_t *gNewton = NULL;
 SDL_Surface *gScreen = NULL;
 bool gNeedsSilkScreen = true;
 
-void newton_display_open(int width, int height) {
+static void sdl_display_open(void *ext, int width, int height) {
 	gScreen = SDL_SetVideoMode(width, height + silkscreen_height, 8, SDL_HWSURFACE|SDL_DOUBLEBUF);
 	if (!gScreen) {
 		fprintf(stderr, "SDL_SetVideoMode returned NULL\n");
@@ -43,7 +43,7 @@ void newton_display_open(int width, int height) {
 }
 
 
-void newton_display_set_framebuffer(const uint8_t *src, int width, int height) {
+static void sdl_display_update(void *ext, const uint8_t *src, int width, int height) {
 	uint8_t *dest;
 	if (gScreen == NULL) {
 		return;
@@ -61,7 +61,7 @@ void newton_display_set_framebuffer(const uint8_t *src, int width, int height) {
 	}
 	
 	if (gNeedsSilkScreen == true) {
-		// Meh. Couldn't get this to work inside newton_display_open().
+		// Meh. Couldn't get this to work inside sdl_display_open().
 		for (int srcidx=0; srcidx<(silkscreen_width * silkscreen_height)/8; srcidx++) {
 			uint8_t pixels = silkscreen_bits[srcidx];
 			for (int bit=0; bit<8; bit++) {
@@ -126,7 +126,7 @@ void handle_mouse_event(SDL_Event event) {
 void handle_keyup_event(SDL_Event event) {
 	char sym = event.key.keysym.sym;
 	if (sym == ' ') {
-		runt_switch_toggle(newton_get_runt(gNewton), RuntSwitchPower);
+		newton_switch_toggle(gNewton, RuntSwitchPower);
 	}	
 }
 
@@ -181,6 +181,8 @@ int main(int argc, char **argv) {
 		goto out;
 	}
 	
+	newton_set_display_functions(gNewton, NULL, sdl_display_open, sdl_display_update);
+	
 	if (start_cpu() < 0) {
 		fprintf(stderr, "start_cpu failed\n");
 		result = -1;
@@ -0,0 +1,261 @@
+//
+//  snapshot.c
+//  Leibniz
+//
+
+#include "snapshot.h"
+
+#include <stdlib.h>
+
+#include "fpa.h"
+#include "state.h"
+
+struct newton_snapshot_s {
+  // The CPU and the devices, see newton_snapshot_save_devices()
+  state_t state;
+  
+  // One for each memory, see newton_snapshot_get_memories()
+  uint32_t memoryCount;
+  memory_snapshot_t **memories;
+};
+
+#pragma mark - Devices
+static void newton_save_arm(newton_t *c, state_t *st) {
+  arm_save_state(c->arm, st);
+}
+
+static bool newton_load_arm(newton_t *c, state_t *st) {
+  return (arm_load_state(c->arm, st) == 0);
+}
+
+static void newton_save_cp15(newton_t *c, state_t *st) {
+  cp15_save_state(c->arm, st);
+}
+
+static bool newton_load_cp15(newton_t *c, state_t *st) {
+  return (cp15_load_state(c->arm, st) == 0);
+}
+
+static void newton_save_fpa(newton_t *c, state_t *st) {
+  fpa_save_state(c->arm, st);
+}
+
+static bool newton_load_fpa(newton_t *c, state_t *st) {
+  return fpa_load_state(c->arm, st);
+}
+
+static void newton_save_runt(newton_t *c, state_t *st) {
+  runt_save_state(c->runt, st);
+}
+
+static bool newton_load_runt(newton_t *c, state_t *st) {
+  return runt_load_state(c->runt, st);
+}
+
+static void newton_save_scc(newton_t *c, state_t *st) {
+  e8530_save_state(runt_get_scc(c->runt), st);
+}
+
+static bool newton_load_scc(newton_t *c, state_t *st) {
+  bool ok = (e8530_load_state(runt_get_scc(c->runt), st) == 0);
+  // How fast the characters go is up to the host, not the state
+  runt_set_fast_serial(c->runt, runt_get_fast_serial(c->runt));
+  return ok;
+}
+
+static void newton_save_lcd(newton_t *c, state_t *st) {
+  runt_save_lcd_state(c->runt, st);
+}
+
+static bool newton_load_lcd(newton_t *c, state_t *st) {
+  return runt_load_lcd_state(c->runt, st);
+}
+
+static void newton_save_pcmcia(newton_t *c, state_t *st) {
+  pcmcia_save_state(c->pcmcia, st);
+}
+
+static bool newton_load_pcmcia(newton_t *c, state_t *st) {
+  return pcmcia_load_state(c->pcmcia, st);
+}
+
+// One chunk per device, in the order they are saved and loaded: the
+// RUNT reads the ARM's instruction counter as it is loaded. A chunk's
+// version goes up whenever its layout changes.
+static const struct {
+  uint32_t tag;
+  uint32_t version;
+  void (*save) (newton_t *c, state_t *st);
+  bool (*load) (newton_t *c, state_t *st);
+} newton_device_chunks[] = {
+  { STATE_TAG('A','R','M',' '), 1, newton_save_arm, newton_load_arm },
+  { STATE_TAG('C','P','1','5'), 1, newton_save_cp15, newton_load_cp15 },
+  { STATE_TAG('F','P','A',' '), 1, newton_save_fpa, newton_load_fpa },
+  { STATE_TAG('R','U','N','T'), 1, newton_save_runt, newton_load_runt },
+  { STATE_TAG('S','C','C',' '), 1, newton_save_scc, newton_load_scc },
+  { STATE_TAG('L','C','D',' '), 1, newton_save_lcd, newton_load_lcd },
+  { STATE_TAG('P','C','M','C'), 1, newton_save_pcmcia, newton_load_pcmcia },
+};
+
+#define NEWTON_DEVICE_CHUNK_COUNT (sizeof(newton_device_chunks) / sizeof(newton_device_chunks[0]))
+
+void newton_snapshot_save_devices(newton_t *c, state_t *st) {
+  for (int i=0; i<NEWTON_DEVICE_CHUNK_COUNT; i++) {
+    size_t mark = state_begin_chunk(st, newton_device_chunks[i].tag, newton_device_chunks[i].version);
+    newton_device_chunks[i].save(c, st);
+    state_end_chunk(st, mark);
+  }
+}
+
+bool newton_snapshot_load_devices(newton_t *c, state_t *st) {
+  int next = 0;
+  uint32_t tag, version;
+  state_t payload;
+  
+  while (state_get_chunk(st, &tag, &version, &payload) == true) {
+    if (next == NEWTON_DEVICE_CHUNK_COUNT || tag != newton_device_chunks[next].tag) {
+      return false;
+    }
+    if (version != newton_device_chunks[next].version) {
+      return false;
+    }
+    if (newton_device_chunks[next].load(c, &payload) == false) {
+      return false;
+    }
+    next++;
+  }
+  
+  return (st->error == false && next == NEWTON_DEVICE_CHUNK_COUNT);
+}
+
+#pragma mark - Memory
+uint32_t newton_snapshot_get_memories(newton_t *c, memory_t **memories) {
+  uint32_t count = 0;
+  for (membank_t *bank = c->membanks; bank != NULL; bank = bank->next) {
+    if (bank->memory != NULL) {
+      if (memories != NULL) {
+        memories[count] = bank->memory;
+      }
+      count++;
+    }
+  }
+  if (c->pcmcia != NULL && c->pcmcia->cardMemory != NULL) {
+    if (memories != NULL) {
+      memories[count] = c->pcmcia->cardMemory;
+    }
+    count++;
+  }
+  return count;
+}
+
+// The CPU stores to the direct RAM windows without going through the
+// membanks. Hand the pages it wrote over to the memories behind them.
+static void newton_snapshot_collect_dirty(newton_t *c) {
+  for (membank_t *bank = c->membanks; bank != NULL; bank = bank->next) {
+    memory_t *memory = bank->memory;
+    if (memory == NULL) {
+      continue;
+    }
+    
+    uint32_t length = memory_get_length(memory);
+    if (length > bank->length) {
+      length = bank->length;
+    }
+    for (uint32_t offset=0; offset<length; offset+=MEMORY_PAGE_SIZE) {
+      if (arm_get_dirty(c->arm, bank->base + offset) != 0) {
+        memory_mark_dirty(memory, bank->base + offset);
+      }
+    }
+  }
+}
+
+#pragma mark - Snapshots
+newton_snapshot_t *newton_snapshot_save(newton_t *c) {
+  if (c->runt == NULL || c->pcmcia == NULL) {
+    return NULL;
+  }
+  if (arm_set_dirty_tracking(c->arm, 1) != 0) {
+    return NULL;
+  }
+  
+  newton_snapshot_t *snap = calloc(1, sizeof(newton_snapshot_t));
+  if (snap == NULL) {
+    return NULL;
+  }
+  state_init(&snap->state);
+  
+  newton_snapshot_save_devices(c, &snap->state);
+  if (snap->state.error == true) {
+    newton_snapshot_del(snap);
+    return NULL;
+  }
+  
+  newton_snapshot_collect_dirty(c);
+  
+  uint32_t count = newton_snapshot_get_memories(c, NULL);
+  memory_t *memories[count];
+  newton_snapshot_get_memories(c, memories);
+  
+  snap->memories = calloc(count, sizeof(memory_snapshot_t *));
+  if (snap->memories == NULL) {
+    newton_snapshot_del(snap);
+    return NULL;
+  }
+  snap->memoryCount = count;
+  for (uint32_t i=0; i<count; i++) {
+    snap->memories[i] = memory_snapshot_save(memories[i]);
+    if (snap->memories[i] == NULL) {
+      newton_snapshot_del(snap);
+      return NULL;
+    }
+  }
+  
+  return snap;
+}
+
+bool newton_snapshot_restore(newton_t *c, newton_snapshot_t *snap) {
+  uint32_t count = newton_snapshot_get_memories(c, NULL);
+  if (count != snap->memoryCount || c->runt == NULL || c->pcmcia == NULL) {
+    return false;
+  }
+  memory_t *memories[count];
+  newton_snapshot_get_memories(c, memories);
+  
+  newton_snapshot_collect_dirty(c);
+  
+  bool ok = true;
+  for (uint32_t i=0; i<count; i++) {
+    ok = memory_snapshot_restore(memories[i], snap->memories[i]) && ok;
+  }
+  
+  // Loading the CPU state also throws away the translated code,
+  // which may be stale now that memory has changed under it.
+  state_rewind(&snap->state);
+  ok = newton_snapshot_load_devices(c, &snap->state) && ok;
+  
+  return ok;
+}
+
+void newton_snapshot_del(newton_snapshot_t *snap) {
+  if (snap == NULL) {
+    return;
+  }
+  for (uint32_t i=0; i<snap->memoryCount; i++) {
+    memory_snapshot_delete(snap->memories[i]);
+  }
+  free(snap->memories);
+  state_free(&snap->state);
+  free(snap);
+}
+
+state_t *newton_snapshot_get_state(newton_snapshot_t *snap) {
+  return &snap->state;
+}
+
+uint32_t newton_snapshot_get_memory_count(newton_snapshot_t *snap) {
+  return snap->memoryCount;
+}
+
+memory_snapshot_t *newton_snapshot_get_memory(newton_snapshot_t *snap, uint32_t idx) {
+  return snap->memories[idx];
+}
@@ -0,0 +1,42 @@
+//
+//  snapshot.h
+//  Leibniz
+//
+//  Snapshots of a running machine, kept in memory. The CPU and the
+//  devices are saved in full, RAM and flash a page at a time: pages
+//  that were not written since the previous snapshot are shared with
+//  it, so taking a snapshot costs in proportion to the pages written
+//  in between, and restoring one only copies back the pages that
+//  differ from the current contents.
+//
+//  A snapshot can only be restored into the machine it was taken
+//  from. It stays valid after the machine is deleted.
+//
+
+#ifndef __Leibniz__snapshot__
+#define __Leibniz__snapshot__
+
+#include "newton.h"
+#include "state.h"
+
+#include <stdbool.h>
+
+typedef struct newton_snapshot_s newton_snapshot_t;
+
+newton_snapshot_t *newton_snapshot_save(newton_t *c);
+bool newton_snapshot_restore(newton_t *c, newton_snapshot_t *snap);
+void newton_snapshot_del(newton_snapshot_t *snap);
+
+// The CPU and device state, as a series of chunks
+void newton_snapshot_save_devices(newton_t *c, state_t *st);
+bool newton_snapshot_load_devices(newton_t *c, state_t *st);
+
+// The memories that snapshots save, in a fixed order. Returns their
+// number; memories may be NULL to only count them.
+uint32_t newton_snapshot_get_memories(newton_t *c, memory_t **memories);
+
+state_t *newton_snapshot_get_state(newton_snapshot_t *snap);
+uint32_t newton_snapshot_get_memory_count(newton_snapshot_t *snap);
+memory_snapshot_t *newton_snapshot_get_memory(newton_snapshot_t *snap, uint32_t idx);
+
+#endif /* defined(__Leibniz__snapshot__) */
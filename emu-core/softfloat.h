@@ -89,6 +89,13 @@ this code that are retained.
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Host byte order; taken from the compiler unless set on the command line */
+#if !defined(HOST_WORDS_BIGENDIAN) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_WORDS_BIGENDIAN 1
+#endif
+#endif
+
 /* This 'flag' type must be able to hold at least 0 and 1. It should
  * probably be replaced with 'bool' but the uses would need to be audited
  * to check that they weren't accidentally relying on it being a larger type.
@@ -0,0 +1,215 @@
+//
+//  state.c
+//  Leibniz
+//
+
+#include "state.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void state_init(state_t *st) {
+  st->data = NULL;
+  st->length = 0;
+  st->capacity = 0;
+  st->offset = 0;
+  st->error = false;
+}
+
+void state_free(state_t *st) {
+  if (st->capacity > 0) {
+    free(st->data);
+  }
+  state_init(st);
+}
+
+void state_init_view(state_t *st, const void *data, size_t length) {
+  state_init(st);
+  st->data = (uint8_t *)data;
+  st->length = length;
+}
+
+void state_clear(state_t *st) {
+  st->length = 0;
+  st->offset = 0;
+  st->error = false;
+}
+
+void state_rewind(state_t *st) {
+  st->offset = 0;
+  st->error = false;
+}
+
+static bool state_reserve(state_t *st, size_t length) {
+  if (st->error == true) {
+    return false;
+  }
+  // A view
+  if (st->data != NULL && st->capacity == 0) {
+    st->error = true;
+    return false;
+  }
+  if (st->capacity - st->length >= length) {
+    return true;
+  }
+
+  size_t capacity = (st->capacity > 0) ? st->capacity : 4096;
+  while (capacity - st->length < length) {
+    capacity *= 2;
+  }
+
+  uint8_t *data = realloc(st->data, capacity);
+  if (data == NULL) {
+    st->error = true;
+    return false;
+  }
+  st->data = data;
+  st->capacity = capacity;
+  return true;
+}
+
+void state_put_bytes(state_t *st, const void *buf, size_t length) {
+  if (state_reserve(st, length) == false) {
+    return;
+  }
+  memcpy(st->data + st->length, buf, length);
+  st->length += length;
+}
+
+static inline void state_put_le(state_t *st, uint64_t val, int size) {
+  if (state_reserve(st, size) == false) {
+    return;
+  }
+  for (int i=0; i<size; i++) {
+    st->data[st->length++] = (uint8_t)(val >> (8 * i));
+  }
+}
+
+void state_put_u8(state_t *st, uint8_t val) {
+  state_put_le(st, val, 1);
+}
+
+void state_put_u16(state_t *st, uint16_t val) {
+  state_put_le(st, val, 2);
+}
+
+void state_put_u32(state_t *st, uint32_t val) {
+  state_put_le(st, val, 4);
+}
+
+void state_put_u64(state_t *st, uint64_t val) {
+  state_put_le(st, val, 8);
+}
+
+void state_get_bytes(state_t *st, void *buf, size_t length) {
+  if (st->error == true || st->length - st->offset < length) {
+    st->error = true;
+    memset(buf, 0, length);
+    return;
+  }
+  memcpy(buf, st->data + st->offset, length);
+  st->offset += length;
+}
+
+static inline uint64_t state_get_le(state_t *st, int size) {
+  if (st->error == true || st->length - st->offset < (size_t)size) {
+    st->error = true;
+    return 0;
+  }
+  uint64_t val = 0;
+  for (int i=0; i<size; i++) {
+    val |= (uint64_t)st->data[st->offset++] << (8 * i);
+  }
+  return val;
+}
+
+uint8_t state_get_u8(state_t *st) {
+  return (uint8_t)state_get_le(st, 1);
+}
+
+uint16_t state_get_u16(state_t *st) {
+  return (uint16_t)state_get_le(st, 2);
+}
+
+uint32_t state_get_u32(state_t *st) {
+  return (uint32_t)state_get_le(st, 4);
+}
+
+uint64_t state_get_u64(state_t *st) {
+  return state_get_le(st, 8);
+}
+
+void state_put_varint(state_t *st, uint64_t val) {
+  while (val >= 0x80) {
+    state_put_u8(st, (uint8_t)(val | 0x80));
+    val >>= 7;
+  }
+  state_put_u8(st, (uint8_t)val);
+}
+
+uint64_t state_get_varint(state_t *st) {
+  uint64_t val = 0;
+  for (int shift=0; shift<64; shift+=7) {
+    uint8_t byte = state_get_u8(st);
+    val |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return val;
+    }
+  }
+  st->error = true;
+  return 0;
+}
+
+void state_put_svarint(state_t *st, int64_t val) {
+  state_put_varint(st, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+int64_t state_get_svarint(state_t *st) {
+  uint64_t val = state_get_varint(st);
+  return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+size_t state_begin_chunk(state_t *st, uint32_t tag, uint32_t version) {
+  state_put_u32(st, tag);
+  state_put_u32(st, version);
+  state_put_u32(st, 0);
+  return st->length;
+}
+
+void state_end_chunk(state_t *st, size_t mark) {
+  if (st->error == true) {
+    return;
+  }
+  uint32_t length = (uint32_t)(st->length - mark);
+  for (int i=0; i<4; i++) {
+    st->data[mark - 4 + i] = (uint8_t)(length >> (8 * i));
+  }
+}
+
+bool state_get_chunk(state_t *st, uint32_t *tag, uint32_t *version, state_t *payload) {
+  if (st->error == true || st->offset == st->length) {
+    return false;
+  }
+  
+  *tag = state_get_u32(st);
+  *version = state_get_u32(st);
+  uint32_t length = state_get_u32(st);
+  if (st->error == true || st->length - st->offset < length) {
+    st->error = true;
+    return false;
+  }
+  
+  state_init_view(payload, st->data + st->offset, length);
+  st->offset += length;
+  return true;
+}
+
+uint64_t state_hash(const void *data, size_t length) {
+  const uint8_t *p = data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i=0; i<length; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
@@ -0,0 +1,86 @@
+//
+//  state.h
+//  Leibniz
+//
+//  A growable byte buffer that the devices write their state into,
+//  and read it back from. Values are stored little endian whatever
+//  the host, so a buffer can be written to disk as it is.
+//
+
+#ifndef __Leibniz__state__
+#define __Leibniz__state__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct state_s {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+
+  // The read position
+  size_t offset;
+
+  // Set when an allocation fails or a read runs past the end. All
+  // further reads return zeroes.
+  bool error;
+} state_t;
+
+void state_init(state_t *st);
+void state_free(state_t *st);
+
+// Read from length bytes of data, which the caller keeps around.
+// Nothing can be written to a view, and it needs no state_free().
+void state_init_view(state_t *st, const void *data, size_t length);
+
+// Drop the contents, keeping the allocation
+void state_clear(state_t *st);
+// Start reading from the beginning again
+void state_rewind(state_t *st);
+
+void state_put_bytes(state_t *st, const void *buf, size_t length);
+void state_put_u8(state_t *st, uint8_t val);
+void state_put_u16(state_t *st, uint16_t val);
+void state_put_u32(state_t *st, uint32_t val);
+void state_put_u64(state_t *st, uint64_t val);
+
+void state_get_bytes(state_t *st, void *buf, size_t length);
+uint8_t state_get_u8(state_t *st);
+uint16_t state_get_u16(state_t *st);
+uint32_t state_get_u32(state_t *st);
+uint64_t state_get_u64(state_t *st);
+
+// Variable length: 7 bits a byte, low bits first. Signed values are
+// zigzag encoded, so small negative numbers stay short too.
+void state_put_varint(state_t *st, uint64_t val);
+uint64_t state_get_varint(state_t *st);
+void state_put_svarint(state_t *st, int64_t val);
+int64_t state_get_svarint(state_t *st);
+
+// Chunks: a tag, a version and the payload length, each 32 bits,
+// followed by the payload. state_begin_chunk() returns a mark to
+// pass to state_end_chunk() once the payload is written.
+#define STATE_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define STATE_CHUNK_HEADER_SIZE 12
+
+size_t state_begin_chunk(state_t *st, uint32_t tag, uint32_t version);
+void state_end_chunk(state_t *st, size_t mark);
+
+// Read the next chunk header, and set payload up as a view of the
+// payload. Returns false at the end, or if the chunk is truncated
+// (which sets the error flag).
+bool state_get_chunk(state_t *st, uint32_t *tag, uint32_t *version, state_t *payload);
+
+// 64 bit FNV-1a
+uint64_t state_hash(const void *data, size_t length);
+
+static inline void state_put_bool(state_t *st, bool val) {
+  state_put_u8(st, val ? 1 : 0);
+}
+
+static inline bool state_get_bool(state_t *st) {
+  return (state_get_u8(st) != 0);
+}
+
+#endif /* defined(__Leibniz__state__) */
@@ -0,0 +1,204 @@
+//
+//  symbols.c
+//  Leibniz
+//
+
+#include "symbols.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+typedef struct symbol_entry_s {
+  symbol_t symbol;
+  // When it was added
+  uint32_t order;
+} symbol_entry_t;
+
+struct symbol_table_s {
+  // In the order added until indexed, then by address
+  symbol_entry_t *symbols;
+  uint32_t count;
+  uint32_t capacity;
+
+  uint32_t nextOrder;
+
+  // Open addressing, holding an index into symbols plus one, so that
+  // 0 is an empty slot. The size is a power of two.
+  uint32_t *names;
+  uint32_t namesSize;
+
+  bool indexed;
+};
+
+symbol_table_t *symbol_table_new(void) {
+  return calloc(1, sizeof(symbol_table_t));
+}
+
+void symbol_table_del(symbol_table_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  for (uint32_t i=0; i<table->count; i++) {
+    free(table->symbols[i].symbol.name);
+  }
+  free(table->symbols);
+  free(table->names);
+  free(table);
+}
+
+void symbol_table_add(symbol_table_t *table, uint32_t address, const char *name) {
+  if (table->count == table->capacity) {
+    uint32_t capacity = (table->capacity == 0) ? 1024 : table->capacity * 2;
+    symbol_entry_t *symbols = realloc(table->symbols, capacity * sizeof(symbol_entry_t));
+    if (symbols == NULL) {
+      return;
+    }
+    table->symbols = symbols;
+    table->capacity = capacity;
+  }
+
+  char *copy = calloc(strlen(name)+1, sizeof(char));
+  if (copy == NULL) {
+    return;
+  }
+  strcpy(copy, name);
+
+  symbol_entry_t *entry = &table->symbols[table->count++];
+  entry->symbol.name = copy;
+  entry->symbol.address = address;
+  entry->order = table->nextOrder++;
+  table->indexed = false;
+}
+
+uint32_t symbol_table_count(symbol_table_t *table) {
+  return table->count;
+}
+
+#pragma mark - Index
+static uint32_t symbol_name_hash(const char *name) {
+  // FNV-1a, without case
+  uint32_t hash = 2166136261u;
+  for (const char *p=name; *p != '\0'; p++) {
+    hash ^= (uint8_t)tolower((unsigned char)*p);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// By address, and the last added first where they're the same
+static int symbol_compare(const void *a, const void *b) {
+  const symbol_entry_t *entryA = a;
+  const symbol_entry_t *entryB = b;
+  if (entryA->symbol.address != entryB->symbol.address) {
+    return (entryA->symbol.address < entryB->symbol.address) ? -1 : 1;
+  }
+  return (entryA->order < entryB->order) ? 1 : (entryA->order > entryB->order) ? -1 : 0;
+}
+
+static void symbol_table_index_names(symbol_table_t *table) {
+  free(table->names);
+  table->names = NULL;
+  table->namesSize = 0;
+
+  uint32_t size = 16;
+  while (size < table->count * 2) {
+    size *= 2;
+  }
+  table->names = calloc(size, sizeof(uint32_t));
+  if (table->names == NULL) {
+    return;
+  }
+  table->namesSize = size;
+
+  for (uint32_t i=0; i<table->count; i++) {
+    const symbol_entry_t *entry = &table->symbols[i];
+    uint32_t slot = symbol_name_hash(entry->symbol.name) & (size - 1);
+    while (table->names[slot] != 0) {
+      const symbol_entry_t *other = &table->symbols[table->names[slot] - 1];
+      if (strcasecmp(other->symbol.name, entry->symbol.name) == 0) {
+        break;
+      }
+      slot = (slot + 1) & (size - 1);
+    }
+    // The last added of a name wins
+    if (table->names[slot] == 0 || table->symbols[table->names[slot] - 1].order < entry->order) {
+      table->names[slot] = i + 1;
+    }
+  }
+}
+
+void symbol_table_index(symbol_table_t *table) {
+  if (table->indexed == true) {
+    return;
+  }
+
+  qsort(table->symbols, table->count, sizeof(symbol_entry_t), symbol_compare);
+  symbol_table_index_names(table);
+  table->indexed = true;
+}
+
+#pragma mark - Lookup
+// The first symbol with an address above address
+static uint32_t symbol_table_upper_bound(symbol_table_t *table, uint32_t address) {
+  uint32_t lo = 0;
+  uint32_t hi = table->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (table->symbols[mid].symbol.address <= address) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+const symbol_t *symbol_table_find_nearest(symbol_table_t *table, uint32_t address, uint32_t *offset) {
+  symbol_table_index(table);
+
+  uint32_t idx = symbol_table_upper_bound(table, address);
+  if (idx == 0) {
+    return NULL;
+  }
+
+  // The first of those at the same address
+  idx--;
+  while (idx > 0 && table->symbols[idx - 1].symbol.address == table->symbols[idx].symbol.address) {
+    idx--;
+  }
+
+  const symbol_t *sym = &table->symbols[idx].symbol;
+  if (offset != NULL) {
+    *offset = address - sym->address;
+  }
+  return sym;
+}
+
+const symbol_t *symbol_table_find_address(symbol_table_t *table, uint32_t address) {
+  uint32_t offset = 0;
+  const symbol_t *sym = symbol_table_find_nearest(table, address, &offset);
+  if (sym == NULL || offset != 0) {
+    return NULL;
+  }
+  return sym;
+}
+
+const symbol_t *symbol_table_find_name(symbol_table_t *table, const char *name) {
+  symbol_table_index(table);
+  if (table->namesSize == 0) {
+    return NULL;
+  }
+
+  uint32_t slot = symbol_name_hash(name) & (table->namesSize - 1);
+  while (table->names[slot] != 0) {
+    const symbol_t *sym = &table->symbols[table->names[slot] - 1].symbol;
+    if (strcasecmp(sym->name, name) == 0) {
+      return sym;
+    }
+    slot = (slot + 1) & (table->namesSize - 1);
+  }
+  return NULL;
+}
@@ -0,0 +1,42 @@
+//
+//  symbols.h
+//  Leibniz
+//
+//  The symbols loaded from AIF debug data or map files. They are
+//  added one by one while loading, then indexed once: an array sorted
+//  by address for finding the symbol at or before an address, and a
+//  hash table for finding a symbol by name. Adding a symbol after
+//  that drops the index, and the next lookup builds it again.
+//
+
+#ifndef __Leibniz__symbols__
+#define __Leibniz__symbols__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct symbol_s {
+  char *name;
+  uint32_t address;
+} symbol_t;
+
+typedef struct symbol_table_s symbol_table_t;
+
+symbol_table_t *symbol_table_new(void);
+void symbol_table_del(symbol_table_t *table);
+
+void symbol_table_add(symbol_table_t *table, uint32_t address, const char *name);
+uint32_t symbol_table_count(symbol_table_t *table);
+// Build the index now rather than on the next lookup
+void symbol_table_index(symbol_table_t *table);
+
+// Where several symbols share an address or a name, the one added
+// last is found.
+const symbol_t *symbol_table_find_address(symbol_table_t *table, uint32_t address);
+// The symbol at address or the closest one before it, with how far
+// past it address is
+const symbol_t *symbol_table_find_nearest(symbol_table_t *table, uint32_t address, uint32_t *offset);
+// Names are compared without case
+const symbol_t *symbol_table_find_name(symbol_table_t *table, const char *name);
+
+#endif /* defined(__Leibniz__symbols__) */